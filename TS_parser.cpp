@@ -1,93 +1,670 @@
 #include "tsCommon.h"
 #include "tsTransportStream.h"
+#include "tsInputSource.h"
+#include "tsDemuxer.h"
+#include "tsParser.h"
+#include "tsParallelDemuxer.h"
+#include "tsPipeline.h"
+#include "tsIndex.h"
+#include "tsTiming.h"
+#include "tsMonitor.h"
+#include "tsRemux.h"
+#include "tsBatch.h"
+#include "tsAllocCounter.h"
+#include "tsProfiler.h"
+#include "tsTrace.h"
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
-#include <fstream>
+#include <cstring>
+#include <string>
 #include <vector>
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 //=============================================================================================================================================================================
 
-int main(int argc, char* argv[], char* envp[])
+/// @brief PES level - event when PES starts, finishes or is lost; Packet level - every packet of demuxed PID
+static void xTracePacket(uint64_t TS_PacketId, const xTS_Demuxer& Demuxer, xPES_Assembler::eResult Result)
 {
-    if (argc != 3) {
-        printf("Usage: %s <input_file> <output_file>\n", argv[0]);
-        return EXIT_FAILURE;
+    const xTS_PacketHeader& TS_PacketHeader = Demuxer.getPacketHeader();
+    const xPES_Assembler* PES_Assembler = Demuxer.getAssembler(TS_PacketHeader.getPID());
+
+    if ((int)xTrace::eLevel::Packet <= TS_TRACE_MAX_LEVEL && xTrace::isEnabled(xTrace::eLevel::Packet)) {
+        xTrace::Packet(TS_PacketId, TS_PacketHeader, Demuxer.getAdaptationField(), Result, PES_Assembler);
     }
+    else if (Result != xPES_Assembler::eResult::AssemblingContinue) {
+        xTrace::PES(TS_PacketId, TS_PacketHeader.getPID(), Result, PES_Assembler);
+    }
+}
 
-    const char* inputFileName = argv[1];
-    std::ifstream inputFile(inputFileName, std::ios::binary);
-    if (!inputFile.is_open()) {
-        printf("Failed to open input file: %s\n", inputFileName);
-        return EXIT_FAILURE;
+/// @brief Per-PID frame counts and PTS span for --frames, PES level traces every frame
+class xFrameStats : public xES_FrameSink
+{
+public:
+  struct xStats
+  {
+    uint64_t NumTimed; // frames with PTS
+    uint64_t FirstPTS;
+    uint64_t LastPTS;
+    uint64_t NumBytes;
+  };
+
+protected:
+  std::vector<xStats> m_Stats;
+
+public:
+  xFrameStats() : m_Stats(xTS_Demuxer::NumPIDs, xStats{0, 0, 0, 0}) {}
+
+  void OnFrame(const xES_AudioFramer& Framer, const xES_Frame& Frame) override
+  {
+    xStats& Stats = m_Stats[Framer.getPID() & (xTS_Demuxer::NumPIDs - 1)];
+    if (Frame.hasPTS) {
+      if (Stats.NumTimed++ == 0)
+        Stats.FirstPTS = Frame.PTS;
+      Stats.LastPTS = Frame.PTS;
+    }
+    Stats.NumBytes += Frame.Size;
+    X_TRACE(xTrace::eLevel::PES, xTrace::Message(xTrace::eLevel::PES, "PID %d: frame %" PRIu64 " size=%u PTS=%s%" PRIu64, Framer.getPID(), Framer.getNumFrames() - 1, Frame.Size, Frame.hasPTS ? "" : "none/", Frame.PTS));
+  }
+
+  const xStats& getStats(uint16_t PID) const { return m_Stats[PID & (xTS_Demuxer::NumPIDs - 1)]; }
+};
+
+/// @brief Parser events of the command line tool - packet traces and per-batch analyzers (each optional)
+class xAnalysisHandler : public xTS_ParserHandler
+{
+public:
+  const xTS_Demuxer*  Demuxer        = nullptr;
+  const uint8_t*      FileBase       = nullptr; // mapped input, index offsets are relative to it
+  xTS_IndexBuilder*   IndexBuilder   = nullptr;
+  xTS_TimingAnalyzer* TimingAnalyzer = nullptr;
+  xTS_Monitor*        Monitor        = nullptr;
+  xTS_Remuxer*        Remuxer        = nullptr;
+
+  void OnPacket(uint64_t PacketId, xPES_Assembler::eResult Result)
+  {
+    if (Result != xPES_Assembler::eResult::UnexpectedPID) {
+      X_TRACE(xTrace::eLevel::PES, xTracePacket(PacketId, *Demuxer, Result));
     }
+  }
 
-    const char* outputFileName = argv[2];
-    if (std::ofstream(outputFileName)) {
-        std::remove(outputFileName);
+  void OnBatch(const uint8_t* const* Packets, uint32_t NumPackets, uint64_t /*FirstPacketId*/)
+  {
+    if (IndexBuilder != nullptr)
+      IndexBuilder->AddPackets(Packets, NumPackets, FileBase, *Demuxer);
+    if (TimingAnalyzer != nullptr)
+      TimingAnalyzer->AddPackets(Packets, NumPackets, *Demuxer);
+    if (Monitor != nullptr)
+      Monitor->AddBatch(Packets, Demuxer->getBatch());
+    if (Remuxer != nullptr)
+      Remuxer->AddPackets(Packets, NumPackets);
+  }
+};
+
+/// Input parsed serially per step in --threads mode until the PID table is complete
+static constexpr uint64_t ParallelDiscoveryChunk = 64 * 1024;
+
+static xTS_NetworkInput* s_NetworkInput = nullptr;
+
+/// @brief Ctrl+C ends live input - packets received so far are demuxed and reported
+static void xOnStopSignal(int)
+{
+    if (s_NetworkInput != nullptr)
+        s_NetworkInput->Stop();
+}
+
+/// @brief Time as seconds, [[HH:]MM:]SS[.fff]
+static bool xParseTime(const char* Text, double& Seconds)
+{
+    Seconds = 0;
+    for (int Part = 0; Part < 3; Part++) {
+        char* End = nullptr;
+        const double Value = strtod(Text, &End);
+        if (End == Text || Value < 0)
+            return false;
+        Seconds = Seconds * 60 + Value;
+        if (*End == '\0')
+            return true;
+        if (*End != ':')
+            return false;
+        Text = End + 1;
     }
+    return false;
+}
 
-    int NumberOfPacketsLost = 0;
+/**
+  @brief Extract PES of PIDs decoded in [Begin, End) seconds from start of input, located with index instead of scanning
+  @param PIDs are PIDs to extract (all indexed PIDs if empty)
+ */
+static int xExtractRange(const xTS_MappedFile& InputFile, const std::string& IndexFileName, std::vector<uint16_t> PIDs, const std::string& OutputFileName, double Begin, double End)
+{
+    xTS_Index Index;
+    if (!Index.Open(IndexFileName.c_str())) {
+        printf("Failed to open index file: %s\n", IndexFileName.c_str());
+        return EXIT_FAILURE;
+    }
+    if (Index.getInputSize() != InputFile.getSize()) {
+        printf("Index %s does not match input file (indexed %" PRIu64 " bytes, file has %" PRIu64 ")\n", IndexFileName.c_str(), Index.getInputSize(), InputFile.getSize());
+        return EXIT_FAILURE;
+    }
 
-    xTS_PacketHeader TS_PacketHeader;
-    xTS_AdaptationField TS_PacketAdaptationField;
-    xPES_Assembler PES_Assembler(outputFileName);
+    const bool SingleOutput = PIDs.size() == 1;
+    if (PIDs.empty())
+        PIDs = Index.getPIDs();
+    const int64_t Origin = Index.getTimeOrigin();
+    for (uint16_t PID : PIDs) {
+        uint64_t NumEntries = 0, First = 0, Last = 0;
+        const xTS_Index::xPES_Entry* Entries = Index.FindPID(PID, NumEntries);
+        if (!Index.FindRange(PID, Origin + (int64_t)(Begin * xTS::BaseClockFrequency_Hz), Origin + (int64_t)(End * xTS::BaseClockFrequency_Hz), true, First, Last)) {
+            printf("PID %4d: no PES in range\n", PID);
+            continue;
+        }
 
-    int32_t TS_PacketId = 0;
-    std::vector<uint8_t> TS_PacketBuffer(xTS::TS_PacketLength);
-    while (!(inputFile.eof())) {
-        // Read TS packet from file
-        inputFile.read(reinterpret_cast<char*>(TS_PacketBuffer.data()), xTS::TS_PacketLength);
-        if (!inputFile) {
-            printf("Error while reading from file\n");
-            break;
+        // PES of PID between the two entries are complete - the next one starts at the end offset
+        const uint64_t BeginOffset = Entries[First].Offset;
+        const uint64_t EndOffset   = Last < NumEntries ? Entries[Last].Offset : InputFile.getSize();
+        xTS_Demuxer Demuxer;
+        Demuxer.AddPID(PID, SingleOutput ? OutputFileName : xTS_Demuxer::MakeOutputFileName(OutputFileName, PID));
+        xTS_PacketReader PacketReader;
+        PacketReader.Init(InputFile.getData(), InputFile.getSize(), BeginOffset, EndOffset, Index.getPacketSize());
+        const uint8_t* TS_Packets[xTS_PacketHeaderBatch::MaxPackets];
+        while (const uint32_t NumPackets = PacketReader.getNextPackets(TS_Packets, xTS_PacketHeaderBatch::MaxPackets)) {
+            Demuxer.ProcessBatch(TS_Packets, NumPackets, [](uint32_t, xPES_Assembler::eResult) {});
         }
+        Demuxer.Close();
+        printf("PID %4d: PES=%u time=%.3f-%.3fs bytes=[%" PRIu64 ", %" PRIu64 ") packets=%" PRIu64 " lost=%" PRIu64 "\n", PID, Demuxer.getAssembler(PID)->getNumFinished(),
+               (double)(Entries[First].DTS - Origin) / xTS::BaseClockFrequency_Hz, (double)(Entries[Last - 1].DTS - Origin) / xTS::BaseClockFrequency_Hz,
+               BeginOffset, EndOffset, PacketReader.getNumPackets(), Demuxer.getStats(PID).NumPacketsLost);
+    }
+    return EXIT_SUCCESS;
+}
 
-        // Parse TS packet header
-        TS_PacketHeader.Reset();
-        TS_PacketHeader.Parse(TS_PacketBuffer);
-        
-        TS_PacketAdaptationField.Reset();
-        if (TS_PacketHeader.getSyncByte() == 'G' && TS_PacketHeader.getPID() == 136) {
-            if (TS_PacketHeader.hasAdaptationField()) {
-                TS_PacketAdaptationField.Parse(TS_PacketBuffer, TS_PacketHeader.getAdaptationFieldControl());
+/**
+  @brief Batch mode - TS_parser --batch <directory|list_file> <summary_file|-> [options], see usage
+ */
+static int xRunBatch(int argc, char* argv[])
+{
+    xTS_BatchProcessor::xConfig Config;
+    uint8_t StreamSelection = 0;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            Config.NumThreads = (uint32_t)strtoul(argv[++i], nullptr, 0);
+            if (Config.NumThreads == 0) {
+                printf("Invalid number of threads: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--io-jobs") == 0 && i + 1 < argc) {
+            Config.NumReaders = (uint32_t)strtoul(argv[++i], nullptr, 0);
+            if (Config.NumReaders == 0) {
+                printf("Invalid number of I/O jobs: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+            const unsigned long MiB = strtoul(argv[++i], nullptr, 0);
+            if (MiB == 0) {
+                printf("Invalid memory budget: %s\n", argv[i]);
+                return EXIT_FAILURE;
             }
+            Config.MemoryBudget = (uint64_t)MiB << 20;
+            continue;
+        }
+        if      (strcmp(argv[i], "--audio") == 0) { StreamSelection |= xPSI_PMT::eStreamCategory_Audio; continue; }
+        else if (strcmp(argv[i], "--video") == 0) { StreamSelection |= xPSI_PMT::eStreamCategory_Video; continue; }
+        else if (strcmp(argv[i], "--other") == 0) { StreamSelection |= xPSI_PMT::eStreamCategory_Other; continue; }
+        else if (strcmp(argv[i], "--all"  ) == 0) { StreamSelection |= xPSI_PMT::eStreamCategory_All;   continue; }
+        printf("Option not supported with --batch: %s\n", argv[i]);
+        return EXIT_FAILURE;
+    }
+    if (StreamSelection != 0) {
+        Config.StreamSelection = StreamSelection;
+    }
 
-            printf("%010d ", TS_PacketId);
-            TS_PacketHeader.Print();
+    std::vector<std::string> FileNames;
+    if (!xTS_BatchProcessor::ListInputs(argv[2], FileNames)) {
+        printf("Failed to read input directory or list: %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    const bool ToStdout = strcmp(argv[3], "-") == 0;
+    FILE* SummaryFile = ToStdout ? stdout : fopen(argv[3], "w");
+    if (SummaryFile == nullptr) {
+        printf("Failed to open summary file: %s\n", argv[3]);
+        return EXIT_FAILURE;
+    }
 
-            if (TS_PacketHeader.hasAdaptationField()) { 
-                printf("\n"); 
-                TS_PacketAdaptationField.Print(); 
-                printf("\n");
-            }
+    xTS_BatchProcessor Processor(Config);
+    Processor.Run(FileNames);
+    uint32_t NumFailed = 0;
+    for (const xTS_BatchProcessor::xFileSummary& Summary : Processor.getSummaries()) {
+        xTS_BatchProcessor::PrintSummary(SummaryFile, Summary);
+        NumFailed += !Summary.Opened || Summary.ReadError;
+    }
+    if (!ToStdout)
+        fclose(SummaryFile);
+
+    const double Seconds = Processor.getSeconds();
+    printf("Batch: %zu files (%u failed), %" PRIu64 " bytes in %.3fs (%.1f MB/s), %u threads, %u I/O jobs, %u KiB buffers, steals=%" PRIu64 ", read waits=%" PRIu64 "\n",
+           FileNames.size(), NumFailed, Processor.getNumBytes(), Seconds, Seconds > 0 ? Processor.getNumBytes() / Seconds / 1e6 : 0.0, Processor.getNumThreads(),
+           Processor.getNumReaders(), Processor.getBufferSize() >> 10, Processor.getNumSteals(), Processor.getNumReadWaits());
+    return NumFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-            xPES_Assembler::eResult Result = PES_Assembler.AbsorbPacket(TS_PacketBuffer, &TS_PacketHeader, &TS_PacketAdaptationField);
-            switch (Result) {
-                case xPES_Assembler::eResult::StreamPackedLost:  
-                    printf("\nPcktLost \n"); 
-                    NumberOfPacketsLost++; 
-                    break;
-                case xPES_Assembler::eResult::AssemblingStarted: 
-                    printf("\n           Assembling Started  \n"); 
-                    PES_Assembler.PrintPESH(); 
-                    break;
-                case xPES_Assembler::eResult::AssemblingContinue: 
-                    printf(" Assembling Continue \n"); 
-                    break;
-                case xPES_Assembler::eResult::AssemblingFinished: 
-                    printf("           Assembling Finished \n"); 
-                    printf("           PES: PcktLen=%d HeadLen=%d DataLen=%d\n", PES_Assembler.getNumPacketBytes(), PES_Assembler.getHeaderLength(), PES_Assembler.getNumPacketBytes() - PES_Assembler.getHeaderLength()); 
-                    break;
-                default: 
-                    break;
+int main(int argc, char* argv[], char* envp[])
+{
+    (void)envp;
+    if (argc >= 4 && strcmp(argv[1], "--batch") == 0) {
+        return xRunBatch(argc, argv);
+    }
+    if (argc < 3) {
+        printf("Usage: %s <input_file> <output_file> [PID ...] [--audio] [--video] [--other] [--all] [--threads N] [--pipeline] [--direct]\n", argv[0]);
+        printf("       [--trace off|error|warning|info|pes|packet] [--trace-format text|json] [--trace-file <file>]\n");
+        printf("       [--index] [--range <begin> <end>] [--index-file <file>] [--timing <seconds>] [--monitor] [--idle-timeout <seconds>] [--reorder N]\n");
+        printf("       [--remux <file>] [--program N] [--drop-null] [--frames]\n");
+        printf("       %s --batch <directory|list_file> <summary_file|-> [--audio] [--video] [--other] [--all] [--threads N] [--io-jobs N] [--memory MiB]\n", argv[0]);
+        printf("       Without PIDs, audio streams are discovered from PAT/PMT (same as --audio)\n");
+        printf("       Unless exactly one stream is written (one PID given, or one discovered), PID is appended to output file name (out.mp2 -> out_136.mp2)\n");
+        printf("       --threads N demuxes file in chunks on N threads once PAT/PMT are known (packets demuxed by workers are not traced)\n");
+        printf("       --pipeline reads input on a separate thread (always used for input file \"-\" = stdin)\n");
+        printf("       --direct reads input file past the page cache (O_DIRECT, %u x %u MiB read-ahead blocks) on a separate thread, prints MB/s\n",
+               xTS_Pipeline::DirectNumSlabs, xTS_Pipeline::DirectSlabSize >> 20);
+        printf("       Built with -DTS_PROFILE: per-stage cycle histograms go to stderr at exit and on SIGUSR1\n");
+        printf("       --index writes random-access index <input_file>.tsidx (PES starts, PTS/DTS, PCR) during the pass\n");
+        printf("       --range extracts PES of PIDs (all indexed if none given) decoded between [[HH:]MM:]SS times using the index\n");
+        printf("       --timing prints per-PID bitrate, PCR interval/jitter, PTS-PCR offset every <seconds> of stream time (0 = at end only),\n");
+        printf("       PCR drift against arrival time is added for stdin input\n");
+        printf("       --monitor checks all packets against TR 101 290 priority 1 and 2 indicators (error counts at end, details with --trace warning)\n");
+        printf("       Input udp://[<address>]:<port> or rtp://... receives live TS (multicast address is joined), ends after --idle-timeout\n");
+        printf("       seconds without data (default 5, 0 = until Ctrl+C), --reorder N holds up to N RTP datagrams to restore order (default 16)\n");
+        printf("       --remux writes a TS with the selected PIDs/streams, their PCR PIDs and rewritten PAT/PMT (--program N keeps streams of program N only,\n");
+        printf("       --drop-null leaves out NULL packets)\n");
+        printf("       --frames splits audio PES (ADTS, MPEG audio Layer II) into frames and prints per-PID counts (frames traced at --trace pes)\n");
+        printf("       --batch processes every .ts/.m2ts/.mts/.trp file of directory (or every path listed in file) concurrently, one parser per file,\n");
+        printf("       on --threads workers (default all cores) with at most --io-jobs reads in flight (default 2) and --memory MiB of read buffers\n");
+        printf("       in total (default 256); per-file summary (lost packets, PES count and PTS duration per stream of --all by default) in input order\n");
+        printf("       --trace packet gives the per-packet dump, tracing is off by default (stdout unless --trace-file)\n");
+        return EXIT_FAILURE;
+    }
+
+    const char* inputFileName = argv[1];
+    std::vector<uint16_t> PIDs;
+    uint8_t StreamSelection = 0;
+    uint32_t NumThreads = 1;
+    const bool UseNetwork = xTS_NetworkInput::isAddress(inputFileName);
+    bool UsePipeline = strcmp(inputFileName, "-") == 0;
+    bool UseDirect   = false;
+    xTrace::eLevel  TraceLevel  = xTrace::eLevel::Off;
+    xTrace::eFormat TraceFormat = xTrace::eFormat::Text;
+    const char*     TraceFileName = nullptr;
+    bool            BuildIndex    = false;
+    bool            ExtractRange  = false;
+    double          RangeBegin    = 0;
+    double          RangeEnd      = 0;
+    std::string     IndexFileName = xTS_Index::MakeFileName(inputFileName);
+    bool            AnalyzeTiming = false;
+    bool            Monitor       = false;
+    const char*     RemuxFileName = nullptr;
+    bool            SplitFrames   = false;
+    xTS_Remuxer::xConfig RemuxConfig;
+    xTS_TimingAnalyzer::xConfig TimingConfig;
+    xTS_NetworkInput::xConfig   NetworkConfig;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--pipeline") == 0) { UsePipeline = true; continue; }
+        if (strcmp(argv[i], "--direct") == 0) { UsePipeline = UseDirect = true; continue; }
+        if (strcmp(argv[i], "--index") == 0) { BuildIndex = true; continue; }
+        if (strcmp(argv[i], "--monitor") == 0) { Monitor = true; continue; }
+        if (strcmp(argv[i], "--index-file") == 0 && i + 1 < argc) { IndexFileName = argv[++i]; continue; }
+        if (strcmp(argv[i], "--remux") == 0 && i + 1 < argc) { RemuxFileName = argv[++i]; continue; }
+        if (strcmp(argv[i], "--drop-null") == 0) { RemuxConfig.DropNull = true; continue; }
+        if (strcmp(argv[i], "--frames") == 0) { SplitFrames = true; continue; }
+        if (strcmp(argv[i], "--program") == 0 && i + 1 < argc) {
+            char* End = nullptr;
+            const unsigned long ProgramNumber = strtoul(argv[++i], &End, 0);
+            if (End == argv[i] || *End != '\0' || ProgramNumber == 0 || ProgramNumber > 0xFFFF) {
+                printf("Invalid program number: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            RemuxConfig.ProgramNumber = (uint16_t)ProgramNumber;
+            continue;
+        }
+        if (strcmp(argv[i], "--range") == 0 && i + 2 < argc) {
+            if (!xParseTime(argv[i + 1], RangeBegin) || !xParseTime(argv[i + 2], RangeEnd) || RangeEnd <= RangeBegin) {
+                printf("Invalid time range: %s %s\n", argv[i + 1], argv[i + 2]);
+                return EXIT_FAILURE;
+            }
+            ExtractRange = true;
+            i += 2;
+            continue;
+        }
+        if (strcmp(argv[i], "--timing") == 0 && i + 1 < argc) {
+            char* End = nullptr;
+            TimingConfig.SnapshotPeriod = strtod(argv[++i], &End);
+            if (End == argv[i] || *End != '\0' || TimingConfig.SnapshotPeriod < 0) {
+                printf("Invalid snapshot period: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            AnalyzeTiming = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            char* End = nullptr;
+            NetworkConfig.IdleTimeout = strtod(argv[++i], &End);
+            if (End == argv[i] || *End != '\0' || NetworkConfig.IdleTimeout < 0) {
+                printf("Invalid idle time-out: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            char* End = nullptr;
+            const unsigned long Depth = strtoul(argv[++i], &End, 0);
+            if (End == argv[i] || *End != '\0' || Depth > xTS_NetworkInput::MaxReorderDepth) {
+                printf("Invalid reorder depth (0-%u): %s\n", xTS_NetworkInput::MaxReorderDepth, argv[i]);
+                return EXIT_FAILURE;
+            }
+            NetworkConfig.ReorderDepth = (uint32_t)Depth;
+            continue;
+        }
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            if (!xTrace::ParseLevel(argv[++i], TraceLevel)) {
+                printf("Invalid trace level: %s\n", argv[i]);
+                return EXIT_FAILURE;
             }
+            continue;
         }
+        if (strcmp(argv[i], "--trace-format") == 0 && i + 1 < argc) {
+            if (!xTrace::ParseFormat(argv[++i], TraceFormat)) {
+                printf("Invalid trace format: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--trace-file") == 0 && i + 1 < argc) { TraceFileName = argv[++i]; continue; }
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            NumThreads = (uint32_t)strtoul(argv[++i], nullptr, 0);
+            if (NumThreads == 0) {
+                printf("Invalid number of threads: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if      (strcmp(argv[i], "--audio") == 0) { StreamSelection |= xPSI_PMT::eStreamCategory_Audio; continue; }
+        else if (strcmp(argv[i], "--video") == 0) { StreamSelection |= xPSI_PMT::eStreamCategory_Video; continue; }
+        else if (strcmp(argv[i], "--other") == 0) { StreamSelection |= xPSI_PMT::eStreamCategory_Other; continue; }
+        else if (strcmp(argv[i], "--all"  ) == 0) { StreamSelection |= xPSI_PMT::eStreamCategory_All;   continue; }
+
+        char* End = nullptr;
+        const long PID = strtol(argv[i], &End, 0);
+        if (End == argv[i] || *End != '\0' || PID < 0 || PID >= (long)xTS_Demuxer::NumPIDs) {
+            printf("Invalid PID: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        PIDs.push_back((uint16_t)PID);
+    }
+    if (PIDs.empty() && StreamSelection == 0) {
+        StreamSelection = xPSI_PMT::eStreamCategory_Audio;
+    }
+    if ((int)TraceLevel > TS_TRACE_MAX_LEVEL) {
+        printf("Tracing above level %d is compiled out (TS_TRACE_MAX_LEVEL)\n", TS_TRACE_MAX_LEVEL);
+    }
+    FILE* TraceFile = TraceFileName != nullptr ? fopen(TraceFileName, TraceFormat == xTrace::eFormat::JSON ? "wb" : "w") : nullptr;
+    if (TraceFileName != nullptr && TraceFile == nullptr) {
+        printf("Failed to open trace file: %s\n", TraceFileName);
+        return EXIT_FAILURE;
+    }
+    xTrace::Configure(TraceLevel, TraceFormat, TraceFile);
+    if ((UsePipeline || UseNetwork) && NumThreads > 1) {
+        printf("--threads needs memory-mapped input, it cannot be combined with --pipeline or network input\n");
+        return EXIT_FAILURE;
+    }
+    if ((BuildIndex || ExtractRange) && (UsePipeline || UseNetwork || NumThreads > 1)) {
+        printf("--index and --range need memory-mapped input read by one thread (no --pipeline, --threads, stdin or network input)\n");
+        return EXIT_FAILURE;
+    }
+    if (UseDirect && (UseNetwork || strcmp(inputFileName, "-") == 0)) {
+        printf("--direct needs an input file (no stdin or network input)\n");
+        return EXIT_FAILURE;
+    }
+    if (UseNetwork && UsePipeline) {
+        printf("Network input is received by the demux thread, it cannot be combined with --pipeline\n");
+        return EXIT_FAILURE;
+    }
+    if ((AnalyzeTiming || Monitor || RemuxFileName != nullptr || SplitFrames) && NumThreads > 1) {
+        printf("--timing, --monitor, --remux and --frames need packets in input order, they cannot be combined with --threads\n");
+        return EXIT_FAILURE;
+    }
+    // Input from stdin or network is taken as live - arrival time is meaningful for drift
+    TimingConfig.ArrivalClock = strcmp(inputFileName, "-") == 0 || UseNetwork;
 
-        TS_PacketId++;
+    xTS_MappedFile inputFile;
+    xTS_NetworkInput NetworkInput;
+    int inputFileDescriptor = -1;
+    if (UseDirect) {
+        inputFileDescriptor = xTS_Pipeline::OpenDirect(inputFileName);
+    }
+    else if (UsePipeline) {
+#if defined(_WIN32)
+        inputFileDescriptor = strcmp(inputFileName, "-") == 0 ? 0 : _open(inputFileName, _O_RDONLY | _O_BINARY);
+        if (inputFileDescriptor == 0) _setmode(0, _O_BINARY);
+#else
+        inputFileDescriptor = strcmp(inputFileName, "-") == 0 ? STDIN_FILENO : open(inputFileName, O_RDONLY);
+#endif
+    }
+    if (UseNetwork) {
+        if (!NetworkInput.Open(inputFileName, NetworkConfig)) {
+            printf("Failed to open network input: %s\n", inputFileName);
+            return EXIT_FAILURE;
+        }
+        s_NetworkInput = &NetworkInput;
+        signal(SIGINT, xOnStopSignal);
+        signal(SIGTERM, xOnStopSignal);
+    }
+    else if (UsePipeline ? inputFileDescriptor < 0 : !inputFile.Open(inputFileName)) {
+        printf("Failed to open input file: %s\n", inputFileName);
+        return EXIT_FAILURE;
+    }
+    if (ExtractRange) {
+        return xExtractRange(inputFile, IndexFileName, PIDs, argv[2], RangeBegin, RangeEnd);
+    }
+
+    xAnalysisHandler Handler;
+    xTS_Parser<xAnalysisHandler> Parser(Handler);
+    xTS_Demuxer& Demuxer = Parser.getDemuxer();
+    xFrameStats FrameStats;
+    const std::string outputFileName = argv[2];
+    for (uint16_t PID : PIDs) {
+        const bool SingleOutput = PIDs.size() == 1 && StreamSelection == 0;
+        Demuxer.AddPID(PID, SingleOutput ? outputFileName : xTS_Demuxer::MakeOutputFileName(outputFileName, PID));
+        if (SplitFrames)
+            Demuxer.AddFramer(PID, &FrameStats);
+    }
+    if (SplitFrames) {
+        Demuxer.EnableFraming(&FrameStats);
+    }
+    if (StreamSelection != 0) {
+        Parser.EnableDiscovery(StreamSelection, outputFileName);
     }
 
-    printf("Number of lost packets: %d\n", NumberOfPacketsLost);
-    inputFile.close();
+    const uint64_t NumAllocationsBefore = xAllocCounter::getNumAllocations();
+    xProfiler::Start(stderr);
+    const bool Parallel = NumThreads > 1;
+
+    uint64_t TS_PacketId     = 0;
+    uint64_t NumSkippedBytes = 0;
+    uint64_t NumSyncLosses   = 0;
+    uint32_t PacketSize      = 0;
+    xTS_Pipeline Pipeline(Demuxer, UseDirect ? xTS_Pipeline::DirectSlabSize : xTS_Pipeline::DefaultSlabSize,
+                          UseDirect ? xTS_Pipeline::DirectNumSlabs : xTS_Pipeline::DefaultNumSlabs, UseDirect);
+    if (UsePipeline && Pipeline.getNumSlabs() == 0) {
+        printf("Failed to allocate pipeline buffers (%u x %u KiB)\n", UseDirect ? xTS_Pipeline::DirectNumSlabs : xTS_Pipeline::DefaultNumSlabs, Pipeline.getSlabSize() >> 10);
+        return EXIT_FAILURE;
+    }
+    xTS_IndexBuilder IndexBuilder;
+    xTS_TimingAnalyzer TimingAnalyzer(TimingConfig);
+    xTS_Monitor ConformanceMonitor(xTS_Monitor::xConfig{});
+    // Mapped file stays valid until the end - packets are written from it; slabs and datagrams are reused, so each batch is written at once
+    RemuxConfig.StreamSelection = StreamSelection;
+    RemuxConfig.StableInput     = !UsePipeline && !UseNetwork;
+    xTS_Remuxer Remuxer(RemuxConfig);
+    if (RemuxFileName != nullptr) {
+        for (uint16_t PID : PIDs)
+            Remuxer.AddPID(PID);
+        if (!Remuxer.Open(RemuxFileName)) {
+            printf("Failed to open remux output file: %s\n", RemuxFileName);
+            return EXIT_FAILURE;
+        }
+    }
+    Handler.Demuxer        = &Demuxer;
+    Handler.FileBase       = inputFile.getData();
+    Handler.IndexBuilder   = BuildIndex ? &IndexBuilder : nullptr;
+    Handler.TimingAnalyzer = AnalyzeTiming ? &TimingAnalyzer : nullptr;
+    Handler.Monitor        = Monitor ? &ConformanceMonitor : nullptr;
+    Handler.Remuxer        = Remuxer.isOpen() ? &Remuxer : nullptr;
+
+    if (UsePipeline) {
+        if (!Pipeline.Read(inputFileDescriptor, [&Parser](const uint8_t* const* TS_Packets, uint32_t NumPackets) { Parser.FeedPackets(TS_Packets, NumPackets); })) {
+            printf("Read error on input file: %s\n", inputFileName);
+        }
+        NumSkippedBytes = Pipeline.getNumSkippedBytes();
+        NumSyncLosses   = Pipeline.getNumSyncLosses();
+        PacketSize      = Pipeline.getPacketSize();
+    }
+    else if (UseNetwork) {
+        // TS packets are views into received datagrams
+        const uint8_t* TS_Packets[xTS_PacketHeaderBatch::MaxPackets];
+        while (const uint32_t NumPackets = NetworkInput.getNextPackets(TS_Packets, xTS_PacketHeaderBatch::MaxPackets)) {
+            Parser.FeedPackets(TS_Packets, NumPackets);
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        s_NetworkInput = nullptr;
+        NumSkippedBytes = NetworkInput.getNumSkippedBytes();
+        PacketSize      = NetworkInput.getNumPackets() ? xTS::TS_PacketLength : 0;
+    }
+    else if (!Parallel) {
+        // Whole mapping as one chunk - every packet is a view into the file (index offsets are taken from packet addresses)
+        Parser.Feed(inputFile.getData(), inputFile.getSize(), true);
+    }
+    else {
+        // Parallel mode - PID table is completed serially, rest of file is split between threads
+        const uint64_t Size = inputFile.getSize();
+        for (uint64_t Offset = 0; Offset < Size && !(Parser.getNumPackets() != 0 && Demuxer.isDiscoveryComplete()); Offset += ParallelDiscoveryChunk)
+            Parser.Feed(inputFile.getData() + Offset, Size - Offset < ParallelDiscoveryChunk ? Size - Offset : ParallelDiscoveryChunk);
+    }
+    TS_PacketId = Parser.getNumPackets();
+    if (!UsePipeline && !UseNetwork) {
+        NumSkippedBytes = Parser.getReader().getNumSkippedBytes();
+        NumSyncLosses   = Parser.getReader().getNumSyncLosses();
+        PacketSize      = Parser.getReader().getPacketSize();
+    }
+
+    if (Parallel) {
+        // Carried bytes not yet parsed are where the threads start
+        xTS_ParallelDemuxer ParallelDemuxer(Demuxer, NumThreads);
+        ParallelDemuxer.Run(inputFile.getData(), inputFile.getSize(), Parser.getReader().getPosition(), PacketSize);
+        TS_PacketId     += ParallelDemuxer.getNumPackets();
+        NumSkippedBytes += ParallelDemuxer.getNumSkippedBytes();
+        NumSyncLosses   += ParallelDemuxer.getNumSyncLosses();
+        printf("Parallel: %u threads, %u chunks\n", NumThreads, ParallelDemuxer.getNumChunks());
+    }
+    if (!Demuxer.Close()) {
+        printf("Failed to rename output file %s to %s\n", xTS_Demuxer::MakeOutputFileName(outputFileName, Demuxer.getDemuxedPIDs()[0]).c_str(), outputFileName.c_str());
+    }
+    xProfiler::Stop();
+    if (AnalyzeTiming) {
+        TimingAnalyzer.Finish();
+    }
+
+    if (xAllocCounter::isEnabled()) {
+        const uint64_t NumAllocations = xAllocCounter::getNumAllocations() - NumAllocationsBefore;
+        printf("Heap allocations in packet loop: %" PRIu64 " (%.4f per packet)\n", NumAllocations, TS_PacketId ? (double)NumAllocations / TS_PacketId : 0.0);
+    }
+
+    if (PacketSize == 0) {
+        printf("No TS sync found in input file\n");
+    }
+    else if (PacketSize != xTS::TS_PacketLength) {
+        printf("Packet size: %u bytes\n", PacketSize);
+    }
+    if (NumSkippedBytes != 0 || NumSyncLosses != 0) {
+        printf("Sync: lost %" PRIu64 " times, skipped %" PRIu64 " bytes\n", NumSyncLosses, NumSkippedBytes);
+    }
+
+    for (const xTS_Demuxer::xStreamInfo& Stream : Demuxer.getStreams()) {
+        printf("Discovered: Program=%d PID=%d StreamType=0x%02X\n", Stream.ProgramNumber, Stream.PID, Stream.StreamType);
+    }
+    for (uint16_t PID : Demuxer.getDemuxedPIDs()) {
+        const xPES_Assembler* PES_Assembler = Demuxer.getAssembler(PID);
+        printf("PID %4d: packets=%" PRIu64 " PES=%u lost=%" PRIu64 "\n", PID, Demuxer.getStats(PID).NumPackets, PES_Assembler->getNumFinished(), Demuxer.getStats(PID).NumPacketsLost);
+    }
+    for (uint16_t PID : Demuxer.getDemuxedPIDs()) {
+        const xES_AudioFramer* Framer = Demuxer.getAssembler(PID)->getFramer();
+        if (Framer == nullptr)
+            continue;
+        const xFrameStats::xStats& Stats = FrameStats.getStats(PID);
+        printf("Frames PID %4d: %s %u Hz, frames=%" PRIu64 " (%" PRIu64 " bytes, %" PRIu64 " carried) resyncs=%" PRIu64 " skipped=%" PRIu64 " bytes",
+               PID, xES_AudioFramer::getFormatName(Framer->getFormat()), Framer->getSampleRate(), Framer->getNumFrames(), Stats.NumBytes, Framer->getNumCarried(),
+               Framer->getNumResyncs(), Framer->getNumSkippedBytes());
+        if (Stats.NumTimed != 0)
+            printf(" PTS %.3f-%.3f s", (double)Stats.FirstPTS / xTS::BaseClockFrequency_Hz, (double)Stats.LastPTS / xTS::BaseClockFrequency_Hz);
+        printf("\n");
+    }
+    const xTS_OutputWriter& Writer = Demuxer.getWriter();
+    printf("Output: %" PRIu64 " bytes in %" PRIu64 " write calls, %" PRIu64 " stalls\n", Writer.getNumBytesWritten(), Writer.getNumWriteCalls(), Writer.getNumStalls());
+    if (UsePipeline) {
+        printf("Pipeline: read %" PRIu64 " bytes in %" PRIu64 " calls, reader stalls=%" PRIu64 ", demux stalls=%" PRIu64 ", writer stalls=%" PRIu64 ", writer idle=%" PRIu64 "\n",
+               Pipeline.getNumBytesRead(), Pipeline.getNumReadCalls(), Pipeline.getNumReaderStalls(), Pipeline.getNumDemuxStalls(), Writer.getNumStalls(), Writer.getNumIdleWaits());
+        printf("Pipeline: slab queue depth avg=%.2f max=%u of %u, output queue depth max=%u\n",
+               Pipeline.getAvgQueueDepth(), Pipeline.getMaxQueueDepth(), Pipeline.getNumSlabs(), Writer.getMaxQueueDepth());
+        printf("Pipeline: %s input, %u KiB slabs, %.3fs reading (%.1f MB/s)\n", Pipeline.isDirect() ? "direct" : UseDirect ? "uncached" : "buffered",
+               Pipeline.getSlabSize() >> 10, Pipeline.getReadSeconds(), Pipeline.getReadRate() / 1e6);
+    }
+    if (UseNetwork) {
+        printf("Network: %" PRIu64 " datagrams (%" PRIu64 " RTP), %" PRIu64 " bytes in %" PRIu64 " receive calls, socket buffer %u bytes\n",
+               NetworkInput.getNumDatagrams(), NetworkInput.getNumRTP_Datagrams(), NetworkInput.getNumBytes(), NetworkInput.getNumReceiveCalls(), NetworkInput.getReceiveBufferSize());
+        printf("Network: lost=%" PRIu64 " reordered=%" PRIu64 " duplicate/late=%" PRIu64 " malformed=%" PRIu64 " kernel drops=%u\n",
+               NetworkInput.getNumLost(), NetworkInput.getNumReordered(), NetworkInput.getNumDuplicates(), NetworkInput.getNumMalformed(), NetworkInput.getNumKernelDrops());
+    }
+    if (Writer.getNumErrors() != 0) {
+        printf("Output errors: %" PRIu64 "\n", Writer.getNumErrors());
+    }
+    if (BuildIndex) {
+        if (IndexBuilder.Write(IndexFileName.c_str(), inputFile.getSize(), PacketSize))
+            printf("Index: %" PRIu64 " PES, %" PRIu64 " PCR entries written to %s\n", IndexBuilder.getNumPES(), IndexBuilder.getNumPCR(), IndexFileName.c_str());
+        else
+            printf("Failed to write index file: %s\n", IndexFileName.c_str());
+    }
+    if (Remuxer.isOpen()) {
+        const bool RemuxOk = Remuxer.Close();
+        printf("Remux: %" PRIu64 " of %" PRIu64 " packets, %" PRIu64 " PSI sections rewritten, %" PRIu64 " NULL dropped, %" PRIu64 " bytes in %" PRIu64 " write calls\n",
+               Remuxer.getNumPacketsWritten(), Remuxer.getNumPackets(), Remuxer.getNumSectionsRewritten(), Remuxer.getNumNullDropped(), Remuxer.getNumBytesWritten(), Remuxer.getNumWriteCalls());
+        if (!RemuxOk)
+            printf("Write error on remux output file: %s\n", RemuxFileName);
+    }
+    if (Monitor) {
+        ConformanceMonitor.AddSyncLosses(NumSyncLosses);
+        ConformanceMonitor.Print(stdout);
+    }
+    if (Demuxer.getNumCRC_Errors() != 0) {
+        printf("PSI sections with CRC error: %" PRIu64 "\n", Demuxer.getNumCRC_Errors());
+    }
+    printf("Number of lost packets: %d\n", (int)Demuxer.getNumPacketsLost());
+    inputFile.Close();
+    if (TraceFile != nullptr) {
+        fclose(TraceFile);
+    }
+#if defined(_WIN32)
+    if (inputFileDescriptor > 0) _close(inputFileDescriptor);
+#else
+    if (inputFileDescriptor > STDIN_FILENO) close(inputFileDescriptor);
+#endif
 
     return EXIT_SUCCESS;
 }
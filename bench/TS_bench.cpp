@@ -0,0 +1,542 @@
+/*
+Benchmarks of parser building blocks and of the whole demuxer, run on a
+deterministic synthetic stream (see xTS_StreamGenerator) held in memory.
+
+Build with the TS_bench target of CMakeLists.txt in the repository root:
+  cmake -S . -B build && cmake --build build --target TS_bench
+
+Every result is the best of --repeats repetitions, each running for at least
+--time seconds. Compare runs with the same stream options (and --seed) on an
+idle machine; --write saves the stream to compare TS_parser I/O modes.
+
+Before measuring, outputs that are easy to get subtly wrong are checked on
+streams of their own (fixed configuration, not the benchmark options); the
+bench exits with failure when a check does not pass.
+*/
+
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include "tsInputSource.h"
+#include "tsDemuxer.h"
+#include "tsParallelDemuxer.h"
+#include "tsPipeline.h"
+#include "tsMonitor.h"
+#include "tsRemux.h"
+#include "tsStreamGenerator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock xClock;
+
+//=============================================================================================================================================================================
+
+typedef uint32_t (*xCRC32_Func)(const uint8_t* Data, size_t Size, uint32_t CRC);
+
+/// @brief Run Func over Buffer split into Size byte blocks for at least MinSeconds and return GB/s
+static double xMeasureCRC32(xCRC32_Func Func, const std::vector<uint8_t>& Buffer, size_t BlockSize, double MinSeconds, uint32_t* Checksum)
+{
+    const size_t NumBlocks = Buffer.size() / BlockSize;
+    uint64_t NumBytes = 0;
+    uint32_t Accumulator = 0;
+    const xClock::time_point Start = xClock::now();
+    double Seconds = 0;
+    do {
+        for (size_t i = 0; i < NumBlocks; i++)
+            Accumulator ^= Func(Buffer.data() + i * BlockSize, BlockSize, xCRC32::InitValue);
+        NumBytes += NumBlocks * BlockSize;
+        Seconds = std::chrono::duration<double>(xClock::now() - Start).count();
+    } while (Seconds < MinSeconds);
+    *Checksum = Accumulator;
+    return NumBytes / Seconds / 1e9;
+}
+
+static void xBenchCRC32()
+{
+    std::vector<uint8_t> Buffer(16 << 20);
+    uint32_t Seed = 12345;
+    for (uint8_t& Byte : Buffer) {
+        Seed = Seed * 1103515245 + 12345;
+        Byte = (uint8_t)(Seed >> 16);
+    }
+
+    struct xVariant { const char* Name; xCRC32_Func Func; };
+    const xVariant Variants[] = {
+        { xCRC32::getImplName(xCRC32::eImpl::Bytewise), xCRC32::CalcBytewise },
+        { xCRC32::getImplName(xCRC32::eImpl::Slicing8), xCRC32::CalcSlicing8 },
+        { xCRC32::getImplName(xCRC32::eImpl::CLMUL   ), xCRC32::CalcCLMUL    },
+        { "dispatched",                                 xCRC32::Calc         },
+    };
+    const size_t BlockSizes[] = { 16, 184, 1024, 4096, 1 << 20 };
+
+    printf("CRC32/MPEG-2 (runtime selection: %s, pclmulqdq %savailable)\n", xCRC32::getImplName(xCRC32::getImpl()), xCRC32::isCLMUL_Available() ? "" : "not ");
+    printf("  %-14s", "block [B]");
+    for (size_t BlockSize : BlockSizes)
+        printf(" %10zu", BlockSize);
+    printf("\n");
+
+    for (const xVariant& Variant : Variants) {
+        if (Variant.Func == xCRC32::CalcCLMUL && !xCRC32::isCLMUL_Available())
+            continue;
+        printf("  %-14s", Variant.Name);
+        for (size_t BlockSize : BlockSizes) {
+            uint32_t Checksum = 0;
+            const double GBps = xMeasureCRC32(Variant.Func, Buffer, BlockSize, 0.2, &Checksum);
+            printf(" %6.2f GB/s", GBps);
+        }
+        printf("\n");
+    }
+}
+
+//=============================================================================================================================================================================
+// Parsing stages and end-to-end demux on synthetic stream
+//=============================================================================================================================================================================
+
+struct xBenchConfig
+{
+    xTS_StreamGenerator::xConfig Stream;
+    uint64_t    NumPackets    = 200000;
+    double      MinSeconds    = 0.3;
+    uint32_t    NumRepeats    = 3;
+    uint32_t    NumThreads    = 0; // 0 = hardware concurrency
+    uint64_t    ChunkSize     = 4 << 20;
+    const char* WriteFileName = nullptr;
+};
+
+/// @brief Stream prepared for stage benchmarks - each stage gets inputs decoded by the stages before it
+struct xBenchStream
+{
+    std::vector<uint8_t>             Data;
+    std::vector<uint16_t>            PIDs;
+    std::vector<const uint8_t*>      Packets;
+    std::vector<xTS_PacketHeader>    Headers;
+    std::vector<xTS_AdaptationField> AdaptationFields; // valid for packets with adaptation field
+    std::vector<uint32_t>            AF_Packets;       // indices of packets with adaptation field
+    std::vector<uint32_t>            ES_Packets;       // indices of packets of elementary streams
+    std::vector<uint32_t>            PES_Starts;       // indices of ES packets with payload_unit_start_indicator
+};
+
+static void xPrepareStream(const xBenchConfig& Config, xBenchStream& Stream)
+{
+    xTS_StreamGenerator Generator(Config.Stream);
+    Generator.Generate(Config.NumPackets, Stream.Data);
+    Stream.PIDs = Generator.getPIDs();
+
+    const uint32_t NumPackets = (uint32_t)(Stream.Data.size() / xTS::TS_PacketLength);
+    Stream.Packets.resize(NumPackets);
+    Stream.Headers.resize(NumPackets);
+    Stream.AdaptationFields.resize(NumPackets);
+    for (uint32_t i = 0; i < NumPackets; i++) {
+        const uint8_t* Packet = Stream.Data.data() + (size_t)i * xTS::TS_PacketLength;
+        Stream.Packets[i] = Packet;
+        xTS_PacketHeader& Header = Stream.Headers[i];
+        Header.Parse(Packet, xTS::TS_PacketLength);
+        Stream.AdaptationFields[i].Reset();
+        if (Header.hasAdaptationField()) {
+            Stream.AdaptationFields[i].Parse(Packet, xTS::TS_PacketLength, Header.getAFC());
+            Stream.AF_Packets.push_back(i);
+        }
+        if (Header.getPID() >= xTS_StreamGenerator::FirstES_PID && Header.getPID() < xTS_StreamGenerator::FirstES_PID + Stream.PIDs.size()) {
+            Stream.ES_Packets.push_back(i);
+            if (Header.isPayloadStart())
+                Stream.PES_Starts.push_back(i);
+        }
+    }
+
+    const xTS_StreamGenerator::xConfig& Used = Generator.getConfig();
+    printf("Synthetic stream: %u packets (%.1f MB), %u PIDs, PES %u-%u B, AF share %.3f, PCR every %u packets at %.2f Mbit/s, seed %" PRIu64 "\n",
+           NumPackets, Stream.Data.size() / 1e6, Used.NumPIDs, Used.MinPES_Size, Used.MaxPES_Size, Used.AdaptationFieldShare, Used.PCR_Interval, Used.MuxRate / 1e6, Used.Seed);
+    printf("  %zu packets with adaptation field, %zu PES, %" PRIu64 " CC errors injected\n", Stream.AF_Packets.size(), Stream.PES_Starts.size(), Generator.getNumCC_Errors());
+}
+
+/**
+  @brief Run Func (one pass over NumPackets packets) repeatedly for at least MinSeconds, best of NumRepeats
+  @return Best time of one pass in seconds
+ */
+template <class tFunc> static double xMeasurePass(const xBenchConfig& Config, tFunc&& Func)
+{
+    double Best = DBL_MAX;
+    for (uint32_t r = 0; r < Config.NumRepeats; r++) {
+        uint64_t NumPasses = 0;
+        double Seconds = 0;
+        const xClock::time_point Start = xClock::now();
+        do {
+            Func();
+            NumPasses++;
+            Seconds = std::chrono::duration<double>(xClock::now() - Start).count();
+        } while (Seconds < Config.MinSeconds);
+        Best = Seconds / NumPasses < Best ? Seconds / NumPasses : Best;
+    }
+    return Best;
+}
+
+/// @brief Print rate of NumPackets packets (TS bytes) processed per Seconds
+static void xPrintRate(const char* Name, uint64_t NumPackets, double Seconds, uint64_t Checksum)
+{
+    printf("  %-34s %9.2f Mpkt/s %7.2f GB/s   (%" PRIu64 ")\n", Name, NumPackets / Seconds / 1e6, NumPackets * xTS::TS_PacketLength / Seconds / 1e9, Checksum);
+}
+
+static void xBenchStages(const xBenchConfig& Config, const xBenchStream& Stream)
+{
+    printf("Parsing stages (rate of packets handed to the stage)\n");
+
+    uint64_t Checksum = 0;
+    double Seconds = xMeasurePass(Config, [&]() {
+        xTS_PacketHeader Header;
+        for (const uint8_t* Packet : Stream.Packets) {
+            Header.Parse(Packet, xTS::TS_PacketLength);
+            Checksum += Header.getPID() + Header.getCC();
+        }
+    });
+    xPrintRate("xTS_PacketHeader::Parse", Stream.Packets.size(), Seconds, Checksum);
+
+    Checksum = 0;
+    xTS_PacketHeaderBatch Batch;
+    Seconds = xMeasurePass(Config, [&]() {
+        for (size_t First = 0; First < Stream.Packets.size(); First += xTS_PacketHeaderBatch::MaxPackets) {
+            const uint32_t NumPackets = (uint32_t)(Stream.Packets.size() - First < xTS_PacketHeaderBatch::MaxPackets ? Stream.Packets.size() - First : xTS_PacketHeaderBatch::MaxPackets);
+            Batch.Parse(Stream.Packets.data() + First, NumPackets);
+            Checksum += Batch.getPID(NumPackets - 1);
+        }
+    });
+    xPrintRate("xTS_PacketHeaderBatch::Parse", Stream.Packets.size(), Seconds, Checksum);
+
+    Checksum = 0;
+    Seconds = xMeasurePass(Config, [&]() {
+        xTS_AdaptationField AdaptationField;
+        for (uint32_t Idx : Stream.AF_Packets) {
+            AdaptationField.Parse(Stream.Packets[Idx], xTS::TS_PacketLength, Stream.Headers[Idx].getAFC());
+            Checksum += AdaptationField.getNumBytes() + AdaptationField.getPCR();
+        }
+    });
+    xPrintRate("xTS_AdaptationField::Parse", Stream.AF_Packets.size(), Seconds, Checksum);
+
+    Checksum = 0;
+    Seconds = xMeasurePass(Config, [&]() {
+        xPES_PacketHeader PES_Header;
+        for (uint32_t Idx : Stream.PES_Starts) {
+            const uint32_t Offset = xTS::TS_HeaderLength + (Stream.Headers[Idx].hasAdaptationField() ? Stream.AdaptationFields[Idx].getNumBytes() : 0);
+            PES_Header.Reset();
+            Checksum += PES_Header.Parse(Stream.Packets[Idx] + Offset, (int32_t)(xTS::TS_PacketLength - Offset)) + PES_Header.getPTS();
+        }
+    });
+    xPrintRate("xPES_PacketHeader::Parse", Stream.PES_Starts.size(), Seconds, Checksum);
+
+    Checksum = 0;
+    std::vector<xPES_Assembler> Assemblers(Stream.PIDs.size());
+    Seconds = xMeasurePass(Config, [&]() {
+        for (size_t i = 0; i < Assemblers.size(); i++)
+            Assemblers[i].Init(Stream.PIDs[i]);
+        for (uint32_t Idx : Stream.ES_Packets) {
+            const xTS_PacketHeader& Header = Stream.Headers[Idx];
+            xPES_Assembler& Assembler = Assemblers[Header.getPID() - xTS_StreamGenerator::FirstES_PID];
+            Checksum += (uint64_t)Assembler.AbsorbPacket(Stream.Packets[Idx], &Header, &Stream.AdaptationFields[Idx]);
+        }
+    });
+    xPrintRate("xPES_Assembler::AbsorbPacket", Stream.ES_Packets.size(), Seconds, Checksum);
+
+    Checksum = 0;
+    Seconds = xMeasurePass(Config, [&]() {
+        xTS_Monitor Monitor(xTS_Monitor::xConfig{});
+        for (size_t First = 0; First < Stream.Packets.size(); First += xTS_PacketHeaderBatch::MaxPackets) {
+            const uint32_t NumPackets = (uint32_t)(Stream.Packets.size() - First < xTS_PacketHeaderBatch::MaxPackets ? Stream.Packets.size() - First : xTS_PacketHeaderBatch::MaxPackets);
+            Monitor.AddPackets(Stream.Packets.data() + First, NumPackets);
+        }
+        Checksum += Monitor.getNumErrors();
+    });
+    xPrintRate("xTS_Monitor::AddPackets", Stream.Packets.size(), Seconds, Checksum);
+}
+
+/// @brief Demuxer with all generated PIDs added (payload dropped, or written to OutputFileName)
+static std::unique_ptr<xTS_Demuxer> xMakeDemuxer(const xBenchStream& Stream, const char* OutputFileName = nullptr)
+{
+    std::unique_ptr<xTS_Demuxer> Demuxer(new xTS_Demuxer());
+    for (uint16_t PID : Stream.PIDs)
+        Demuxer->AddPID(PID, OutputFileName != nullptr ? std::string(OutputFileName) : std::string());
+    return Demuxer;
+}
+
+/// @brief Sync scanner + batch demux over memory (what TS_parser does on mmap-ed file)
+static uint64_t xDemuxBatches(xTS_Demuxer& Demuxer, const xBenchStream& Stream)
+{
+    uint64_t Checksum = 0;
+    xTS_PacketReader PacketReader;
+    PacketReader.Init(Stream.Data.data(), Stream.Data.size());
+    const uint8_t* Packets[xTS_PacketHeaderBatch::MaxPackets];
+    for (;;) {
+        const uint32_t NumPackets = PacketReader.getNextPackets(Packets, xTS_PacketHeaderBatch::MaxPackets);
+        if (NumPackets == 0)
+            break;
+        Demuxer.ProcessBatch(Packets, NumPackets, [&](uint32_t, xPES_Assembler::eResult Result) { Checksum += (uint64_t)Result; });
+    }
+    Demuxer.Flush();
+    return Checksum;
+}
+
+static void xBenchDemux(const xBenchConfig& Config, const xBenchStream& Stream)
+{
+    const uint32_t NumThreads = Config.NumThreads != 0 ? Config.NumThreads : (std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() : 2);
+    printf("End-to-end demux (%zu PIDs, rate of all input packets)\n", Stream.PIDs.size());
+
+    uint64_t Checksum = 0;
+    double Seconds = xMeasurePass(Config, [&]() {
+        std::unique_ptr<xTS_Demuxer> Demuxer = xMakeDemuxer(Stream);
+        xTS_PacketReader PacketReader;
+        PacketReader.Init(Stream.Data.data(), Stream.Data.size());
+        while (const uint8_t* Packet = PacketReader.getNextPacket())
+            Checksum += (uint64_t)Demuxer->ProcessPacket(Packet);
+        Demuxer->Flush();
+    });
+    xPrintRate("demux packet by packet", Stream.Packets.size(), Seconds, Checksum);
+
+    Checksum = 0;
+    Seconds = xMeasurePass(Config, [&]() {
+        std::unique_ptr<xTS_Demuxer> Demuxer = xMakeDemuxer(Stream);
+        Checksum += xDemuxBatches(*Demuxer, Stream);
+    });
+    xPrintRate("demux batches (mmap mode)", Stream.Packets.size(), Seconds, Checksum);
+
+#if !defined(_WIN32)
+    Checksum = 0;
+    Seconds = xMeasurePass(Config, [&]() {
+        std::unique_ptr<xTS_Demuxer> Demuxer = xMakeDemuxer(Stream, "/dev/null");
+        Checksum += xDemuxBatches(*Demuxer, Stream);
+        Demuxer->Close();
+        Checksum += Demuxer->getWriter().getNumBytesWritten();
+    });
+    xPrintRate("demux batches + writer (/dev/null)", Stream.Packets.size(), Seconds, Checksum);
+
+    Checksum = 0;
+    Seconds = xMeasurePass(Config, [&]() {
+        std::unique_ptr<xTS_Demuxer> Demuxer = xMakeDemuxer(Stream);
+        int Pipe[2];
+        if (pipe(Pipe) != 0)
+            return;
+        std::thread Feeder([&]() {
+            for (size_t Written = 0; Written < Stream.Data.size(); ) {
+                const ssize_t Result = write(Pipe[1], Stream.Data.data() + Written, Stream.Data.size() - Written);
+                if (Result <= 0)
+                    break;
+                Written += (size_t)Result;
+            }
+            close(Pipe[1]);
+        });
+        xTS_Pipeline Pipeline(*Demuxer);
+        Pipeline.Run(Pipe[0], [&](uint64_t, xPES_Assembler::eResult Result) { Checksum += (uint64_t)Result; });
+        Feeder.join();
+        close(Pipe[0]);
+        Demuxer->Flush();
+    });
+    xPrintRate("pipeline (input from pipe)", Stream.Packets.size(), Seconds, Checksum);
+#endif
+
+    char Name[64];
+    for (uint32_t Threads = 2; Threads <= NumThreads; Threads = Threads * 2 <= NumThreads || Threads == NumThreads ? Threads * 2 : NumThreads) {
+        Checksum = 0;
+        Seconds = xMeasurePass(Config, [&]() {
+            std::unique_ptr<xTS_Demuxer> Demuxer = xMakeDemuxer(Stream);
+            xTS_ParallelDemuxer ParallelDemuxer(*Demuxer, Threads, Config.ChunkSize);
+            ParallelDemuxer.Run(Stream.Data.data(), Stream.Data.size(), 0, xTS::TS_PacketLength);
+            Demuxer->Flush();
+            Checksum += ParallelDemuxer.getNumPackets() + Demuxer->getNumPacketsLost();
+        });
+        snprintf(Name, sizeof(Name), "parallel %u threads, %u MiB chunks", Threads, (uint32_t)(Config.ChunkSize >> 20));
+        xPrintRate(Name, Stream.Packets.size(), Seconds, Checksum);
+    }
+}
+
+//=============================================================================================================================================================================
+
+/**
+  @brief Demux a stream with continuity gaps placed at the first PES start after every chunk boundary, sequentially and in parallel,
+  and check that output and PES counts are identical
+  The open PES of unspecified length must be dropped at the gap (as a sequential run does), not finished by the merge.
+ */
+static bool xCheckParallel()
+{
+    const uint32_t ChunkPackets = 2000;
+    xTS_StreamGenerator::xConfig StreamConfig;
+    StreamConfig.NumPIDs = 2;
+    xTS_StreamGenerator Generator(StreamConfig);
+    std::vector<uint8_t> Data;
+    Generator.Generate(100 * ChunkPackets, Data);
+
+    // From the first PUSI packet of the video PID after each boundary on, CC is shifted by 5 more - one gap per boundary
+    const uint16_t VideoPID = xTS_StreamGenerator::FirstES_PID;
+    uint32_t Shift = 0, NumGaps = 0;
+    bool GapPending = false;
+    for (size_t Offset = 0; Offset < Data.size(); Offset += xTS::TS_PacketLength) {
+        uint8_t* Packet = Data.data() + Offset;
+        GapPending |= Offset != 0 && Offset / xTS::TS_PacketLength % ChunkPackets == 0;
+        if (xTS_HeaderLayout::PID::Get(Packet) != VideoPID)
+            continue;
+        if (GapPending && (Packet[1] & 0x40)) {
+            GapPending = false;
+            Shift += 5;
+            NumGaps++;
+        }
+        Packet[3] = (uint8_t)((Packet[3] & 0xF0) | ((Packet[3] + Shift) & 0x0F));
+    }
+
+    const std::vector<uint16_t> PIDs = Generator.getPIDs();
+    std::vector<xTS_OutputSink> Sequential(PIDs.size()), Parallel(PIDs.size());
+    xTS_Demuxer SequentialDemuxer, ParallelDemuxer;
+    for (uint32_t i = 0; i < PIDs.size(); i++) {
+        SequentialDemuxer.AddPID(PIDs[i], &Sequential[i]);
+        ParallelDemuxer.AddPID(PIDs[i], &Parallel[i]);
+    }
+    xTS_PacketReader PacketReader;
+    PacketReader.Init(Data.data(), Data.size());
+    while (const uint8_t* Packet = PacketReader.getNextPacket())
+        SequentialDemuxer.ProcessPacket(Packet);
+    SequentialDemuxer.Flush();
+    xTS_ParallelDemuxer Demuxer(ParallelDemuxer, 4, (uint64_t)ChunkPackets * xTS::TS_PacketLength);
+    Demuxer.Run(Data.data(), Data.size(), 0, xTS::TS_PacketLength);
+    ParallelDemuxer.Flush();
+
+    bool Passed = true;
+    uint32_t NumPES = 0;
+    for (uint32_t i = 0; i < PIDs.size(); i++) {
+        Passed &= Sequential[i].getMemory() == Parallel[i].getMemory();
+        Passed &= SequentialDemuxer.getAssembler(PIDs[i])->getNumFinished() == ParallelDemuxer.getAssembler(PIDs[i])->getNumFinished();
+        NumPES += SequentialDemuxer.getAssembler(PIDs[i])->getNumFinished();
+    }
+    printf("Parallel check: %u chunks, %u continuity gaps at chunk boundaries, %u PES - %s\n", Demuxer.getNumChunks(), NumGaps, NumPES, Passed ? "ok" : "FAILED");
+    return Passed;
+}
+
+//=============================================================================================================================================================================
+
+#if !defined(_WIN32)
+/**
+  @brief Remux one of two PIDs of a stream with frequent PAT/PMT and check continuity of every output PID
+  Many short runs of kept packets fill the I/O vector while rewritten PSI packets are pending, which once overwrote
+  generated packets before they were written.
+ */
+static bool xCheckRemux()
+{
+    xTS_StreamGenerator::xConfig StreamConfig;
+    StreamConfig.NumPIDs      = 2;
+    StreamConfig.PSI_Interval = 150;
+    xTS_StreamGenerator Generator(StreamConfig);
+    std::vector<uint8_t> Data;
+    Generator.Generate(300000, Data);
+
+    char FileName[] = "/tmp/TS_bench_remux_XXXXXX";
+    const int FileDescriptor = mkstemp(FileName);
+    if (FileDescriptor < 0) {
+        printf("Remux check: cannot create temporary file\n");
+        return false;
+    }
+    close(FileDescriptor);
+
+    xTS_Remuxer Remuxer(xTS_Remuxer::xConfig{});
+    Remuxer.AddPID(xTS_StreamGenerator::FirstES_PID);
+    bool Passed = Remuxer.Open(FileName);
+    xTS_PacketReader PacketReader;
+    PacketReader.Init(Data.data(), Data.size());
+    const uint8_t* Packets[xTS_PacketHeaderBatch::MaxPackets];
+    while (const uint32_t NumPackets = PacketReader.getNextPackets(Packets, xTS_PacketHeaderBatch::MaxPackets))
+        Remuxer.AddPackets(Packets, NumPackets);
+    Passed &= Remuxer.Close();
+
+    // Every packet carries payload - CC advances by one per packet of a PID
+    std::vector<int16_t> LastCC(xTS_Remuxer::NumPIDs, -1);
+    uint64_t NumPackets = 0, NumErrors = 0;
+    FILE* File = fopen(FileName, "rb");
+    uint8_t Packet[xTS::TS_PacketLength];
+    while (File != nullptr && fread(Packet, 1, sizeof(Packet), File) == sizeof(Packet)) {
+        xTS_PacketHeader Header;
+        Header.Parse(Packet, xTS::TS_PacketLength);
+        const uint16_t PID = Header.getPID();
+        if (Header.getSyncByte() != 0x47 || (LastCC[PID] >= 0 && Header.getCC() != ((LastCC[PID] + 1) & 0xF)))
+            NumErrors++;
+        LastCC[PID] = Header.getCC();
+        NumPackets++;
+    }
+    if (File != nullptr)
+        fclose(File);
+    remove(FileName);
+
+    Passed &= NumPackets == Remuxer.getNumPacketsWritten() && NumErrors == 0;
+    printf("Remux check: %" PRIu64 " of %u packets written, %" PRIu64 " PSI sections rewritten, %" PRIu64 " continuity errors - %s\n",
+           NumPackets, (uint32_t)(Data.size() / xTS::TS_PacketLength), Remuxer.getNumSectionsRewritten(), NumErrors, Passed ? "ok" : "FAILED");
+    return Passed;
+}
+#endif
+
+//=============================================================================================================================================================================
+
+static void xPrintUsage(const char* Name)
+{
+    printf("Usage: %s [--packets N] [--pids N] [--pes-size MIN MAX] [--af-share S] [--pcr-interval N] [--mux-rate BPS] [--cc-errors RATE] [--seed N]\n", Name);
+    printf("       [--time SECONDS] [--repeats N] [--threads N] [--chunk-size MiB] [--write FILE] [--crc]\n");
+    printf("       Stream options configure the synthetic stream, --write saves it (to compare I/O modes of TS_parser)\n");
+    printf("       --crc runs CRC32 benchmark only\n");
+}
+
+int main(int argc, char* argv[])
+{
+    xBenchConfig Config;
+    bool OnlyCRC = false;
+    for (int i = 1; i < argc; i++) {
+        const bool HasValue = i + 1 < argc;
+        if      (strcmp(argv[i], "--crc") == 0)                   { OnlyCRC = true; }
+        else if (strcmp(argv[i], "--packets") == 0 && HasValue)   { Config.NumPackets = strtoull(argv[++i], nullptr, 10); }
+        else if (strcmp(argv[i], "--pids") == 0 && HasValue)      { Config.Stream.NumPIDs = (uint32_t)atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--pes-size") == 0 && i + 2 < argc) {
+            Config.Stream.MinPES_Size = (uint32_t)atoi(argv[++i]);
+            Config.Stream.MaxPES_Size = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--af-share") == 0 && HasValue)     { Config.Stream.AdaptationFieldShare = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--pcr-interval") == 0 && HasValue) { Config.Stream.PCR_Interval = (uint32_t)atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--mux-rate") == 0 && HasValue)     { Config.Stream.MuxRate = (uint32_t)strtoul(argv[++i], nullptr, 10); }
+        else if (strcmp(argv[i], "--cc-errors") == 0 && HasValue)    { Config.Stream.CC_ErrorRate = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--seed") == 0 && HasValue)         { Config.Stream.Seed = strtoull(argv[++i], nullptr, 10); }
+        else if (strcmp(argv[i], "--time") == 0 && HasValue)         { Config.MinSeconds = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--repeats") == 0 && HasValue)      { Config.NumRepeats = (uint32_t)atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--threads") == 0 && HasValue)      { Config.NumThreads = (uint32_t)atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--chunk-size") == 0 && HasValue)   { Config.ChunkSize = strtoull(argv[++i], nullptr, 10) << 20; }
+        else if (strcmp(argv[i], "--write") == 0 && HasValue)        { Config.WriteFileName = argv[++i]; }
+        else {
+            xPrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    Config.NumRepeats = Config.NumRepeats != 0 ? Config.NumRepeats : 1;
+    Config.ChunkSize  = Config.ChunkSize  != 0 ? Config.ChunkSize  : xTS_ParallelDemuxer::DefaultChunkSize;
+
+    xBenchCRC32();
+    if (OnlyCRC)
+        return EXIT_SUCCESS;
+
+    if (!xCheckParallel())
+        return EXIT_FAILURE;
+#if !defined(_WIN32)
+    if (!xCheckRemux())
+        return EXIT_FAILURE;
+#endif
+
+    xBenchStream Stream;
+    xPrepareStream(Config, Stream);
+    if (Config.WriteFileName != nullptr) {
+        FILE* File = fopen(Config.WriteFileName, "wb");
+        if (File == nullptr || fwrite(Stream.Data.data(), 1, Stream.Data.size(), File) != Stream.Data.size()) {
+            printf("Failed to write stream to %s\n", Config.WriteFileName);
+            return EXIT_FAILURE;
+        }
+        fclose(File);
+        printf("  written to %s\n", Config.WriteFileName);
+    }
+    xBenchStages(Config, Stream);
+    xBenchDemux(Config, Stream);
+    return EXIT_SUCCESS;
+}
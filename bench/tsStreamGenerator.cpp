@@ -0,0 +1,251 @@
+#include "tsStreamGenerator.h"
+#include <cstring>
+
+//=============================================================================================================================================================================
+// xTS_StreamGenerator
+//=============================================================================================================================================================================
+
+xTS_StreamGenerator::xTS_StreamGenerator(const xConfig& Config)
+    : m_Config(Config), m_Random(Config.Seed != 0 ? Config.Seed : 1), m_PAT_CC(0), m_PMT_CC(0), m_NumPackets(0), m_NumCC_Errors(0)
+{
+    m_Config.NumPIDs     = m_Config.NumPIDs < 1 ? 1 : (m_Config.NumPIDs > MaxNumPIDs ? MaxNumPIDs : m_Config.NumPIDs);
+    m_Config.MinPES_Size = m_Config.MinPES_Size < 1 ? 1 : m_Config.MinPES_Size;
+    m_Config.MaxPES_Size = m_Config.MaxPES_Size < m_Config.MinPES_Size ? m_Config.MinPES_Size : m_Config.MaxPES_Size;
+    m_Config.MuxRate     = m_Config.MuxRate < 1 ? 1 : (m_Config.MuxRate > MaxMuxRate ? MaxMuxRate : m_Config.MuxRate);
+
+    m_Streams.resize(m_Config.NumPIDs);
+    for (uint32_t i = 0; i < m_Config.NumPIDs; i++) {
+        xStream& Stream   = m_Streams[i];
+        const bool Video  = (i & 1) == 0;
+        Stream.PID        = (uint16_t)(FirstES_PID + i);
+        Stream.StreamType = Video ? 0x1B : 0x0F;
+        Stream.StreamId   = (uint8_t)(Video ? 0xE0 + (i >> 1) : 0xC0 + (i >> 1));
+        Stream.CC         = 0;
+        Stream.NumPackets = 0;
+        Stream.PTS        = 900000;
+        Stream.Position   = 0;
+    }
+}
+
+std::vector<uint16_t> xTS_StreamGenerator::getPIDs() const
+{
+    std::vector<uint16_t> PIDs;
+    for (const xStream& Stream : m_Streams)
+        PIDs.push_back(Stream.PID);
+    return PIDs;
+}
+
+/**
+  @brief Append NumPackets packets to Output, continuing the stream generated so far
+ */
+void xTS_StreamGenerator::Generate(uint64_t NumPackets, std::vector<uint8_t>& Output)
+{
+    uint8_t  Section[xTS::TS_PacketLength];
+    size_t   Offset = Output.size();
+    Output.resize(Offset + NumPackets * xTS::TS_PacketLength);
+
+    for (uint64_t i = 0; i < NumPackets; i++, m_NumPackets++, Offset += xTS::TS_PacketLength) {
+        uint8_t* Packet = Output.data() + Offset;
+        const uint64_t PSI_Phase = m_Config.PSI_Interval != 0 ? m_NumPackets % m_Config.PSI_Interval : m_NumPackets;
+        if (PSI_Phase == 0) {
+            xPutPSI(Packet, 0, m_PAT_CC, Section, xMakePAT(Section));
+        }
+        else if (PSI_Phase == 1) {
+            xPutPSI(Packet, PMT_PID, m_PMT_CC, Section, xMakePMT(Section));
+        }
+        else {
+            xPutES(Packet, m_Streams[xRandom() % m_Streams.size()]);
+        }
+    }
+}
+
+/// @brief xorshift64* - fast and deterministic across platforms
+uint32_t xTS_StreamGenerator::xRandom()
+{
+    m_Random ^= m_Random >> 12;
+    m_Random ^= m_Random << 25;
+    m_Random ^= m_Random >> 27;
+    return (uint32_t)((m_Random * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/// @brief Build next PES packet of Stream - header with PTS (and DTS for video) followed by random payload
+void xTS_StreamGenerator::xNextPES(xStream& Stream)
+{
+    const bool     Video        = Stream.StreamType == 0x1B;
+    const uint32_t HeaderLength = Video ? 19 : 14;
+    const uint32_t DataLength   = m_Config.MinPES_Size + xRandom() % (m_Config.MaxPES_Size - m_Config.MinPES_Size + 1);
+    const uint32_t PacketLength = HeaderLength - 6 + DataLength;
+
+    Stream.PES.resize(HeaderLength + DataLength);
+    Stream.Position = 0;
+    uint8_t* PES = Stream.PES.data();
+    PES[0] = 0x00;
+    PES[1] = 0x00;
+    PES[2] = 0x01;
+    PES[3] = Stream.StreamId;
+    // Video PES of unspecified length, audio bounded unless it does not fit into 16 bits
+    const uint32_t LengthField = !Video && PacketLength <= 0xFFFF ? PacketLength : 0;
+    PES[4] = (uint8_t)(LengthField >> 8);
+    PES[5] = (uint8_t)(LengthField);
+    PES[6] = 0x80;
+    PES[7] = Video ? 0xC0 : 0x80;
+    PES[8] = (uint8_t)(HeaderLength - 9);
+    if (Video) {
+        xPutTimestamp(PES + 9,  0x3, Stream.PTS + 3600);
+        xPutTimestamp(PES + 14, 0x1, Stream.PTS);
+    }
+    else {
+        xPutTimestamp(PES + 9,  0x2, Stream.PTS);
+    }
+    Stream.PTS += Video ? 3600 : 1920;
+
+    uint8_t* Data = PES + HeaderLength;
+    uint32_t i = 0;
+    for (; i + 4 <= DataLength; i += 4) {
+        const uint32_t Value = xRandom();
+        memcpy(Data + i, &Value, 4);
+    }
+    for (; i < DataLength; i++)
+        Data[i] = (uint8_t)xRandom();
+}
+
+/// @brief PSI section in single packet (pointer_field 0, rest stuffed with 0xFF)
+void xTS_StreamGenerator::xPutPSI(uint8_t* Packet, uint16_t PID, uint8_t& CC, const uint8_t* Section, uint32_t Length)
+{
+    Packet[0] = 0x47;
+    Packet[1] = (uint8_t)(0x40 | (PID >> 8));
+    Packet[2] = (uint8_t)(PID);
+    Packet[3] = (uint8_t)(0x10 | CC);
+    Packet[4] = 0x00;
+    memcpy(Packet + 5, Section, Length);
+    memset(Packet + 5 + Length, 0xFF, xTS::TS_PacketLength - 5 - Length);
+    CC = (CC + 1) & 0xF;
+}
+
+/// @brief Next packet of Stream's PES, with adaptation field when PCR is due, when drawn or to stuff the last packet of PES
+void xTS_StreamGenerator::xPutES(uint8_t* Packet, xStream& Stream)
+{
+    if (Stream.Position >= Stream.PES.size())
+        xNextPES(Stream);
+
+    if (m_Config.CC_ErrorRate > 0 && xRandomShare() < m_Config.CC_ErrorRate) {
+        Stream.CC = (Stream.CC + 1) & 0xF;
+        m_NumCC_Errors++;
+    }
+
+    const bool PUSI     = Stream.Position == 0;
+    const bool PCR      = m_Config.PCR_Interval != 0 && Stream.PID == FirstES_PID && Stream.NumPackets % m_Config.PCR_Interval == 0;
+    const bool Stuffing = m_Config.AdaptationFieldShare > 0 && xRandomShare() < m_Config.AdaptationFieldShare;
+
+    // Adaptation field bytes including adaptation_field_length (0 = no adaptation field)
+    uint32_t AF_Bytes = 0;
+    if (PCR || Stuffing)
+        AF_Bytes = 2 + (PCR ? 6 : 0) + (Stuffing ? xRandom() % 8 : 0);
+    const uint32_t Remaining = (uint32_t)Stream.PES.size() - Stream.Position;
+    const uint32_t Payload   = Remaining < xTS::TS_PacketLength - xTS::TS_HeaderLength - AF_Bytes ? Remaining : xTS::TS_PacketLength - xTS::TS_HeaderLength - AF_Bytes;
+    AF_Bytes = xTS::TS_PacketLength - xTS::TS_HeaderLength - Payload;
+
+    Packet[0] = 0x47;
+    Packet[1] = (uint8_t)((PUSI ? 0x40 : 0x00) | (Stream.PID >> 8));
+    Packet[2] = (uint8_t)(Stream.PID);
+    Packet[3] = (uint8_t)((AF_Bytes != 0 ? 0x30 : 0x10) | Stream.CC);
+    uint8_t* AF = Packet + xTS::TS_HeaderLength;
+    if (AF_Bytes != 0) {
+        AF[0] = (uint8_t)(AF_Bytes - 1);
+        uint32_t Position = 1;
+        if (AF_Bytes > 1) {
+            AF[Position++] = (uint8_t)((PCR ? 0x10 : 0x00) | (PUSI && Stream.StreamType == 0x1B ? 0x40 : 0x00));
+            if (PCR) {
+                const uint64_t Clock     = xPCR();
+                const uint64_t Base      = (Clock / 300) & 0x1FFFFFFFFULL;
+                const uint32_t Extension = (uint32_t)(Clock % 300);
+                AF[Position++] = (uint8_t)(Base >> 25);
+                AF[Position++] = (uint8_t)(Base >> 17);
+                AF[Position++] = (uint8_t)(Base >> 9);
+                AF[Position++] = (uint8_t)(Base >> 1);
+                AF[Position++] = (uint8_t)(((Base & 1) << 7) | 0x7E | (Extension >> 8));
+                AF[Position++] = (uint8_t)(Extension);
+            }
+        }
+        memset(AF + Position, 0xFF, AF_Bytes - Position);
+    }
+    memcpy(AF + AF_Bytes, Stream.PES.data() + Stream.Position, Payload);
+
+    Stream.Position += Payload;
+    Stream.CC = (Stream.CC + 1) & 0xF;
+    Stream.NumPackets++;
+}
+
+uint32_t xTS_StreamGenerator::xMakePAT(uint8_t* Section) const
+{
+    const uint32_t Length = 8 + 4 + 4;
+    Section[0]  = 0x00; // table_id
+    Section[1]  = (uint8_t)(0xB0 | ((Length - 3) >> 8));
+    Section[2]  = (uint8_t)(Length - 3);
+    Section[3]  = 0x00; // transport_stream_id
+    Section[4]  = 0x01;
+    Section[5]  = 0xC1; // version 0, current
+    Section[6]  = 0x00;
+    Section[7]  = 0x00;
+    Section[8]  = (uint8_t)(ProgramNumber >> 8);
+    Section[9]  = (uint8_t)(ProgramNumber);
+    Section[10] = (uint8_t)(0xE0 | (PMT_PID >> 8));
+    Section[11] = (uint8_t)(PMT_PID);
+    const uint32_t CRC = xCRC32::Calc(Section, Length - 4);
+    Section[12] = (uint8_t)(CRC >> 24);
+    Section[13] = (uint8_t)(CRC >> 16);
+    Section[14] = (uint8_t)(CRC >> 8);
+    Section[15] = (uint8_t)(CRC);
+    return Length;
+}
+
+uint32_t xTS_StreamGenerator::xMakePMT(uint8_t* Section) const
+{
+    const uint32_t Length = 12 + 5 * (uint32_t)m_Streams.size() + 4;
+    Section[0]  = 0x02; // table_id
+    Section[1]  = (uint8_t)(0xB0 | ((Length - 3) >> 8));
+    Section[2]  = (uint8_t)(Length - 3);
+    Section[3]  = (uint8_t)(ProgramNumber >> 8);
+    Section[4]  = (uint8_t)(ProgramNumber);
+    Section[5]  = 0xC1; // version 0, current
+    Section[6]  = 0x00;
+    Section[7]  = 0x00;
+    Section[8]  = (uint8_t)(0xE0 | (FirstES_PID >> 8)); // PCR_PID
+    Section[9]  = (uint8_t)(FirstES_PID);
+    Section[10] = 0xF0; // program_info_length = 0
+    Section[11] = 0x00;
+    uint8_t* Entry = Section + 12;
+    for (const xStream& Stream : m_Streams) {
+        Entry[0] = Stream.StreamType;
+        Entry[1] = (uint8_t)(0xE0 | (Stream.PID >> 8));
+        Entry[2] = (uint8_t)(Stream.PID);
+        Entry[3] = 0xF0; // ES_info_length = 0
+        Entry[4] = 0x00;
+        Entry += 5;
+    }
+    const uint32_t CRC = xCRC32::Calc(Section, Length - 4);
+    Entry[0] = (uint8_t)(CRC >> 24);
+    Entry[1] = (uint8_t)(CRC >> 16);
+    Entry[2] = (uint8_t)(CRC >> 8);
+    Entry[3] = (uint8_t)(CRC);
+    return Length;
+}
+
+/// @brief 27 MHz program clock at the current packet - starts 100 ms before the first PTS and advances by one packet time at MuxRate per packet
+uint64_t xTS_StreamGenerator::xPCR() const
+{
+    const uint64_t PacketClocks = (uint64_t)xTS::TS_PacketLength * 8 * xTS::ExtendedClockFrequency_Hz; // 27 MHz ticks per packet, times MuxRate
+    const uint64_t Start        = (900000 - 9000) * 300ULL;
+    // Split packet index so the product cannot overflow on long streams
+    return Start + m_NumPackets / m_Config.MuxRate * PacketClocks + m_NumPackets % m_Config.MuxRate * PacketClocks / m_Config.MuxRate;
+}
+
+/// @brief 33-bit PTS/DTS in 5 bytes with marker bits, Prefix is the 4-bit '0010'/'0011'/'0001' code
+void xTS_StreamGenerator::xPutTimestamp(uint8_t* Output, uint8_t Prefix, uint64_t Timestamp)
+{
+    Output[0] = (uint8_t)((Prefix << 4) | (((Timestamp >> 30) & 0x7) << 1) | 1);
+    Output[1] = (uint8_t)(Timestamp >> 22);
+    Output[2] = (uint8_t)((((Timestamp >> 15) & 0x7F) << 1) | 1);
+    Output[3] = (uint8_t)(Timestamp >> 7);
+    Output[4] = (uint8_t)(((Timestamp & 0x7F) << 1) | 1);
+}
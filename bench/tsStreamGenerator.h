@@ -0,0 +1,93 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include <vector>
+
+//=============================================================================================================================================================================
+// Synthetic transport stream generator
+//=============================================================================================================================================================================
+
+/*
+Deterministic generator of 188-byte transport streams for benchmarks: the same
+configuration (including Seed) always gives the same bytes. One program with
+NumPIDs elementary streams, alternating video (stream_type 0x1B, PES of
+unspecified length, PTS+DTS) and audio (stream_type 0x0F, bounded PES, PTS).
+PAT and PMT are repeated every PSI_Interval packets. Packets of the streams are
+interleaved in pseudo-random order.
+
+Knobs:
+ - PES payload size is uniform in [MinPES_Size, MaxPES_Size],
+ - AdaptationFieldShare is the share (0..1) of payload packets given an
+   adaptation field with a few stuffing bytes, on top of the packets that need
+   one (last packet of PES, PCR),
+ - the first PID carries PCR every PCR_Interval of its packets (0 = no PCR);
+   PCR follows the packet index at constant MuxRate, so PCR intervals and
+   accuracy match a constant rate multiplex,
+ - CC_ErrorRate is the probability per packet of a continuity counter jump
+   (as if the preceding packet of the PID was lost).
+*/
+
+class xTS_StreamGenerator
+{
+public:
+  static constexpr uint16_t PMT_PID       = 0x1000;
+  static constexpr uint16_t FirstES_PID   = 0x0100;
+  static constexpr uint16_t ProgramNumber = 1;
+  static constexpr uint32_t MaxNumPIDs    = 32; // PMT fits in one packet
+  static constexpr uint32_t MaxMuxRate    = 400000000; // bit/s, keeps PCR arithmetic in 64 bits
+
+  struct xConfig
+  {
+    uint32_t NumPIDs              = 4;
+    uint32_t MinPES_Size          = 1000;
+    uint32_t MaxPES_Size          = 20000;
+    double   AdaptationFieldShare = 0.05;
+    uint32_t PCR_Interval         = 20;
+    uint32_t MuxRate              = 10000000; // bits per second
+    double   CC_ErrorRate         = 0.0;
+    uint32_t PSI_Interval         = 4000;
+    uint64_t Seed                 = 1;
+  };
+
+protected:
+  struct xStream
+  {
+    uint16_t             PID;
+    uint8_t              StreamType;
+    uint8_t              StreamId;
+    uint8_t              CC;
+    uint32_t             NumPackets;
+    uint64_t             PTS;
+    std::vector<uint8_t> PES;      // PES packet being sent
+    uint32_t             Position; // next byte of PES to send
+  };
+
+  xConfig              m_Config;
+  uint64_t             m_Random;
+  std::vector<xStream> m_Streams;
+  uint8_t              m_PAT_CC;
+  uint8_t              m_PMT_CC;
+  uint64_t             m_NumPackets;
+  uint64_t             m_NumCC_Errors;
+
+public:
+  explicit xTS_StreamGenerator(const xConfig& Config);
+
+  void                  Generate(uint64_t NumPackets, std::vector<uint8_t>& Output);
+  std::vector<uint16_t> getPIDs () const;
+
+public:
+  const xConfig& getConfig     () const { return m_Config; }
+  uint64_t       getNumCC_Errors() const { return m_NumCC_Errors; }
+
+protected:
+  uint32_t xRandom      ();
+  double   xRandomShare () { return xRandom() / 4294967296.0; }
+  void     xNextPES     (xStream& Stream);
+  void     xPutPSI      (uint8_t* Packet, uint16_t PID, uint8_t& CC, const uint8_t* Section, uint32_t Length);
+  void     xPutES       (uint8_t* Packet, xStream& Stream);
+  uint32_t xMakePAT     (uint8_t* Section) const;
+  uint32_t xMakePMT     (uint8_t* Section) const;
+  uint64_t xPCR         () const;
+  static void xPutTimestamp(uint8_t* Output, uint8_t Prefix, uint64_t Timestamp);
+};
@@ -0,0 +1,41 @@
+#include "tsAllocCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+//=============================================================================================================================================================================
+// xAllocCounter
+//=============================================================================================================================================================================
+
+static std::atomic<uint64_t> s_NumAllocations{0};
+static std::atomic<uint64_t> s_NumAllocatedBytes{0};
+
+#if defined(TS_COUNT_ALLOCATIONS)
+
+bool xAllocCounter::isEnabled() { return true; }
+
+static void* xCountedAlloc(std::size_t Size)
+{
+    s_NumAllocations.fetch_add(1, std::memory_order_relaxed);
+    s_NumAllocatedBytes.fetch_add(Size, std::memory_order_relaxed);
+    void* Ptr = std::malloc(Size != 0 ? Size : 1);
+    if (Ptr == nullptr)
+        throw std::bad_alloc();
+    return Ptr;
+}
+
+void* operator new  (std::size_t Size) { return xCountedAlloc(Size); }
+void* operator new[](std::size_t Size) { return xCountedAlloc(Size); }
+void  operator delete  (void* Ptr) noexcept { std::free(Ptr); }
+void  operator delete[](void* Ptr) noexcept { std::free(Ptr); }
+void  operator delete  (void* Ptr, std::size_t) noexcept { std::free(Ptr); }
+void  operator delete[](void* Ptr, std::size_t) noexcept { std::free(Ptr); }
+
+#else
+
+bool xAllocCounter::isEnabled() { return false; }
+
+#endif
+
+uint64_t xAllocCounter::getNumAllocations   () { return s_NumAllocations.load(std::memory_order_relaxed); }
+uint64_t xAllocCounter::getNumAllocatedBytes() { return s_NumAllocatedBytes.load(std::memory_order_relaxed); }
@@ -0,0 +1,20 @@
+#pragma once
+#include "tsCommon.h"
+
+//=============================================================================================================================================================================
+// Heap allocation counter
+//=============================================================================================================================================================================
+
+/*
+Build with -DTS_COUNT_ALLOCATIONS to replace global operator new/delete with
+counting versions. Sample getNumAllocations() around a code region to check
+that it does not touch the heap. Without the define the counter stays at 0.
+*/
+
+class xAllocCounter
+{
+public:
+  static bool     isEnabled();
+  static uint64_t getNumAllocations();
+  static uint64_t getNumAllocatedBytes();
+};
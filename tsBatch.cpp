@@ -0,0 +1,272 @@
+#include "tsBatch.h"
+#include "tsParser.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <fcntl.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//=============================================================================================================================================================================
+// xTS_BatchProcessor
+//=============================================================================================================================================================================
+
+/// @brief Parser events of one file - PES counts and PTS span per PID
+class xBatchFileHandler : public xTS_ParserHandler
+{
+public:
+  static constexpr uint64_t TimestampMask = (1ull << 33) - 1;
+
+  struct xTrack
+  {
+    uint64_t NumPES;
+    uint64_t NumTimed;
+    uint64_t LastPTS;
+    uint64_t Duration;
+  };
+
+  std::vector<xTrack> Tracks;
+
+  xBatchFileHandler() : Tracks(xTS_Demuxer::NumPIDs, xTrack{0, 0, 0, 0}) {}
+
+  void OnPES(xPES_Assembler& Assembler)
+  {
+    xTrack& Track = Tracks[Assembler.getPID() & (xTS_Demuxer::NumPIDs - 1)];
+    Track.NumPES++;
+    if (!Assembler.getHeader().hasPTS())
+      return;
+    // Forward steps only, modulo 33 bits - wrap continues the span, a jump back (B-frames, splice) does not shorten it
+    const uint64_t PTS = Assembler.getHeader().getPTS();
+    if (Track.NumTimed++ != 0) {
+      const uint64_t Step = (PTS - Track.LastPTS) & TimestampMask;
+      if (Step >= (TimestampMask >> 1))
+        return; // earlier PTS - last stays the latest
+      Track.Duration += Step;
+    }
+    Track.LastPTS = PTS;
+  }
+};
+
+xTS_BatchProcessor::xTS_BatchProcessor(const xConfig& Config)
+    : m_Config(Config), m_BufferSize(0), m_NumReading(0), m_NumSteals(0), m_NumBytes(0), m_NumReadWaits(0), m_Seconds(0)
+{
+    if (m_Config.NumThreads == 0)
+        m_Config.NumThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (m_Config.NumReaders == 0)
+        m_Config.NumReaders = 1;
+    // Whole 4 KiB pages
+    const uint64_t BufferSize = std::min<uint64_t>(std::max<uint64_t>(m_Config.MemoryBudget / m_Config.NumThreads, MinBufferSize), MaxBufferSize);
+    m_BufferSize = (uint32_t)(BufferSize & ~(uint64_t)4095);
+}
+
+/**
+  @brief Process all files, summaries are in input order afterwards (getSummaries)
+ */
+void xTS_BatchProcessor::Run(const std::vector<std::string>& FileNames)
+{
+    const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+    m_Summaries.assign(FileNames.size(), xFileSummary{});
+    std::vector<std::pair<uint64_t, uint32_t>> Order;
+    for (uint32_t i = 0; i < FileNames.size(); i++) {
+        m_Summaries[i].FileName = FileNames[i];
+        std::error_code Error;
+        const uint64_t Size = std::filesystem::file_size(FileNames[i], Error);
+        Order.emplace_back(Error ? 0 : Size, i);
+    }
+    // Largest first, dealt round-robin - each deque starts with its share of the long jobs
+    std::stable_sort(Order.begin(), Order.end(), [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) { return a.first > b.first; });
+    const uint32_t NumWorkers = std::max(1u, std::min<uint32_t>(m_Config.NumThreads, (uint32_t)FileNames.size()));
+    m_Queues.clear();
+    for (uint32_t w = 0; w < NumWorkers; w++)
+        m_Queues.emplace_back(new xWorkerQueue);
+    for (uint32_t i = 0; i < Order.size(); i++)
+        m_Queues[i % NumWorkers]->Jobs.push_back(Order[i].second);
+
+    std::vector<std::thread> Workers;
+    for (uint32_t w = 0; w < NumWorkers; w++)
+        Workers.emplace_back(&xTS_BatchProcessor::xWorker, this, w);
+    for (std::thread& Worker : Workers)
+        Worker.join();
+
+    m_Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+}
+
+void xTS_BatchProcessor::xWorker(uint32_t WorkerIdx)
+{
+    std::vector<uint8_t> Buffer(m_BufferSize);
+    uint32_t Job;
+    while (xNextJob(WorkerIdx, Job))
+        xProcessFile(m_Summaries[Job], Buffer);
+}
+
+/// @brief Front of own deque, else back of another one (the smallest jobs left there)
+bool xTS_BatchProcessor::xNextJob(uint32_t WorkerIdx, uint32_t& Job)
+{
+    {
+        xWorkerQueue& Own = *m_Queues[WorkerIdx];
+        std::lock_guard<std::mutex> Lock(Own.Mutex);
+        if (!Own.Jobs.empty()) {
+            Job = Own.Jobs.front();
+            Own.Jobs.pop_front();
+            return true;
+        }
+    }
+    // No jobs are added after start - one pass over the others is final
+    const uint32_t NumQueues = (uint32_t)m_Queues.size();
+    for (uint32_t i = 1; i < NumQueues; i++) {
+        xWorkerQueue& Victim = *m_Queues[(WorkerIdx + i) % NumQueues];
+        std::lock_guard<std::mutex> Lock(Victim.Mutex);
+        if (!Victim.Jobs.empty()) {
+            Job = Victim.Jobs.back();
+            Victim.Jobs.pop_back();
+            m_NumSteals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void xTS_BatchProcessor::xProcessFile(xFileSummary& Summary, std::vector<uint8_t>& Buffer)
+{
+    const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+#if defined(_WIN32)
+    const int FileDescriptor = _open(Summary.FileName.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    const int FileDescriptor = open(Summary.FileName.c_str(), O_RDONLY);
+#endif
+    Summary.Opened = FileDescriptor >= 0;
+    if (!Summary.Opened)
+        return;
+
+    xBatchFileHandler Handler;
+    xTS_Parser<xBatchFileHandler> Parser(Handler);
+    Parser.EnableDiscovery(m_Config.StreamSelection);
+    for (;;) {
+        const size_t Size = xRead(FileDescriptor, Buffer.data(), Buffer.size(), Summary.ReadError);
+        if (Size == 0)
+            break;
+        Parser.Feed(Buffer.data(), Size);
+        Summary.NumBytes += Size;
+    }
+    Parser.Finish();
+#if defined(_WIN32)
+    _close(FileDescriptor);
+#else
+    close(FileDescriptor);
+#endif
+    m_NumBytes.fetch_add(Summary.NumBytes, std::memory_order_relaxed);
+
+    const xTS_Demuxer& Demuxer = Parser.getDemuxer();
+    Summary.PacketSize      = Parser.getReader().getPacketSize();
+    Summary.NumPackets      = Parser.getNumPackets();
+    Summary.NumSkippedBytes = Parser.getReader().getNumSkippedBytes();
+    Summary.NumSyncLosses   = Parser.getReader().getNumSyncLosses();
+    Summary.NumPacketsLost  = Demuxer.getNumPacketsLost();
+    Summary.NumCRC_Errors   = Demuxer.getNumCRC_Errors();
+    for (const xTS_Demuxer::xStreamInfo& Stream : Demuxer.getStreams()) {
+        if (!Demuxer.isDemuxed(Stream.PID))
+            continue;
+        const xBatchFileHandler::xTrack& Track = Handler.Tracks[Stream.PID];
+        const xTS_Demuxer::xPID_Stats& Stats = Demuxer.getStats(Stream.PID);
+        Summary.Streams.push_back(xStreamSummary{Stream.PID, Stream.StreamType, Stats.NumPackets, Stats.NumPacketsLost, Track.NumPES, Track.NumTimed, Track.Duration});
+    }
+    Summary.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+}
+
+/// @brief Fill buffer from file, at most NumReaders workers are inside read() at once
+size_t xTS_BatchProcessor::xRead(int FileDescriptor, uint8_t* Buffer, size_t Size, bool& Error)
+{
+    {
+        std::unique_lock<std::mutex> Lock(m_ReadMutex);
+        if (m_NumReading >= m_Config.NumReaders) {
+            m_NumReadWaits.fetch_add(1, std::memory_order_relaxed);
+            m_ReadFree.wait(Lock, [this] { return m_NumReading < m_Config.NumReaders; });
+        }
+        m_NumReading++;
+    }
+    size_t Filled = 0;
+    while (Filled < Size) {
+#if defined(_WIN32)
+        const int Read = _read(FileDescriptor, Buffer + Filled, (unsigned)(Size - Filled));
+#else
+        const ssize_t Read = read(FileDescriptor, Buffer + Filled, Size - Filled);
+#endif
+        if (Read < 0 && errno == EINTR)
+            continue;
+        if (Read <= 0) {
+            Error |= Read < 0;
+            break;
+        }
+        Filled += (size_t)Read;
+    }
+    {
+        std::lock_guard<std::mutex> Lock(m_ReadMutex);
+        m_NumReading--;
+    }
+    m_ReadFree.notify_one();
+    return Filled;
+}
+
+/**
+  @brief Collect input files
+  @param Source is directory (regular files in it with TS extension: .ts .m2ts .mts .trp, sorted) or list file (one path per line, # comments)
+  @return false if Source cannot be read
+ */
+bool xTS_BatchProcessor::ListInputs(const std::string& Source, std::vector<std::string>& FileNames)
+{
+    std::error_code Error;
+    if (std::filesystem::is_directory(Source, Error)) {
+        std::vector<std::string> Found;
+        for (const std::filesystem::directory_entry& Entry : std::filesystem::directory_iterator(Source, Error)) {
+            if (!Entry.is_regular_file(Error))
+                continue;
+            std::string Extension = Entry.path().extension().string();
+            std::transform(Extension.begin(), Extension.end(), Extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+            if (Extension == ".ts" || Extension == ".m2ts" || Extension == ".mts" || Extension == ".trp")
+                Found.push_back(Entry.path().string());
+        }
+        if (Error)
+            return false;
+        std::sort(Found.begin(), Found.end());
+        FileNames.insert(FileNames.end(), Found.begin(), Found.end());
+        return true;
+    }
+
+    std::ifstream List(Source);
+    if (!List)
+        return false;
+    std::string Line;
+    while (std::getline(List, Line)) {
+        while (!Line.empty() && (Line.back() == '\r' || Line.back() == ' ' || Line.back() == '\t'))
+            Line.pop_back();
+        if (!Line.empty() && Line[0] != '#')
+            FileNames.push_back(Line);
+    }
+    return true;
+}
+
+/// @brief One line per file, one indented line per stream - lost packet count as in single file summary
+void xTS_BatchProcessor::PrintSummary(FILE* Output, const xFileSummary& Summary)
+{
+    if (!Summary.Opened) {
+        fprintf(Output, "%s: failed to open\n", Summary.FileName.c_str());
+        return;
+    }
+    fprintf(Output, "%s: bytes=%" PRIu64 " packets=%" PRIu64 " packet_size=%u lost=%" PRIu64 " skipped=%" PRIu64 " sync_losses=%" PRIu64 " crc_errors=%" PRIu64 " time=%.3fs%s\n",
+            Summary.FileName.c_str(), Summary.NumBytes, Summary.NumPackets, Summary.PacketSize, Summary.NumPacketsLost, Summary.NumSkippedBytes, Summary.NumSyncLosses,
+            Summary.NumCRC_Errors, Summary.Seconds, Summary.ReadError ? " READ ERROR" : "");
+    for (const xStreamSummary& Stream : Summary.Streams) {
+        fprintf(Output, "  PID %4d: type=0x%02X packets=%" PRIu64 " lost=%" PRIu64 " PES=%" PRIu64 " duration=%.3fs\n",
+                Stream.PID, Stream.StreamType, Stream.NumPackets, Stream.NumPacketsLost, Stream.NumPES, (double)Stream.Duration / xTS::BaseClockFrequency_Hz);
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsPSI.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Batch processing of many input files
+//=============================================================================================================================================================================
+
+/*
+Processes a list of input files concurrently, one independent xTS_Parser
+(demuxer, PID table, PES assemblers) per file - nothing is shared between
+files but the pool. Nothing is written but the summary; discovered streams
+are assembled to count PES and measure their PTS span.
+
+Files are distributed over per-worker deques, largest first (fewer long
+files left at the end). A worker takes jobs from the front of its own deque;
+when it is empty it steals from the back of the others', so workers stay
+busy whatever the mix of file sizes.
+
+Resources are bounded independently of the number of files:
+ - memory: each worker owns one read buffer of MemoryBudget / NumThreads
+   bytes, files are read into it with plain read() and pushed to the parser
+   chunk by chunk (no mapping, so page cache pressure does not scale with
+   file size either),
+ - disk: at most NumReaders reads are in flight at any time, the other
+   workers parse what they have read meanwhile. NumThreads sets CPU use,
+   NumReaders the I/O queue depth the disks see.
+*/
+
+class xTS_BatchProcessor
+{
+public:
+  static constexpr uint32_t MinBufferSize = 64 << 10;
+  static constexpr uint32_t MaxBufferSize = 64 << 20;
+
+  struct xConfig
+  {
+    uint32_t NumThreads      = 0;         // 0 = number of hardware threads
+    uint32_t NumReaders      = 2;         // reads in flight at once
+    uint64_t MemoryBudget    = 256 << 20; // read buffers of all workers together
+    uint8_t  StreamSelection = xPSI_PMT::eStreamCategory_All;
+  };
+
+  struct xStreamSummary
+  {
+    uint16_t PID;
+    uint8_t  StreamType;
+    uint64_t NumPackets;
+    uint64_t NumPacketsLost;
+    uint64_t NumPES;
+    uint64_t NumTimed;     // PES with PTS
+    uint64_t Duration;     // 90 kHz, PTS span (forward steps summed over 33-bit wrap)
+  };
+
+  struct xFileSummary
+  {
+    std::string                 FileName;
+    bool                        Opened;
+    bool                        ReadError;
+    uint64_t                    NumBytes;
+    uint32_t                    PacketSize;  // 0 = no sync found
+    uint64_t                    NumPackets;
+    uint64_t                    NumSkippedBytes;
+    uint64_t                    NumSyncLosses;
+    uint64_t                    NumPacketsLost;
+    uint64_t                    NumCRC_Errors;
+    double                      Seconds;     // wall time of job
+    std::vector<xStreamSummary> Streams;
+  };
+
+protected:
+  struct xWorkerQueue
+  {
+    std::mutex           Mutex;
+    std::deque<uint32_t> Jobs;   // indices into m_Summaries
+  };
+
+  xConfig                                    m_Config;
+  uint32_t                                   m_BufferSize;
+  std::vector<xFileSummary>                  m_Summaries;
+  std::vector<std::unique_ptr<xWorkerQueue>> m_Queues;
+
+  std::mutex                                 m_ReadMutex;
+  std::condition_variable                    m_ReadFree;
+  uint32_t                                   m_NumReading;
+
+  //statistics
+  std::atomic<uint64_t>                      m_NumSteals;
+  std::atomic<uint64_t>                      m_NumBytes;
+  std::atomic<uint64_t>                      m_NumReadWaits;  // read delayed by NumReaders limit
+  double                                     m_Seconds;
+
+public:
+  xTS_BatchProcessor(const xConfig& Config);
+
+  void Run(const std::vector<std::string>& FileNames);
+
+  static bool ListInputs  (const std::string& Source, std::vector<std::string>& FileNames);
+  static void PrintSummary(FILE* Output, const xFileSummary& Summary);
+
+public:
+  const std::vector<xFileSummary>& getSummaries  () const { return m_Summaries; }
+  uint32_t                         getNumThreads () const { return m_Config.NumThreads; }
+  uint32_t                         getNumReaders () const { return m_Config.NumReaders; }
+  uint32_t                         getBufferSize () const { return m_BufferSize; }
+  uint64_t                         getNumSteals  () const { return m_NumSteals.load(std::memory_order_relaxed); }
+  uint64_t                         getNumBytes   () const { return m_NumBytes.load(std::memory_order_relaxed); }
+  uint64_t                         getNumReadWaits() const { return m_NumReadWaits.load(std::memory_order_relaxed); }
+  double                           getSeconds    () const { return m_Seconds; }
+
+protected:
+  void   xWorker     (uint32_t WorkerIdx);
+  bool   xNextJob    (uint32_t WorkerIdx, uint32_t& Job);
+  void   xProcessFile(xFileSummary& Summary, std::vector<uint8_t>& Buffer);
+  size_t xRead       (int FileDescriptor, uint8_t* Buffer, size_t Size, bool& Error);
+};
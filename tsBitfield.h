@@ -0,0 +1,118 @@
+#pragma once
+#include "tsCommon.h"
+#include <cstring>
+#include <type_traits>
+
+//=============================================================================================================================================================================
+// Compile-time bitfield layouts
+//=============================================================================================================================================================================
+
+/*
+Field extractors generated from layout descriptions, instead of shifts and
+masks written by hand for every field. A layout is a big-endian word of 1, 2,
+4 or 8 bytes at a fixed byte offset of a structure of SpanBytes bytes; its
+fields are given by bit position and width, numbered as in the syntax tables
+of ISO/IEC 13818-1 (bit 0 = most significant bit of byte 0 of the structure):
+
+  typedef xBitWord<0, 4, xTS::TS_HeaderLength> tWord;
+  typedef tWord::Field<11, 13> PID;
+  const tWord::tWord Word = tWord::Load(Packet);   // one load + byte swap
+  const uint16_t     Pid  = PID::Extract(Word);    // shift + mask
+
+Everything is checked at compile time: the word must lie within the bytes the
+caller guarantees (SpanBytes after the pointer, LeadBytes before it - a word
+may start before the structure when that memory is readable, so that a wide
+load does not run past its end), fields must lie within their word and fit
+into the value type, which is the narrowest unsigned type holding NumBits
+bits (33-bit timestamps come out as uint64_t). Extraction is branch-free and
+inlined; the word is loaded with memcpy (no alignment requirement) and
+xSwapBytes16/32/64.
+*/
+
+template <uint32_t NumBytes> struct xBigEndian;
+template <> struct xBigEndian<1> { typedef uint8_t  tWord; static tWord Load(const uint8_t* Data) { return Data[0]; } };
+template <> struct xBigEndian<2> { typedef uint16_t tWord; static tWord Load(const uint8_t* Data) { tWord Word; memcpy(&Word, Data, sizeof(Word)); return xSwapBytes16(Word); } };
+template <> struct xBigEndian<4> { typedef uint32_t tWord; static tWord Load(const uint8_t* Data) { tWord Word; memcpy(&Word, Data, sizeof(Word)); return xSwapBytes32(Word); } };
+template <> struct xBigEndian<8> { typedef uint64_t tWord; static tWord Load(const uint8_t* Data) { tWord Word; memcpy(&Word, Data, sizeof(Word)); return xSwapBytes64(Word); } };
+
+/// Narrowest unsigned type of NumBits bits
+template <uint32_t NumBits> using xBitValue = typename std::conditional<NumBits <= 8, uint8_t, typename std::conditional<NumBits <= 16, uint16_t,
+                                              typename std::conditional<NumBits <= 32, uint32_t, uint64_t>::type>::type>::type;
+
+/**
+  @brief Big-endian word of WordBytes bytes at byte WordByte of a structure
+  @tparam SpanBytes is number of bytes of the structure guaranteed readable from its start
+  @tparam LeadBytes is number of bytes guaranteed readable before its start (WordByte may be negative down to -LeadBytes)
+ */
+template <int32_t WordByte, uint32_t WordBytes, uint32_t SpanBytes, uint32_t LeadBytes = 0>
+class xBitWord
+{
+public:
+  static_assert(WordBytes == 1 || WordBytes == 2 || WordBytes == 4 || WordBytes == 8, "word is 1, 2, 4 or 8 bytes");
+  static_assert(WordByte >= -(int32_t)LeadBytes, "word starts before readable bytes");
+  static_assert(WordByte + (int32_t)WordBytes <= (int32_t)SpanBytes, "word ends after structure");
+
+  typedef typename xBigEndian<WordBytes>::tWord tWord;
+
+  static constexpr int32_t FirstBit = WordByte * 8;
+  static constexpr int32_t EndBit   = (WordByte + (int32_t)WordBytes) * 8;
+
+  static tWord Load(const uint8_t* Data) { return xBigEndian<WordBytes>::Load(Data + WordByte); }
+
+  /// @brief Field of NumBits bits at bit BitPos of the structure
+  template <int32_t BitPos, uint32_t NumBits>
+  class Field
+  {
+  public:
+    static_assert(NumBits >= 1 && NumBits <= WordBytes * 8, "field wider than word");
+    static_assert(BitPos >= FirstBit && BitPos + (int32_t)NumBits <= EndBit, "field outside word");
+
+    typedef xBitValue<NumBits> tValue;
+
+    static constexpr uint32_t Shift = (uint32_t)(EndBit - BitPos - (int32_t)NumBits);
+    static constexpr uint64_t Mask  = NumBits == 64 ? ~0ull : (1ull << NumBits) - 1;
+
+    static tValue Extract(tWord Word) { return (tValue)((Word >> Shift) & Mask); }
+    static tValue Get    (const uint8_t* Data) { return Extract(Load(Data)); }
+  };
+};
+
+/**
+  @brief 33-bit timestamp in PES layout at byte ByteOffset of a structure - 4 prefix bits, then 3, 15 and 15 bits each followed by marker bit
+  The 5 bytes are the low end of one 8-byte word, which starts 3 bytes before the timestamp (those must be readable).
+ */
+template <uint32_t ByteOffset, uint32_t SpanBytes, uint32_t LeadBytes = 0>
+class xTimestampField
+{
+public:
+  typedef xBitWord<(int32_t)ByteOffset - 3, 8, SpanBytes, LeadBytes> tWord;
+  typedef typename tWord::template Field<ByteOffset * 8 +  4,  3> High;
+  typedef typename tWord::template Field<ByteOffset * 8 +  8, 15> Middle;
+  typedef typename tWord::template Field<ByteOffset * 8 + 24, 15> Low;
+
+  static uint64_t Get(const uint8_t* Data)
+  {
+    const uint64_t Word = tWord::Load(Data);
+    return ((uint64_t)High::Extract(Word) << 30) | ((uint64_t)Middle::Extract(Word) << 15) | Low::Extract(Word);
+  }
+};
+
+/**
+  @brief 42-bit clock (PCR, OPCR) at byte ByteOffset of a structure - 33-bit base (90 kHz), 6 reserved bits, 9-bit extension
+  The 6 bytes are the low end of one 8-byte word, which starts 2 bytes before the clock (those must be readable).
+ */
+template <uint32_t ByteOffset, uint32_t SpanBytes, uint32_t LeadBytes = 0>
+class xClockField
+{
+public:
+  typedef xBitWord<(int32_t)ByteOffset - 2, 8, SpanBytes, LeadBytes> tWord;
+  typedef typename tWord::template Field<ByteOffset * 8,      33> Base;
+  typedef typename tWord::template Field<ByteOffset * 8 + 39,  9> Extension;
+
+  /// @return Clock in 27 MHz units (base * 300 + extension)
+  static uint64_t Get(const uint8_t* Data)
+  {
+    const uint64_t Word = tWord::Load(Data);
+    return Base::Extract(Word) * 300 + Extension::Extract(Word);
+  }
+};
@@ -0,0 +1,172 @@
+#include "tsCommon.h"
+
+//=============================================================================================================================================================================
+// xCRC32
+//=============================================================================================================================================================================
+
+static constexpr uint64_t CRC32_Polynomial = 0x104C11DB7; // with x^32 term
+
+/// @brief x^Exponent mod P - folding constants for carry-less multiply
+static constexpr uint32_t xPowModP(uint32_t Exponent)
+{
+    uint64_t Remainder = 1;
+    for (uint32_t i = 0; i < Exponent; i++) {
+        Remainder <<= 1;
+        if (Remainder & 0x100000000)
+            Remainder ^= CRC32_Polynomial;
+    }
+    return (uint32_t)Remainder;
+}
+
+struct xCRC32_Tables
+{
+    uint32_t T[8][256]; // T[0] - classic bytewise table, T[k] - byte followed by k zero bytes
+};
+
+static constexpr xCRC32_Tables xMakeTables()
+{
+    xCRC32_Tables Tables{};
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t CRC = b << 24;
+        for (int i = 0; i < 8; i++)
+            CRC = (CRC & 0x80000000) ? (CRC << 1) ^ (uint32_t)CRC32_Polynomial : (CRC << 1);
+        Tables.T[0][b] = CRC;
+    }
+    for (uint32_t k = 1; k < 8; k++)
+        for (uint32_t b = 0; b < 256; b++)
+            Tables.T[k][b] = (Tables.T[k - 1][b] << 8) ^ Tables.T[0][Tables.T[k - 1][b] >> 24];
+    return Tables;
+}
+
+static constexpr xCRC32_Tables s_CRC32 = xMakeTables();
+
+static inline uint32_t xLoadBE32(const uint8_t* Data)
+{
+    return ((uint32_t)Data[0] << 24) | ((uint32_t)Data[1] << 16) | ((uint32_t)Data[2] << 8) | (uint32_t)Data[3];
+}
+
+uint32_t xCRC32::CalcBytewise(const uint8_t* Data, size_t Size, uint32_t CRC)
+{
+    for (size_t i = 0; i < Size; i++)
+        CRC = (CRC << 8) ^ s_CRC32.T[0][(CRC >> 24) ^ Data[i]];
+    return CRC;
+}
+
+uint32_t xCRC32::CalcSlicing8(const uint8_t* Data, size_t Size, uint32_t CRC)
+{
+    while (Size >= 8) {
+        const uint32_t Hi = CRC ^ xLoadBE32(Data);
+        const uint32_t Lo = xLoadBE32(Data + 4);
+        CRC = s_CRC32.T[7][Hi >> 24] ^ s_CRC32.T[6][(Hi >> 16) & 0xFF] ^ s_CRC32.T[5][(Hi >> 8) & 0xFF] ^ s_CRC32.T[4][Hi & 0xFF] ^
+              s_CRC32.T[3][Lo >> 24] ^ s_CRC32.T[2][(Lo >> 16) & 0xFF] ^ s_CRC32.T[1][(Lo >> 8) & 0xFF] ^ s_CRC32.T[0][Lo & 0xFF];
+        Data += 8;
+        Size -= 8;
+    }
+    return CalcBytewise(Data, Size, CRC);
+}
+
+#if defined(X_ARCH_X86)
+
+/*
+Folding: 128-bit block X = H*x^64 + L (most significant bit = first message bit)
+moved D bits forward is X*x^D = H*x^(D+64) + L*x^D, which is congruent mod P to
+H*(x^(D+64) mod P) + L*(x^D mod P) - two 64x32 carry-less products. Four
+accumulators are folded 512 bits at a time and then merged; remaining 128-bit
+value and tail bytes go through slicing-by-8. Initial CRC value is xored
+into first 32 message bits.
+*/
+
+static constexpr uint32_t CRC32_Fold512[2] = { xPowModP(512), xPowModP(512 + 64) };
+static constexpr uint32_t CRC32_Fold384[2] = { xPowModP(384), xPowModP(384 + 64) };
+static constexpr uint32_t CRC32_Fold256[2] = { xPowModP(256), xPowModP(256 + 64) };
+static constexpr uint32_t CRC32_Fold128[2] = { xPowModP(128), xPowModP(128 + 64) };
+
+X_TARGET("pclmul,ssse3")
+static inline __m128i xFold(__m128i X, __m128i K)
+{
+    return _mm_xor_si128(_mm_clmulepi64_si128(X, K, 0x11), _mm_clmulepi64_si128(X, K, 0x00));
+}
+
+X_TARGET("pclmul,ssse3")
+uint32_t xCRC32::CalcCLMUL(const uint8_t* Data, size_t Size, uint32_t CRC)
+{
+    if (Size < 64)
+        return CalcSlicing8(Data, Size, CRC);
+
+    const __m128i Swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i K512 = _mm_set_epi64x(CRC32_Fold512[1], CRC32_Fold512[0]);
+    const __m128i K384 = _mm_set_epi64x(CRC32_Fold384[1], CRC32_Fold384[0]);
+    const __m128i K256 = _mm_set_epi64x(CRC32_Fold256[1], CRC32_Fold256[0]);
+    const __m128i K128 = _mm_set_epi64x(CRC32_Fold128[1], CRC32_Fold128[0]);
+
+    __m128i X0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data +  0)), Swap);
+    __m128i X1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 16)), Swap);
+    __m128i X2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 32)), Swap);
+    __m128i X3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 48)), Swap);
+    X0 = _mm_xor_si128(X0, _mm_set_epi32((int32_t)CRC, 0, 0, 0));
+    Data += 64;
+    Size -= 64;
+
+    while (Size >= 64) {
+        X0 = _mm_xor_si128(xFold(X0, K512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data +  0)), Swap));
+        X1 = _mm_xor_si128(xFold(X1, K512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 16)), Swap));
+        X2 = _mm_xor_si128(xFold(X2, K512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 32)), Swap));
+        X3 = _mm_xor_si128(xFold(X3, K512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 48)), Swap));
+        Data += 64;
+        Size -= 64;
+    }
+
+    __m128i X = _mm_xor_si128(_mm_xor_si128(xFold(X0, K384), xFold(X1, K256)), _mm_xor_si128(xFold(X2, K128), X3));
+    while (Size >= 16) {
+        X = _mm_xor_si128(xFold(X, K128), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)Data), Swap));
+        Data += 16;
+        Size -= 16;
+    }
+
+    uint8_t Remainder[16];
+    _mm_storeu_si128((__m128i*)Remainder, _mm_shuffle_epi8(X, Swap));
+    CRC = CalcSlicing8(Remainder, sizeof(Remainder), 0);
+    return CalcSlicing8(Data, Size, CRC);
+}
+
+bool xCRC32::isCLMUL_Available()
+{
+#if defined(_MSC_VER)
+    int CPUInfo[4];
+    __cpuid(CPUInfo, 1);
+    return (CPUInfo[2] & (1 << 1)) && (CPUInfo[2] & (1 << 9)); // PCLMULQDQ, SSSE3
+#else
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#else
+
+uint32_t xCRC32::CalcCLMUL(const uint8_t* Data, size_t Size, uint32_t CRC) { return CalcSlicing8(Data, Size, CRC); }
+bool     xCRC32::isCLMUL_Available() { return false; }
+
+#endif
+
+xCRC32::eImpl xCRC32::getImpl()
+{
+    static const eImpl Impl = isCLMUL_Available() ? eImpl::CLMUL : eImpl::Slicing8;
+    return Impl;
+}
+
+uint32_t xCRC32::Calc(const uint8_t* Data, size_t Size, uint32_t CRC)
+{
+    // CalcCLMUL() itself falls back to slicing-by-8 below 64 bytes
+    if (getImpl() == eImpl::CLMUL)
+        return CalcCLMUL(Data, Size, CRC);
+    return CalcSlicing8(Data, Size, CRC);
+}
+
+const char* xCRC32::getImplName(eImpl Impl)
+{
+    switch (Impl) {
+        case eImpl::Bytewise: return "bytewise";
+        case eImpl::Slicing8: return "slicing-by-8";
+        case eImpl::CLMUL:    return "pclmulqdq";
+        default:              return "unknown";
+    }
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdlib>
 #include <cstdint>
 #include <cinttypes>
 #include <cfloat>
@@ -20,8 +21,17 @@
 
 #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64) || defined(_M_IX86))
 #include <intrin.h>
+#define X_ARCH_X86 1
 #elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
 #include <x86intrin.h>
+#define X_ARCH_X86 1
+#endif
+
+// Functions using instruction set extensions beyond the build baseline (selected at runtime)
+#if defined(__GNUC__)
+#define X_TARGET(Extensions) __attribute__((target(Extensions)))
+#else
+#define X_TARGET(Extensions)
 #endif
 
 //=============================================================================================================================================================================
@@ -44,3 +54,58 @@ static inline  int64_t xSwapBytes64( int64_t Value) { return __builtin_bswap64(V
 #else
 #error Unrecognized compiler
 #endif
+
+//=============================================================================================================================================================================
+// Bit scan
+//=============================================================================================================================================================================
+#if defined(_MSC_VER)
+static inline uint32_t xCountTrailingZeros32(uint32_t Value) { unsigned long Index; _BitScanForward(&Index, Value); return Index; } // Value must not be 0
+static inline uint32_t xCountLeadingZeros64 (uint64_t Value) { unsigned long Index; _BitScanReverse64(&Index, Value); return 63 - Index; } // Value must not be 0
+#elif defined (__GNUC__)
+static inline uint32_t xCountTrailingZeros32(uint32_t Value) { return __builtin_ctz(Value); } // Value must not be 0
+static inline uint32_t xCountLeadingZeros64 (uint64_t Value) { return __builtin_clzll(Value); } // Value must not be 0
+#endif
+
+//=============================================================================================================================================================================
+// Aligned allocation
+//=============================================================================================================================================================================
+#if defined(_MSC_VER)
+static inline void* xAlignedAlloc(size_t Alignment, size_t Size) { return _aligned_malloc(Size, Alignment); }
+static inline void  xAlignedFree (void* Ptr) { _aligned_free(Ptr); }
+#else
+static inline void* xAlignedAlloc(size_t Alignment, size_t Size) { void* Ptr = nullptr; return posix_memalign(&Ptr, Alignment, Size) == 0 ? Ptr : nullptr; }
+static inline void  xAlignedFree (void* Ptr) { free(Ptr); }
+#endif
+
+//=============================================================================================================================================================================
+// CRC32/MPEG-2 (poly 0x04C11DB7, init 0xFFFFFFFF, no reflection, no final xor)
+//=============================================================================================================================================================================
+
+/*
+Calc() dispatches at first use to carry-less multiply folding (PCLMULQDQ) when
+the CPU supports it and to table driven slicing-by-8 otherwise. CRC over a
+whole PSI section including its CRC_32 field is 0 for an intact section.
+*/
+
+class xCRC32
+{
+public:
+  static constexpr uint32_t InitValue = 0xFFFFFFFF;
+
+  enum class eImpl : int32_t
+  {
+    Bytewise,
+    Slicing8,
+    CLMUL,
+  };
+
+public:
+  static uint32_t Calc         (const uint8_t* Data, size_t Size, uint32_t CRC = InitValue);
+  static uint32_t CalcBytewise (const uint8_t* Data, size_t Size, uint32_t CRC = InitValue);
+  static uint32_t CalcSlicing8 (const uint8_t* Data, size_t Size, uint32_t CRC = InitValue);
+  static uint32_t CalcCLMUL    (const uint8_t* Data, size_t Size, uint32_t CRC = InitValue);
+
+  static bool        isCLMUL_Available();
+  static eImpl       getImpl          ();
+  static const char* getImplName      (eImpl Impl);
+};
@@ -0,0 +1,315 @@
+#include "tsDemuxer.h"
+#include "tsTrace.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+//=============================================================================================================================================================================
+// xTS_Demuxer
+//=============================================================================================================================================================================
+
+xTS_Demuxer::xTS_Demuxer() : m_TableVersion(0), m_NumPackets(0), m_NumSyncErrors(0), m_StreamSelection(0), m_FrameSink(nullptr), m_OnFinished(nullptr), m_OnFinishedContext(nullptr)
+{
+    m_PIDs.fill(xPID_Entry{ePID_Kind::Ignored, nullptr, nullptr});
+    m_Stats.fill(xPID_Stats{0, 0});
+}
+
+/**
+  @brief Start demuxing PID
+  @param PID is packet identifier of elementary stream
+  @param FileName is output file for PES payload (empty = do not write), existing file is truncated
+  @return Assembler owned by demuxer (nullptr if PID carries PSI)
+ */
+xPES_Assembler* xTS_Demuxer::AddPID(uint16_t PID, const std::string& FileName)
+{
+    const xPID_Entry& Entry = m_PIDs[PID & (NumPIDs - 1)];
+    if (Entry.PES != nullptr || Entry.Kind != ePID_Kind::Ignored)
+        return Entry.PES; // already demuxed or PID carries PSI
+
+    return AddPID(PID, FileName.empty() ? nullptr : m_Writer.OpenSink(FileName));
+}
+
+/**
+  @brief Start demuxing PID
+  @param PID is packet identifier of elementary stream
+  @param Output is sink for PES payload (nullptr = do not write), not owned by demuxer
+  @return Assembler owned by demuxer (nullptr if PID carries PSI)
+ */
+xPES_Assembler* xTS_Demuxer::AddPID(uint16_t PID, xTS_OutputSink* Output)
+{
+    PID &= (NumPIDs - 1);
+    xPID_Entry& Entry = m_PIDs[PID];
+    if (Entry.PES != nullptr)
+        return Entry.PES;
+    if (Entry.Kind != ePID_Kind::Ignored)
+        return nullptr; // PID carries PSI
+
+    m_AssemblerStorage.emplace_back(new xPES_Assembler(Output, &m_BufferPool));
+    xPES_Assembler* Assembler = m_AssemblerStorage.back().get();
+    Assembler->Init(PID);
+    Assembler->SetFinishedCallback(m_OnFinished, m_OnFinishedContext);
+    Entry.Kind = ePID_Kind::PES;
+    Entry.PES  = Assembler;
+    m_TableVersion++;
+    return Assembler;
+}
+
+/**
+  @brief Split PES of demuxed PID into audio frames
+  @param Sink receives frames, not owned by demuxer
+  @return Framer owned by demuxer (nullptr if PID is not demuxed)
+ */
+xES_AudioFramer* xTS_Demuxer::AddFramer(uint16_t PID, xES_FrameSink* Sink)
+{
+    xPES_Assembler* Assembler = getAssembler(PID);
+    if (Assembler == nullptr)
+        return nullptr;
+    if (Assembler->getFramer() == nullptr) {
+        m_FramerStorage.emplace_back(new xES_AudioFramer(Assembler->getPID(), Sink));
+        Assembler->SetFramer(m_FramerStorage.back().get());
+    }
+    return Assembler->getFramer();
+}
+
+/// @brief Pass every finished PES of all demuxed PIDs to Callback
+void xTS_Demuxer::SetFinishedCallback(xPES_Assembler::tFinishedCallback Callback, void* Context)
+{
+    m_OnFinished        = Callback;
+    m_OnFinishedContext = Context;
+    for (const std::unique_ptr<xPES_Assembler>& Assembler : m_AssemblerStorage)
+        Assembler->SetFinishedCallback(Callback, Context);
+}
+
+/**
+  @brief Discover elementary streams from PAT/PMT and demux selected ones
+  @param StreamSelection is mask of xPSI_PMT::eStreamCategory
+  @param OutputFileName is base output file name - PID is appended (see MakeOutputFileName), empty = not written
+  When only one stream is demuxed in the end, Close renames its file to OutputFileName itself.
+ */
+void xTS_Demuxer::EnableDiscovery(uint8_t StreamSelection, const std::string& OutputFileName)
+{
+    m_StreamSelection = StreamSelection;
+    m_OutputFileName  = OutputFileName;
+    xAddPSI((uint16_t)xTS_PacketHeader::ePID::PAT, ePID_Kind::PAT);
+}
+
+/// @brief Output file name for one of several demuxed PIDs: "audio.mp2" -> "audio_136.mp2"
+std::string xTS_Demuxer::MakeOutputFileName(const std::string& OutputFileName, uint16_t PID)
+{
+    const std::string::size_type Dot   = OutputFileName.find_last_of('.');
+    const std::string::size_type Slash = OutputFileName.find_last_of("/\\");
+    const std::string Suffix = "_" + std::to_string(PID);
+    if (Dot == std::string::npos || (Slash != std::string::npos && Dot < Slash))
+        return OutputFileName + Suffix;
+    return OutputFileName.substr(0, Dot) + Suffix + OutputFileName.substr(Dot);
+}
+
+void xTS_Demuxer::xAddPSI(uint16_t PID, ePID_Kind Kind)
+{
+    xPID_Entry& Entry = m_PIDs[PID & (NumPIDs - 1)];
+    if (Entry.Kind != ePID_Kind::Ignored)
+        return;
+
+    m_SectionAssemblerStorage.emplace_back(new xPSI_SectionAssembler());
+    Entry.Kind = Kind;
+    Entry.PSI  = m_SectionAssemblerStorage.back().get();
+    m_TableVersion++;
+}
+
+/**
+  @brief Dispatch one TS packet to assembler of its PID
+  @param Packet is pointer to 188 byte TS packet
+  @return Assembling state or UnexpectedPID if packet does not belong to demuxed PES (ignored PID, PSI or invalid packet)
+ */
+xPES_Assembler::eResult xTS_Demuxer::ProcessPacket(const uint8_t* Packet)
+{
+    m_NumPackets++;
+
+    if (Packet[0] != 'G') {
+        m_NumSyncErrors++;
+        return xPES_Assembler::eResult::UnexpectedPID;
+    }
+
+    // Hot path - unwanted PIDs are dropped before anything else is decoded
+    const uint16_t PID = xTS_HeaderLayout::PID::Get(Packet);
+    if (m_PIDs[PID].Kind == ePID_Kind::Ignored)
+        return xPES_Assembler::eResult::UnexpectedPID;
+
+    return xProcessSelected(Packet, PID);
+}
+
+/**
+  @brief Collect indices of batch packets (from First on) that have sync byte and belong to PID that is not ignored
+  @return Number of selected packets (see m_Selected)
+ */
+uint32_t xTS_Demuxer::xSelect(uint32_t First)
+{
+    const uint32_t NumPackets = m_Batch.getNumPackets();
+    const uint16_t* PIDs = m_Batch.getPIDs();
+    const uint8_t*  SBs  = m_Batch.getSBs();
+    uint32_t NumSelected = 0;
+    for (uint32_t i = First; i < NumPackets; i++) {
+        // Branch-free: index is always written, counter advances only for wanted packets
+        m_Selected[NumSelected] = (uint16_t)i;
+        NumSelected += (SBs[i] == 'G') & (m_PIDs[PIDs[i]].Kind != ePID_Kind::Ignored);
+    }
+    if (First == 0) {
+        for (uint32_t i = 0; i < NumPackets; i++)
+            m_NumSyncErrors += SBs[i] != 'G';
+    }
+    return NumSelected;
+}
+
+/// @brief Process packet of PID that is demuxed or carries wanted PSI
+xPES_Assembler::eResult xTS_Demuxer::xProcessSelected(const uint8_t* Packet, uint16_t PID)
+{
+    const xPID_Entry& Entry = m_PIDs[PID];
+
+    X_PROFILE_BEGIN(HeaderStart);
+    m_PacketHeader.Reset();
+    m_PacketHeader.Parse(Packet, xTS::TS_PacketLength);
+    X_PROFILE_END(HeaderStart, HeaderParse, PID, 1);
+
+    m_AdaptationField.Reset();
+    if (m_PacketHeader.hasAdaptationField()) {
+        X_PROFILE_BEGIN(AF_Start);
+        m_AdaptationField.Parse(Packet, xTS::TS_PacketLength, m_PacketHeader.getAdaptationFieldControl());
+        X_PROFILE_END(AF_Start, AF_Parse, PID, 1);
+    }
+
+    xPID_Stats& Stats = m_Stats[PID];
+    Stats.NumPackets++;
+
+    if (Entry.Kind != ePID_Kind::PES) {
+        const uint32_t PayloadOffset = xTS::TS_HeaderLength + (m_PacketHeader.hasAdaptationField() ? m_AdaptationField.getNumBytes() : 0);
+        xPSI_SectionAssembler::eResult Result = Entry.PSI->AbsorbPacket(Packet, &m_PacketHeader, PayloadOffset);
+        if (Result == xPSI_SectionAssembler::eResult::StreamPackedLost)
+            Stats.NumPacketsLost++;
+        if (Result == xPSI_SectionAssembler::eResult::CRC_Error)
+            X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "PID %u: PSI section CRC error", PID));
+        if (Result == xPSI_SectionAssembler::eResult::SectionsReady)
+            xProcessPSI(Entry.Kind, Entry.PSI);
+        return xPES_Assembler::eResult::UnexpectedPID;
+    }
+
+    xPES_Assembler::eResult Result = Entry.PES->AbsorbPacket(Packet, &m_PacketHeader, &m_AdaptationField);
+    if (Result == xPES_Assembler::eResult::StreamPackedLost) {
+        Stats.NumPacketsLost++;
+        X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "PID %u: packet lost (CC=%u)", PID, m_PacketHeader.getCC()));
+    }
+    return Result;
+}
+
+void xTS_Demuxer::xProcessPSI(ePID_Kind Kind, xPSI_SectionAssembler* Assembler)
+{
+    for (uint32_t i = 0; i < Assembler->getNumCompleted(); i++) {
+        if (Kind == ePID_Kind::PAT)
+            xProcessPAT(Assembler->getSection(i), Assembler->getSectionLength(i));
+        else if (Kind == ePID_Kind::PMT)
+            xProcessPMT(Assembler->getSection(i), Assembler->getSectionLength(i));
+    }
+}
+
+void xTS_Demuxer::xProcessPAT(const uint8_t* Section, uint32_t Length)
+{
+    if (m_PAT.Parse(Section, Length) == NOT_VALID)
+        return;
+
+    for (uint32_t i = 0; i < m_PAT.getNumPrograms(); i++) {
+        const xPSI_PAT::xProgram& Program = m_PAT.getProgram(i);
+        if (Program.ProgramNumber != 0) // program 0 points to NIT
+            xAddPSI(Program.PID, ePID_Kind::PMT);
+    }
+}
+
+void xTS_Demuxer::xProcessPMT(const uint8_t* Section, uint32_t Length)
+{
+    if (m_PMT.Parse(Section, Length) == NOT_VALID)
+        return;
+
+    for (uint32_t i = 0; i < m_PMT.getNumStreams(); i++) {
+        const xPSI_PMT::xElementaryStream& Stream = m_PMT.getStream(i);
+        if (!(Stream.Category & m_StreamSelection) || getPIDKind(Stream.PID) != ePID_Kind::Ignored)
+            continue;
+
+        AddPID(Stream.PID, m_OutputFileName.empty() ? std::string() : MakeOutputFileName(m_OutputFileName, Stream.PID));
+        if (m_FrameSink != nullptr && Stream.Category == xPSI_PMT::eStreamCategory_Audio)
+            AddFramer(Stream.PID, m_FrameSink);
+        m_Streams.push_back(xStreamInfo{m_PMT.getProgramNumber(), Stream.PID, Stream.StreamType, Stream.Category, m_PMT.getPCR_PID()});
+        X_TRACE(xTrace::eLevel::Info, xTrace::Message(xTrace::eLevel::Info, "program %u: demuxing PID %u (stream_type 0x%02X)", m_PMT.getProgramNumber(), Stream.PID, Stream.StreamType));
+    }
+}
+
+/// @brief Finish all PES of unspecified length (end of stream) and wait until output is written
+void xTS_Demuxer::Flush()
+{
+    for (const std::unique_ptr<xPES_Assembler>& Assembler : m_AssemblerStorage)
+        Assembler->Flush();
+    m_Writer.Flush();
+}
+
+/**
+  @brief Flush and close output files
+  @return false if single discovered stream could not be renamed to the output name (it stays in MakeOutputFileName(Name, PID))
+ */
+bool xTS_Demuxer::Close()
+{
+    Flush();
+    m_Writer.Close();
+
+    // Single discovered stream is written to the output name as given, as a single PID always was - only known at the end
+    bool Renamed = true;
+    if (!m_OutputFileName.empty() && m_Streams.size() == 1 && m_AssemblerStorage.size() == 1) {
+        const std::string FileName = MakeOutputFileName(m_OutputFileName, m_Streams[0].PID);
+#if defined(_WIN32)
+        Renamed = remove(m_OutputFileName.c_str()) == 0 || errno == ENOENT; // rename does not replace existing file
+#endif
+        Renamed = Renamed && rename(FileName.c_str(), m_OutputFileName.c_str()) == 0;
+        if (!Renamed)
+            X_TRACE(xTrace::eLevel::Error, xTrace::Message(xTrace::eLevel::Error, "cannot rename %s to %s: %s", FileName.c_str(), m_OutputFileName.c_str(), strerror(errno)));
+        m_OutputFileName.clear();
+    }
+    return Renamed;
+}
+
+/// @brief Add packet counters of PID collected by another demuxer (chunk demuxed on worker thread)
+void xTS_Demuxer::AddStats(uint16_t PID, const xPID_Stats& Stats)
+{
+    xPID_Stats& Own = m_Stats[PID & (NumPIDs - 1)];
+    Own.NumPackets     += Stats.NumPackets;
+    Own.NumPacketsLost += Stats.NumPacketsLost;
+}
+
+/// @brief true when discovery is disabled or PAT and every PMT it lists have been received
+bool xTS_Demuxer::isDiscoveryComplete() const
+{
+    for (const std::unique_ptr<xPSI_SectionAssembler>& Assembler : m_SectionAssemblerStorage) {
+        if (Assembler->getNumSections() == 0)
+            return false;
+    }
+    return true;
+}
+
+uint64_t xTS_Demuxer::getNumPacketsLost() const
+{
+    uint64_t NumPacketsLost = 0;
+    for (const std::unique_ptr<xPES_Assembler>& Assembler : m_AssemblerStorage)
+        NumPacketsLost += m_Stats[Assembler->getPID()].NumPacketsLost;
+    return NumPacketsLost;
+}
+
+uint64_t xTS_Demuxer::getNumCRC_Errors() const
+{
+    uint64_t NumCRC_Errors = 0;
+    for (const std::unique_ptr<xPSI_SectionAssembler>& Assembler : m_SectionAssemblerStorage)
+        NumCRC_Errors += Assembler->getNumCRC_Errors();
+    return NumCRC_Errors;
+}
+
+std::vector<uint16_t> xTS_Demuxer::getDemuxedPIDs() const
+{
+    std::vector<uint16_t> PIDs;
+    for (const std::unique_ptr<xPES_Assembler>& Assembler : m_AssemblerStorage)
+        PIDs.push_back((uint16_t)Assembler->getPID());
+    return PIDs;
+}
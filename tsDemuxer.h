@@ -0,0 +1,169 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include "tsPSI.h"
+#include "tsElementary.h"
+#include "tsOutputSink.h"
+#include "tsProfiler.h"
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Multi-PID demuxer
+//=============================================================================================================================================================================
+
+/*
+Single pass demuxer. Every TS packet is dispatched through a flat table
+indexed by the 13-bit PID - PIDs that are neither demuxed nor carry wanted
+PSI are skipped right after the PID is read, without touching the payload.
+Each demuxed PID owns its xPES_Assembler (continuity counter state, PES buffer
+and output file); PES buffers of all PIDs come from one xPES_BufferPool.
+
+With discovery enabled, PAT and PMT sections are assembled and decoded and
+elementary streams of selected categories (audio/video/other) are added as
+soon as their PMT is seen. With framing enabled, discovered audio streams
+also get an xES_AudioFramer passing their frames to a sink.
+*/
+
+class xTS_Demuxer
+{
+public:
+  static constexpr uint32_t NumPIDs = 8192;
+
+  enum class ePID_Kind : uint8_t
+  {
+    Ignored = 0,
+    PES,
+    PAT,
+    PMT,
+  };
+
+  struct xPID_Stats
+  {
+    uint64_t NumPackets;
+    uint64_t NumPacketsLost;
+  };
+
+  struct xStreamInfo
+  {
+    uint16_t ProgramNumber;
+    uint16_t PID;
+    uint8_t  StreamType;
+    uint8_t  Category;   // xPSI_PMT::eStreamCategory
+    uint16_t PCR_PID;    // PID carrying clock of program
+  };
+
+protected:
+  struct xPID_Entry
+  {
+    ePID_Kind              Kind;
+    xPES_Assembler*        PES;
+    xPSI_SectionAssembler* PSI;
+  };
+
+  std::array<xPID_Entry, NumPIDs> m_PIDs;
+  xPES_BufferPool                 m_BufferPool; // PES buffers of all assemblers (declared first - outlives them)
+  std::vector<std::unique_ptr<xPES_Assembler>>        m_AssemblerStorage;
+  std::vector<std::unique_ptr<xPSI_SectionAssembler>> m_SectionAssemblerStorage;
+  std::vector<std::unique_ptr<xES_AudioFramer>>       m_FramerStorage;
+  std::array<xPID_Stats, NumPIDs> m_Stats;
+  xTS_OutputWriter                m_Writer;
+
+  xTS_PacketHeader      m_PacketHeader;
+  xTS_AdaptationField   m_AdaptationField;
+  xTS_PacketHeaderBatch m_Batch;
+  uint16_t              m_Selected[xTS_PacketHeaderBatch::MaxPackets];
+  uint32_t              m_TableVersion; // incremented when PID table changes
+  uint64_t              m_NumPackets;
+  uint64_t            m_NumSyncErrors;
+
+  //discovery
+  uint8_t                  m_StreamSelection; // xPSI_PMT::eStreamCategory mask, 0 = no streams added (PAT/PMT followed once enabled)
+  std::string              m_OutputFileName;
+  xPSI_PAT                 m_PAT;
+  xPSI_PMT                 m_PMT;
+  std::vector<xStreamInfo> m_Streams;
+  xES_FrameSink*           m_FrameSink;       // discovered audio streams are framed (nullptr = not framed)
+  xPES_Assembler::tFinishedCallback m_OnFinished; // set on all assemblers, also those added later
+  void*                    m_OnFinishedContext;
+
+public:
+  xTS_Demuxer();
+
+  xPES_Assembler*         AddPID         (uint16_t PID, const std::string& FileName);
+  xPES_Assembler*         AddPID         (uint16_t PID, xTS_OutputSink* Output);
+  void                    EnableDiscovery(uint8_t StreamSelection, const std::string& OutputFileName);
+  xES_AudioFramer*        AddFramer      (uint16_t PID, xES_FrameSink* Sink);
+  void                    EnableFraming  (xES_FrameSink* Sink) { m_FrameSink = Sink; }
+  void                    SetFinishedCallback(xPES_Assembler::tFinishedCallback Callback, void* Context);
+  xPES_Assembler::eResult ProcessPacket  (const uint8_t* Packet);
+  void                    Flush          ();
+  bool                    Close          ();
+  void                    AddStats       (uint16_t PID, const xPID_Stats& Stats);
+
+  template <class tHandler> uint32_t ProcessBatch(const uint8_t* const* Packets, uint32_t NumPackets, tHandler&& Handler);
+
+  static std::string MakeOutputFileName(const std::string& OutputFileName, uint16_t PID);
+
+public:
+  bool                       isDemuxed         (uint16_t PID) const { return m_PIDs[PID & (NumPIDs - 1)].PES != nullptr; }
+  ePID_Kind                  getPIDKind        (uint16_t PID) const { return m_PIDs[PID & (NumPIDs - 1)].Kind; }
+  xPES_Assembler*            getAssembler      (uint16_t PID) const { return m_PIDs[PID & (NumPIDs - 1)].PES; }
+  const xPSI_SectionAssembler* getSectionAssembler(uint16_t PID) const { return m_PIDs[PID & (NumPIDs - 1)].PSI; } // sections completed by last packet of PID
+  const xPID_Stats&          getStats          (uint16_t PID) const { return m_Stats[PID & (NumPIDs - 1)]; }
+  const xTS_PacketHeader&    getPacketHeader   () const { return m_PacketHeader; }
+  const xTS_AdaptationField& getAdaptationField() const { return m_AdaptationField; }
+  const xTS_PacketHeaderBatch& getBatch        () const { return m_Batch; } // headers of batch last passed to ProcessBatch
+  uint64_t                   getNumPackets     () const { return m_NumPackets; }
+  uint64_t                   getNumSyncErrors  () const { return m_NumSyncErrors; }
+  bool                       isDiscoveryComplete() const;
+  uint64_t                   getNumPacketsLost () const;
+  uint64_t                   getNumCRC_Errors  () const;
+  const std::vector<xStreamInfo>& getStreams   () const { return m_Streams; }
+  std::vector<uint16_t>      getDemuxedPIDs    () const;
+  const xTS_OutputWriter&    getWriter         () const { return m_Writer; }
+  const xPES_BufferPool&     getBufferPool     () const { return m_BufferPool; }
+
+protected:
+  xPES_Assembler::eResult xProcessSelected(const uint8_t* Packet, uint16_t PID);
+  uint32_t                xSelect         (uint32_t First);
+
+  void xAddPSI       (uint16_t PID, ePID_Kind Kind);
+  void xProcessPSI   (ePID_Kind Kind, xPSI_SectionAssembler* Assembler);
+  void xProcessPAT   (const uint8_t* Section, uint32_t Length);
+  void xProcessPMT   (const uint8_t* Section, uint32_t Length);
+};
+
+//=============================================================================================================================================================================
+
+/**
+  @brief Dispatch batch of TS packets - headers are decoded column-wise and only packets of wanted PIDs are processed further
+  @param Packets is array of pointers to 188 byte TS packets
+  @param NumPackets is number of packets (at most xTS_PacketHeaderBatch::MaxPackets)
+  @param Handler is called as Handler(PacketIdx, eResult) right after each wanted packet is processed
+         (getPacketHeader()/getAdaptationField() describe that packet during the call)
+  @return Number of processed packets
+ */
+template <class tHandler> uint32_t xTS_Demuxer::ProcessBatch(const uint8_t* const* Packets, uint32_t NumPackets, tHandler&& Handler)
+{
+    X_PROFILE_BEGIN(Start);
+    NumPackets = m_Batch.Parse(Packets, NumPackets);
+    X_PROFILE_END(Start, HeaderParse, xProfiler::AllPIDs, NumPackets);
+    m_NumPackets += NumPackets;
+
+    uint32_t NumSelected = xSelect(0);
+    for (uint32_t s = 0; s < NumSelected; s++) {
+        const uint32_t Idx = m_Selected[s];
+        const uint32_t TableVersion = m_TableVersion;
+        Handler(Idx, xProcessSelected(Packets[Idx], m_Batch.getPID(Idx)));
+
+        // PSI added new PIDs - select again from the next packet on
+        if (TableVersion != m_TableVersion) {
+            NumSelected = xSelect(Idx + 1);
+            s = (uint32_t)-1;
+        }
+    }
+    return NumPackets;
+}
@@ -0,0 +1,293 @@
+#include "tsElementary.h"
+#include "tsTrace.h"
+#include <algorithm>
+#include <cstring>
+
+//=============================================================================================================================================================================
+// xES_AudioFramer
+//=============================================================================================================================================================================
+
+static constexpr uint32_t c_ADTS_SampleRates[16] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350, 0, 0, 0 };
+
+static constexpr uint16_t c_LayerII_Bitrates[2][16] = // kbit/s, [LSF][bitrate_index]
+{
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 }, // MPEG-1
+    { 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0 }, // MPEG-2/2.5 low sampling frequencies
+};
+
+static constexpr uint32_t c_MPEG_SampleRates[4] = { 44100, 48000, 32000, 0 }; // MPEG-1, halved for MPEG-2, quartered for MPEG-2.5
+
+xES_AudioFramer::xES_AudioFramer(int32_t PID, xES_FrameSink* Sink)
+    : m_PID(PID), m_Sink(Sink), m_Format(xES_Frame::eFormat::Unknown), m_Locked(false), m_CarryInPES(false), m_Header(), m_PendingPTS(false), m_PES_PTS(0),
+      m_HasNextPTS(false), m_NextPTS(0), m_NextPTS_Fraction(0), m_NumFrames(0), m_NumCarried(0), m_NumResyncs(0), m_NumSkippedBytes(0)
+{
+    m_Carry.reserve(MaxFrameSize); // no allocation per carried frame
+}
+
+/**
+  @brief Split payload of finished PES into frames passed to sink
+  @param Payload is PES payload (blocks are taken in order, frames crossing block boundaries are carried)
+  @param Header is PES header - its PTS belongs to the first frame starting in this PES
+ */
+void xES_AudioFramer::AddPES(const xPES_Buffer& Payload, const xPES_PacketHeader& Header)
+{
+    m_PendingPTS = Header.hasPTS();
+    m_PES_PTS    = Header.getPTS() & TimestampMask;
+    m_CarryInPES = false;
+    for (uint32_t i = 0; i < Payload.getNumBlocks(); i++) {
+        const xPES_Buffer::xBlock& Block = Payload.getBlock(i);
+        xAddSegment(Block.Data, Block.Data + Block.Size, i + 1 == Payload.getNumBlocks());
+    }
+}
+
+/// @brief Data was lost - drop carried frame, timestamps are taken from next PES with PTS
+void xES_AudioFramer::Resync()
+{
+    xLoseLock();
+}
+
+/**
+  @brief Parse ADTS or Layer II frame header
+  @param Header points to at least ParseLength bytes
+  @param Frame receives format, sample rate, samples and channels
+  @return Frame size in bytes, 0 if Header is not a valid header
+ */
+uint32_t xES_AudioFramer::ParseHeader(const uint8_t* Header, xES_Frame& Frame)
+{
+    if (Header[0] != 0xFF || (Header[1] & 0xE0) != 0xE0)
+        return 0;
+
+    // ADTS - syncword 0xFFF, layer 00
+    if ((Header[1] & 0xF6) == 0xF0) {
+        const uint32_t SampleRate    = c_ADTS_SampleRates[(Header[2] >> 2) & 0x0F];
+        const uint32_t HeaderLength  = (Header[1] & 0x01) ? 7 : 9; // protection_absent
+        const uint32_t FrameLength   = ((Header[3] & 0x03) << 11) | (Header[4] << 3) | (Header[5] >> 5);
+        if (SampleRate == 0 || FrameLength < HeaderLength)
+            return 0;
+        Frame.Format      = xES_Frame::eFormat::ADTS;
+        Frame.SampleRate  = SampleRate;
+        Frame.NumSamples  = (uint16_t)(1024 * ((Header[6] & 0x03) + 1)); // number_of_raw_data_blocks_in_frame + 1
+        Frame.NumChannels = (uint8_t)(((Header[2] & 0x01) << 2) | (Header[3] >> 6));
+        return FrameLength;
+    }
+
+    // MPEG audio - syncword 0x7FF, Layer II only (layer bits 10)
+    const uint32_t Version = (Header[1] >> 3) & 0x03; // 3 = MPEG-1, 2 = MPEG-2, 0 = MPEG-2.5
+    if (Version == 1 || ((Header[1] >> 1) & 0x03) != 2 || (Header[3] & 0x03) == 2) // reserved version, other layer, reserved emphasis
+        return 0;
+    const uint32_t Bitrate    = c_LayerII_Bitrates[Version != 3][Header[2] >> 4]; // 0 = free format (not supported) or invalid
+    const uint32_t SampleRate = c_MPEG_SampleRates[(Header[2] >> 2) & 0x03] >> (Version == 3 ? 0 : Version == 2 ? 1 : 2);
+    if (Bitrate == 0 || SampleRate == 0)
+        return 0;
+    Frame.Format      = xES_Frame::eFormat::MPEG_Audio;
+    Frame.SampleRate  = SampleRate;
+    Frame.NumSamples  = 1152;
+    Frame.NumChannels = (Header[3] >> 6) == 3 ? 1 : 2;
+    return 144000 * Bitrate / SampleRate + ((Header[2] >> 1) & 0x01); // padding_bit
+}
+
+const char* xES_AudioFramer::getFormatName(xES_Frame::eFormat Format)
+{
+    switch (Format) {
+    case xES_Frame::eFormat::ADTS:       return "ADTS";
+    case xES_Frame::eFormat::MPEG_Audio: return "MPEG audio Layer II";
+    default:                             return "unknown";
+    }
+}
+
+const uint8_t* xES_AudioFramer::FindSyncScalar(const uint8_t* Begin, const uint8_t* End)
+{
+    for (; End - Begin >= 2; Begin++) {
+        if (Begin[0] == 0xFF && (Begin[1] & 0xE0) == 0xE0)
+            return Begin;
+    }
+    return End;
+}
+
+#if defined(X_ARCH_X86)
+
+const uint8_t* xES_AudioFramer::FindSyncSSE2(const uint8_t* Begin, const uint8_t* End)
+{
+    const __m128i MaskFF = _mm_set1_epi8((char)0xFF);
+    const __m128i MaskE0 = _mm_set1_epi8((char)0xE0);
+    while (End - Begin >= 17) {
+        const __m128i First  = _mm_loadu_si128((const __m128i*)Begin);
+        const __m128i Second = _mm_loadu_si128((const __m128i*)(Begin + 1));
+        const uint32_t Mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(First, MaskFF), _mm_cmpeq_epi8(_mm_and_si128(Second, MaskE0), MaskE0)));
+        if (Mask != 0)
+            return Begin + xCountTrailingZeros32(Mask);
+        Begin += 16;
+    }
+    return FindSyncScalar(Begin, End);
+}
+
+#else
+
+const uint8_t* xES_AudioFramer::FindSyncSSE2(const uint8_t* Begin, const uint8_t* End) { return FindSyncScalar(Begin, End); }
+
+#endif
+
+/**
+  @brief Find first sync word candidate (0xFF followed by byte with top 3 bits set)
+  @return Pointer to 0xFF of first candidate in [Begin, End - 1) or End if there is none
+ */
+const uint8_t* xES_AudioFramer::FindSync(const uint8_t* Begin, const uint8_t* End)
+{
+    return FindSyncSSE2(Begin, End);
+}
+
+/**
+  @brief Split contiguous part of PES payload into frames
+  @param LastSegment is true for the last block of PES (frame ending at End is confirmed by end of PES)
+ */
+void xES_AudioFramer::xAddSegment(const uint8_t* Data, const uint8_t* End, bool LastSegment)
+{
+    if (!m_Carry.empty())
+        Data += xCompleteCarry(Data, End);
+
+    while (Data < End) {
+        if (!m_Locked) {
+            Data = xHunt(Data, End, LastSegment);
+            if (!m_Locked)
+                return;
+        }
+        const uint32_t Available = (uint32_t)(End - Data);
+        if (Available < ParseLength) {
+            xCarry(Data, End);
+            return;
+        }
+        xES_Frame Frame;
+        const uint32_t Size = ParseHeader(Data, Frame);
+        if (Size == 0 || !xIsSameStream(Frame)) {
+            X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "PID %d: %s sync lost", m_PID, getFormatName(m_Format)));
+            xLoseLock();
+            continue;
+        }
+        m_Header = Frame;
+        if (Size > Available) {
+            xCarry(Data, End);
+            return;
+        }
+        xEmit(Data, Size, true);
+        Data += Size;
+    }
+}
+
+/**
+  @brief Complete carried frame with bytes from start of segment and emit it
+  @return Number of bytes of segment used (0 if carried header turned out invalid - segment is scanned from its start)
+ */
+uint32_t xES_AudioFramer::xCompleteCarry(const uint8_t* Data, const uint8_t* End)
+{
+    uint32_t Used = 0;
+    if (m_Carry.size() < ParseLength) {
+        Used = std::min((uint32_t)(ParseLength - m_Carry.size()), (uint32_t)(End - Data));
+        m_Carry.insert(m_Carry.end(), Data, Data + Used);
+        if (m_Carry.size() < ParseLength)
+            return Used;
+    }
+    xES_Frame Frame;
+    const uint32_t Size = ParseHeader(m_Carry.data(), Frame);
+    if (Size == 0 || !xIsSameStream(Frame)) {
+        m_NumSkippedBytes += m_Carry.size() - Used;
+        m_Carry.clear(); // bytes taken from this segment are scanned again
+        xLoseLock();
+        return 0;
+    }
+    m_Header = Frame;
+    const uint32_t Missing = std::min(Size - (uint32_t)m_Carry.size(), (uint32_t)(End - Data) - Used);
+    m_Carry.insert(m_Carry.end(), Data + Used, Data + Used + Missing);
+    Used += Missing;
+    if (m_Carry.size() == Size) {
+        m_NumCarried++;
+        xEmit(m_Carry.data(), Size, m_CarryInPES);
+        m_Carry.clear();
+    }
+    return Used;
+}
+
+/**
+  @brief Scan for frame header confirmed by the header after it (or by end of PES) and lock to it
+  @return Pointer to first frame (m_Locked set) or End
+ */
+const uint8_t* xES_AudioFramer::xHunt(const uint8_t* Data, const uint8_t* End, bool LastSegment)
+{
+    for (const uint8_t* Sync = FindSync(Data, End); Sync != End; Sync = FindSync(Sync + 1, End)) {
+        if (End - Sync < ParseLength)
+            break;
+        xES_Frame Frame;
+        const uint32_t Size = ParseHeader(Sync, Frame);
+        if (Size == 0 || (m_Format != xES_Frame::eFormat::Unknown && Frame.Format != m_Format))
+            continue;
+
+        bool Confirmed;
+        const uint8_t* Next = Sync + Size;
+        if (Next == End) {
+            Confirmed = LastSegment;
+        }
+        else if (Next < End && End - Next >= ParseLength) {
+            xES_Frame NextFrame;
+            Confirmed = ParseHeader(Next, NextFrame) != 0 && NextFrame.Format == Frame.Format && NextFrame.SampleRate == Frame.SampleRate;
+        }
+        else {
+            // Next header is in the next PES - good enough for stream known from earlier lock
+            Confirmed = m_Format != xES_Frame::eFormat::Unknown && Frame.SampleRate == m_Header.SampleRate;
+        }
+        if (!Confirmed)
+            continue;
+
+        m_NumSkippedBytes += Sync - Data;
+        m_Locked = true;
+        m_Format = Frame.Format;
+        m_Header = Frame;
+        return Sync;
+    }
+    m_NumSkippedBytes += End - Data;
+    return End;
+}
+
+/// @brief Keep rest of segment (frame or its header continues in next block or PES)
+void xES_AudioFramer::xCarry(const uint8_t* Data, const uint8_t* End)
+{
+    m_Carry.assign(Data, End);
+    m_CarryInPES = true;
+}
+
+bool xES_AudioFramer::xIsSameStream(const xES_Frame& Frame) const
+{
+    return Frame.Format == m_Format && Frame.SampleRate == m_Header.SampleRate;
+}
+
+/// @brief Pass frame to sink - first frame starting in PES takes its PTS, later ones are extrapolated by samples
+void xES_AudioFramer::xEmit(const uint8_t* Data, uint32_t Size, bool StartsInPES)
+{
+    if (StartsInPES && m_PendingPTS) {
+        m_NextPTS          = m_PES_PTS;
+        m_NextPTS_Fraction = 0;
+        m_HasNextPTS       = true;
+        m_PendingPTS       = false;
+    }
+    xES_Frame Frame = m_Header;
+    Frame.Data   = Data;
+    Frame.Size   = Size;
+    Frame.PTS    = m_NextPTS;
+    Frame.hasPTS = m_HasNextPTS;
+    if (m_HasNextPTS) {
+        m_NextPTS_Fraction += (uint32_t)Frame.NumSamples * xTS::BaseClockFrequency_Hz;
+        m_NextPTS           = (m_NextPTS + m_NextPTS_Fraction / Frame.SampleRate) & TimestampMask;
+        m_NextPTS_Fraction %= Frame.SampleRate;
+    }
+    m_NumFrames++;
+    if (m_Sink != nullptr)
+        m_Sink->OnFrame(*this, Frame);
+}
+
+void xES_AudioFramer::xLoseLock()
+{
+    if (m_Locked)
+        m_NumResyncs++;
+    m_Locked     = false;
+    m_HasNextPTS = false;
+    m_NumSkippedBytes += m_Carry.size();
+    m_Carry.clear();
+}
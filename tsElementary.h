@@ -0,0 +1,119 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include <vector>
+
+//=============================================================================================================================================================================
+// Audio elementary stream framing
+//=============================================================================================================================================================================
+
+/*
+Splits payload of finished PES into audio frames - ADTS (AAC) and MPEG audio
+Layer II (MPEG-1 and MPEG-2 low sampling frequencies). Stage behind
+xPES_Assembler: the assembler passes every finished PES, frames go to a sink.
+
+Frames are views into the PES buffer, valid during xES_FrameSink::OnFrame
+only. A frame crossing a PES (or PES buffer block) boundary is the one case
+where bytes are copied - into a carry buffer of MaxFrameSize bytes that is
+completed by the next PES.
+
+PTS of PES applies to the first frame starting in it; later frames get the
+PTS extrapolated by the number of samples of the frames before.
+
+Sync words are searched with SSE2 (0xFF followed by byte with top 3 bits set,
+both compared for 16 positions at once), candidates are then checked by
+header fields. A candidate is accepted (lock) if the next frame header follows
+where it ends, or the frame ends exactly where the PES does. Once locked,
+frames are taken by length from their headers without scanning; an invalid
+header or Resync() (called by the assembler after StreamPackedLost) drops the
+carried frame and starts scanning again from where the stream continues.
+*/
+
+class xES_AudioFramer;
+
+struct xES_Frame
+{
+  enum class eFormat : uint8_t
+  {
+    Unknown = 0,
+    ADTS,       // AAC in ADTS
+    MPEG_Audio, // MPEG-1/2 Layer II
+  };
+
+  const uint8_t* Data;        // frame including header
+  uint32_t       Size;
+  uint64_t       PTS;         // 90 kHz, 33 bits
+  bool           hasPTS;      // PTS of PES or extrapolated from an earlier one
+  eFormat        Format;
+  uint32_t       SampleRate;  // Hz
+  uint16_t       NumSamples;  // per channel
+  uint8_t        NumChannels; // 0 = given by AAC program_config_element
+};
+
+class xES_FrameSink
+{
+public:
+  virtual ~xES_FrameSink() {}
+  virtual void OnFrame(const xES_AudioFramer& Framer, const xES_Frame& Frame) = 0;
+};
+
+class xES_AudioFramer
+{
+public:
+  static constexpr uint32_t MaxFrameSize    = 8192; // ADTS frame_length is 13 bits, Layer II frames are at most 1729 bytes
+  static constexpr uint32_t ParseLength     = 7;    // bytes needed to parse header (fixed+variable ADTS header; Layer II uses 4)
+  static constexpr uint64_t TimestampMask   = (1ull << 33) - 1;
+
+protected:
+  int32_t              m_PID;
+  xES_FrameSink*       m_Sink;
+  xES_Frame::eFormat   m_Format;        // locked format (Unknown until first lock)
+  bool                 m_Locked;
+  std::vector<uint8_t> m_Carry;         // frame (or header) started in previous PES or block
+  bool                 m_CarryInPES;    // carried frame started in current PES (block boundary)
+  xES_Frame            m_Header;        // fields of last parsed header
+
+  //timestamps
+  bool                 m_PendingPTS;    // PTS of current PES not yet given to a frame
+  uint64_t             m_PES_PTS;
+  bool                 m_HasNextPTS;
+  uint64_t             m_NextPTS;       // extrapolated PTS of next frame
+  uint32_t             m_NextPTS_Fraction; // in 1/SampleRate of 90 kHz tick
+
+  //statistics
+  uint64_t             m_NumFrames;
+  uint64_t             m_NumCarried;    // frames copied across PES or block boundary
+  uint64_t             m_NumResyncs;    // lock lost (loss reported by assembler or invalid header)
+  uint64_t             m_NumSkippedBytes;
+
+public:
+  xES_AudioFramer(int32_t PID, xES_FrameSink* Sink);
+
+  void AddPES(const xPES_Buffer& Payload, const xPES_PacketHeader& Header);
+  void Resync();
+
+  static const uint8_t* FindSync      (const uint8_t* Begin, const uint8_t* End);
+  static const uint8_t* FindSyncScalar(const uint8_t* Begin, const uint8_t* End);
+  static const uint8_t* FindSyncSSE2  (const uint8_t* Begin, const uint8_t* End);
+  static uint32_t       ParseHeader   (const uint8_t* Header, xES_Frame& Frame);
+  static const char*    getFormatName (xES_Frame::eFormat Format);
+
+public:
+  int32_t            getPID            () const { return m_PID; }
+  xES_Frame::eFormat getFormat         () const { return m_Format; }
+  bool               isLocked          () const { return m_Locked; }
+  uint32_t           getSampleRate     () const { return m_Header.SampleRate; }
+  uint64_t           getNumFrames      () const { return m_NumFrames; }
+  uint64_t           getNumCarried     () const { return m_NumCarried; }
+  uint64_t           getNumResyncs     () const { return m_NumResyncs; }
+  uint64_t           getNumSkippedBytes() const { return m_NumSkippedBytes; }
+
+protected:
+  void     xAddSegment   (const uint8_t* Data, const uint8_t* End, bool LastSegment);
+  uint32_t xCompleteCarry(const uint8_t* Data, const uint8_t* End);
+  const uint8_t* xHunt   (const uint8_t* Data, const uint8_t* End, bool LastSegment);
+  void     xCarry        (const uint8_t* Data, const uint8_t* End);
+  bool     xIsSameStream (const xES_Frame& Frame) const;
+  void     xEmit         (const uint8_t* Data, uint32_t Size, bool StartsInPES);
+  void     xLoseLock     ();
+};
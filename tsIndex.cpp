@@ -0,0 +1,230 @@
+#include "tsIndex.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+//=============================================================================================================================================================================
+// xTS_Index
+//=============================================================================================================================================================================
+
+constexpr char xTS_Index::Magic[8];
+constexpr char xTS_Index::FileExtension[];
+
+/// @brief Map index file and validate header (magic, version, record sizes, table bounds)
+bool xTS_Index::Open(const char* FileName)
+{
+    Close();
+    if (!m_File.Open(FileName))
+        return false;
+
+    const uint64_t Size = m_File.getSize();
+    const xHeader* Header = reinterpret_cast<const xHeader*>(m_File.getData());
+    if (Size < sizeof(xHeader) || memcmp(Header->Magic, Magic, sizeof(Magic)) != 0 || Header->Version != Version ||
+        Header->HeaderSize < sizeof(xHeader) || Header->PES_EntrySize != sizeof(xPES_Entry) || Header->PCR_EntrySize != sizeof(xPCR_Entry) ||
+        Header->PES_Offset % 8 != 0 || Header->PCR_Offset % 8 != 0 ||
+        Header->PES_Offset > Size || Header->NumPES > (Size - Header->PES_Offset) / sizeof(xPES_Entry) ||
+        Header->PCR_Offset > Size || Header->NumPCR > (Size - Header->PCR_Offset) / sizeof(xPCR_Entry)) {
+        m_File.Close();
+        return false;
+    }
+
+    m_Header = Header;
+    m_PES    = reinterpret_cast<const xPES_Entry*>(m_File.getData() + Header->PES_Offset);
+    m_PCR    = reinterpret_cast<const xPCR_Entry*>(m_File.getData() + Header->PCR_Offset);
+    return true;
+}
+
+void xTS_Index::Close()
+{
+    m_File.Close();
+    m_Header = nullptr;
+    m_PES    = nullptr;
+    m_PCR    = nullptr;
+}
+
+/// @brief PIDs with PES entries, ascending
+std::vector<uint16_t> xTS_Index::getPIDs() const
+{
+    std::vector<uint16_t> PIDs;
+    for (uint64_t i = 0; i < m_Header->NumPES; ) {
+        uint64_t NumEntries = 0;
+        FindPID(m_PES[i].PID, NumEntries);
+        PIDs.push_back(m_PES[i].PID);
+        i += NumEntries;
+    }
+    return PIDs;
+}
+
+/**
+  @brief Entries of one PID (contiguous, in file order)
+  @param NumEntries receives number of entries (0 if PID is not indexed)
+  @return First entry of PID
+ */
+const xTS_Index::xPES_Entry* xTS_Index::FindPID(uint16_t PID, uint64_t& NumEntries) const
+{
+    const xPES_Entry* End = m_PES + m_Header->NumPES;
+    const xPES_Entry* First = std::lower_bound(m_PES, End, PID, [](const xPES_Entry& Entry, uint16_t Value) { return Entry.PID < Value; });
+    const xPES_Entry* Last  = std::upper_bound(First, End, PID, [](uint16_t Value, const xPES_Entry& Entry) { return Value < Entry.PID; });
+    NumEntries = (uint64_t)(Last - First);
+    return First;
+}
+
+/**
+  @brief Find PES of PID decoded in [Begin, End) - binary search on decode time
+  @param Begin, End are 90 kHz times on index time line (see getTimeOrigin)
+  @param SnapToRandomAccess moves start back to nearest PES flagged as random access point (when PID has any)
+  @param First receives index (within PID entries) of first PES
+  @param Last receives index of first PES not extracted (number of PID entries if range reaches end of input)
+  @return false if no PES of PID falls into range
+ */
+bool xTS_Index::FindRange(uint16_t PID, int64_t Begin, int64_t End, bool SnapToRandomAccess, uint64_t& First, uint64_t& Last) const
+{
+    uint64_t NumEntries = 0;
+    const xPES_Entry* Entries = FindPID(PID, NumEntries);
+    const auto Before = [](const xPES_Entry& Entry, int64_t Time) { return Entry.DTS < Time; };
+    First = (uint64_t)(std::lower_bound(Entries, Entries + NumEntries, Begin, Before) - Entries);
+    Last  = (uint64_t)(std::lower_bound(Entries + First, Entries + NumEntries, End, Before) - Entries);
+    if (First >= Last)
+        return false;
+
+    if (SnapToRandomAccess) {
+        uint64_t RandomAccess = First;
+        while (RandomAccess > 0 && !(Entries[RandomAccess].Flags & Flag_RandomAccess))
+            RandomAccess--;
+        if (Entries[RandomAccess].Flags & Flag_RandomAccess)
+            First = RandomAccess;
+    }
+    return true;
+}
+
+/// @brief Start of time line (90 kHz) - first PCR, or earliest first decode time of PIDs when input has no PCR
+int64_t xTS_Index::getTimeOrigin() const
+{
+    if (m_Header->NumPCR != 0)
+        return m_PCR[0].PCR / xTS::BaseToExtendedClockMultiplier;
+
+    int64_t Origin = INT64_MAX;
+    for (uint64_t i = 0; i < m_Header->NumPES; i++) {
+        if (i == 0 || m_PES[i].PID != m_PES[i - 1].PID)
+            Origin = m_PES[i].DTS < Origin ? m_PES[i].DTS : Origin;
+    }
+    return Origin != INT64_MAX ? Origin : 0;
+}
+
+//=============================================================================================================================================================================
+// xTS_IndexBuilder
+//=============================================================================================================================================================================
+
+xTS_IndexBuilder::xTS_IndexBuilder() : m_HasPCR(false), m_LastPCR_Base(0)
+{
+    for (xPID_State& State : m_PIDs)
+        State = xPID_State{false, 0};
+}
+
+/**
+  @brief Index packets of batch just passed to the demuxer
+  @param Packets are pointers to packets in mapped input starting at Base
+  @param Demuxer tells which PIDs are demuxed (PES starts of other PIDs are not indexed)
+ */
+void xTS_IndexBuilder::AddPackets(const uint8_t* const* Packets, uint32_t NumPackets, const uint8_t* Base, const xTS_Demuxer& Demuxer)
+{
+    for (uint32_t i = 0; i < NumPackets; i++) {
+        const uint8_t* Packet = Packets[i];
+        const uint16_t PID = xTS_HeaderLayout::PID::Get(Packet);
+        const bool PES_Start = (Packet[1] & 0x40) && (Packet[3] & 0x10) && Demuxer.isDemuxed(PID);
+        const bool PCR       = (Packet[3] & 0x20) && Packet[4] >= 7 && (Packet[5] & 0x10);
+        if (PES_Start || PCR)
+            xAddPacket(Packet, (uint64_t)(Packet - Base), PES_Start);
+    }
+}
+
+void xTS_IndexBuilder::xAddPacket(const uint8_t* Packet, uint64_t Offset, bool PES_Start)
+{
+    m_PacketHeader.Reset();
+    m_PacketHeader.Parse(Packet, xTS::TS_PacketLength);
+    m_AdaptationField.Reset();
+    if (m_PacketHeader.hasAdaptationField())
+        m_AdaptationField.Parse(Packet, xTS::TS_PacketLength, m_PacketHeader.getAdaptationFieldControl());
+    const uint16_t PID = m_PacketHeader.getPID();
+
+    if (m_AdaptationField.hasPCR()) {
+        const uint64_t PCR  = m_AdaptationField.getPCR();
+        const uint64_t Base = PCR / xTS::BaseToExtendedClockMultiplier;
+        m_LastPCR_Base = xTS::UnwrapTimestamp(Base, m_HasPCR ? m_LastPCR_Base : (int64_t)Base);
+        m_HasPCR = true;
+
+        xTS_Index::xPCR_Entry Entry = {};
+        Entry.Offset = Offset;
+        Entry.PCR    = m_LastPCR_Base * xTS::BaseToExtendedClockMultiplier + (int64_t)(PCR % xTS::BaseToExtendedClockMultiplier);
+        Entry.PID    = PID;
+        Entry.Flags  = m_AdaptationField.hasDiscontinuity() ? xTS_Index::Flag_Discontinuity : 0;
+        m_PCR.push_back(Entry);
+    }
+
+    if (!PES_Start)
+        return;
+    const uint32_t PayloadOffset = xTS::TS_HeaderLength + (m_PacketHeader.hasAdaptationField() ? m_AdaptationField.getNumBytes() : 0);
+    if (PayloadOffset >= xTS::TS_PacketLength)
+        return;
+    m_PES_Header.Reset();
+    if (m_PES_Header.Parse(Packet + PayloadOffset, (int32_t)(xTS::TS_PacketLength - PayloadOffset)) == NOT_VALID || m_PES_Header.getPacketStartCodePrefix() != 1)
+        return;
+
+    xPID_State& State = m_PIDs[PID];
+    xTS_Index::xPES_Entry Entry = {};
+    Entry.Offset   = Offset;
+    Entry.PID      = PID;
+    Entry.StreamId = m_PES_Header.getStreamId();
+    Entry.Flags    = m_AdaptationField.hasRandomAccess() ? xTS_Index::Flag_RandomAccess : 0;
+    Entry.DTS      = State.DTS;
+    const int64_t Reference = m_HasPCR ? m_LastPCR_Base : State.DTS;
+    if (m_PES_Header.hasPTS()) {
+        Entry.PTS    = xTS::UnwrapTimestamp(m_PES_Header.getPTS(), State.HasTime || m_HasPCR ? Reference : (int64_t)m_PES_Header.getPTS());
+        Entry.DTS    = Entry.PTS;
+        Entry.Flags |= xTS_Index::Flag_PTS;
+    }
+    if (m_PES_Header.hasDTS()) {
+        Entry.DTS    = xTS::UnwrapTimestamp(m_PES_Header.getDTS(), State.HasTime || m_HasPCR ? Reference : (int64_t)m_PES_Header.getDTS());
+        Entry.Flags |= xTS_Index::Flag_DTS;
+    }
+    if (!(Entry.Flags & xTS_Index::Flag_PTS))
+        Entry.PTS = Entry.DTS;
+    // Search key must not go back (reordered or broken timestamps)
+    if (State.HasTime && Entry.DTS < State.DTS)
+        Entry.DTS = State.DTS;
+    State.HasTime = State.HasTime || (Entry.Flags & (xTS_Index::Flag_PTS | xTS_Index::Flag_DTS)) != 0;
+    State.DTS     = Entry.DTS;
+    m_PES.push_back(Entry);
+}
+
+/**
+  @brief Write index file - PES entries are sorted by PID (stable, so file order is kept within PID)
+  @param InputSize is size of indexed input (checked when index is used)
+  @param PacketSize is stride of indexed input
+ */
+bool xTS_IndexBuilder::Write(const char* FileName, uint64_t InputSize, uint32_t PacketSize)
+{
+    std::stable_sort(m_PES.begin(), m_PES.end(), [](const xTS_Index::xPES_Entry& A, const xTS_Index::xPES_Entry& B) { return A.PID < B.PID; });
+
+    xTS_Index::xHeader Header = {};
+    memcpy(Header.Magic, xTS_Index::Magic, sizeof(Header.Magic));
+    Header.Version       = xTS_Index::Version;
+    Header.HeaderSize    = sizeof(xTS_Index::xHeader);
+    Header.PES_EntrySize = sizeof(xTS_Index::xPES_Entry);
+    Header.PCR_EntrySize = sizeof(xTS_Index::xPCR_Entry);
+    Header.PacketSize    = PacketSize;
+    Header.InputSize     = InputSize;
+    Header.NumPES        = m_PES.size();
+    Header.NumPCR        = m_PCR.size();
+    Header.PES_Offset    = sizeof(xTS_Index::xHeader);
+    Header.PCR_Offset    = Header.PES_Offset + m_PES.size() * sizeof(xTS_Index::xPES_Entry);
+
+    FILE* File = fopen(FileName, "wb");
+    if (File == nullptr)
+        return false;
+    bool Ok = fwrite(&Header, sizeof(Header), 1, File) == 1;
+    Ok = Ok && (m_PES.empty() || fwrite(m_PES.data(), sizeof(xTS_Index::xPES_Entry), m_PES.size(), File) == m_PES.size());
+    Ok = Ok && (m_PCR.empty() || fwrite(m_PCR.data(), sizeof(xTS_Index::xPCR_Entry), m_PCR.size(), File) == m_PCR.size());
+    Ok = (fclose(File) == 0) && Ok;
+    return Ok;
+}
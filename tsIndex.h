@@ -0,0 +1,154 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include "tsInputSource.h"
+#include "tsDemuxer.h"
+#include <array>
+#include <string>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Random-access index (sidecar file)
+//=============================================================================================================================================================================
+
+/*
+Sidecar file mapping time to byte offsets in a TS file, built during a normal
+demux pass and memory-mapped for queries:
+
+  xHeader                  - magic, version, record sizes, size of indexed input
+  xPES_Entry[NumPES]       - PES starts of demuxed PIDs, sorted by PID, then offset
+  xPCR_Entry[NumPCR]       - PCR of any PID, in file order
+
+Records are fixed-size in host byte order (little endian on supported
+targets). Offsets point at the sync byte of the packet. Timestamps are
+unwrapped to 64 bits against the PCR seen last (the previous timestamp of the
+PID before the first PCR), so they keep increasing across the 33-bit wrap and
+PTS, DTS and PCR/300 share one 90 kHz time line. DTS of an entry holds the
+decode time - coded DTS, else PTS, else the decode time of the previous PES -
+and is non-decreasing within a PID, which makes it the binary search key.
+*/
+
+class xTS_Index
+{
+public:
+  static constexpr char     Magic[8]        = { 'T', 'S', 'I', 'N', 'D', 'E', 'X', '\0' };
+  static constexpr uint32_t Version         = 1;
+  static constexpr char     FileExtension[] = ".tsidx";
+
+  enum eFlags : uint8_t
+  {
+    Flag_PTS           = 0x01, // PTS coded in PES header
+    Flag_DTS           = 0x02, // DTS coded in PES header
+    Flag_RandomAccess  = 0x04, // random_access_indicator set in packet with PES start
+    Flag_Discontinuity = 0x08, // discontinuity_indicator set (PCR entries)
+  };
+
+  struct xHeader
+  {
+    char     Magic[8];
+    uint32_t Version;
+    uint32_t HeaderSize;
+    uint32_t PES_EntrySize;
+    uint32_t PCR_EntrySize;
+    uint32_t PacketSize;     // stride of indexed input (188/192/204)
+    uint32_t Reserved;
+    uint64_t InputSize;      // size of indexed input file
+    uint64_t NumPES;
+    uint64_t NumPCR;
+    uint64_t PES_Offset;     // file offset of PES table
+    uint64_t PCR_Offset;     // file offset of PCR table
+  };
+
+  struct xPES_Entry
+  {
+    uint64_t Offset;
+    int64_t  PTS;      // 90 kHz, unwrapped
+    int64_t  DTS;      // 90 kHz, unwrapped decode time (search key)
+    uint16_t PID;
+    uint8_t  StreamId;
+    uint8_t  Flags;
+    uint32_t Reserved;
+  };
+
+  struct xPCR_Entry
+  {
+    uint64_t Offset;
+    int64_t  PCR;      // 27 MHz, unwrapped
+    uint16_t PID;
+    uint8_t  Flags;
+    uint8_t  Reserved[5];
+  };
+
+  static_assert(sizeof(xHeader)    == 72, "index layout");
+  static_assert(sizeof(xPES_Entry) == 32, "index layout");
+  static_assert(sizeof(xPCR_Entry) == 24, "index layout");
+
+protected:
+  xTS_MappedFile    m_File;
+  const xHeader*    m_Header;
+  const xPES_Entry* m_PES;
+  const xPCR_Entry* m_PCR;
+
+public:
+  xTS_Index() : m_Header(nullptr), m_PES(nullptr), m_PCR(nullptr) {}
+
+  bool Open (const char* FileName);
+  void Close();
+
+  std::vector<uint16_t> getPIDs       () const;
+  const xPES_Entry*     FindPID       (uint16_t PID, uint64_t& NumEntries) const;
+  bool                  FindRange     (uint16_t PID, int64_t Begin, int64_t End, bool SnapToRandomAccess, uint64_t& First, uint64_t& Last) const;
+  int64_t               getTimeOrigin () const;
+
+  static std::string    MakeFileName  (const std::string& InputFileName) { return InputFileName + FileExtension; }
+
+public:
+  bool              isOpen       () const { return m_Header != nullptr; }
+  uint64_t          getInputSize () const { return m_Header->InputSize; }
+  uint32_t          getPacketSize() const { return m_Header->PacketSize; }
+  uint64_t          getNumPES    () const { return m_Header->NumPES; }
+  uint64_t          getNumPCR    () const { return m_Header->NumPCR; }
+  const xPES_Entry* getPES       () const { return m_PES; }
+  const xPCR_Entry* getPCR       () const { return m_PCR; }
+};
+
+//=============================================================================================================================================================================
+
+/*
+Collects index entries while the demuxer runs: PES starts of demuxed PIDs and
+PCR of all PIDs. Packets are checked with a few byte tests - only PES starts
+and packets carrying PCR are decoded.
+*/
+
+class xTS_IndexBuilder
+{
+protected:
+  struct xPID_State
+  {
+    bool    HasTime;
+    int64_t DTS; // decode time of previous PES
+  };
+
+  std::vector<xTS_Index::xPES_Entry> m_PES;
+  std::vector<xTS_Index::xPCR_Entry> m_PCR;
+  std::array<xPID_State, xTS_Demuxer::NumPIDs> m_PIDs;
+  bool                               m_HasPCR;
+  int64_t                            m_LastPCR_Base; // unwrapped, 90 kHz
+
+  xTS_PacketHeader    m_PacketHeader;
+  xTS_AdaptationField m_AdaptationField;
+  xPES_PacketHeader   m_PES_Header;
+
+public:
+  xTS_IndexBuilder();
+
+  void AddPackets(const uint8_t* const* Packets, uint32_t NumPackets, const uint8_t* Base, const xTS_Demuxer& Demuxer);
+  bool Write     (const char* FileName, uint64_t InputSize, uint32_t PacketSize);
+
+public:
+  uint64_t getNumPES() const { return m_PES.size(); }
+  uint64_t getNumPCR() const { return m_PCR.size(); }
+
+protected:
+  void xAddPacket(const uint8_t* Packet, uint64_t Offset, bool PES_Start);
+};
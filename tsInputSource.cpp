@@ -0,0 +1,713 @@
+#include "tsInputSource.h"
+#include "tsProfiler.h"
+#include "tsTrace.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//=============================================================================================================================================================================
+// xTS_MappedFile
+//=============================================================================================================================================================================
+
+#if defined(_WIN32)
+
+xTS_MappedFile::xTS_MappedFile() : m_Data(nullptr), m_Size(0), m_FileHandle(INVALID_HANDLE_VALUE), m_MappingHandle(nullptr) {}
+
+/**
+  @brief Map whole file into memory (read only)
+  @param FileName is path to TS file
+  @return true on success
+ */
+bool xTS_MappedFile::Open(const char* FileName)
+{
+    Close();
+
+    m_FileHandle = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_FileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER FileSize;
+    if (!GetFileSizeEx(m_FileHandle, &FileSize)) {
+        Close();
+        return false;
+    }
+    m_Size = static_cast<uint64_t>(FileSize.QuadPart);
+    if (m_Size == 0)
+        return true; // nothing to map
+
+    m_MappingHandle = CreateFileMappingA(m_FileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_MappingHandle == nullptr) {
+        Close();
+        return false;
+    }
+    m_Data = static_cast<const uint8_t*>(MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (m_Data == nullptr) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void xTS_MappedFile::Close()
+{
+    if (m_Data != nullptr)
+        UnmapViewOfFile(m_Data);
+    if (m_MappingHandle != nullptr)
+        CloseHandle(m_MappingHandle);
+    if (m_FileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(m_FileHandle);
+    m_Data = nullptr;
+    m_Size = 0;
+    m_MappingHandle = nullptr;
+    m_FileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+xTS_MappedFile::xTS_MappedFile() : m_Data(nullptr), m_Size(0), m_FileDescriptor(-1) {}
+
+/**
+  @brief Map whole file into memory (read only)
+  @param FileName is path to TS file
+  @return true on success
+ */
+bool xTS_MappedFile::Open(const char* FileName)
+{
+    Close();
+
+    m_FileDescriptor = open(FileName, O_RDONLY);
+    if (m_FileDescriptor < 0)
+        return false;
+
+    struct stat FileStat;
+    if (fstat(m_FileDescriptor, &FileStat) != 0) {
+        Close();
+        return false;
+    }
+    m_Size = static_cast<uint64_t>(FileStat.st_size);
+    if (m_Size == 0)
+        return true; // mmap refuses zero length mappings
+
+    void* Mapping = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_FileDescriptor, 0);
+    if (Mapping == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    m_Data = static_cast<const uint8_t*>(Mapping);
+
+    // Whole file is read front to back - let the kernel read ahead aggressively
+    madvise(Mapping, m_Size, MADV_SEQUENTIAL);
+    return true;
+}
+
+void xTS_MappedFile::Close()
+{
+    if (m_Data != nullptr)
+        munmap(const_cast<uint8_t*>(m_Data), m_Size);
+    if (m_FileDescriptor >= 0)
+        close(m_FileDescriptor);
+    m_Data = nullptr;
+    m_Size = 0;
+    m_FileDescriptor = -1;
+}
+
+#endif
+
+//=============================================================================================================================================================================
+// xTS_SyncScanner
+//=============================================================================================================================================================================
+
+const uint8_t* xTS_SyncScanner::FindSyncByteScalar(const uint8_t* Begin, const uint8_t* End)
+{
+    const void* Found = memchr(Begin, SyncByte, End - Begin);
+    return Found != nullptr ? static_cast<const uint8_t*>(Found) : End;
+}
+
+#if defined(X_ARCH_X86)
+
+const uint8_t* xTS_SyncScanner::FindSyncByteSSE2(const uint8_t* Begin, const uint8_t* End)
+{
+    const __m128i Sync = _mm_set1_epi8((char)SyncByte);
+    while (End - Begin >= 16) {
+        const uint32_t Mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)Begin), Sync));
+        if (Mask != 0)
+            return Begin + xCountTrailingZeros32(Mask);
+        Begin += 16;
+    }
+    return FindSyncByteScalar(Begin, End);
+}
+
+X_TARGET("avx2")
+const uint8_t* xTS_SyncScanner::FindSyncByteAVX2(const uint8_t* Begin, const uint8_t* End)
+{
+    const __m256i Sync = _mm256_set1_epi8((char)SyncByte);
+    while (End - Begin >= 64) {
+        const __m256i Eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(Begin +  0)), Sync);
+        const __m256i Eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(Begin + 32)), Sync);
+        if (!_mm256_testz_si256(_mm256_or_si256(Eq0, Eq1), _mm256_or_si256(Eq0, Eq1))) {
+            const uint32_t Mask0 = (uint32_t)_mm256_movemask_epi8(Eq0);
+            if (Mask0 != 0)
+                return Begin + xCountTrailingZeros32(Mask0);
+            return Begin + 32 + xCountTrailingZeros32((uint32_t)_mm256_movemask_epi8(Eq1));
+        }
+        Begin += 64;
+    }
+    return FindSyncByteSSE2(Begin, End);
+}
+
+static bool xIsAVX2_Available()
+{
+#if defined(_MSC_VER)
+    int CPUInfo[4];
+    __cpuidex(CPUInfo, 7, 0);
+    return (CPUInfo[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#else
+
+const uint8_t* xTS_SyncScanner::FindSyncByteSSE2(const uint8_t* Begin, const uint8_t* End) { return FindSyncByteScalar(Begin, End); }
+const uint8_t* xTS_SyncScanner::FindSyncByteAVX2(const uint8_t* Begin, const uint8_t* End) { return FindSyncByteScalar(Begin, End); }
+static bool xIsAVX2_Available() { return false; }
+
+#endif
+
+/**
+  @brief Find first sync byte
+  @return Pointer to first 0x47 in [Begin, End) or End if there is none
+ */
+const uint8_t* xTS_SyncScanner::FindSyncByte(const uint8_t* Begin, const uint8_t* End)
+{
+    static const bool AVX2 = xIsAVX2_Available();
+    return AVX2 ? FindSyncByteAVX2(Begin, End) : FindSyncByteSSE2(Begin, End);
+}
+
+/**
+  @brief Check if sync bytes repeat at given stride starting at Position
+  @return PacketSize if locked, 0 otherwise
+ */
+uint32_t xTS_SyncScanner::CheckLock(const uint8_t* Data, uint64_t Size, uint64_t Position, uint32_t PacketSize)
+{
+    if (Position + xTS::TS_PacketLength > Size)
+        return 0;
+
+    for (uint32_t i = 0; i < NumLockPackets; i++) {
+        const uint64_t PacketPosition = Position + (uint64_t)i * PacketSize;
+        if (PacketPosition + xTS::TS_PacketLength > Size)
+            return PacketSize; // end of data - every complete packet so far had sync byte
+        if (Data[PacketPosition] != SyncByte)
+            return 0;
+    }
+    return PacketSize;
+}
+
+/**
+  @brief Check all supported strides (188, 192, 204)
+  @return Detected packet size or 0 if Position does not start a run of packets
+ */
+uint32_t xTS_SyncScanner::CheckLock(const uint8_t* Data, uint64_t Size, uint64_t Position)
+{
+    for (uint32_t PacketSize : PacketSizes) {
+        if (CheckLock(Data, Size, Position, PacketSize) != 0)
+            return PacketSize;
+    }
+    return 0;
+}
+
+//=============================================================================================================================================================================
+// xTS_PacketReader
+//=============================================================================================================================================================================
+
+/**
+  @brief Start reading packets of part of data
+  @param Data is pointer to whole input (lock checks may look past End)
+  @param Size is size of whole input
+  @param Begin is position where sync search starts
+  @param End is position from which no packet is returned (packet straddling End belongs to this range)
+  @param LockedPacketSize is stride of lock continued from preceding range (0 = search for lock at Begin)
+ */
+void xTS_PacketReader::Init(const uint8_t* Data, uint64_t Size, uint64_t Begin, uint64_t End, uint32_t LockedPacketSize)
+{
+    m_Data = Data;
+    m_Size = Size;
+    m_End = End < Size ? End : Size;
+    m_Position = Begin;
+    m_LastPosition = Begin;
+    m_PacketSize = LockedPacketSize;
+    m_LockedPacketSize = LockedPacketSize;
+    m_NumPackets = 0;
+    m_NumSkippedBytes = 0;
+    m_NumSyncLosses = 0;
+}
+
+/**
+  @brief Get next TS packet, resynchronising if needed
+  @return Pointer to sync byte of next 188 byte TS packet or nullptr at end of data
+ */
+const uint8_t* xTS_PacketReader::getNextPacket()
+{
+    for (;;) {
+        if (m_PacketSize != 0) {
+            if (m_Position >= m_End || m_Position + xTS::TS_PacketLength > m_Size)
+                return nullptr;
+            if (m_Data[m_Position] == xTS_SyncScanner::SyncByte) {
+                m_LastPosition = m_Position;
+                m_Position += m_PacketSize;
+                m_NumPackets++;
+                return m_Data + m_LastPosition;
+            }
+            m_NumSyncLosses++;
+            m_PacketSize = 0;
+            X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "sync lost at offset %" PRIu64, m_Position));
+        }
+        if (!xLock())
+            return nullptr;
+    }
+}
+
+/**
+  @brief Get up to MaxPackets next TS packets
+  @param Packets is array receiving pointers to sync bytes of packets
+  @return Number of packets (0 at end of data)
+ */
+uint32_t xTS_PacketReader::getNextPackets(const uint8_t** Packets, uint32_t MaxPackets)
+{
+    X_PROFILE_BEGIN(Start);
+    uint32_t NumPackets = 0;
+    while (NumPackets < MaxPackets) {
+        const uint8_t* Packet = getNextPacket();
+        if (Packet == nullptr)
+            break;
+        Packets[NumPackets++] = Packet;
+    }
+    if (NumPackets != 0)
+        X_PROFILE_END(Start, Read, xProfiler::AllPIDs, NumPackets);
+    return NumPackets;
+}
+
+bool xTS_PacketReader::xLock()
+{
+    const uint8_t* const End = m_Data + m_End;
+    const uint64_t Start = m_Position;
+    while (m_Position < m_End) {
+        const uint8_t* Candidate = xTS_SyncScanner::FindSyncByte(m_Data + m_Position, End);
+        m_Position = Candidate - m_Data;
+        if (Candidate == End)
+            break;
+
+        const uint32_t PacketSize = xTS_SyncScanner::CheckLock(m_Data, m_Size, m_Position);
+        if (PacketSize != 0) {
+            m_NumSkippedBytes += m_Position - Start;
+            m_PacketSize = PacketSize;
+            m_LockedPacketSize = PacketSize;
+            return true;
+        }
+        m_Position++;
+    }
+    if (m_Position < m_End)
+        m_Position = m_End;
+    m_NumSkippedBytes += m_Position - Start;
+    return false;
+}
+
+//=============================================================================================================================================================================
+// xTS_ChunkReader
+//=============================================================================================================================================================================
+
+/// @brief Start of new input - carried bytes, lock and statistics are dropped
+void xTS_ChunkReader::Reset()
+{
+    m_CarrySize        = 0;
+    m_PacketSize       = 0;
+    m_LockedPacketSize = 0;
+    m_NumBytes         = 0;
+    m_NumPackets       = 0;
+    m_NumSkippedBytes  = 0;
+    m_NumSyncLosses    = 0;
+}
+
+//=============================================================================================================================================================================
+// xTS_NetworkInput
+//=============================================================================================================================================================================
+
+xTS_NetworkInput::xTS_NetworkInput()
+    : m_Socket(-1), m_StopRequested(false), m_Buffers(nullptr), m_ReadyPos(0), m_PacketPos(0), m_EndOfInput(true), m_NumHeld(0), m_NextSeq(0), m_HighestSeq(0), m_HasSeq(false),
+      m_ReceiveBufferSize(0), m_NumDatagrams(0), m_NumRTP_Datagrams(0), m_NumBytes(0), m_NumReceiveCalls(0), m_NumPackets(0), m_NumLost(0), m_NumReordered(0),
+      m_NumDuplicates(0), m_NumMalformed(0), m_NumSkippedBytes(0), m_NumKernelDrops(0)
+{
+}
+
+/// @brief Input name is network address (udp:// or rtp://)
+bool xTS_NetworkInput::isAddress(const char* Name)
+{
+    return strncmp(Name, "udp://", 6) == 0 || strncmp(Name, "rtp://", 6) == 0;
+}
+
+/**
+  @brief Bind socket to address (joining multicast group) and allocate datagram buffers
+  @param Address is udp://[@][<IPv4 address>]:<port> or rtp://... - RTP header is detected per datagram for both
+  @return false if address is invalid, datagram buffers cannot be allocated or socket cannot be set up
+ */
+bool xTS_NetworkInput::Open(const char* Address, const xConfig& Config)
+{
+    Close();
+    if (!isAddress(Address))
+        return false;
+
+    // Host part is optional (any address), '@' prefix is accepted as in VLC
+    const char* Host = Address + 6;
+    if (*Host == '@')
+        Host++;
+    const char* Colon = strrchr(Host, ':');
+    if (Colon == nullptr || (size_t)(Colon - Host) >= 64)
+        return false;
+    char* End = nullptr;
+    const unsigned long Port = strtoul(Colon + 1, &End, 10);
+    if (End == Colon + 1 || *End != '\0' || Port == 0 || Port > 0xFFFF)
+        return false;
+    char HostName[64] = "0.0.0.0";
+    if (Colon != Host) {
+        memcpy(HostName, Host, Colon - Host);
+        HostName[Colon - Host] = '\0';
+    }
+
+#if defined(_WIN32)
+    (void)Config;
+    return false; // not implemented
+#else
+    sockaddr_in SocketAddress = {};
+    SocketAddress.sin_family = AF_INET;
+    SocketAddress.sin_port   = htons((uint16_t)Port);
+    if (inet_pton(AF_INET, HostName, &SocketAddress.sin_addr) != 1)
+        return false;
+    const bool Multicast = (ntohl(SocketAddress.sin_addr.s_addr) >> 28) == 0xE;
+
+    // Buffers first - no socket is bound or multicast group joined when they cannot be allocated
+    m_Buffers = static_cast<uint8_t*>(xAlignedAlloc(64, (size_t)NumBuffers * MaxDatagramSize));
+    if (m_Buffers == nullptr)
+        return false;
+    m_Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_Socket < 0) {
+        Close();
+        return false;
+    }
+    const int One = 1;
+    setsockopt(m_Socket, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+
+    // Bursts of a high rate stream must fit in the socket buffer while demux or writer stalls. SO_RCVBUFFORCE
+    // exceeds net.core.rmem_max but needs CAP_NET_ADMIN - fall back to what rmem_max allows.
+    const int ReceiveBufferSize = (int)Config.ReceiveBufferSize;
+#if defined(SO_RCVBUFFORCE)
+    if (setsockopt(m_Socket, SOL_SOCKET, SO_RCVBUFFORCE, &ReceiveBufferSize, sizeof(ReceiveBufferSize)) != 0)
+#endif
+        setsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, &ReceiveBufferSize, sizeof(ReceiveBufferSize));
+    int GrantedSize = 0;
+    socklen_t OptionLength = sizeof(GrantedSize);
+    getsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, &GrantedSize, &OptionLength);
+    m_ReceiveBufferSize = (uint32_t)GrantedSize;
+#if defined(SO_RXQ_OVFL)
+    // Datagrams dropped by the kernel since socket creation arrive as control message
+    setsockopt(m_Socket, SOL_SOCKET, SO_RXQ_OVFL, &One, sizeof(One));
+#endif
+    // Receive wakes up periodically to check Stop() and idle time-out
+    timeval Timeout = { 0, 100000 };
+    setsockopt(m_Socket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+
+    if (bind(m_Socket, reinterpret_cast<const sockaddr*>(&SocketAddress), sizeof(SocketAddress)) != 0) {
+        Close();
+        return false;
+    }
+    if (Multicast) {
+        ip_mreq Membership = {};
+        Membership.imr_multiaddr = SocketAddress.sin_addr;
+        Membership.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(m_Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &Membership, sizeof(Membership)) != 0) {
+            Close();
+            return false;
+        }
+    }
+
+    m_FreeBuffers.clear();
+    for (uint32_t i = NumBuffers; i > 0; i--)
+        m_FreeBuffers.push_back((uint16_t)(i - 1));
+    m_Released.clear();
+    m_Released.reserve(NumBuffers);
+    m_Ready.clear();
+    m_Ready.reserve(NumBuffers);
+    for (xDatagram& Slot : m_Window)
+        Slot.Buffer = NoBuffer;
+
+    m_Config = Config;
+    m_Config.ReorderDepth = Config.ReorderDepth < MaxReorderDepth ? Config.ReorderDepth : MaxReorderDepth;
+    m_StopRequested.store(false);
+    m_ReadyPos = m_PacketPos = 0;
+    m_EndOfInput = false;
+    m_LastArrival = std::chrono::steady_clock::now();
+    m_NumHeld = 0;
+    m_NextSeq = m_HighestSeq = 0;
+    m_HasSeq = false;
+    m_NumDatagrams = m_NumRTP_Datagrams = m_NumBytes = m_NumReceiveCalls = m_NumPackets = 0;
+    m_NumLost = m_NumReordered = m_NumDuplicates = m_NumMalformed = m_NumSkippedBytes = 0;
+    m_NumKernelDrops = 0;
+    return true;
+#endif
+}
+
+void xTS_NetworkInput::Close()
+{
+#if !defined(_WIN32)
+    if (m_Socket >= 0)
+        close(m_Socket);
+#endif
+    m_Socket = -1;
+    xAlignedFree(m_Buffers);
+    m_Buffers = nullptr;
+    m_EndOfInput = true;
+}
+
+/**
+  @brief Get packets of next datagrams in sequence order, waiting for input when none are pending
+  @param Packets receives pointers to packets (valid until next call)
+  @return Number of packets, 0 at end of input (idle time-out, Stop or receive error)
+ */
+uint32_t xTS_NetworkInput::getNextPackets(const uint8_t** Packets, uint32_t MaxPackets)
+{
+    // Packets handed out by previous call are done with
+    for (uint16_t Buffer : m_Released)
+        xFreeBuffer(Buffer);
+    m_Released.clear();
+
+    X_PROFILE_BEGIN(Start);
+    uint32_t NumPackets = 0;
+    while (NumPackets < MaxPackets) {
+        if (m_ReadyPos == m_Ready.size()) {
+            m_Ready.clear();
+            m_ReadyPos = 0;
+            if (NumPackets != 0 || m_EndOfInput)
+                break;
+            // Nothing handed out yet - buffers of datagrams without valid packets can be reused right away
+            for (uint16_t Buffer : m_Released)
+                xFreeBuffer(Buffer);
+            m_Released.clear();
+            if (!xReceive())
+                break;
+            continue;
+        }
+
+        const xDatagram& Datagram = m_Ready[m_ReadyPos];
+        const uint8_t* Payload = m_Buffers + (size_t)Datagram.Buffer * MaxDatagramSize + Datagram.Offset;
+        while (NumPackets < MaxPackets && m_PacketPos + xTS::TS_PacketLength <= Datagram.Size) {
+            const uint8_t* Packet = Payload + m_PacketPos;
+            m_PacketPos += xTS::TS_PacketLength;
+            if (Packet[0] != xTS_SyncScanner::SyncByte) {
+                m_NumSkippedBytes += xTS::TS_PacketLength;
+                continue;
+            }
+            Packets[NumPackets++] = Packet;
+        }
+        if (m_PacketPos + xTS::TS_PacketLength > Datagram.Size) {
+            m_NumSkippedBytes += Datagram.Size - m_PacketPos;
+            m_Released.push_back(Datagram.Buffer);
+            m_ReadyPos++;
+            m_PacketPos = 0;
+        }
+    }
+    m_NumPackets += NumPackets;
+    if (NumPackets != 0)
+        X_PROFILE_END(Start, Read, xProfiler::AllPIDs, NumPackets);
+    return NumPackets;
+}
+
+/**
+  @brief Receive a batch of datagrams (blocks until at least one arrives)
+  @return false at end of input - datagrams held for reordering are then moved to ready list
+ */
+bool xTS_NetworkInput::xReceive()
+{
+#if defined(_WIN32)
+    m_EndOfInput = true;
+    return false;
+#else
+    // Every buffer not held in window is free here, so a full batch can be received
+    const uint32_t NumMessages = (uint32_t)m_FreeBuffers.size() < MaxBatchDatagrams ? (uint32_t)m_FreeBuffers.size() : MaxBatchDatagrams;
+    uint16_t Buffers[MaxBatchDatagrams];
+    iovec    Vectors[MaxBatchDatagrams];
+    alignas(cmsghdr) uint8_t Control[MaxBatchDatagrams][CMSG_SPACE(sizeof(uint32_t))];
+#if defined(__linux__)
+    mmsghdr  Messages[MaxBatchDatagrams];
+#else
+    struct xMessage { msghdr msg_hdr; uint32_t msg_len; } Messages[MaxBatchDatagrams];
+#endif
+    for (uint32_t i = 0; i < NumMessages; i++) {
+        Buffers[i] = m_FreeBuffers.back();
+        m_FreeBuffers.pop_back();
+        Vectors[i].iov_base = m_Buffers + (size_t)Buffers[i] * MaxDatagramSize;
+        Vectors[i].iov_len  = MaxDatagramSize;
+        Messages[i] = {};
+        Messages[i].msg_hdr.msg_iov        = &Vectors[i];
+        Messages[i].msg_hdr.msg_iovlen     = 1;
+        Messages[i].msg_hdr.msg_control    = Control[i];
+        Messages[i].msg_hdr.msg_controllen = sizeof(Control[i]);
+    }
+
+    int NumReceived = 0;
+    while (!m_StopRequested.load(std::memory_order_relaxed)) {
+#if defined(__linux__)
+        // Blocks for the first datagram only, then takes what is queued
+        NumReceived = recvmmsg(m_Socket, Messages, NumMessages, MSG_WAITFORONE, nullptr);
+#else
+        NumReceived = 0;
+        for (; NumReceived < (int)NumMessages; NumReceived++) {
+            const ssize_t Size = recvmsg(m_Socket, &Messages[NumReceived].msg_hdr, NumReceived != 0 ? MSG_DONTWAIT : 0);
+            if (Size < 0)
+                break;
+            Messages[NumReceived].msg_len = (uint32_t)Size;
+        }
+        NumReceived = NumReceived != 0 ? NumReceived : -1;
+#endif
+        m_NumReceiveCalls++;
+        if (NumReceived > 0)
+            break;
+        if (NumReceived < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            break;
+        if (m_Config.IdleTimeout > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - m_LastArrival).count() >= m_Config.IdleTimeout)
+            break;
+    }
+    if (NumReceived <= 0) {
+        for (uint32_t i = 0; i < NumMessages; i++)
+            xFreeBuffer(Buffers[i]);
+        m_EndOfInput = true;
+        xAdvance(0);
+        return !m_Ready.empty();
+    }
+
+    m_LastArrival = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < NumMessages; i++) {
+        if (i >= (uint32_t)NumReceived) {
+            xFreeBuffer(Buffers[i]);
+            continue;
+        }
+        const msghdr& Header = Messages[i].msg_hdr;
+#if defined(SO_RXQ_OVFL)
+        for (const cmsghdr* Message = CMSG_FIRSTHDR(&Header); Message != nullptr; Message = CMSG_NXTHDR(const_cast<msghdr*>(&Header), const_cast<cmsghdr*>(Message))) {
+            if (Message->cmsg_level == SOL_SOCKET && Message->cmsg_type == SO_RXQ_OVFL)
+                memcpy(&m_NumKernelDrops, CMSG_DATA(Message), sizeof(m_NumKernelDrops));
+        }
+#endif
+        if (Header.msg_flags & MSG_TRUNC) {
+            m_NumDatagrams++;
+            m_NumMalformed++;
+            xFreeBuffer(Buffers[i]);
+            continue;
+        }
+        xAddDatagram(Buffers[i], Messages[i].msg_len);
+    }
+    return true;
+#endif
+}
+
+/// @brief Classify datagram - plain TS goes to ready list, RTP to sequence window
+void xTS_NetworkInput::xAddDatagram(uint16_t Buffer, uint32_t Size)
+{
+    const uint8_t* Data = m_Buffers + (size_t)Buffer * MaxDatagramSize;
+    m_NumDatagrams++;
+    m_NumBytes += Size;
+    if (Size != 0 && Data[0] == xTS_SyncScanner::SyncByte) {
+        m_Ready.push_back(xDatagram{Buffer, 0, (uint16_t)Size, 0});
+        return;
+    }
+
+    // RTP version 2: CSRC list, header extension and padding around payload
+    uint32_t Offset = RTP_HeaderLength + 4 * (Data[0] & 0x0F);
+    uint32_t End    = Size;
+    const bool Valid = Size >= RTP_HeaderLength && (Data[0] & 0xC0) == 0x80;
+    if (Valid && (Data[0] & 0x10))
+        Offset = Offset + 4 <= Size ? Offset + 4 + 4 * (((uint32_t)Data[Offset + 2] << 8) | Data[Offset + 3]) : Size;
+    if (Valid && (Data[0] & 0x20))
+        End = Data[Size - 1] <= Size ? Size - Data[Size - 1] : 0;
+    if (!Valid || Offset >= End) {
+        m_NumMalformed++;
+        xFreeBuffer(Buffer);
+        return;
+    }
+    m_NumRTP_Datagrams++;
+    xAddRTP(xDatagram{Buffer, (uint16_t)Offset, (uint16_t)(End - Offset), (uint16_t)(((uint32_t)Data[2] << 8) | Data[3])});
+}
+
+/// @brief Put RTP datagram into sequence window and move datagrams that are in order to ready list
+void xTS_NetworkInput::xAddRTP(const xDatagram& Datagram)
+{
+    if (!m_HasSeq) {
+        m_NextSeq = m_HighestSeq = Datagram.Seq;
+        m_HasSeq = true;
+    }
+    const int32_t Distance = (int16_t)(uint16_t)(Datagram.Seq - m_NextSeq);
+    if (Distance < 0 && Distance >= -(int32_t)WindowSize) {
+        // Place already delivered or skipped
+        m_NumDuplicates++;
+        xFreeBuffer(Datagram.Buffer);
+        return;
+    }
+    if (Distance < 0 || Distance >= (int32_t)WindowSize) {
+        // Sender restarted or jumped - not a loss
+        X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "RTP: sequence number jumps from %u to %u", m_NextSeq, Datagram.Seq));
+        xAdvance(0);
+        m_NextSeq = m_HighestSeq = Datagram.Seq;
+    }
+
+    xDatagram& Slot = m_Window[Datagram.Seq & (WindowSize - 1)];
+    if (Slot.Buffer != NoBuffer) {
+        m_NumDuplicates++;
+        xFreeBuffer(Datagram.Buffer);
+        return;
+    }
+    if ((int16_t)(uint16_t)(Datagram.Seq - m_HighestSeq) < 0)
+        m_NumReordered++;
+    else
+        m_HighestSeq = Datagram.Seq;
+    Slot = Datagram;
+    m_NumHeld++;
+    xAdvance(m_Config.ReorderDepth);
+}
+
+/**
+  @brief Deliver datagrams in sequence, skipping missing ones while more than MaxHeld later datagrams wait
+  @param MaxHeld is 0 to empty the window
+ */
+void xTS_NetworkInput::xAdvance(uint32_t MaxHeld)
+{
+    for (;;) {
+        while (m_NumHeld != 0) {
+            xDatagram& Slot = m_Window[m_NextSeq & (WindowSize - 1)];
+            if (Slot.Buffer == NoBuffer)
+                break;
+            m_Ready.push_back(Slot);
+            Slot.Buffer = NoBuffer;
+            m_NumHeld--;
+            m_NextSeq++;
+        }
+        if (m_NumHeld <= MaxHeld)
+            return;
+
+        const uint16_t First = m_NextSeq;
+        while (m_Window[m_NextSeq & (WindowSize - 1)].Buffer == NoBuffer)
+            m_NextSeq++;
+        m_NumLost += (uint16_t)(m_NextSeq - First);
+        X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "RTP: %u datagrams lost (sequence %u-%u)", (uint16_t)(m_NextSeq - First), First, (uint16_t)(m_NextSeq - 1)));
+    }
+}
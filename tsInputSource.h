@@ -0,0 +1,343 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Memory-mapped input
+//=============================================================================================================================================================================
+
+/*
+Read-only mapping of a whole TS file. Packets are handed out as pointers into
+the mapping - no per-packet syscall and no copy. A trailing incomplete packet
+(file size not a multiple of 188) is not reported by getNumPackets().
+*/
+
+class xTS_MappedFile
+{
+protected:
+  const uint8_t* m_Data;
+  uint64_t       m_Size;
+#if defined(_WIN32)
+  void*          m_FileHandle;
+  void*          m_MappingHandle;
+#else
+  int            m_FileDescriptor;
+#endif
+
+public:
+  xTS_MappedFile();
+  ~xTS_MappedFile() { Close(); }
+  xTS_MappedFile(const xTS_MappedFile&) = delete;
+  xTS_MappedFile& operator=(const xTS_MappedFile&) = delete;
+
+  bool  Open (const char* FileName);
+  void  Close();
+
+public:
+  const uint8_t* getData      () const { return m_Data; }
+  uint64_t       getSize      () const { return m_Size; }
+  uint64_t       getNumPackets() const { return m_Size / xTS::TS_PacketLength; }
+  const uint8_t* getPacket    (uint64_t PacketId) const { return m_Data + PacketId * xTS::TS_PacketLength; }
+};
+
+//=============================================================================================================================================================================
+// Sync byte scanner / packet reader
+//=============================================================================================================================================================================
+
+/*
+Locks onto sync bytes (0x47) repeating at 188 (plain TS), 192 (M2TS - 4 byte
+timestamp before each packet) or 204 byte (TS + 16 byte Reed-Solomon parity)
+stride. Lock requires NumLockPackets consecutive sync bytes at the same stride
+(fewer at the end of data). When a sync byte is missing, the reader drops the
+lock and scans forward for the next position that locks again. Bytes skipped
+while searching are counted.
+
+Scanning uses AVX2 or SSE2 compares (selected at runtime) and checks candidate
+strides only at positions holding 0x47.
+*/
+
+class xTS_SyncScanner
+{
+public:
+  static constexpr uint8_t  SyncByte       = 0x47;
+  static constexpr uint32_t NumLockPackets = 4;
+  static constexpr uint32_t NumPacketSizes = 3;
+  static constexpr uint32_t PacketSizes[NumPacketSizes] = { 188, 192, 204 };
+
+public:
+  static const uint8_t* FindSyncByte       (const uint8_t* Begin, const uint8_t* End);
+  static const uint8_t* FindSyncByteScalar (const uint8_t* Begin, const uint8_t* End);
+  static const uint8_t* FindSyncByteSSE2   (const uint8_t* Begin, const uint8_t* End);
+  static const uint8_t* FindSyncByteAVX2   (const uint8_t* Begin, const uint8_t* End);
+  static uint32_t       CheckLock          (const uint8_t* Data, uint64_t Size, uint64_t Position);
+  static uint32_t       CheckLock          (const uint8_t* Data, uint64_t Size, uint64_t Position, uint32_t PacketSize);
+};
+
+class xTS_PacketReader
+{
+protected:
+  const uint8_t* m_Data;
+  uint64_t       m_Size;
+  uint64_t       m_End;          // packets must start before this position
+  uint64_t       m_Position;     // position of next expected sync byte
+  uint64_t       m_LastPosition; // position of last returned packet
+  uint32_t       m_PacketSize;   // 0 = not locked
+  uint32_t       m_LockedPacketSize;
+  uint64_t       m_NumPackets;
+  uint64_t       m_NumSkippedBytes;
+  uint64_t       m_NumSyncLosses;
+
+public:
+  xTS_PacketReader() { Init(nullptr, 0); }
+
+  void           Init         (const uint8_t* Data, uint64_t Size) { Init(Data, Size, 0, Size); }
+  void           Init         (const uint8_t* Data, uint64_t Size, uint64_t Begin, uint64_t End, uint32_t LockedPacketSize = 0);
+  const uint8_t* getNextPacket ();
+  uint32_t       getNextPackets(const uint8_t** Packets, uint32_t MaxPackets);
+
+public:
+  bool     isLocked          () const { return m_PacketSize != 0; }
+  uint32_t getPacketSize     () const { return m_LockedPacketSize; } // stride of last lock (0 = never locked)
+  uint64_t getPacketOffset   () const { return m_LastPosition; }      // byte offset of last returned packet
+  uint64_t getPosition       () const { return m_Position; }          // byte offset of next expected packet
+  uint64_t getNumPackets     () const { return m_NumPackets; }
+  uint64_t getNumSkippedBytes() const { return m_NumSkippedBytes; }
+  uint64_t getNumSyncLosses  () const { return m_NumSyncLosses; }
+
+protected:
+  bool xLock();
+};
+
+/*
+Locates packets in input pushed in chunks of any size - chunks need not hold
+whole packets. Packets inside a chunk are passed as pointers into it. The last
+MaxCarrySize bytes of a chunk (a packet starting there cannot be lock-checked
+yet) are copied and joined with the head of the next chunk; packets starting
+in them are passed from that staging copy. Lock and resync are those of
+xTS_PacketReader, continued from chunk to chunk.
+*/
+
+class xTS_ChunkReader
+{
+public:
+  static constexpr uint32_t MaxCarrySize = xTS_SyncScanner::NumLockPackets * 204;
+
+protected:
+  uint8_t  m_Stage[2 * MaxCarrySize]; // carried tail + head of next chunk
+  uint32_t m_CarrySize;
+  uint32_t m_PacketSize;              // lock continued into next chunk (0 = not locked)
+  uint32_t m_LockedPacketSize;
+  uint64_t m_NumBytes;
+  uint64_t m_NumPackets;
+  uint64_t m_NumSkippedBytes;
+  uint64_t m_NumSyncLosses;
+
+public:
+  xTS_ChunkReader() { Reset(); }
+
+  void Reset();
+  template <class tBatchHandler> void Feed  (const uint8_t* Data, size_t Size, bool EndOfInput, tBatchHandler&& Handler);
+  template <class tBatchHandler> void Finish(tBatchHandler&& Handler);
+
+public:
+  uint32_t getPacketSize     () const { return m_LockedPacketSize; }     // stride of last lock (0 = never locked)
+  uint64_t getPosition       () const { return m_NumBytes - m_CarrySize; } // input offset of first byte not yet passed on (start of carry)
+  uint32_t getCarrySize      () const { return m_CarrySize; }
+  uint64_t getNumPackets     () const { return m_NumPackets; }
+  uint64_t getNumSkippedBytes() const { return m_NumSkippedBytes; }
+  uint64_t getNumSyncLosses  () const { return m_NumSyncLosses; }
+
+protected:
+  template <class tBatchHandler> uint64_t xRead(const uint8_t* Data, uint64_t Size, uint64_t Begin, uint64_t End, tBatchHandler&& Handler);
+};
+
+/**
+  @brief Locate packets in next chunk of input
+  @param EndOfInput is true for the last chunk - packets at its end are passed without waiting for lock-check data (no Finish needed)
+  @param Handler is called as Handler(Packets, NumPackets) with up to xTS_PacketHeaderBatch::MaxPackets packets (valid during the call)
+ */
+template <class tBatchHandler> void xTS_ChunkReader::Feed(const uint8_t* Data, size_t Size, bool EndOfInput, tBatchHandler&& Handler)
+{
+    m_NumBytes += Size;
+    uint64_t Position = 0;
+    if (m_CarrySize != 0) {
+        // Packets starting in carried bytes, lock-checked with head of this chunk
+        const uint32_t Head      = Size < MaxCarrySize ? (uint32_t)Size : MaxCarrySize;
+        const uint32_t StageSize = m_CarrySize + Head;
+        const bool     Whole     = Size == Head; // chunk fits the stage
+        memcpy(m_Stage + m_CarrySize, Data, Head);
+        const uint32_t StageEnd  = !Whole ? m_CarrySize : EndOfInput ? StageSize : StageSize > MaxCarrySize ? StageSize - MaxCarrySize : 0;
+        const uint32_t StagePosition = (uint32_t)xRead(m_Stage, StageSize, 0, StageEnd, Handler);
+        if (Whole) {
+            m_CarrySize = EndOfInput ? 0 : StageSize - StagePosition;
+            memmove(m_Stage, m_Stage + StagePosition, m_CarrySize);
+            return;
+        }
+        Position = StagePosition - m_CarrySize;
+        m_CarrySize = 0;
+    }
+    else if (!EndOfInput && Size <= MaxCarrySize) {
+        memcpy(m_Stage, Data, Size);
+        m_CarrySize = (uint32_t)Size;
+        return;
+    }
+    Position = xRead(Data, Size, Position, EndOfInput ? Size : Size - MaxCarrySize, Handler);
+    m_CarrySize = EndOfInput || Position >= Size ? 0 : (uint32_t)(Size - Position);
+    memcpy(m_Stage, Data + Size - m_CarrySize, m_CarrySize);
+}
+
+/// @brief End of input - pass packets in carried bytes
+template <class tBatchHandler> void xTS_ChunkReader::Finish(tBatchHandler&& Handler)
+{
+    if (m_CarrySize != 0)
+        xRead(m_Stage, m_CarrySize, 0, m_CarrySize, Handler);
+    m_CarrySize = 0;
+}
+
+/// @return Position after last packet passed (or where lock search stopped)
+template <class tBatchHandler> uint64_t xTS_ChunkReader::xRead(const uint8_t* Data, uint64_t Size, uint64_t Begin, uint64_t End, tBatchHandler&& Handler)
+{
+    xTS_PacketReader Reader;
+    Reader.Init(Data, Size, Begin, End, m_PacketSize);
+    const uint8_t* Packets[xTS_PacketHeaderBatch::MaxPackets];
+    for (;;) {
+        const uint32_t NumPackets = Reader.getNextPackets(Packets, xTS_PacketHeaderBatch::MaxPackets);
+        if (NumPackets == 0)
+            break;
+        Handler(Packets, NumPackets);
+    }
+    m_PacketSize = Reader.isLocked() ? Reader.getPacketSize() : 0;
+    if (Reader.getPacketSize() != 0)
+        m_LockedPacketSize = Reader.getPacketSize();
+    m_NumPackets      += Reader.getNumPackets();
+    m_NumSkippedBytes += Reader.getNumSkippedBytes();
+    m_NumSyncLosses   += Reader.getNumSyncLosses();
+    return Reader.getPosition();
+}
+
+//=============================================================================================================================================================================
+// UDP/RTP network input
+//=============================================================================================================================================================================
+
+/*
+Receives TS over UDP from a unicast or multicast (joined) IPv4 address -
+plain (usually 7 packets per datagram) or with RTP header (RFC 3550, TS
+payload as in RFC 2250, detected per datagram). recvmmsg() pulls up to
+MaxBatchDatagrams datagrams per call into a pool of fixed size buffers
+allocated by Open(). Packets are handed out as pointers into the buffers -
+the same view xTS_PacketReader::getNextPackets() gives for files - valid
+until the next call.
+
+RTP datagrams are put back into sequence order in a window: a missing
+datagram is waited for until ReorderDepth later ones are held, then counted
+as lost and skipped (gap traced as warning). Duplicates and datagrams arriving
+after their place was skipped are dropped. Datagrams without RTP header are
+passed in arrival order.
+
+Losses are counted where they happen: socket buffer overflow (kernel counter,
+SO_RXQ_OVFL), RTP sequence gaps, datagrams that are truncated or malformed,
+and bytes not forming whole 188 byte packets starting with the sync byte.
+Input ends IdleTimeout seconds after the last datagram, or when Stop() is
+called (from any thread or a signal handler).
+*/
+
+class xTS_NetworkInput
+{
+public:
+  static constexpr uint32_t MaxDatagramSize   = 2048; // above Ethernet MTU, larger datagrams are truncated
+  static constexpr uint32_t MaxBatchDatagrams = 64;   // per receive call
+  static constexpr uint32_t MaxReorderDepth   = 64;
+  static constexpr uint32_t WindowSize        = 128;  // power of 2 above MaxReorderDepth
+  static constexpr uint32_t NumBuffers        = MaxBatchDatagrams + MaxReorderDepth;
+  static constexpr uint32_t RTP_HeaderLength  = 12;
+
+  struct xConfig
+  {
+    uint32_t ReceiveBufferSize = 16 << 20; // SO_RCVBUF request, the kernel may grant less (see getReceiveBufferSize)
+    uint32_t ReorderDepth      = 16;       // datagrams held while waiting for a missing one (0 = no reordering)
+    double   IdleTimeout       = 5.0;      // seconds without datagram that end input (0 = wait until Stop)
+  };
+
+protected:
+  struct xDatagram
+  {
+    uint16_t Buffer;
+    uint16_t Offset;  // payload (TS packets)
+    uint16_t Size;
+    uint16_t Seq;     // RTP sequence number
+  };
+  static constexpr uint16_t NoBuffer = 0xFFFF;
+
+  xConfig                 m_Config;
+  int                     m_Socket;
+  std::atomic<bool>       m_StopRequested;
+  uint8_t*                m_Buffers;      // NumBuffers * MaxDatagramSize
+  std::vector<uint16_t>   m_FreeBuffers;
+  std::vector<uint16_t>   m_Released;     // buffers of packets handed out by last getNextPackets
+  std::vector<xDatagram>  m_Ready;        // in order, split into packets by getNextPackets
+  uint32_t                m_ReadyPos;
+  uint32_t                m_PacketPos;    // byte offset of next packet in m_Ready[m_ReadyPos] payload
+  bool                    m_EndOfInput;
+  std::chrono::steady_clock::time_point m_LastArrival;
+
+  //RTP sequence window - datagram of sequence number Seq is in m_Window[Seq % WindowSize]
+  std::array<xDatagram, WindowSize> m_Window;
+  uint32_t                m_NumHeld;
+  uint16_t                m_NextSeq;
+  uint16_t                m_HighestSeq;
+  bool                    m_HasSeq;
+
+  //statistics
+  uint32_t                m_ReceiveBufferSize;
+  uint64_t                m_NumDatagrams;
+  uint64_t                m_NumRTP_Datagrams;
+  uint64_t                m_NumBytes;
+  uint64_t                m_NumReceiveCalls;
+  uint64_t                m_NumPackets;
+  uint64_t                m_NumLost;
+  uint64_t                m_NumReordered;
+  uint64_t                m_NumDuplicates;
+  uint64_t                m_NumMalformed;
+  uint64_t                m_NumSkippedBytes;
+  uint32_t                m_NumKernelDrops;
+
+public:
+  xTS_NetworkInput();
+  ~xTS_NetworkInput() { Close(); }
+  xTS_NetworkInput(const xTS_NetworkInput&) = delete;
+  xTS_NetworkInput& operator=(const xTS_NetworkInput&) = delete;
+
+  static bool isAddress(const char* Name);
+
+  bool     Open          (const char* Address, const xConfig& Config);
+  void     Close         ();
+  void     Stop          () { m_StopRequested.store(true, std::memory_order_relaxed); }
+  uint32_t getNextPackets(const uint8_t** Packets, uint32_t MaxPackets);
+
+public:
+  bool     isOpen              () const { return m_Socket >= 0; }
+  uint32_t getReceiveBufferSize() const { return m_ReceiveBufferSize; }
+  uint64_t getNumDatagrams     () const { return m_NumDatagrams; }
+  uint64_t getNumRTP_Datagrams () const { return m_NumRTP_Datagrams; }
+  uint64_t getNumBytes         () const { return m_NumBytes; }
+  uint64_t getNumReceiveCalls  () const { return m_NumReceiveCalls; }
+  uint64_t getNumPackets       () const { return m_NumPackets; }
+  uint64_t getNumLost          () const { return m_NumLost; }       // RTP datagrams missing from sequence
+  uint64_t getNumReordered     () const { return m_NumReordered; }  // RTP datagrams arriving after a later one
+  uint64_t getNumDuplicates    () const { return m_NumDuplicates; } // RTP datagrams dropped as duplicate or too late
+  uint64_t getNumMalformed     () const { return m_NumMalformed; }  // truncated or neither TS nor RTP
+  uint64_t getNumSkippedBytes  () const { return m_NumSkippedBytes; }
+  uint32_t getNumKernelDrops   () const { return m_NumKernelDrops; }
+
+protected:
+  bool xReceive     ();
+  void xAddDatagram (uint16_t Buffer, uint32_t Size);
+  void xAddRTP      (const xDatagram& Datagram);
+  void xAdvance     (uint32_t MaxHeld);
+  void xFreeBuffer  (uint16_t Buffer) { m_FreeBuffers.push_back(Buffer); }
+};
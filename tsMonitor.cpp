@@ -0,0 +1,362 @@
+#include "tsMonitor.h"
+#include "tsTrace.h"
+#include <cstdint>
+
+//=============================================================================================================================================================================
+// xTS_Monitor
+//=============================================================================================================================================================================
+
+static const char* const c_CheckIds  [] = { "1.1", "1.2", "1.3", "1.4", "1.5", "1.6", "2.1", "2.2", "2.3a", "2.3b", "2.4", "2.5", "2.6" };
+static const char* const c_CheckNames[] = { "TS_sync_loss", "Sync_byte_error", "PAT_error", "Continuity_count_error", "PMT_error", "PID_error",
+                                            "Transport_error", "CRC_error", "PCR_repetition_error", "PCR_discontinuity_indicator_error",
+                                            "PCR_accuracy_error", "PTS_error", "CAT_error" };
+
+xTS_Monitor::xTS_Monitor(const xConfig& Config)
+    : m_Config(Config), m_CAT_Seen(false), m_InSync(true), m_NumBadSync(0), m_NumGoodSync(0), m_ClockPID(InvalidPID), m_NumPackets(0), m_LastLoss(0),
+      m_PSI_Limit(UINT64_MAX), m_PID_Limit(UINT64_MAX), m_PTS_Limit(UINT64_MAX)
+{
+    m_Counts.fill(0);
+    m_LastCC.fill(-1);
+    m_Flags.fill(0);
+    m_LastSeen.fill(0);
+    m_LastPTS.fill(0);
+    m_PCR_Index.fill(InvalidPID);
+    m_PSI_Index.fill(InvalidPID);
+    m_Flags[(uint16_t)xTS_PacketHeader::ePID::CAT] = Flag_CAT;
+    xWatch((uint16_t)xTS_PacketHeader::ePID::PAT, Flag_PAT, 0);
+}
+
+const char* xTS_Monitor::getCheckName(eCheck Check)
+{
+    return Check < eCheck::NumChecks ? c_CheckNames[(uint32_t)Check] : "unknown";
+}
+
+uint64_t xTS_Monitor::getNumErrors() const
+{
+    uint64_t NumErrors = 0;
+    for (uint64_t Count : m_Counts)
+        NumErrors += Count;
+    return NumErrors;
+}
+
+/// @brief Check packets - headers are decoded here (use AddBatch when they are decoded already)
+void xTS_Monitor::AddPackets(const uint8_t* const* Packets, uint32_t NumPackets)
+{
+    for (uint32_t First = 0; First < NumPackets; First += xTS_PacketHeaderBatch::MaxPackets) {
+        const uint32_t Num = NumPackets - First < xTS_PacketHeaderBatch::MaxPackets ? NumPackets - First : xTS_PacketHeaderBatch::MaxPackets;
+        m_Batch.Parse(Packets + First, Num);
+        AddBatch(Packets + First, m_Batch);
+    }
+}
+
+/**
+  @brief Check batch of consecutive packets of the multiplex
+  @param Packets are pointers to TS packets of all PIDs, in input order
+  @param Batch holds decoded headers of Packets (e.g. xTS_Demuxer::getBatch after ProcessBatch)
+ */
+void xTS_Monitor::AddBatch(const uint8_t* const* Packets, const xTS_PacketHeaderBatch& Batch)
+{
+    const uint32_t NumPackets = Batch.getNumPackets();
+    const uint8_t* SBs  = Batch.getSBs();
+    const uint8_t* TEIs = Batch.getTEIs();
+    const uint8_t* TSCs = Batch.getTSCs();
+
+    // Column counts - no branches, vectorised
+    uint32_t NumBadSync = 0, NumTransportErrors = 0, NumScrambled = 0;
+    for (uint32_t i = 0; i < NumPackets; i++) {
+        NumBadSync         += SBs[i] != 0x47;
+        NumTransportErrors += TEIs[i];
+        NumScrambled       += TSCs[i] != 0;
+    }
+    m_Counts[(uint32_t)eCheck::SyncByte]  += NumBadSync;
+    m_Counts[(uint32_t)eCheck::Transport] += NumTransportErrors;
+    xCheckSync(Batch, NumBadSync);
+
+    xUpdateLimits();
+    for (uint32_t i = 0; i < NumPackets; i++) {
+        if (SBs[i] != 0x47 || TEIs[i]) {
+            // Counted above - rest of header cannot be trusted
+            m_LastLoss = m_NumPackets + i;
+            X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "TR 101 290 %s: packet %" PRIu64, getCheckName(SBs[i] != 0x47 ? eCheck::SyncByte : eCheck::Transport), m_NumPackets + i));
+            continue;
+        }
+        if (NumScrambled != 0 && TSCs[i] != 0) {
+            const uint16_t PID = Batch.getPID(i);
+            if (PID == (uint16_t)xTS_PacketHeader::ePID::PAT)
+                xReport(eCheck::PAT, PID, m_NumPackets + i);
+            else if (m_Flags[PID] & Flag_PMT)
+                xReport(eCheck::PMT, PID, m_NumPackets + i);
+            if (!m_CAT_Seen)
+                xReport(eCheck::CAT, PID, m_NumPackets + i);
+        }
+        xCheckPacket(Packets[i], Batch, i, m_NumPackets + i);
+    }
+    m_NumPackets += NumPackets;
+    xCheckTimeouts();
+}
+
+/// @brief TS_sync_loss - 2 consecutive bad sync bytes lose sync, 5 good ones regain it
+void xTS_Monitor::xCheckSync(const xTS_PacketHeaderBatch& Batch, uint32_t NumBadSync)
+{
+    if (NumBadSync == 0 && m_InSync) {
+        m_NumBadSync = 0;
+        return;
+    }
+    for (uint32_t i = 0; i < Batch.getNumPackets(); i++) {
+        if (Batch.getSB(i) != 0x47) {
+            m_NumGoodSync = 0;
+            if (++m_NumBadSync >= 2 && m_InSync) {
+                m_InSync = false;
+                xReport(eCheck::TS_SyncLoss, xTS_Monitor::InvalidPID, m_NumPackets + i);
+            }
+        }
+        else {
+            m_NumBadSync = 0;
+            if (!m_InSync && ++m_NumGoodSync >= 5)
+                m_InSync = true;
+        }
+    }
+}
+
+void xTS_Monitor::xCheckPacket(const uint8_t* Packet, const xTS_PacketHeaderBatch& Batch, uint32_t Idx, uint64_t PacketId)
+{
+    const uint16_t PID = Batch.getPID(Idx);
+    const uint8_t  AFC = Batch.getAFC(Idx);
+    const uint8_t  CC  = Batch.getCC(Idx);
+    uint8_t& Flags = m_Flags[PID];
+
+    // Continuity - counter advances with payload only, one duplicate allowed. Packets without payload
+    // are not checked - muxers disagree on whether their counter repeats or advances
+    if (PID != (uint16_t)xTS_PacketHeader::ePID::NuLL && (AFC & 0x01)) {
+        const bool   Discontinuity = (AFC & 0x02) && Packet[4] != 0 && (Packet[5] & 0x80);
+        const int8_t LastCC = m_LastCC[PID];
+        if (LastCC < 0 || Discontinuity) {
+            Flags &= ~Flag_Duplicate;
+        }
+        else if (CC == LastCC) {
+            if (Flags & Flag_Duplicate)
+                xReport(eCheck::ContinuityCount, PID, PacketId);
+            Flags |= Flag_Duplicate;
+        }
+        else {
+            if (CC != ((LastCC + 1) & 0x0F))
+                xReport(eCheck::ContinuityCount, PID, PacketId);
+            Flags &= ~Flag_Duplicate;
+        }
+        m_LastCC[PID] = (int8_t)CC;
+    }
+
+    if ((AFC & 0x02) && Packet[4] >= 7 && (Packet[5] & 0x10))
+        xCheckPCR(Packet, PID, PacketId);
+
+    if (Flags & (Flag_PAT | Flag_PMT | Flag_CAT)) {
+        if (AFC & 0x01)
+            xCheckPSI(Packet, PID, PacketId);
+    }
+    else if (Flags & Flag_ES) {
+        xSeen(PID, PacketId, m_PID_Limit, eCheck::PID);
+        if (Batch.getPUSI(Idx) && (AFC & 0x01))
+            xCheckPES(Packet, PID, PacketId);
+    }
+}
+
+/// @brief PAT, PMT and CAT - table_id at section start, CRC of PAT/PMT sections, programs and streams to watch
+void xTS_Monitor::xCheckPSI(const uint8_t* Packet, uint16_t PID, uint64_t PacketId)
+{
+    const uint8_t Flags = m_Flags[PID];
+    m_PacketHeader.Reset();
+    m_PacketHeader.Parse(Packet, xTS::TS_PacketLength);
+    m_AdaptationField.Reset();
+    if (m_PacketHeader.hasAdaptationField())
+        m_AdaptationField.Parse(Packet, xTS::TS_PacketLength, m_PacketHeader.getAdaptationFieldControl());
+    const uint32_t PayloadOffset = xTS::TS_HeaderLength + (m_PacketHeader.hasAdaptationField() ? m_AdaptationField.getNumBytes() : 0);
+    if (PayloadOffset >= xTS::TS_PacketLength)
+        return;
+
+    const eCheck Check = (Flags & Flag_PAT) ? eCheck::PAT : (Flags & Flag_PMT) ? eCheck::PMT : eCheck::CAT;
+    if (m_PacketHeader.isPayloadStart() && PayloadOffset + 1 + Packet[PayloadOffset] < xTS::TS_PacketLength) {
+        const uint8_t TableId  = Packet[PayloadOffset + 1 + Packet[PayloadOffset]];
+        const uint8_t Expected = Check == eCheck::PAT ? xPSI::eTableId_PAT : Check == eCheck::PMT ? xPSI::eTableId_PMT : xPSI::eTableId_CAT;
+        if (TableId == Expected) {
+            if (Check == eCheck::CAT)
+                m_CAT_Seen = true;
+            else
+                xSeen(PID, PacketId, m_PSI_Limit, Check);
+        }
+        else if (TableId != 0xFF) {
+            xReport(Check, PID, PacketId);
+        }
+    }
+    if (Check == eCheck::CAT)
+        return;
+
+    xPSI_SectionAssembler* Assembler = m_PSI[m_PSI_Index[PID]].get();
+    const uint64_t NumCRC_Errors = Assembler->getNumCRC_Errors();
+    if (Assembler->AbsorbPacket(Packet, &m_PacketHeader, PayloadOffset) != xPSI_SectionAssembler::eResult::SectionsReady) {
+        if (Assembler->getNumCRC_Errors() != NumCRC_Errors)
+            xReport(eCheck::CRC, PID, PacketId);
+        return;
+    }
+    for (uint64_t i = NumCRC_Errors; i < Assembler->getNumCRC_Errors(); i++)
+        xReport(eCheck::CRC, PID, PacketId);
+
+    for (uint32_t s = 0; s < Assembler->getNumCompleted(); s++) {
+        if (Check == eCheck::PAT && m_PAT.Parse(Assembler->getSection(s), Assembler->getSectionLength(s)) != NOT_VALID) {
+            for (uint32_t p = 0; p < m_PAT.getNumPrograms(); p++) {
+                if (m_PAT.getProgram(p).ProgramNumber != 0) // program 0 points to NIT
+                    xWatch(m_PAT.getProgram(p).PID, Flag_PMT, PacketId);
+            }
+        }
+        else if (Check == eCheck::PMT && m_PMT.Parse(Assembler->getSection(s), Assembler->getSectionLength(s)) != NOT_VALID) {
+            for (uint32_t e = 0; e < m_PMT.getNumStreams(); e++)
+                xWatch(m_PMT.getStream(e).PID, Flag_ES, PacketId);
+            if (m_PMT.getPCR_PID() != (uint16_t)xTS_PacketHeader::ePID::NuLL)
+                xWatch(m_PMT.getPCR_PID(), Flag_ES, PacketId);
+        }
+    }
+}
+
+/// @brief PES start of watched PID - PTS repetition
+void xTS_Monitor::xCheckPES(const uint8_t* Packet, uint16_t PID, uint64_t PacketId)
+{
+    const uint32_t Offset = xTS::TS_HeaderLength + ((Packet[3] & 0x20) ? Packet[4] + 1 : 0);
+    if (Offset + 9 > xTS::TS_PacketLength || Packet[Offset] != 0 || Packet[Offset + 1] != 0 || Packet[Offset + 2] != 1)
+        return;
+    // Stream ids without optional PES header (program_stream_map, padding, private_stream_2, ECM, EMM, directory, DSMCC, H.222.1 type E)
+    const uint8_t StreamId = Packet[Offset + 3];
+    if (StreamId == 0xBC || StreamId == 0xBE || StreamId == 0xBF || StreamId == 0xF0 || StreamId == 0xF1 || StreamId == 0xFF || StreamId == 0xF2 || StreamId == 0xF8)
+        return;
+    if (!(Packet[Offset + 7] & 0x80))
+        return;
+
+    uint8_t& Flags = m_Flags[PID];
+    if (Flags & Flag_NoPTS)
+        Flags &= ~Flag_NoPTS;
+    else if ((Flags & Flag_PTS) && PacketId - m_LastPTS[PID] > m_PTS_Limit)
+        xReport(eCheck::PTS, PID, PacketId);
+    Flags |= Flag_PTS;
+    m_LastPTS[PID] = PacketId;
+}
+
+/// @brief PCR repetition, discontinuity and accuracy - first PID carrying PCR is also the stream clock for time-outs
+void xTS_Monitor::xCheckPCR(const uint8_t* Packet, uint16_t PID, uint64_t PacketId)
+{
+    m_AdaptationField.Reset();
+    m_AdaptationField.Parse(Packet, xTS::TS_PacketLength, (Packet[3] >> 4) & 0x03);
+    if (!m_AdaptationField.hasPCR())
+        return;
+    const uint64_t PCR  = m_AdaptationField.getPCR();
+    const uint64_t Base = PCR / xTS::BaseToExtendedClockMultiplier;
+
+    if (m_PCR_Index[PID] == InvalidPID) {
+        m_PCR_Index[PID] = (uint16_t)m_PCR.size();
+        const int64_t Current = (int64_t)PCR;
+        m_PCR.push_back(xPCR_State{Current, PacketId, Current, PacketId});
+        m_ClockPID = m_ClockPID == InvalidPID ? PID : m_ClockPID;
+        return;
+    }
+
+    xPCR_State& State = m_PCR[m_PCR_Index[PID]];
+    const int64_t Current = xTS::UnwrapTimestamp(Base, State.LastPCR / xTS::BaseToExtendedClockMultiplier) * xTS::BaseToExtendedClockMultiplier +
+                            (int64_t)(PCR % xTS::BaseToExtendedClockMultiplier);
+    const int64_t Delta = Current - State.LastPCR;
+    // Packets lost since start of rate estimate would count as jitter
+    bool Restart = m_AdaptationField.hasDiscontinuity() || State.RatePacket < m_LastLoss;
+    if (!Restart && (Delta < 0 || Delta > (int64_t)(m_Config.PCR_Jump * xTS::ExtendedClockFrequency_Hz))) {
+        xReport(eCheck::PCR_Discontinuity, PID, PacketId);
+        Restart = true;
+    }
+    else if (!Restart) {
+        if (Delta > (int64_t)(m_Config.PCR_Repetition * xTS::ExtendedClockFrequency_Hz))
+            xReport(eCheck::PCR_Repetition, PID, PacketId);
+        if (State.LastPacket > State.RatePacket) {
+            const double TicksPerPacket = (double)(State.LastPCR - State.RatePCR) / (State.LastPacket - State.RatePacket);
+            const double Error = Current - (State.LastPCR + (PacketId - State.LastPacket) * TicksPerPacket);
+            if (Error > m_Config.PCR_Accuracy * xTS::ExtendedClockFrequency_Hz || -Error > m_Config.PCR_Accuracy * xTS::ExtendedClockFrequency_Hz)
+                xReport(eCheck::PCR_Accuracy, PID, PacketId);
+        }
+    }
+    if (Restart) {
+        State.RatePCR    = Current;
+        State.RatePacket = PacketId;
+    }
+    State.LastPCR    = Current;
+    State.LastPacket = PacketId;
+}
+
+/// @brief Occurrence of watched PID (or PSI section) - late occurrence is an error unless time-out was reported already
+void xTS_Monitor::xSeen(uint16_t PID, uint64_t PacketId, uint64_t Limit, eCheck Check)
+{
+    uint8_t& Flags = m_Flags[PID];
+    if (Flags & Flag_Absent)
+        Flags &= ~Flag_Absent;
+    else if (PacketId - m_LastSeen[PID] > Limit)
+        xReport(Check, PID, PacketId);
+    m_LastSeen[PID] = PacketId;
+}
+
+/// @brief Report watched PIDs, PSI and PTS not seen within their limits (once per absence)
+void xTS_Monitor::xCheckTimeouts()
+{
+    const uint64_t Now = m_NumPackets;
+    for (uint16_t PID : m_Watched) {
+        uint8_t& Flags = m_Flags[PID];
+        const uint64_t Limit = (Flags & Flag_ES) ? m_PID_Limit : m_PSI_Limit;
+        if (!(Flags & Flag_Absent) && Now - m_LastSeen[PID] > Limit) {
+            xReport((Flags & Flag_PAT) ? eCheck::PAT : (Flags & Flag_PMT) ? eCheck::PMT : eCheck::PID, PID, Now);
+            Flags |= Flag_Absent;
+        }
+        if ((Flags & (Flag_PTS | Flag_NoPTS)) == Flag_PTS && Now - m_LastPTS[PID] > m_PTS_Limit) {
+            xReport(eCheck::PTS, PID, Now);
+            Flags |= Flag_NoPTS;
+        }
+    }
+}
+
+/// @brief Start watching PID for time-outs (PAT, PMT of program in PAT, PID referred in PMT)
+void xTS_Monitor::xWatch(uint16_t PID, uint8_t Flag, uint64_t PacketId)
+{
+    PID &= NumPIDs - 1;
+    if (m_Flags[PID] & (Flag_PAT | Flag_PMT | Flag_ES))
+        return;
+    m_Flags[PID] |= Flag;
+    m_LastSeen[PID] = PacketId;
+    m_Watched.push_back(PID);
+    if (Flag & (Flag_PAT | Flag_PMT)) {
+        m_PSI_Index[PID] = (uint16_t)m_PSI.size();
+        m_PSI.emplace_back(new xPSI_SectionAssembler());
+    }
+}
+
+/// @brief Convert time-outs to packet counts at transport rate measured on the stream clock
+void xTS_Monitor::xUpdateLimits()
+{
+    if (m_ClockPID == InvalidPID)
+        return;
+    const xPCR_State& State = m_PCR[m_PCR_Index[m_ClockPID]];
+    if (State.LastPacket <= State.RatePacket || State.LastPCR <= State.RatePCR)
+        return;
+    const double PacketsPerSecond = (double)(State.LastPacket - State.RatePacket) * xTS::ExtendedClockFrequency_Hz / (State.LastPCR - State.RatePCR);
+    m_PSI_Limit = (uint64_t)(m_Config.PSI_Timeout * PacketsPerSecond);
+    m_PID_Limit = (uint64_t)(m_Config.PID_Timeout * PacketsPerSecond);
+    m_PTS_Limit = (uint64_t)(m_Config.PTS_Timeout * PacketsPerSecond);
+}
+
+void xTS_Monitor::xReport(eCheck Check, uint16_t PID, uint64_t PacketId)
+{
+    m_Counts[(uint32_t)Check]++;
+    if (Check == eCheck::ContinuityCount)
+        m_LastLoss = PacketId;
+    if (PID == InvalidPID)
+        X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "TR 101 290 %s: packet %" PRIu64, getCheckName(Check), PacketId));
+    else
+        X_TRACE(xTrace::eLevel::Warning, xTrace::Message(xTrace::eLevel::Warning, "TR 101 290 %s: PID %u, packet %" PRIu64, getCheckName(Check), PID, PacketId));
+}
+
+/// @brief Error counts of all checks
+void xTS_Monitor::Print(FILE* Output) const
+{
+    fprintf(Output, "TR 101 290: %" PRIu64 " packets, %" PRIu64 " errors\n", m_NumPackets, getNumErrors());
+    for (uint32_t c = 0; c < (uint32_t)eCheck::NumChecks; c++)
+        fprintf(Output, "  %-4s %-34s %12" PRIu64 "\n", c_CheckIds[c], c_CheckNames[c], m_Counts[c]);
+}
@@ -0,0 +1,167 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include "tsPSI.h"
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+//=============================================================================================================================================================================
+// ETSI TR 101 290 conformance monitor (priority 1 and 2)
+//=============================================================================================================================================================================
+
+/*
+Checks every packet of the multiplex against the first and second priority
+indicators of TR 101 290:
+
+  1.1 TS_sync_loss        - 2 or more consecutive corrupted sync bytes (sync is
+                            regained after 5 good ones), plus sync losses of the reader
+  1.2 Sync_byte_error     - sync byte other than 0x47
+  1.3 PAT_error           - PAT not seen for 0.5 s, table_id other than 0x00 or scrambling on PID 0
+  1.4 Continuity_count_error - wrong order or loss (one duplicate allowed, reset by discontinuity_indicator)
+  1.5 PMT_error           - PMT of program in PAT not seen for 0.5 s, table_id other than 0x02 or scrambling
+  1.6 PID_error           - PID referred in PMT not seen for PID_Timeout
+  2.1 Transport_error     - transport_error_indicator set
+  2.2 CRC_error           - CRC_32 of PAT/PMT section
+  2.3 PCR_repetition_error - PCR interval above 40 ms
+      PCR_discontinuity_indicator_error - PCR back or ahead by 100 ms without discontinuity_indicator
+  2.4 PCR_accuracy_error  - PCR off by more than 500 ns from the time predicted from the mean
+                            transport rate since the last discontinuity or
+                            detected packet loss (constant-rate multiplex)
+  2.5 PTS_error           - PTS of PID carrying PTS not seen for 0.7 s
+  2.6 CAT_error           - scrambled packets without CAT, table_id other than 0x01 on PID 1
+
+Work is done per batch over the columns of xTS_PacketHeaderBatch: sync,
+transport error and scrambling are counted with plain loops over the columns
+(vectorised by the compiler) and need no per-PID work when clean. The
+continuity check is a few table lookups per packet. Only packets of PSI PIDs,
+PES starts and packets with PCR are looked at beyond the header.
+
+Timeouts are measured on stream time: the PCR of the first PID carrying one,
+extrapolated over packets with the mean transport rate - so files are checked
+as if played in real time. Before two PCRs are seen nothing times out. Each
+time-out is counted once until the PID or table shows up again.
+*/
+
+class xTS_Monitor
+{
+public:
+  static constexpr uint32_t NumPIDs    = 8192;
+  static constexpr uint16_t InvalidPID = 0xFFFF;
+
+  enum class eCheck : uint8_t
+  {
+    //priority 1
+    TS_SyncLoss = 0,
+    SyncByte,
+    PAT,
+    ContinuityCount,
+    PMT,
+    PID,
+    //priority 2
+    Transport,
+    CRC,
+    PCR_Repetition,
+    PCR_Discontinuity,
+    PCR_Accuracy,
+    PTS,
+    CAT,
+    NumChecks,
+  };
+
+  struct xConfig
+  {
+    double PSI_Timeout     = 0.5;    // s, PAT and PMT repetition
+    double PID_Timeout     = 5.0;    // s, user specified period of PID_error
+    double PTS_Timeout     = 0.7;    // s
+    double PCR_Repetition  = 0.040;  // s
+    double PCR_Jump        = 0.100;  // s
+    double PCR_Accuracy    = 500e-9; // s
+  };
+
+protected:
+  enum ePID_Flags : uint8_t
+  {
+    Flag_PAT       = 0x01,
+    Flag_PMT       = 0x02,
+    Flag_CAT       = 0x04,
+    Flag_ES        = 0x08, // referred in PMT
+    Flag_PTS       = 0x10, // PES with PTS seen
+    Flag_Duplicate = 0x20, // last packet repeated CC (one duplicate allowed)
+    Flag_Absent    = 0x40, // PID_error/PAT_error/PMT_error reported, cleared when PID shows up
+    Flag_NoPTS     = 0x80, // PTS_error reported, cleared by next PTS
+  };
+
+  struct xPCR_State
+  {
+    int64_t  LastPCR;     // 27 MHz, unwrapped
+    uint64_t LastPacket;
+    int64_t  RatePCR;     // start of mean rate estimate (first PCR after discontinuity)
+    uint64_t RatePacket;
+  };
+
+  xConfig                   m_Config;
+  std::array<uint64_t, (uint32_t)eCheck::NumChecks> m_Counts;
+
+  //per PID state - columns indexed by PID
+  std::array<int8_t,   NumPIDs> m_LastCC;     // -1 = none yet
+  std::array<uint8_t,  NumPIDs> m_Flags;      // ePID_Flags
+  std::array<uint64_t, NumPIDs> m_LastSeen;   // packet index of last packet (PSI: last section start)
+  std::array<uint64_t, NumPIDs> m_LastPTS;    // packet index of last PES header with PTS
+  std::array<uint16_t, NumPIDs> m_PCR_Index;  // index into m_PCR, InvalidPID if PID carried no PCR
+  std::vector<xPCR_State>       m_PCR;
+  std::vector<uint16_t>         m_Watched;    // PIDs with Flag_PAT/Flag_PMT/Flag_ES (checked for time-outs)
+
+  //PSI
+  std::array<uint16_t, NumPIDs> m_PSI_Index;  // index into m_PSI, InvalidPID if none
+  std::vector<std::unique_ptr<xPSI_SectionAssembler>> m_PSI;
+  xPSI_PAT                      m_PAT;
+  xPSI_PMT                      m_PMT;
+  bool                          m_CAT_Seen;
+
+  //sync (TR 101 290 hysteresis)
+  bool                          m_InSync;
+  uint32_t                      m_NumBadSync;
+  uint32_t                      m_NumGoodSync;
+
+  //stream time
+  uint16_t                      m_ClockPID;
+  uint64_t                      m_NumPackets;
+  uint64_t                      m_LastLoss;   // packet index of last continuity error or damaged packet (restarts PCR rate estimates)
+  uint64_t                      m_PSI_Limit;  // time-outs in packets at current transport rate (UINT64_MAX = unknown)
+  uint64_t                      m_PID_Limit;
+  uint64_t                      m_PTS_Limit;
+
+  xTS_PacketHeaderBatch         m_Batch;      // used by AddPackets
+  xTS_PacketHeader              m_PacketHeader;
+  xTS_AdaptationField           m_AdaptationField;
+
+public:
+  xTS_Monitor(const xConfig& Config);
+
+  void AddPackets   (const uint8_t* const* Packets, uint32_t NumPackets);
+  void AddBatch     (const uint8_t* const* Packets, const xTS_PacketHeaderBatch& Batch);
+  void AddSyncLosses(uint64_t NumSyncLosses) { m_Counts[(uint32_t)eCheck::TS_SyncLoss] += NumSyncLosses; }
+  void Print        (FILE* Output) const;
+
+  static const char* getCheckName(eCheck Check);
+  static uint32_t    getPriority (eCheck Check) { return Check < eCheck::Transport ? 1 : 2; }
+
+public:
+  uint64_t getCount     (eCheck Check) const { return m_Counts[(uint32_t)Check]; }
+  uint64_t getNumPackets() const { return m_NumPackets; }
+  uint64_t getNumErrors () const;
+
+protected:
+  void xCheckSync    (const xTS_PacketHeaderBatch& Batch, uint32_t NumBadSync);
+  void xCheckPacket  (const uint8_t* Packet, const xTS_PacketHeaderBatch& Batch, uint32_t Idx, uint64_t PacketId);
+  void xCheckPSI     (const uint8_t* Packet, uint16_t PID, uint64_t PacketId);
+  void xCheckPES     (const uint8_t* Packet, uint16_t PID, uint64_t PacketId);
+  void xCheckPCR     (const uint8_t* Packet, uint16_t PID, uint64_t PacketId);
+  void xSeen         (uint16_t PID, uint64_t PacketId, uint64_t Limit, eCheck Check);
+  void xCheckTimeouts();
+  void xWatch        (uint16_t PID, uint8_t Flag, uint64_t PacketId);
+  void xUpdateLimits ();
+  void xReport       (eCheck Check, uint16_t PID, uint64_t PacketId);
+};
@@ -0,0 +1,283 @@
+#include "tsOutputSink.h"
+#include "tsProfiler.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+//=============================================================================================================================================================================
+// xTS_OutputSink
+//=============================================================================================================================================================================
+
+/**
+  @brief Append data to output file (copied into writer buffer, written in background) or to memory if sink has no writer
+  @param Data is pointer to bytes to write
+  @param Size is number of bytes
+ */
+void xTS_OutputSink::Write(const uint8_t* Data, size_t Size)
+{
+    m_NumBytes += Size;
+    if (m_Writer == nullptr) {
+        m_Memory.insert(m_Memory.end(), Data, Data + Size);
+        return;
+    }
+    const uint32_t BufferSize = m_Writer->m_BufferSize;
+    while (Size > 0) {
+        if (m_Current == nullptr)
+            m_Current = m_Writer->xAcquireBuffer(this);
+
+        const size_t Taken = Size < BufferSize - m_Current->Size ? Size : BufferSize - m_Current->Size;
+        memcpy(m_Current->Data + m_Current->Size, Data, Taken);
+        m_Current->Size += (uint32_t)Taken;
+        Data += Taken;
+        Size -= Taken;
+
+        if (m_Current->Size == BufferSize) {
+            m_Writer->xSubmit(m_Current);
+            m_Current = nullptr;
+        }
+    }
+}
+
+//=============================================================================================================================================================================
+// xTS_OutputWriter
+//=============================================================================================================================================================================
+
+xTS_OutputWriter::xTS_OutputWriter(uint32_t BufferSize, uint32_t NumBuffers)
+    : m_BufferSize(BufferSize), m_NumBuffers(NumBuffers), m_FreeBuffers(NumBuffers), m_Queue(NumBuffers), m_Running(false), m_Parked(false), m_NumSubmitted(0), m_NumCompleted(0),
+      m_NumBytesWritten(0), m_NumWriteCalls(0), m_NumStalls(0), m_NumIdleWaits(0), m_MaxQueueDepth(0), m_NumErrors(0)
+{
+}
+
+xTS_OutputWriter::~xTS_OutputWriter()
+{
+    Close();
+    for (xBuffer& Buffer : m_Buffers)
+        xAlignedFree(Buffer.Data);
+}
+
+/**
+  @brief Create (truncate) output file and keep it open until Close()
+  @param FileName is path of output file
+  @return Sink owned by writer or nullptr if file cannot be created
+ */
+xTS_OutputSink* xTS_OutputWriter::OpenSink(const std::string& FileName)
+{
+    if (m_Buffers.empty())
+        xAllocBuffers(); // before the file is opened - throws std::bad_alloc
+#if defined(_WIN32)
+    const int FileDescriptor = _open(FileName.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    const int FileDescriptor = open(FileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (FileDescriptor < 0) {
+        m_NumErrors++;
+        return nullptr;
+    }
+
+    if (!m_Running.load(std::memory_order_relaxed)) {
+        m_Running.store(true, std::memory_order_relaxed);
+        m_Thread = std::thread(&xTS_OutputWriter::xThreadMain, this);
+    }
+    m_Sinks.emplace_back(new xTS_OutputSink(this, FileName, FileDescriptor));
+    return m_Sinks.back().get();
+}
+
+/// @brief Write all buffered data and wait until it reaches the files
+void xTS_OutputWriter::Flush()
+{
+    xSubmitPartial();
+    xBackoff Backoff;
+    while (m_NumCompleted.load(std::memory_order_acquire) != m_NumSubmitted)
+        Backoff.Wait();
+}
+
+/// @brief Flush, stop background thread and close all files
+void xTS_OutputWriter::Close()
+{
+    Flush();
+    m_Running.store(false, std::memory_order_release);
+    xWake();
+    if (m_Thread.joinable())
+        m_Thread.join();
+
+    for (std::unique_ptr<xTS_OutputSink>& Sink : m_Sinks) {
+#if defined(_WIN32)
+        _close(Sink->m_FileDescriptor);
+#else
+        close(Sink->m_FileDescriptor);
+#endif
+    }
+    m_Sinks.clear();
+}
+
+/// @brief Take free buffer for Sink, waiting for background thread when pool is exhausted
+xTS_OutputWriter::xBuffer* xTS_OutputWriter::xAcquireBuffer(xTS_OutputSink* Sink)
+{
+    xBuffer* Buffer;
+    if (!m_FreeBuffers.tryPop(Buffer)) {
+        m_NumStalls++;
+        // Every buffer may be held partially filled by some sink - hand them over so they can be recycled
+        if (m_NumCompleted.load(std::memory_order_acquire) == m_NumSubmitted)
+            xSubmitPartial();
+        xBackoff Backoff;
+        while (!m_FreeBuffers.tryPop(Buffer))
+            Backoff.Wait();
+    }
+    Buffer->Size = 0;
+    Buffer->Sink = Sink;
+    return Buffer;
+}
+
+/// @brief Allocate buffer pool, all buffers start in free ring - throws std::bad_alloc (nothing is kept then)
+void xTS_OutputWriter::xAllocBuffers()
+{
+    m_Buffers.resize(m_NumBuffers, xBuffer{nullptr, 0, nullptr});
+    for (xBuffer& Buffer : m_Buffers) {
+        Buffer.Data = static_cast<uint8_t*>(xAlignedAlloc(BufferAlignment, m_BufferSize));
+        if (Buffer.Data == nullptr) {
+            for (xBuffer& Allocated : m_Buffers)
+                xAlignedFree(Allocated.Data);
+            m_Buffers.clear();
+            throw std::bad_alloc();
+        }
+    }
+    for (xBuffer& Buffer : m_Buffers)
+        m_FreeBuffers.tryPush(&Buffer);
+}
+
+void xTS_OutputWriter::xSubmit(xBuffer* Buffer)
+{
+    // Ring capacity covers the whole pool - push cannot fail
+    m_Queue.tryPush(Buffer);
+    m_NumSubmitted++;
+    xWake();
+    const uint32_t QueueDepth = (uint32_t)(m_NumSubmitted - m_NumCompleted.load(std::memory_order_relaxed));
+    if (QueueDepth > m_MaxQueueDepth)
+        m_MaxQueueDepth = QueueDepth;
+}
+
+/// @brief Queue partially filled buffers of all sinks
+void xTS_OutputWriter::xSubmitPartial()
+{
+    for (std::unique_ptr<xTS_OutputSink>& Sink : m_Sinks) {
+        if (Sink->m_Current != nullptr) {
+            xSubmit(Sink->m_Current);
+            Sink->m_Current = nullptr;
+        }
+    }
+}
+
+void xTS_OutputWriter::xThreadMain()
+{
+    xBuffer* Run[MaxIOVecs];
+    xBackoff Backoff;
+    bool Idle = false;
+    for (;;) {
+        if (!m_Queue.tryPop(Run[0])) {
+            // Close() stops the thread only after Flush() - queue is drained at that point
+            if (!m_Running.load(std::memory_order_acquire))
+                break;
+            m_NumIdleWaits += !Idle;
+            Idle = true;
+            if (!Backoff.isSpent()) {
+                Backoff.Wait();
+                continue;
+            }
+            // Nothing for a while - park until xSubmit or Close wakes the thread (flag is set before the queue is checked again)
+            std::unique_lock<std::mutex> Lock(m_WakeMutex);
+            m_Parked.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_Wake.wait(Lock, [this]() { return m_Queue.peek() != nullptr || !m_Running.load(std::memory_order_acquire); });
+            m_Parked.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        Idle = false;
+        Backoff.Reset();
+
+        // Consecutive buffers of the same file are written with one call
+        uint32_t NumBuffers = 1;
+        const xTS_OutputSink* Sink = Run[0]->Sink;
+        for (xBuffer* const* Next; NumBuffers < MaxIOVecs && (Next = m_Queue.peek()) != nullptr && (*Next)->Sink == Sink;)
+            m_Queue.tryPop(Run[NumBuffers++]);
+
+        bool Error = false;
+        X_PROFILE_BEGIN(Start);
+        m_NumWriteCalls += xWriteRun(Run, NumBuffers, Error);
+        X_PROFILE_END(Start, Write, xProfiler::AllPIDs, NumBuffers);
+        if (Error)
+            m_NumErrors++;
+        for (uint32_t i = 0; i < NumBuffers; i++) {
+            m_NumBytesWritten += Run[i]->Size;
+            Run[i]->Size = 0;
+            Run[i]->Sink = nullptr;
+            m_FreeBuffers.tryPush(Run[i]);
+        }
+        m_NumCompleted.fetch_add(NumBuffers, std::memory_order_release);
+    }
+}
+
+/// @brief Wake parked background thread (producer side) - queue push or m_Running change is ordered before the flag is read
+void xTS_OutputWriter::xWake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_Parked.load(std::memory_order_relaxed))
+        return;
+    std::lock_guard<std::mutex> Lock(m_WakeMutex);
+    m_Wake.notify_one();
+}
+
+/**
+  @brief Write run of buffers belonging to one sink (background thread)
+  @return Number of write calls issued
+ */
+uint32_t xTS_OutputWriter::xWriteRun(xBuffer* const* Buffers, uint32_t NumBuffers, bool& Error)
+{
+    const int FileDescriptor = Buffers[0]->Sink->m_FileDescriptor;
+    uint32_t NumWriteCalls = 0;
+#if defined(_WIN32)
+    for (uint32_t i = 0; i < NumBuffers; i++) {
+        NumWriteCalls++;
+        if (_write(FileDescriptor, Buffers[i]->Data, Buffers[i]->Size) != (int)Buffers[i]->Size)
+            Error = true;
+    }
+#else
+    struct iovec IOVecs[MaxIOVecs];
+    for (uint32_t i = 0; i < NumBuffers; i++) {
+        IOVecs[i].iov_base = Buffers[i]->Data;
+        IOVecs[i].iov_len  = Buffers[i]->Size;
+    }
+
+    struct iovec* Pending = IOVecs;
+    uint32_t NumPending = NumBuffers;
+    while (NumPending > 0) {
+        NumWriteCalls++;
+        ssize_t Written = writev(FileDescriptor, Pending, (int)NumPending);
+        if (Written < 0) {
+            if (errno == EINTR)
+                continue;
+            Error = true;
+            break;
+        }
+        // Partial write - skip completed vectors and continue with the rest
+        while (NumPending > 0 && (size_t)Written >= Pending->iov_len) {
+            Written -= Pending->iov_len;
+            Pending++;
+            NumPending--;
+        }
+        if (NumPending > 0) {
+            Pending->iov_base = static_cast<uint8_t*>(Pending->iov_base) + Written;
+            Pending->iov_len -= Written;
+        }
+    }
+#endif
+    return NumWriteCalls;
+}
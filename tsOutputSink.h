@@ -0,0 +1,132 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsRing.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Buffered asynchronous output
+//=============================================================================================================================================================================
+
+/*
+Output files stay open for the whole run. Data written to a sink is coalesced
+into large aligned buffers taken from a fixed pool. Full buffers are passed to
+a background thread over a lock-free single-producer/single-consumer ring; it
+writes runs of consecutive buffers of the same file with a single writev() and
+returns them over a second ring; when there is nothing to write it spins
+briefly, then parks on a condition variable until the producer queues a
+buffer or closes the writer. Memory use is bounded by the pool size; when
+the pool is exhausted Write() waits until the background thread returns a
+buffer (back-pressure, counted as stall). The pool is allocated when the first
+file is opened.
+
+All sinks of one writer (and OpenSink/Flush/Close) must be used from a single
+thread - it is the producer side of both rings.
+
+A sink created without writer collects data in memory instead - used to hold
+output of a chunk demuxed on a worker thread until it can be appended in order.
+*/
+
+class xTS_OutputSink;
+
+class xTS_OutputWriter
+{
+  friend class xTS_OutputSink;
+
+public:
+  static constexpr uint32_t DefaultBufferSize = 1 << 20;
+  static constexpr uint32_t DefaultNumBuffers = 16;
+  static constexpr uint32_t BufferAlignment   = 4096;
+  static constexpr uint32_t MaxIOVecs         = 64;
+
+  struct xBuffer
+  {
+    uint8_t*        Data;
+    uint32_t        Size;
+    xTS_OutputSink* Sink;
+  };
+
+protected:
+  uint32_t                 m_BufferSize;
+  uint32_t                 m_NumBuffers;
+  std::vector<xBuffer>     m_Buffers;
+  xSPSC_Ring<xBuffer*>     m_FreeBuffers;   // background thread -> producer
+  xSPSC_Ring<xBuffer*>     m_Queue;         // producer -> background thread
+  std::vector<std::unique_ptr<xTS_OutputSink>> m_Sinks;
+
+  std::thread              m_Thread;
+  std::atomic<bool>        m_Running;
+  std::mutex               m_WakeMutex;
+  std::condition_variable  m_Wake;          // background thread parked while queue is empty
+  std::atomic<bool>        m_Parked;
+  uint64_t                 m_NumSubmitted;  // buffers queued by producer
+  std::atomic<uint64_t>    m_NumCompleted;  // buffers written and returned by background thread
+
+  //statistics
+  uint64_t                 m_NumBytesWritten;
+  uint64_t                 m_NumWriteCalls;
+  uint64_t                 m_NumStalls;     // producer waited for free buffer (writing is the bottleneck)
+  uint64_t                 m_NumIdleWaits;  // background thread waited for data
+  uint32_t                 m_MaxQueueDepth;
+  std::atomic<uint64_t>    m_NumErrors;
+
+public:
+  xTS_OutputWriter(uint32_t BufferSize = DefaultBufferSize, uint32_t NumBuffers = DefaultNumBuffers);
+  ~xTS_OutputWriter();
+  xTS_OutputWriter(const xTS_OutputWriter&) = delete;
+  xTS_OutputWriter& operator=(const xTS_OutputWriter&) = delete;
+
+  xTS_OutputSink* OpenSink(const std::string& FileName);
+  void            Flush   ();
+  void            Close   ();
+
+public:
+  uint64_t getNumBytesWritten() const { return m_NumBytesWritten; }
+  uint64_t getNumWriteCalls  () const { return m_NumWriteCalls; }
+  uint64_t getNumStalls      () const { return m_NumStalls; }
+  uint64_t getNumIdleWaits   () const { return m_NumIdleWaits; }
+  uint32_t getMaxQueueDepth  () const { return m_MaxQueueDepth; }
+  uint32_t getQueueDepth     () const { return m_Queue.getSize(); }
+  uint64_t getNumErrors      () const { return m_NumErrors.load(std::memory_order_relaxed); }
+
+protected:
+  xBuffer* xAcquireBuffer(xTS_OutputSink* Sink);
+  void     xSubmit       (xBuffer* Buffer);
+  void     xSubmitPartial();
+  void     xThreadMain   ();
+  void     xWake         ();
+  uint32_t xWriteRun     (xBuffer* const* Buffers, uint32_t NumBuffers, bool& Error);
+  void     xAllocBuffers ();
+};
+
+//=============================================================================================================================================================================
+
+class xTS_OutputSink
+{
+  friend class xTS_OutputWriter;
+
+protected:
+  xTS_OutputWriter*          m_Writer;
+  std::string                m_FileName;
+  int                        m_FileDescriptor;
+  xTS_OutputWriter::xBuffer* m_Current;        // buffer being filled (nullptr = none)
+  uint64_t                   m_NumBytes;
+  std::vector<uint8_t>       m_Memory;         // data of in-memory sink (no writer)
+
+public:
+  xTS_OutputSink() : m_Writer(nullptr), m_FileDescriptor(-1), m_Current(nullptr), m_NumBytes(0) {}
+  xTS_OutputSink(xTS_OutputWriter* Writer, const std::string& FileName, int FileDescriptor)
+    : m_Writer(Writer), m_FileName(FileName), m_FileDescriptor(FileDescriptor), m_Current(nullptr), m_NumBytes(0) {}
+
+  void Write(const uint8_t* Data, size_t Size);
+
+public:
+  const std::string&          getFileName() const { return m_FileName; }
+  uint64_t                    getNumBytes () const { return m_NumBytes; }
+  const std::vector<uint8_t>& getMemory  () const { return m_Memory; }
+};
@@ -0,0 +1,307 @@
+#include "tsPSI.h"
+#include <cstdio>
+
+//=============================================================================================================================================================================
+// xPSI_SectionAssembler
+//=============================================================================================================================================================================
+
+xPSI_SectionAssembler::xPSI_SectionAssembler()
+{
+    m_Buffer.reserve(xPSI::MaxSectionLength);
+    m_Completed.reserve(xPSI::MaxSectionLength);
+    m_CompletedOffsets.reserve(16);
+    m_NumSections = 0;
+    m_NumCRC_Errors = 0;
+    Reset();
+}
+
+void xPSI_SectionAssembler::Reset()
+{
+    xSectionReset();
+    m_LastContinuityCounter = -1;
+    m_Completed.clear();
+    m_CompletedOffsets.clear();
+    m_CompletedOffsets.push_back(0);
+}
+
+void xPSI_SectionAssembler::xSectionReset()
+{
+    m_Buffer.clear();
+    m_SectionLength = 0;
+    m_Started = false;
+}
+
+/**
+@brief Move assembled section to completed list if its CRC_32 is correct (sections with section_syntax_indicator = 1 only)
+@return false on CRC error
+*/
+bool xPSI_SectionAssembler::xComplete()
+{
+    const bool SectionSyntax = xPSI_ShortHeaderLayout::SectionSyntaxIndicator::Get(m_Buffer.data()) != 0;
+    if (SectionSyntax && (m_SectionLength < xPSI::LongHeaderLength + xPSI::CRC_Length || xCRC32::Calc(m_Buffer.data(), m_SectionLength) != 0)) {
+        m_NumCRC_Errors++;
+        xSectionReset();
+        return false;
+    }
+    m_Completed.insert(m_Completed.end(), m_Buffer.begin(), m_Buffer.end());
+    m_CompletedOffsets.push_back((uint32_t)m_Completed.size());
+    m_NumSections++;
+    xSectionReset();
+    return true;
+}
+
+/**
+@brief Append section bytes, moving every completed section to completed list
+@param Data is pointer to section bytes
+@param Size is number of bytes in Data
+@return false if section header is not valid or section CRC is not correct
+*/
+bool xPSI_SectionAssembler::xConsume(const uint8_t* Data, uint32_t Size)
+{
+    bool Valid = true;
+    while (Size > 0) {
+        // 0xFF in place of table_id - stuffing till end of packet
+        if (m_Buffer.empty() && Data[0] == 0xFF) {
+            xSectionReset();
+            return Valid;
+        }
+        m_Started = true;
+
+        const uint32_t Needed = m_SectionLength == 0 ? xPSI::SectionHeaderLength - (uint32_t)m_Buffer.size() : m_SectionLength - (uint32_t)m_Buffer.size();
+        const uint32_t Taken  = Needed < Size ? Needed : Size;
+        m_Buffer.insert(m_Buffer.end(), Data, Data + Taken);
+        Data += Taken;
+        Size -= Taken;
+
+        if (m_SectionLength == 0 && m_Buffer.size() == xPSI::SectionHeaderLength) {
+            m_SectionLength = xPSI::SectionHeaderLength + xPSI_ShortHeaderLayout::SectionLength::Get(m_Buffer.data());
+            if (m_SectionLength > xPSI::MaxSectionLength) {
+                xSectionReset();
+                return false;
+            }
+        }
+
+        if (m_SectionLength != 0 && m_Buffer.size() == m_SectionLength) {
+            Valid &= xComplete();
+        }
+    }
+    return Valid;
+}
+
+/**
+@brief Absorb TS packet carrying PSI sections
+@param TransportStreamPacket is pointer to 188 byte TS packet
+@param PacketHeader is parsed header of TransportStreamPacket
+@param PayloadOffset is offset of first payload byte (after adaptation field)
+@return SectionsReady if at least one section was completed - see getNumCompleted()/getSection()
+*/
+xPSI_SectionAssembler::eResult xPSI_SectionAssembler::AbsorbPacket(const uint8_t* TransportStreamPacket, const xTS_PacketHeader* PacketHeader, uint32_t PayloadOffset)
+{
+    m_Completed.clear();
+    m_CompletedOffsets.resize(1);
+
+    if (PayloadOffset >= xTS::TS_PacketLength || !(PacketHeader->getAFC() & 0x01)) {
+        return eResult::NoSection;
+    }
+
+    // Repeated packet (same CC) carries no new data
+    if (m_LastContinuityCounter >= 0 && PacketHeader->getCC() == m_LastContinuityCounter) {
+        return eResult::NoSection;
+    }
+    const bool Continuous = m_LastContinuityCounter >= 0 && PacketHeader->getCC() == ((m_LastContinuityCounter + 1) & 0x0F);
+    m_LastContinuityCounter = PacketHeader->getCC();
+
+    const uint8_t* Payload = TransportStreamPacket + PayloadOffset;
+    uint32_t PayloadSize = xTS::TS_PacketLength - PayloadOffset;
+    const uint64_t NumCRC_Errors = m_NumCRC_Errors;
+    eResult Result = eResult::NoSection;
+    bool Valid = true;
+
+    if (!PacketHeader->isPayloadStart()) {
+        if (!m_Started) {
+            return eResult::NoSection;
+        }
+        if (!Continuous) {
+            xSectionReset();
+            return eResult::StreamPackedLost;
+        }
+        Valid = xConsume(Payload, PayloadSize);
+        return xResult(Valid, NumCRC_Errors, Result);
+    }
+
+    const uint32_t PointerField = Payload[0];
+    Payload++;
+    PayloadSize--;
+    if (PointerField > PayloadSize) {
+        xSectionReset();
+        return eResult::SectionError;
+    }
+
+    // Tail of section started in previous packets
+    if (m_Started) {
+        if (Continuous) {
+            Valid &= xConsume(Payload, PointerField);
+        }
+        else {
+            Result = eResult::StreamPackedLost;
+        }
+    }
+    xSectionReset();
+
+    Valid &= xConsume(Payload + PointerField, PayloadSize - PointerField);
+    return xResult(Valid, NumCRC_Errors, Result);
+}
+
+xPSI_SectionAssembler::eResult xPSI_SectionAssembler::xResult(bool Valid, uint64_t NumCRC_ErrorsBefore, eResult Otherwise) const
+{
+    if (getNumCompleted())
+        return eResult::SectionsReady;
+    if (m_NumCRC_Errors != NumCRC_ErrorsBefore)
+        return eResult::CRC_Error;
+    if (!Valid)
+        return eResult::SectionError;
+    return Otherwise;
+}
+
+//=============================================================================================================================================================================
+// xPSI_PAT
+//=============================================================================================================================================================================
+
+void xPSI_PAT::Reset()
+{
+    m_TransportStreamId = 0;
+    m_Version = 0;
+    m_Programs.clear();
+}
+
+/**
+@brief Parse program association section (programs of one section - PAT may span several sections)
+@param Section is pointer to first byte of section (table_id)
+@param Length is section length including header and CRC
+@return Number of programs in section or -1 on failure
+*/
+int32_t xPSI_PAT::Parse(const uint8_t* Section, uint32_t Length)
+{
+    Reset();
+    if (Section == nullptr || Length < xPSI::LongHeaderLength + xPSI::CRC_Length || Section[0] != xPSI::eTableId_PAT)
+        return NOT_VALID;
+
+    const uint64_t Header = xPSI_LongHeaderLayout::tWord::Load(Section);
+    m_TransportStreamId = xPSI_LongHeaderLayout::TableIdExtension::Extract(Header);
+    m_Version           = xPSI_LongHeaderLayout::Version::Extract(Header);
+
+    typedef xPSI_PAT_EntryLayout L;
+    const uint32_t LoopEnd = Length - xPSI::CRC_Length;
+    for (uint32_t i = xPSI::LongHeaderLength; i + L::Length <= LoopEnd; i += L::Length) {
+        const uint32_t Entry = L::tWord::Load(Section + i);
+        xProgram Program;
+        Program.ProgramNumber = L::ProgramNumber::Extract(Entry);
+        Program.PID           = L::PID::Extract(Entry);
+        m_Programs.push_back(Program);
+    }
+    return (int32_t)m_Programs.size();
+}
+
+void xPSI_PAT::Print() const
+{
+    printf("PAT: TSID=%d V=%d Programs=%d\n", m_TransportStreamId, m_Version, (int)m_Programs.size());
+    for (const xProgram& Program : m_Programs) {
+        printf("           Program=%5d PMT PID=%5d\n", Program.ProgramNumber, Program.PID);
+    }
+}
+
+//=============================================================================================================================================================================
+// xPSI_PMT
+//=============================================================================================================================================================================
+
+void xPSI_PMT::Reset()
+{
+    m_ProgramNumber = 0;
+    m_Version = 0;
+    m_PCR_PID = 0;
+    m_Streams.clear();
+}
+
+/**
+@brief Parse program map section
+@param Section is pointer to first byte of section (table_id)
+@param Length is section length including header and CRC
+@return Number of elementary streams or -1 on failure
+*/
+int32_t xPSI_PMT::Parse(const uint8_t* Section, uint32_t Length)
+{
+    Reset();
+    if (Section == nullptr || Length < xPSI_PMT_HeaderLayout::Length + xPSI::CRC_Length || Section[0] != xPSI::eTableId_PMT)
+        return NOT_VALID;
+
+    const uint64_t Header = xPSI_LongHeaderLayout::tWord::Load(Section);
+    m_ProgramNumber = xPSI_LongHeaderLayout::TableIdExtension::Extract(Header);
+    m_Version       = xPSI_LongHeaderLayout::Version::Extract(Header);
+    const uint32_t PMT_Header = xPSI_PMT_HeaderLayout::tWord::Load(Section);
+    m_PCR_PID       = xPSI_PMT_HeaderLayout::PCR_PID::Extract(PMT_Header);
+
+    typedef xPSI_PMT_EntryLayout L;
+    const uint32_t ProgramInfoLength = xPSI_PMT_HeaderLayout::ProgramInfoLength::Extract(PMT_Header);
+    const uint32_t LoopEnd = Length - xPSI::CRC_Length;
+    uint32_t i = xPSI_PMT_HeaderLayout::Length + ProgramInfoLength;
+    while (i + L::Length <= LoopEnd) {
+        const uint64_t Entry = L::tWord::Load(Section + i);
+        const uint32_t ES_InfoLength = L::ES_InfoLength::Extract(Entry);
+        if (i + L::Length + ES_InfoLength > LoopEnd)
+            return NOT_VALID;
+
+        xElementaryStream Stream;
+        Stream.StreamType = L::StreamType::Extract(Entry);
+        Stream.PID        = L::PID::Extract(Entry);
+        Stream.Category   = ClassifyStream(Stream.StreamType, Section + i + L::Length, ES_InfoLength);
+        m_Streams.push_back(Stream);
+        i += L::Length + ES_InfoLength;
+    }
+    return (int32_t)m_Streams.size();
+}
+
+/**
+@brief Classify elementary stream as audio, video or other
+@param StreamType is stream_type from PMT
+@param Descriptors is pointer to ES_info descriptors (used for private PES streams)
+@param DescriptorsLength is length of ES_info descriptors
+@return eStreamCategory
+*/
+uint8_t xPSI_PMT::ClassifyStream(uint8_t StreamType, const uint8_t* Descriptors, uint32_t DescriptorsLength)
+{
+    switch (StreamType) {
+        case 0x01: // MPEG-1 video
+        case 0x02: // MPEG-2 video
+        case 0x10: // MPEG-4 part 2 video
+        case 0x1B: // H.264/AVC
+        case 0x24: // H.265/HEVC
+        case 0x42: // AVS
+        case 0xEA: // VC-1
+            return eStreamCategory_Video;
+        case 0x03: // MPEG-1 audio
+        case 0x04: // MPEG-2 audio
+        case 0x0F: // AAC ADTS
+        case 0x11: // AAC LATM
+        case 0x81: // AC-3 (ATSC)
+        case 0x87: // E-AC-3 (ATSC)
+            return eStreamCategory_Audio;
+        case 0x06: // PES private data - DVB signals audio codec with descriptor
+            for (uint32_t i = 0; i + 2 <= DescriptorsLength; i += 2 + Descriptors[i + 1]) {
+                const uint8_t Tag = Descriptors[i];
+                if (Tag == 0x6A || Tag == 0x7A || Tag == 0x7C || Tag == 0x7B) // AC-3, E-AC-3, AAC, DTS
+                    return eStreamCategory_Audio;
+            }
+            return eStreamCategory_Other;
+        default:
+            return eStreamCategory_Other;
+    }
+}
+
+void xPSI_PMT::Print() const
+{
+    printf("PMT: Program=%d V=%d PCR PID=%d Streams=%d\n", m_ProgramNumber, m_Version, m_PCR_PID, (int)m_Streams.size());
+    for (const xElementaryStream& Stream : m_Streams) {
+        const char* Category = Stream.Category == eStreamCategory_Audio ? "audio" : Stream.Category == eStreamCategory_Video ? "video" : "other";
+        printf("           PID=%5d Type=0x%02X (%s)\n", Stream.PID, Stream.StreamType, Category);
+    }
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include <vector>
+
+/*
+PSI section (long form, section_syntax_indicator = 1):
+`        3                   2                   1                   0  `
+`      1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0  `
+`     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ `
+`   0 |   table_id    |S|0|RR |    section_length     |  table_id_ext | `
+`     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ `
+`   4 | table_id_ext  |RR | version |C|section_number |  last_section | `
+`     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ `
+`   8 |                        Table data ...                         | `
+`     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ `
+`     |                            CRC_32                             | `
+`     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ `
+
+First payload byte of a packet with payload_unit_start_indicator set is the
+pointer_field - number of bytes (end of previous section) before the first
+new section. Bytes equal to 0xFF after a section are stuffing.
+*/
+
+//=============================================================================================================================================================================
+
+class xPSI
+{
+public:
+  static constexpr uint32_t SectionHeaderLength = 3;    // table_id + section_length
+  static constexpr uint32_t LongHeaderLength    = 8;    // up to last_section_number
+  static constexpr uint32_t CRC_Length          = 4;
+  static constexpr uint32_t MaxSectionLength    = 4096; // private sections, PAT/PMT are limited to 1024
+
+  enum eTableId : uint8_t
+  {
+    eTableId_PAT = 0x00,
+    eTableId_CAT = 0x01,
+    eTableId_PMT = 0x02,
+    eTableId_SDT = 0x42,
+  };
+};
+
+//=============================================================================================================================================================================
+// Section layouts (ISO/IEC 13818-1 tables 2-30 and 2-33), see tsBitfield.h
+//=============================================================================================================================================================================
+
+/// Section header up to section_length - what is known once the first 3 bytes are assembled
+struct xPSI_ShortHeaderLayout
+{
+  typedef xBitWord<1, 2, xPSI::SectionHeaderLength> tWord;
+  typedef tWord::Field< 8,  1> SectionSyntaxIndicator;
+  typedef tWord::Field<12, 12> SectionLength;
+};
+
+/// Section header of long form (section_syntax_indicator = 1) - one 64-bit word
+struct xPSI_LongHeaderLayout
+{
+  typedef xBitWord<0, 8, xPSI::LongHeaderLength> tWord;
+  typedef tWord::Field< 0,  8> TableId;
+  typedef tWord::Field<12, 12> SectionLength;
+  typedef tWord::Field<24, 16> TableIdExtension;  // transport_stream_id (PAT), program_number (PMT)
+  typedef tWord::Field<42,  5> Version;
+  typedef tWord::Field<47,  1> CurrentNextIndicator;
+  typedef tWord::Field<48,  8> SectionNumber;
+  typedef tWord::Field<56,  8> LastSectionNumber;
+};
+
+/// PAT program loop entry
+struct xPSI_PAT_EntryLayout
+{
+  static constexpr uint32_t Length = 4;
+  typedef xBitWord<0, 4, Length> tWord;
+  typedef tWord::Field< 0, 16> ProgramNumber;
+  typedef tWord::Field<19, 13> PID;               // network_PID for program_number 0
+};
+
+/// PMT fields between section header and program info descriptors
+struct xPSI_PMT_HeaderLayout
+{
+  static constexpr uint32_t Length = xPSI::LongHeaderLength + 4;
+  typedef xBitWord<xPSI::LongHeaderLength, 4, Length> tWord;
+  typedef tWord::Field<67, 13> PCR_PID;
+  typedef tWord::Field<84, 12> ProgramInfoLength;
+};
+
+/// PMT elementary stream loop entry (without descriptors) - read as one 64-bit word ending with the entry, entries follow the PMT header so the 3 bytes before are readable
+struct xPSI_PMT_EntryLayout
+{
+  static constexpr uint32_t Length = 5;
+  typedef xBitWord<-3, 8, Length, 3> tWord;
+  typedef tWord::Field< 0,  8> StreamType;
+  typedef tWord::Field<11, 13> PID;
+  typedef tWord::Field<28, 12> ES_InfoLength;
+};
+
+//=============================================================================================================================================================================
+
+class xPSI_SectionAssembler
+{
+public:
+  enum class eResult : int32_t
+  {
+    NoSection = 0,
+    SectionsReady,
+    StreamPackedLost,
+    SectionError,
+    CRC_Error,
+  };
+
+protected:
+  std::vector<uint8_t>  m_Buffer;            // section being assembled
+  uint32_t              m_SectionLength;     // total length of section being assembled (0 = unknown yet)
+  int8_t                m_LastContinuityCounter;
+  bool                  m_Started;
+  //completed sections of last absorbed packet
+  std::vector<uint8_t>  m_Completed;
+  std::vector<uint32_t> m_CompletedOffsets;
+  uint64_t              m_NumSections;
+  uint64_t              m_NumCRC_Errors;
+
+public:
+  xPSI_SectionAssembler();
+
+  void    Reset       ();
+  eResult AbsorbPacket(const uint8_t* TransportStreamPacket, const xTS_PacketHeader* PacketHeader, uint32_t PayloadOffset);
+
+public:
+  uint32_t       getNumCompleted  () const { return (uint32_t)m_CompletedOffsets.size() - 1; }
+  const uint8_t* getSection       (uint32_t Idx) const { return m_Completed.data() + m_CompletedOffsets[Idx]; }
+  uint32_t       getSectionLength (uint32_t Idx) const { return m_CompletedOffsets[Idx + 1] - m_CompletedOffsets[Idx]; }
+  uint64_t       getNumSections   () const { return m_NumSections; }
+  uint64_t       getNumCRC_Errors () const { return m_NumCRC_Errors; }
+
+protected:
+  bool xConsume(const uint8_t* Data, uint32_t Size);
+  bool xComplete();
+  eResult xResult(bool Valid, uint64_t NumCRC_ErrorsBefore, eResult Otherwise) const;
+  void xSectionReset();
+};
+
+//=============================================================================================================================================================================
+
+class xPSI_PAT
+{
+public:
+  struct xProgram
+  {
+    uint16_t ProgramNumber;
+    uint16_t PID;           // program_map_PID (network_PID for program 0)
+  };
+
+protected:
+  uint16_t              m_TransportStreamId;
+  uint8_t               m_Version;
+  std::vector<xProgram> m_Programs;
+
+public:
+  void    Reset();
+  int32_t Parse(const uint8_t* Section, uint32_t Length);
+  void    Print() const;
+
+public:
+  uint16_t        getTransportStreamId() const { return m_TransportStreamId; }
+  uint8_t         getVersion          () const { return m_Version; }
+  uint32_t        getNumPrograms      () const { return (uint32_t)m_Programs.size(); }
+  const xProgram& getProgram          (uint32_t Idx) const { return m_Programs[Idx]; }
+};
+
+//=============================================================================================================================================================================
+
+class xPSI_PMT
+{
+public:
+  enum eStreamCategory : uint8_t
+  {
+    eStreamCategory_Other = 0x01,
+    eStreamCategory_Audio = 0x02,
+    eStreamCategory_Video = 0x04,
+    eStreamCategory_All   = 0x07,
+  };
+
+  struct xElementaryStream
+  {
+    uint8_t  StreamType;
+    uint8_t  Category;    // eStreamCategory
+    uint16_t PID;
+  };
+
+protected:
+  uint16_t                       m_ProgramNumber;
+  uint8_t                        m_Version;
+  uint16_t                       m_PCR_PID;
+  std::vector<xElementaryStream> m_Streams;
+
+public:
+  void    Reset();
+  int32_t Parse(const uint8_t* Section, uint32_t Length);
+  void    Print() const;
+
+  static uint8_t ClassifyStream(uint8_t StreamType, const uint8_t* Descriptors, uint32_t DescriptorsLength);
+
+public:
+  uint16_t                 getProgramNumber() const { return m_ProgramNumber; }
+  uint8_t                  getVersion      () const { return m_Version; }
+  uint16_t                 getPCR_PID      () const { return m_PCR_PID; }
+  uint32_t                 getNumStreams   () const { return (uint32_t)m_Streams.size(); }
+  const xElementaryStream& getStream       (uint32_t Idx) const { return m_Streams[Idx]; }
+};
@@ -0,0 +1,173 @@
+#include "tsParallelDemuxer.h"
+#include <thread>
+
+//=============================================================================================================================================================================
+// xTS_ParallelDemuxer
+//=============================================================================================================================================================================
+
+/// @brief Packet starts new PES - it has PUSI, payload and valid payload offset, so the assembler state before it does not matter
+static inline bool xStartsPES(const uint8_t* Packet)
+{
+    if (!(Packet[1] & 0x40) || !(Packet[3] & 0x10))
+        return false;
+    return !(Packet[3] & 0x20) || xTS::TS_HeaderLength + Packet[4] + 1u <= xTS::TS_PacketLength;
+}
+
+xTS_ParallelDemuxer::xTS_ParallelDemuxer(xTS_Demuxer& Demuxer, uint32_t NumThreads, uint64_t ChunkSize)
+    : m_Demuxer(Demuxer), m_NumThreads(NumThreads != 0 ? NumThreads : 1), m_ChunkSize(ChunkSize), m_Data(nullptr), m_Size(0),
+      m_NextChunk(0), m_NumMerged(0), m_NextPosition(0), m_NumPackets(0), m_NumSkippedBytes(0), m_NumSyncLosses(0)
+{
+    m_PID_Index.fill(-1);
+}
+
+/**
+  @brief Demux [Begin, Size) of Data on worker threads, output goes to PIDs demuxed by Demuxer passed to constructor
+  @param Data is pointer to whole input (memory-mapped file)
+  @param Size is size of whole input
+  @param Begin is position of first packet not processed by Demuxer yet
+  @param PacketSize is stride of packets (188, 192 or 204) - chunks are whole multiples of it
+ */
+void xTS_ParallelDemuxer::Run(const uint8_t* Data, uint64_t Size, uint64_t Begin, uint32_t PacketSize)
+{
+    m_Data = Data;
+    m_Size = Size;
+    m_PIDs = m_Demuxer.getDemuxedPIDs();
+    for (uint32_t i = 0; i < m_PIDs.size(); i++)
+        m_PID_Index[m_PIDs[i]] = (int16_t)i;
+
+    if (PacketSize == 0)
+        PacketSize = xTS::TS_PacketLength;
+    const uint64_t ChunkSize = (m_ChunkSize > PacketSize ? m_ChunkSize / PacketSize : 1) * PacketSize;
+
+    m_Chunks.clear();
+    for (uint64_t Position = Begin; Position < Size; Position += ChunkSize) {
+        m_Chunks.emplace_back();
+        xChunk& Chunk = m_Chunks.back();
+        Chunk.Begin = Position;
+        Chunk.End   = Size - Position > ChunkSize ? Position + ChunkSize : Size;
+        Chunk.NumPackets = Chunk.NumSkippedBytes = Chunk.NumSyncLosses = 0;
+        Chunk.Done  = false;
+    }
+    m_NextChunk = 0;
+    m_NumMerged = 0;
+    m_NextPosition = Begin;
+
+    std::vector<std::thread> Workers;
+    for (uint32_t i = 0; i < m_NumThreads && i < m_Chunks.size(); i++)
+        Workers.emplace_back(&xTS_ParallelDemuxer::xWorker, this);
+
+    for (xChunk& Chunk : m_Chunks) {
+        {
+            std::unique_lock<std::mutex> Lock(m_Mutex);
+            m_ChunkDone.wait(Lock, [&Chunk] { return Chunk.Done; });
+        }
+        xMergeChunk(Chunk);
+        {
+            std::lock_guard<std::mutex> Lock(m_Mutex);
+            m_NumMerged++;
+        }
+        m_WindowFree.notify_all();
+    }
+
+    for (std::thread& Worker : Workers)
+        Worker.join();
+}
+
+void xTS_ParallelDemuxer::xWorker()
+{
+    const uint32_t Window = 2 * m_NumThreads;
+    for (;;) {
+        uint32_t Idx;
+        {
+            std::unique_lock<std::mutex> Lock(m_Mutex);
+            m_WindowFree.wait(Lock, [this, Window] { return m_NextChunk >= m_Chunks.size() || m_NextChunk < m_NumMerged + Window; });
+            if (m_NextChunk >= m_Chunks.size())
+                return;
+            Idx = m_NextChunk++;
+        }
+        xDemuxChunk(m_Chunks[Idx]);
+        {
+            std::lock_guard<std::mutex> Lock(m_Mutex);
+            m_Chunks[Idx].Done = true;
+        }
+        m_ChunkDone.notify_all();
+    }
+}
+
+void xTS_ParallelDemuxer::xDemuxChunk(xChunk& Chunk)
+{
+    const uint32_t NumPIDs = (uint32_t)m_PIDs.size();
+    Chunk.Demuxer.reset(new xTS_Demuxer());
+    Chunk.Outputs.resize(NumPIDs);
+    Chunk.Heads.resize(NumPIDs);
+    Chunk.Started.assign(NumPIDs, 0);
+    Chunk.StartCC.assign(NumPIDs, 0);
+    for (uint32_t i = 0; i < NumPIDs; i++)
+        Chunk.Demuxer->AddPID(m_PIDs[i], &Chunk.Outputs[i]);
+
+    xTS_PacketReader Reader;
+    Reader.Init(m_Data, m_Size, Chunk.Begin, Chunk.End);
+
+    // Until every PID has started a PES, packets are checked one by one
+    uint32_t NumPending = NumPIDs;
+    const uint8_t* Packet = Reader.getNextPacket();
+    Chunk.FirstPacket = Packet != nullptr ? Packet - m_Data : Chunk.End;
+    for (; Packet != nullptr; Packet = NumPending > 0 ? Reader.getNextPacket() : nullptr) {
+        const int32_t Idx = m_PID_Index[xTS_HeaderLayout::PID::Get(Packet)];
+        if (Idx < 0)
+            continue;
+        if (!Chunk.Started[Idx]) {
+            if (!xStartsPES(Packet)) {
+                Chunk.Heads[Idx].push_back(Packet);
+                continue;
+            }
+            Chunk.Started[Idx] = 1;
+            Chunk.StartCC[Idx] = (uint8_t)xTS_HeaderLayout::ContinuityCounter::Get(Packet);
+            NumPending--;
+        }
+        Chunk.Demuxer->ProcessPacket(Packet);
+    }
+
+    const uint8_t* Packets[xTS_PacketHeaderBatch::MaxPackets];
+    for (uint32_t NumPackets; (NumPackets = Reader.getNextPackets(Packets, xTS_PacketHeaderBatch::MaxPackets)) != 0;)
+        Chunk.Demuxer->ProcessBatch(Packets, NumPackets, [](uint32_t, xPES_Assembler::eResult) {});
+
+    Chunk.NextPosition    = Reader.getPosition();
+    Chunk.NumPackets      = Reader.getNumPackets();
+    Chunk.NumSkippedBytes = Reader.getNumSkippedBytes();
+    Chunk.NumSyncLosses   = Reader.getNumSyncLosses();
+}
+
+void xTS_ParallelDemuxer::xMergeChunk(xChunk& Chunk)
+{
+    for (uint32_t i = 0; i < m_PIDs.size(); i++) {
+        const uint16_t PID = m_PIDs[i];
+        xPES_Assembler* Assembler = m_Demuxer.getAssembler(PID);
+
+        // Tail of PES left open by previous chunk
+        for (const uint8_t* Packet : Chunk.Heads[i])
+            m_Demuxer.ProcessPacket(Packet);
+
+        if (!Chunk.Started[i])
+            continue;
+
+        // First PUSI of chunk ends PES of unspecified length - or drops it after a continuity gap, as in sequential run
+        Assembler->FinishBefore(Chunk.StartCC[i]);
+        const std::vector<uint8_t>& Output = Chunk.Outputs[i].getMemory();
+        if (Assembler->getOutput() != nullptr && !Output.empty())
+            Assembler->getOutput()->Write(Output.data(), Output.size());
+        Assembler->AdoptState(*Chunk.Demuxer->getAssembler(PID));
+        m_Demuxer.AddStats(PID, Chunk.Demuxer->getStats(PID));
+    }
+
+    // Bytes before first packet were skipped only if last packet of previous chunk did not cover them
+    const uint64_t Covered = m_NextPosition > Chunk.Begin ? m_NextPosition : Chunk.Begin;
+    m_NumSkippedBytes += Chunk.NumSkippedBytes - (Chunk.FirstPacket - Chunk.Begin) + (Chunk.FirstPacket > Covered ? Chunk.FirstPacket - Covered : 0);
+    m_NumPackets      += Chunk.NumPackets;
+    m_NumSyncLosses   += Chunk.NumSyncLosses;
+    m_NextPosition     = Chunk.NextPosition;
+
+    Chunk.Demuxer.reset();
+    std::vector<xTS_OutputSink>().swap(Chunk.Outputs);
+    std::vector<std::vector<const uint8_t*>>().swap(Chunk.Heads);
+}
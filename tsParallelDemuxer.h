@@ -0,0 +1,95 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsDemuxer.h"
+#include "tsInputSource.h"
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Parallel chunked demuxer
+//=============================================================================================================================================================================
+
+/*
+Demuxes a memory-mapped file on several worker threads. The PID table must be
+complete before (PSI discovery runs sequentially on the beginning of the file
+in the xTS_Demuxer passed in) - PAT/PMT changes inside chunks are not followed.
+
+The rest of the file is split into chunks of whole packets. Each worker demuxes
+one chunk with its own xTS_Demuxer whose outputs are kept in memory. Packets of
+a PID before its first payload_unit_start_indicator in the chunk belong to the
+PES left open by the previous chunk - they are not processed by the worker but
+set aside as pointers into the mapping.
+
+Chunks are merged strictly in file order on the calling thread: set-aside
+packets are fed to the main demuxer (continuing its PES and CC state), PES
+still open is finished or dropped as the chunk's first PUSI packet would do
+(xPES_Assembler::FinishBefore with the CC recorded by the worker), the chunk
+output is appended to the output files, and the assembler state left open at
+the end of the chunk is taken over. Output is therefore byte-identical to a
+sequential run. Workers run at most 2 * NumThreads chunks ahead of the merge,
+which bounds memory use.
+*/
+
+class xTS_ParallelDemuxer
+{
+public:
+  static constexpr uint64_t DefaultChunkSize = 16 << 20;
+
+protected:
+  struct xChunk
+  {
+    uint64_t                                 Begin;
+    uint64_t                                 End;
+    std::unique_ptr<xTS_Demuxer>             Demuxer;
+    std::vector<xTS_OutputSink>              Outputs; // in-memory output per demuxed PID
+    std::vector<std::vector<const uint8_t*>> Heads;   // packets before first PUSI per demuxed PID
+    std::vector<uint8_t>                     Started; // first PUSI seen per demuxed PID
+    std::vector<uint8_t>                     StartCC; // CC of first PUSI packet per demuxed PID
+    uint64_t                                 FirstPacket;  // position of first packet (End if none)
+    uint64_t                                 NextPosition; // position following last packet
+    uint64_t                                 NumPackets;
+    uint64_t                                 NumSkippedBytes;
+    uint64_t                                 NumSyncLosses;
+    bool                                     Done;
+  };
+
+  xTS_Demuxer&            m_Demuxer;
+  uint32_t                m_NumThreads;
+  uint64_t                m_ChunkSize;
+  const uint8_t*          m_Data;
+  uint64_t                m_Size;
+  std::vector<uint16_t>   m_PIDs;
+  std::array<int16_t, xTS_Demuxer::NumPIDs> m_PID_Index; // -1 = not demuxed
+
+  std::vector<xChunk>     m_Chunks;
+  std::mutex              m_Mutex;
+  std::condition_variable m_ChunkDone;
+  std::condition_variable m_WindowFree;
+  uint32_t                m_NextChunk;
+  uint32_t                m_NumMerged;
+  uint64_t                m_NextPosition; // position following last packet of merged chunks
+
+  //statistics
+  uint64_t                m_NumPackets;
+  uint64_t                m_NumSkippedBytes;
+  uint64_t                m_NumSyncLosses;
+
+public:
+  xTS_ParallelDemuxer(xTS_Demuxer& Demuxer, uint32_t NumThreads, uint64_t ChunkSize = DefaultChunkSize);
+
+  void Run(const uint8_t* Data, uint64_t Size, uint64_t Begin, uint32_t PacketSize);
+
+public:
+  uint32_t getNumChunks      () const { return (uint32_t)m_Chunks.size(); }
+  uint64_t getNumPackets     () const { return m_NumPackets; }
+  uint64_t getNumSkippedBytes() const { return m_NumSkippedBytes; }
+  uint64_t getNumSyncLosses  () const { return m_NumSyncLosses; }
+
+protected:
+  void xWorker     ();
+  void xDemuxChunk (xChunk& Chunk);
+  void xMergeChunk (xChunk& Chunk);
+};
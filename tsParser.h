@@ -0,0 +1,183 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include "tsPSI.h"
+#include "tsDemuxer.h"
+#include "tsInputSource.h"
+
+//=============================================================================================================================================================================
+// Push parser - library entry point
+//=============================================================================================================================================================================
+
+/*
+Parser for embedding: the caller pushes input it already holds - Feed() takes
+chunks of any size and alignment (xTS_ChunkReader locates packets, packets
+inside a chunk are not copied), FeedPackets() takes packets located elsewhere
+(network datagrams, pipeline slabs). Packets go through the xTS_Demuxer owned
+by the parser; events are delivered by calling methods of the handler given
+to the constructor. The handler type is a template parameter, so every call
+is resolved at compile time - no virtual call per packet. Finished PES reach
+the handler through the assembler's finished callback (one indirect call per
+PES).
+
+Handler methods (see xTS_ParserHandler - derive from it and define the ones
+needed, the empty defaults are hidden, not overridden):
+  OnPES   (xPES_Assembler& Assembler)    - PES finished: getPID(), getHeader(), getPacket() (TakePacket() keeps the payload)
+  OnPCR   (uint16_t PID, uint64_t PCR, uint64_t PacketId) - 27 MHz, any PID
+  OnTable (uint16_t PID, const uint8_t* Section, uint32_t Length) - PAT/PMT section with valid CRC_32 (after EnableDiscovery)
+  OnError (eError Error, uint16_t PID, uint64_t PacketId)
+  OnPacket(uint64_t PacketId, xPES_Assembler::eResult Result) - every packet of a demuxed or PSI PID, right after it is processed
+  OnBatch (const uint8_t* const* Packets, uint32_t NumPackets, uint64_t FirstPacketId) - every batch after it is demuxed (all PIDs)
+
+Nothing is printed and nothing is written unless PIDs are added with output
+files or sinks. Not thread safe - one parser per input, fed from one thread.
+*/
+
+class xTS_ParserHandler
+{
+public:
+  enum class eError : uint8_t
+  {
+    SyncLoss,       // sync byte missing at packet stride, input scanned for new lock (PID = InvalidPID)
+    TransportError, // transport_error_indicator set
+    PacketLost,     // continuity error or damaged packet on demuxed PID - PES being assembled is dropped
+    CRC_Error,      // PAT/PMT section with wrong CRC_32
+  };
+
+  static constexpr uint16_t InvalidPID = 0xFFFF;
+
+  static const char* getErrorName(eError Error)
+  {
+    switch (Error) {
+    case eError::SyncLoss:       return "sync loss";
+    case eError::TransportError: return "transport error";
+    case eError::PacketLost:     return "packet lost";
+    case eError::CRC_Error:      return "CRC error";
+    default:                     return "unknown";
+    }
+  }
+
+public:
+  void OnPES   (xPES_Assembler& /*Assembler*/) {}
+  void OnPCR   (uint16_t /*PID*/, uint64_t /*PCR*/, uint64_t /*PacketId*/) {}
+  void OnTable (uint16_t /*PID*/, const uint8_t* /*Section*/, uint32_t /*Length*/) {}
+  void OnError (eError /*Error*/, uint16_t /*PID*/, uint64_t /*PacketId*/) {}
+  void OnPacket(uint64_t /*PacketId*/, xPES_Assembler::eResult /*Result*/) {}
+  void OnBatch (const uint8_t* const* /*Packets*/, uint32_t /*NumPackets*/, uint64_t /*FirstPacketId*/) {}
+};
+
+template <class tHandler> class xTS_Parser
+{
+public:
+  typedef xTS_ParserHandler::eError eError;
+
+protected:
+  tHandler&           m_Handler;
+  xTS_Demuxer         m_Demuxer;
+  xTS_ChunkReader     m_Reader;
+  xTS_AdaptationField m_AdaptationField;
+  uint64_t            m_NumPackets;
+  uint64_t            m_NumSyncLosses;   // reported
+  uint64_t            m_NumCRC_Errors;   // reported
+
+public:
+  xTS_Parser(tHandler& Handler) : m_Handler(Handler), m_NumPackets(0), m_NumSyncLosses(0), m_NumCRC_Errors(0) { m_Demuxer.SetFinishedCallback(&xOnFinished, this); }
+  xTS_Parser(const xTS_Parser&) = delete;
+  xTS_Parser& operator=(const xTS_Parser&) = delete;
+
+  /// @brief Demux PID - PES are passed to OnPES and appended to Output if given (not owned)
+  xPES_Assembler* AddPID(uint16_t PID, xTS_OutputSink* Output = nullptr) { return m_Demuxer.AddPID(PID, Output); }
+  /// @brief Follow PAT/PMT (OnTable) and demux streams of selected xPSI_PMT::eStreamCategory (0 = tables only)
+  void EnableDiscovery(uint8_t StreamSelection, const std::string& OutputFileName = std::string()) { m_Demuxer.EnableDiscovery(StreamSelection, OutputFileName); }
+
+  void Feed       (const uint8_t* Data, size_t Size, bool EndOfInput = false);
+  void FeedPackets(const uint8_t* const* Packets, uint32_t NumPackets);
+  void Finish     ();
+
+public:
+  xTS_Demuxer&           getDemuxer   () { return m_Demuxer; }
+  const xTS_Demuxer&     getDemuxer   () const { return m_Demuxer; }
+  const xTS_ChunkReader& getReader    () const { return m_Reader; }
+  uint64_t               getNumPackets() const { return m_NumPackets; }
+
+protected:
+  void        xProcess    (const uint8_t* const* Packets, uint32_t NumPackets);
+  void        xReportSync ();
+  static void xOnFinished (void* Context, xPES_Assembler& Assembler) { static_cast<xTS_Parser*>(Context)->m_Handler.OnPES(Assembler); }
+};
+
+//=============================================================================================================================================================================
+
+/**
+  @brief Parse next chunk of input
+  @param Data is chunk of any size - packets may straddle chunks (a few hundred bytes at its end are copied until the next call)
+  @param EndOfInput is true for the last chunk - packets at its end are passed at once and PES are finished as by Finish
+ */
+template <class tHandler> void xTS_Parser<tHandler>::Feed(const uint8_t* Data, size_t Size, bool EndOfInput)
+{
+    m_Reader.Feed(Data, Size, EndOfInput, [this](const uint8_t* const* Packets, uint32_t NumPackets) { xProcess(Packets, NumPackets); });
+    xReportSync();
+    if (EndOfInput)
+        m_Demuxer.Flush();
+}
+
+/**
+  @brief Parse packets located by the caller
+  @param Packets is array of pointers to 188 byte TS packets (any stride)
+ */
+template <class tHandler> void xTS_Parser<tHandler>::FeedPackets(const uint8_t* const* Packets, uint32_t NumPackets)
+{
+    for (uint32_t First = 0; First < NumPackets; First += xTS_PacketHeaderBatch::MaxPackets)
+        xProcess(Packets + First, NumPackets - First < xTS_PacketHeaderBatch::MaxPackets ? NumPackets - First : xTS_PacketHeaderBatch::MaxPackets);
+}
+
+/// @brief End of input - parse carried bytes, finish PES of unspecified length and flush output files
+template <class tHandler> void xTS_Parser<tHandler>::Finish()
+{
+    m_Reader.Finish([this](const uint8_t* const* Packets, uint32_t NumPackets) { xProcess(Packets, NumPackets); });
+    xReportSync();
+    m_Demuxer.Flush();
+}
+
+template <class tHandler> void xTS_Parser<tHandler>::xProcess(const uint8_t* const* Packets, uint32_t NumPackets)
+{
+    const uint64_t FirstPacketId = m_NumPackets;
+    m_Demuxer.ProcessBatch(Packets, NumPackets, [&](uint32_t PacketIdx, xPES_Assembler::eResult Result) {
+        const uint16_t PID = m_Demuxer.getBatch().getPID(PacketIdx);
+        if (Result == xPES_Assembler::eResult::StreamPackedLost)
+            m_Handler.OnError(eError::PacketLost, PID, FirstPacketId + PacketIdx);
+        const xPSI_SectionAssembler* Assembler = m_Demuxer.getSectionAssembler(PID);
+        if (Assembler != nullptr) {
+            // Demuxer has already acted on sections (new PIDs from PAT/PMT), handler sees them after
+            for (uint32_t s = 0; s < Assembler->getNumCompleted(); s++)
+                m_Handler.OnTable(PID, Assembler->getSection(s), Assembler->getSectionLength(s));
+            const uint64_t NumCRC_Errors = m_Demuxer.getNumCRC_Errors();
+            if (NumCRC_Errors != m_NumCRC_Errors) {
+                m_NumCRC_Errors = NumCRC_Errors;
+                m_Handler.OnError(eError::CRC_Error, PID, FirstPacketId + PacketIdx);
+            }
+        }
+        m_Handler.OnPacket(FirstPacketId + PacketIdx, Result);
+    });
+
+    // Header columns of whole batch - transport errors and PCR of any PID
+    const xTS_PacketHeaderBatch& Batch = m_Demuxer.getBatch();
+    for (uint32_t i = 0; i < NumPackets; i++) {
+        if (Batch.getTEI(i))
+            m_Handler.OnError(eError::TransportError, Batch.getPID(i), FirstPacketId + i);
+        // Cheap byte test first - adaptation field view decodes nothing but the length byte
+        const uint8_t* Packet = Packets[i];
+        if (Batch.getSB(i) == 0x47 && (Batch.getAFC(i) & 0x02) && Packet[4] >= 7 && (Packet[5] & xTS_AdaptationField::eFlag_PCR)) {
+            m_AdaptationField.Parse(Packet, xTS::TS_PacketLength, Batch.getAFC(i));
+            m_Handler.OnPCR(Batch.getPID(i), m_AdaptationField.getPCR(), FirstPacketId + i);
+        }
+    }
+    m_Handler.OnBatch(Packets, NumPackets, FirstPacketId);
+    m_NumPackets += NumPackets;
+}
+
+template <class tHandler> void xTS_Parser<tHandler>::xReportSync()
+{
+    for (; m_NumSyncLosses < m_Reader.getNumSyncLosses(); m_NumSyncLosses++)
+        m_Handler.OnError(eError::SyncLoss, xTS_ParserHandler::InvalidPID, m_NumPackets);
+}
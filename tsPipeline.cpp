@@ -0,0 +1,229 @@
+#include "tsPipeline.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//=============================================================================================================================================================================
+// xTS_Pipeline
+//=============================================================================================================================================================================
+
+xTS_Pipeline::xTS_Pipeline(xTS_Demuxer& Demuxer, uint32_t SlabSize, uint32_t NumSlabs, bool DropCache)
+    : m_Demuxer(Demuxer), m_SlabSize(((SlabSize > 2 * MaxCarrySize ? SlabSize : 2 * MaxCarrySize) + DirectAlignment - 1) / DirectAlignment * DirectAlignment), m_FreeSlabs(NumSlabs), m_FilledSlabs(NumSlabs),
+      m_FileDescriptor(-1), m_DropCache(DropCache), m_Direct(false), m_FillSlabs(true),
+      m_NumBytesRead(0), m_NumReadCalls(0), m_NumReaderStalls(0), m_NumSkippedBytes(0), m_NumSyncLosses(0), m_PacketSize(0), m_ReadError(false), m_ReadSeconds(0),
+      m_NumPackets(0), m_NumDemuxStalls(0), m_NumSlabs(0), m_SumQueueDepth(0), m_MaxQueueDepth(0)
+{
+    m_Slabs.resize(NumSlabs != 0 ? NumSlabs : 1);
+    for (xSlab& Slab : m_Slabs)
+        Slab.Buffer = static_cast<uint8_t*>(xAlignedAlloc(DirectAlignment, HeadSize + m_SlabSize));
+    for (const xSlab& Slab : m_Slabs) {
+        if (Slab.Buffer == nullptr) {
+            // Out of memory (direct slabs are several MiB each) - keep no slabs, Read fails without starting the reader
+            for (const xSlab& Allocated : m_Slabs)
+                xAlignedFree(Allocated.Buffer);
+            m_Slabs.clear();
+            return;
+        }
+    }
+    for (xSlab& Slab : m_Slabs) {
+        Slab.Data = Slab.Buffer + HeadSize;
+        Slab.Size = 0;
+        Slab.Packets.resize((MaxCarrySize + m_SlabSize) / xTS::TS_PacketLength + 1);
+        Slab.NumPackets = 0;
+        Slab.Last = false;
+    }
+}
+
+xTS_Pipeline::~xTS_Pipeline()
+{
+    xStop();
+    for (xSlab& Slab : m_Slabs)
+        xAlignedFree(Slab.Buffer);
+}
+
+/**
+  @brief Open input file for reading past the page cache - O_DIRECT where the file system supports it, plain open otherwise
+  @return file descriptor or -1 (read it with a pipeline constructed with DropCache)
+ */
+int xTS_Pipeline::OpenDirect(const char* FileName)
+{
+#if defined(_WIN32)
+    return _open(FileName, _O_RDONLY | _O_BINARY);
+#else
+    int FileDescriptor = -1;
+#if defined(O_DIRECT)
+    FileDescriptor = open(FileName, O_RDONLY | O_DIRECT);
+    if (FileDescriptor < 0 && errno == EINVAL)
+        FileDescriptor = open(FileName, O_RDONLY);
+#else
+    FileDescriptor = open(FileName, O_RDONLY);
+#if defined(F_NOCACHE)
+    if (FileDescriptor >= 0)
+        fcntl(FileDescriptor, F_NOCACHE, 1);
+#endif
+#endif
+    return FileDescriptor;
+#endif
+}
+
+void xTS_Pipeline::xStart(int FileDescriptor)
+{
+    // Reader thread is the producer of free ring until it starts
+    for (xSlab& Slab : m_Slabs)
+        m_FreeSlabs.tryPush(&Slab);
+    m_FileDescriptor = FileDescriptor;
+#if defined(_WIN32)
+    struct _stat FileStat;
+    m_FillSlabs = _fstat(FileDescriptor, &FileStat) == 0 && (FileStat.st_mode & _S_IFMT) == _S_IFREG;
+#else
+    struct stat FileStat;
+    m_FillSlabs = fstat(FileDescriptor, &FileStat) == 0 && S_ISREG(FileStat.st_mode);
+#endif
+#if defined(O_DIRECT)
+    const int Flags = fcntl(FileDescriptor, F_GETFL);
+    m_Direct = Flags >= 0 && (Flags & O_DIRECT) != 0;
+#endif
+    m_ReaderThread = std::thread(&xTS_Pipeline::xReaderMain, this);
+}
+
+void xTS_Pipeline::xStop()
+{
+    if (m_ReaderThread.joinable())
+        m_ReaderThread.join();
+    // Demux stage takes the rest so the rings are empty for next Run
+    xSlab* Slab;
+    while (m_FilledSlabs.tryPop(Slab)) {}
+    while (m_FreeSlabs.tryPop(Slab)) {}
+}
+
+xTS_Pipeline::xSlab* xTS_Pipeline::xPopFilled()
+{
+    xSlab* Slab;
+    if (!m_FilledSlabs.tryPop(Slab)) {
+        m_NumDemuxStalls++;
+        xBackoff Backoff;
+        while (!m_FilledSlabs.tryPop(Slab))
+            Backoff.Wait();
+    }
+    const uint32_t QueueDepth = m_FilledSlabs.getSize() + 1;
+    m_SumQueueDepth += QueueDepth;
+    m_MaxQueueDepth = QueueDepth > m_MaxQueueDepth ? QueueDepth : m_MaxQueueDepth;
+    m_NumSlabs++;
+    return Slab;
+}
+
+void xTS_Pipeline::xPushFree(xSlab* Slab)
+{
+    // Every slab fits into the ring - push cannot fail
+    m_FreeSlabs.tryPush(Slab);
+}
+
+void xTS_Pipeline::xReaderMain()
+{
+    const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+    uint8_t  Carry[MaxCarrySize];
+    uint32_t CarrySize = 0;
+    uint32_t LockedPacketSize = 0; // lock is kept across slabs
+    bool     EndOfInput = false;
+    xTS_PacketReader PacketReader;
+#if defined(POSIX_FADV_DONTNEED)
+    // Offset of regular file (-1 for pipes and sockets) - read ranges are dropped from page cache
+    const off_t FileBase = m_DropCache ? lseek(m_FileDescriptor, 0, SEEK_CUR) : (off_t)-1;
+    uint64_t    DroppedEnd = 0; // bytes after FileBase dropped from page cache
+    if (FileBase >= 0) {
+        posix_fadvise(m_FileDescriptor, FileBase, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(m_FileDescriptor, FileBase, 0, POSIX_FADV_NOREUSE);
+    }
+#endif
+
+    while (!EndOfInput) {
+        xSlab* Slab;
+        if (!m_FreeSlabs.tryPop(Slab)) {
+            m_NumReaderStalls++;
+            xBackoff Backoff;
+            while (!m_FreeSlabs.tryPop(Slab))
+                Backoff.Wait();
+        }
+
+        // Carry goes in front of the read area, which stays aligned for O_DIRECT
+        uint8_t* ReadArea = Slab->Buffer + HeadSize;
+        memcpy(ReadArea - CarrySize, Carry, CarrySize);
+        uint32_t ReadSize = 0;
+        EndOfInput = !xReadSlab(ReadArea, ReadSize, m_FillSlabs ? m_SlabSize : LiveMinSize - CarrySize);
+#if defined(POSIX_FADV_DONTNEED)
+        // Pages just read may not be droppable yet (readahead in flight, LRU batches) - drop range of previous slab, whole file at the end
+        if (FileBase >= 0 && (EndOfInput || m_NumBytesRead - ReadSize > DroppedEnd)) {
+            const uint64_t DropBegin = EndOfInput ? 0 : DroppedEnd;
+            posix_fadvise(m_FileDescriptor, FileBase + (off_t)DropBegin, EndOfInput ? 0 : (off_t)(m_NumBytesRead - ReadSize - DropBegin), POSIX_FADV_DONTNEED);
+            DroppedEnd = m_NumBytesRead - ReadSize;
+        }
+#endif
+
+        // Packets starting in the last MaxCarrySize bytes are located in next slab, where lock can be checked
+        const uint32_t Size = CarrySize + ReadSize;
+        const uint32_t End  = EndOfInput ? Size : Size - MaxCarrySize;
+        Slab->Data = ReadArea - CarrySize;
+        PacketReader.Init(Slab->Data, Size, 0, End, LockedPacketSize);
+        Slab->Size       = Size;
+        Slab->NumPackets = PacketReader.getNextPackets(Slab->Packets.data(), (uint32_t)Slab->Packets.size());
+        Slab->Last       = EndOfInput;
+        m_NumSkippedBytes += PacketReader.getNumSkippedBytes();
+        m_NumSyncLosses   += PacketReader.getNumSyncLosses();
+        if (PacketReader.getPacketSize() != 0)
+            m_PacketSize = PacketReader.getPacketSize();
+        LockedPacketSize = PacketReader.isLocked() ? PacketReader.getPacketSize() : 0;
+
+        const uint32_t CarryBegin = PacketReader.getPosition() < Size ? (uint32_t)PacketReader.getPosition() : Size;
+        CarrySize = EndOfInput ? 0 : Size - CarryBegin;
+        memcpy(Carry, Slab->Data + CarryBegin, CarrySize);
+
+        xBackoff Backoff;
+        while (!m_FilledSlabs.tryPush(Slab))
+            Backoff.Wait();
+    }
+    m_ReadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+}
+
+/**
+  @brief Read into read area of slab (up to m_SlabSize bytes) until it holds at least MinSize bytes or input ends
+  O_DIRECT reads keep address, offset and size aligned as long as the file does not end; a read refused after a short
+  one (EINVAL - unaligned offset) continues without O_DIRECT.
+  @return false at end of input or on read error
+ */
+bool xTS_Pipeline::xReadSlab(uint8_t* Data, uint32_t& Size, uint32_t MinSize)
+{
+    while (Size < MinSize) {
+        X_PROFILE_BEGIN(Start);
+#if defined(_WIN32)
+        const int Read = _read(m_FileDescriptor, Data + Size, m_SlabSize - Size);
+#else
+        const ssize_t Read = read(m_FileDescriptor, Data + Size, m_SlabSize - Size);
+#endif
+        m_NumReadCalls++;
+        if (Read < 0 && errno == EINTR)
+            continue;
+#if defined(O_DIRECT)
+        if (Read < 0 && errno == EINVAL && m_Direct) {
+            m_Direct = false;
+            if (fcntl(m_FileDescriptor, F_SETFL, fcntl(m_FileDescriptor, F_GETFL) & ~O_DIRECT) == 0)
+                continue;
+        }
+#endif
+        if (Read <= 0) {
+            m_ReadError |= Read < 0;
+            return false;
+        }
+        X_PROFILE_END(Start, Read, xProfiler::AllPIDs, (uint32_t)(Read / xTS::TS_PacketLength) + 1);
+        Size += (uint32_t)Read;
+        m_NumBytesRead += (uint64_t)Read;
+    }
+    return true;
+}
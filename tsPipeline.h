@@ -0,0 +1,179 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsDemuxer.h"
+#include "tsInputSource.h"
+#include "tsRing.h"
+#include <thread>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Reader -> demux -> writer pipeline
+//=============================================================================================================================================================================
+
+/*
+Three stages overlapping I/O, parsing and output for streamed input (pipes,
+sockets, files read with read()):
+ - reader thread fills pre-allocated slabs with input bytes and locates
+   packets in them (sync scanner), a few hundred bytes at the end of each slab
+   that may start an incomplete packet are carried over to the next slab;
+   slabs of a regular file are filled completely, live input (pipe, socket)
+   is passed on after every read that completes a packet, so it is demuxed
+   as it arrives,
+ - demux stage (the thread calling Run) dispatches packets of each slab
+   through xTS_Demuxer and hands the slab back (Read passes the packets to
+   any consumer instead, e.g. xTS_Parser),
+ - writer stage is the background thread of the demuxer's xTS_OutputWriter.
+Slabs travel reader -> demux over one SPSC ring and back over another, so the
+pipeline allocates nothing after construction (if the slabs cannot be
+allocated, getNumSlabs is 0 and Read/Run fail).
+
+For archives much larger than RAM the input can bypass the page cache
+(OpenDirect, DropCache): the file is opened with O_DIRECT where supported and
+read straight into the aligned slabs - the carried tail goes into a head
+room in front of the read area, so every read starts at an aligned address
+and file offset and has an aligned size. The slabs are the only buffers;
+memory use is NumSlabs x SlabSize however large the file is, and the reader
+thread keeps NumSlabs - 1 slabs of read-ahead in flight while the demux
+stage works on one. Where O_DIRECT is refused (tmpfs, some network file
+systems) the file is read normally and each slab's range is dropped from the
+page cache with posix_fadvise(POSIX_FADV_DONTNEED) once read.
+
+Counters show the bottleneck: reader stalls (no free slab - demux or writer is
+slower than input), demux stalls (no filled slab - input is the bottleneck),
+writer stalls (see xTS_OutputWriter::getNumStalls - output is the bottleneck)
+and the depth of the filled-slab ring seen by the demux stage.
+*/
+
+class xTS_Pipeline
+{
+public:
+  static constexpr uint32_t DefaultSlabSize = 1 << 20;
+  static constexpr uint32_t DefaultNumSlabs = 8;
+  static constexpr uint32_t MaxCarrySize    = xTS_SyncScanner::NumLockPackets * 204; // unchecked tail of slab, moved to next one
+  static constexpr uint32_t DirectAlignment = 4096;     // buffer address, file offset and size of O_DIRECT reads
+  static constexpr uint32_t HeadSize        = (MaxCarrySize + DirectAlignment - 1) / DirectAlignment * DirectAlignment; // room for carry in front of read area
+  static constexpr uint32_t DirectSlabSize  = 8 << 20;  // large blocks for direct input
+  static constexpr uint32_t DirectNumSlabs  = 4;        // one being demuxed, three read ahead
+  static constexpr uint32_t LiveMinSize     = MaxCarrySize + 204; // live input - slab holds a whole packet in front of the carried tail
+
+  struct xSlab
+  {
+    uint8_t*                    Buffer;  // allocation - HeadSize bytes of head room, then read area
+    uint8_t*                    Data;    // first byte of slab content (carry from previous slab, then bytes read)
+    uint32_t                    Size;
+    std::vector<const uint8_t*> Packets;
+    uint32_t                    NumPackets;
+    bool                        Last;    // end of input
+  };
+
+protected:
+  xTS_Demuxer&        m_Demuxer;
+  uint32_t            m_SlabSize;
+  std::vector<xSlab>  m_Slabs;
+  xSPSC_Ring<xSlab*>  m_FreeSlabs;   // demux -> reader
+  xSPSC_Ring<xSlab*>  m_FilledSlabs; // reader -> demux
+  std::thread         m_ReaderThread;
+  int                 m_FileDescriptor;
+  bool                m_DropCache;
+  bool                m_Direct;      // input opened with O_DIRECT (known in xStart)
+  bool                m_FillSlabs;   // input is regular file - read until slab is full (known in xStart)
+
+  //statistics - reader stage (valid after Run)
+  uint64_t            m_NumBytesRead;
+  uint64_t            m_NumReadCalls;
+  uint64_t            m_NumReaderStalls;
+  uint64_t            m_NumSkippedBytes;
+  uint64_t            m_NumSyncLosses;
+  uint32_t            m_PacketSize;
+  bool                m_ReadError;
+  double              m_ReadSeconds; // reader thread, start to end of input
+  //statistics - demux stage
+  uint64_t            m_NumPackets;
+  uint64_t            m_NumDemuxStalls;
+  uint64_t            m_NumSlabs;
+  uint64_t            m_SumQueueDepth;
+  uint32_t            m_MaxQueueDepth;
+
+public:
+  xTS_Pipeline(xTS_Demuxer& Demuxer, uint32_t SlabSize = DefaultSlabSize, uint32_t NumSlabs = DefaultNumSlabs, bool DropCache = false);
+  ~xTS_Pipeline();
+  xTS_Pipeline(const xTS_Pipeline&) = delete;
+  xTS_Pipeline& operator=(const xTS_Pipeline&) = delete;
+
+  template <class tHandler> bool Run(int FileDescriptor, tHandler&& Handler) { return Run(FileDescriptor, Handler, [](const uint8_t* const*, uint32_t) {}); }
+  template <class tHandler, class tBatchHandler> bool Run(int FileDescriptor, tHandler&& Handler, tBatchHandler&& BatchHandler);
+  template <class tBatchHandler> bool Read(int FileDescriptor, tBatchHandler&& BatchHandler);
+
+  static int OpenDirect(const char* FileName);
+
+public:
+  uint64_t getNumBytesRead    () const { return m_NumBytesRead; }
+  uint64_t getNumReadCalls    () const { return m_NumReadCalls; }
+  uint64_t getNumReaderStalls () const { return m_NumReaderStalls; }
+  uint64_t getNumDemuxStalls  () const { return m_NumDemuxStalls; }
+  uint32_t getMaxQueueDepth   () const { return m_MaxQueueDepth; }
+  double   getAvgQueueDepth   () const { return m_NumSlabs ? (double)m_SumQueueDepth / m_NumSlabs : 0.0; }
+  uint32_t getNumSlabs        () const { return (uint32_t)m_Slabs.size(); }
+  uint64_t getNumPackets      () const { return m_NumPackets; }
+  uint64_t getNumSkippedBytes () const { return m_NumSkippedBytes; }
+  uint64_t getNumSyncLosses   () const { return m_NumSyncLosses; }
+  uint32_t getPacketSize      () const { return m_PacketSize; }
+  uint32_t getSlabSize        () const { return m_SlabSize; }
+  bool     isDirect           () const { return m_Direct; }
+  double   getReadSeconds     () const { return m_ReadSeconds; }
+  double   getReadRate        () const { return m_ReadSeconds > 0 ? m_NumBytesRead / m_ReadSeconds : 0.0; } // bytes per second
+
+protected:
+  void   xStart     (int FileDescriptor);
+  void   xStop      ();
+  void   xReaderMain();
+  bool   xReadSlab  (uint8_t* Data, uint32_t& Size, uint32_t MinSize); // false at end of input
+  xSlab* xPopFilled ();
+  void   xPushFree  (xSlab* Slab);
+};
+
+//=============================================================================================================================================================================
+
+/**
+  @brief Demux whole input read from FileDescriptor, reading runs on a separate thread
+  @param FileDescriptor is open input (not closed)
+  @param Handler is called as Handler(PacketId, eResult) for every wanted packet (see xTS_Demuxer::ProcessBatch)
+  @param BatchHandler is called as BatchHandler(Packets, NumPackets) after each batch is demuxed (packets of all PIDs, valid during the call)
+  @return false on read error (or slabs not allocated)
+ */
+template <class tHandler, class tBatchHandler> bool xTS_Pipeline::Run(int FileDescriptor, tHandler&& Handler, tBatchHandler&& BatchHandler)
+{
+    return Read(FileDescriptor, [&](const uint8_t* const* Packets, uint32_t NumPackets) {
+        const uint64_t FirstPacketId = m_NumPackets;
+        m_Demuxer.ProcessBatch(Packets, NumPackets, [&](uint32_t PacketIdx, xPES_Assembler::eResult Result) {
+            Handler(FirstPacketId + PacketIdx, Result);
+        });
+        BatchHandler(Packets, NumPackets);
+    });
+}
+
+/**
+  @brief Read whole input on a separate thread and pass located packets on, without demuxing (caller's consumer does it, e.g. xTS_Parser)
+  @param BatchHandler is called as BatchHandler(Packets, NumPackets) with up to xTS_PacketHeaderBatch::MaxPackets packets (valid during the call)
+  @return false on read error (or slabs not allocated)
+ */
+template <class tBatchHandler> bool xTS_Pipeline::Read(int FileDescriptor, tBatchHandler&& BatchHandler)
+{
+    if (m_Slabs.empty())
+        return false;
+    xStart(FileDescriptor);
+    for (;;) {
+        xSlab* Slab = xPopFilled();
+        for (uint32_t First = 0; First < Slab->NumPackets; First += xTS_PacketHeaderBatch::MaxPackets) {
+            const uint32_t NumPackets = Slab->NumPackets - First < xTS_PacketHeaderBatch::MaxPackets ? Slab->NumPackets - First : xTS_PacketHeaderBatch::MaxPackets;
+            BatchHandler(Slab->Packets.data() + First, NumPackets);
+            m_NumPackets += NumPackets;
+        }
+        const bool Last = Slab->Last;
+        xPushFree(Slab);
+        if (Last)
+            break;
+    }
+    xStop();
+    return !m_ReadError;
+}
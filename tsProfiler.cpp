@@ -0,0 +1,202 @@
+#include "tsProfiler.h"
+#include <chrono>
+#include <csignal>
+#include <thread>
+
+//=============================================================================================================================================================================
+// xProfiler
+//=============================================================================================================================================================================
+
+thread_local xProfiler::xThreadProfile* xProfiler::t_Profile = nullptr;
+std::mutex                                   xProfiler::s_Mutex;
+std::vector<xProfiler::xThreadProfile*>      xProfiler::s_Threads; // live until exit - threads may end before the final dump
+
+static const uint64_t                              s_StartTicks    = xProfiler::getTicks();
+static const std::chrono::steady_clock::time_point s_StartTime     = std::chrono::steady_clock::now();
+static FILE*                                       s_Output        = nullptr;
+static std::thread                                 s_Monitor;
+static std::atomic<bool>                           s_Running{false};
+static volatile sig_atomic_t                       s_DumpRequested = 0;
+
+static const char* const c_StageNames[] = { "read", "header-parse", "af-parse", "pes-header-parse", "buffer-append", "write" };
+
+#if defined(TS_PROFILE)
+bool xProfiler::isEnabled() { return true; }
+#else
+bool xProfiler::isEnabled() { return false; }
+#endif
+
+const char* xProfiler::getStageName(eStage Stage)
+{
+    return Stage < eStage::NumStages ? c_StageNames[(uint32_t)Stage] : "unknown";
+}
+
+uint64_t xProfiler::getBucketValue(uint32_t Bucket)
+{
+    if (Bucket < NumSubBuckets)
+        return Bucket;
+    const uint32_t Exponent = (Bucket - NumSubBuckets) / NumSubBuckets + 2;
+    const uint64_t SubBucket = (Bucket - NumSubBuckets) % NumSubBuckets;
+    return (NumSubBuckets + SubBucket) << (Exponent - 2);
+}
+
+uint64_t xProfiler::xSteadyNanoseconds()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+xProfiler::xThreadProfile* xProfiler::xRegisterThread()
+{
+    xThreadProfile* Profile = new xThreadProfile();
+    for (std::atomic<xPID_Profile*>& PID : Profile->PIDs)
+        PID.store(nullptr, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> Lock(s_Mutex);
+        s_Threads.push_back(Profile);
+    }
+    t_Profile = Profile;
+    return Profile;
+}
+
+xProfiler::xPID_Profile* xProfiler::xAddPID(xThreadProfile* Profile, uint32_t PID)
+{
+    xPID_Profile* PID_Profile = new xPID_Profile();
+    for (xHistogram& Histogram : PID_Profile->Stages) {
+        for (std::atomic<uint64_t>& Bucket : Histogram.Buckets)
+            Bucket.store(0, std::memory_order_relaxed);
+        Histogram.NumItems.store(0, std::memory_order_relaxed);
+        Histogram.SumTicks.store(0, std::memory_order_relaxed);
+        Histogram.MaxTicks.store(0, std::memory_order_relaxed);
+    }
+    // Published to dumping thread
+    Profile->PIDs[PID].store(PID_Profile, std::memory_order_release);
+    return PID_Profile;
+}
+
+static void xOnDumpSignal(int)
+{
+    s_DumpRequested = 1;
+}
+
+/**
+  @brief Start dumping on SIGUSR1 (checked every 100 ms by a monitor thread), no-op unless built with TS_PROFILE
+  @param Output is stream receiving dumps (not closed)
+ */
+void xProfiler::Start(FILE* Output)
+{
+    if (!isEnabled() || s_Running.load())
+        return;
+    s_Output = Output;
+    s_Running.store(true);
+#if !defined(_WIN32)
+    signal(SIGUSR1, xOnDumpSignal);
+#endif
+    s_Monitor = std::thread([]() {
+        while (s_Running.load(std::memory_order_relaxed)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (s_DumpRequested) {
+                s_DumpRequested = 0;
+                Dump(s_Output);
+            }
+        }
+    });
+}
+
+/// @brief Stop monitor thread and write final dump
+void xProfiler::Stop()
+{
+    if (!s_Running.load())
+        return;
+    s_Running.store(false);
+    s_Monitor.join();
+#if !defined(_WIN32)
+    signal(SIGUSR1, SIG_DFL);
+#endif
+    Dump(s_Output);
+}
+
+/// @brief Write histograms merged over threads - items, total ticks and share, ticks per item (mean, percentiles, max)
+void xProfiler::Dump(FILE* Output)
+{
+    if (!isEnabled() || Output == nullptr)
+        return;
+
+    struct xMerged
+    {
+        uint64_t Buckets[NumBuckets];
+        uint64_t NumItems;
+        uint64_t SumTicks;
+        uint64_t MaxTicks;
+    };
+    std::vector<xThreadProfile*> Threads;
+    {
+        std::lock_guard<std::mutex> Lock(s_Mutex);
+        Threads = s_Threads;
+    }
+
+    const double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - s_StartTime).count();
+    const double TicksPerSecond = Seconds > 0 ? (getTicks() - s_StartTicks) / Seconds : 0.0;
+
+    // Merge first - share needs total over all rows
+    std::vector<std::pair<uint32_t, std::vector<xMerged>>> Rows;
+    uint64_t TotalTicks = 0;
+    for (uint32_t PID = 0; PID <= NumPIDs; PID++) {
+        std::vector<xMerged> Stages;
+        for (const xThreadProfile* Thread : Threads) {
+            const xPID_Profile* PID_Profile = Thread->PIDs[PID].load(std::memory_order_acquire);
+            if (PID_Profile == nullptr)
+                continue;
+            if (Stages.empty())
+                Stages.resize((uint32_t)eStage::NumStages, xMerged{});
+            for (uint32_t s = 0; s < (uint32_t)eStage::NumStages; s++) {
+                const xHistogram& Histogram = PID_Profile->Stages[s];
+                xMerged& Merged = Stages[s];
+                for (uint32_t b = 0; b < NumBuckets; b++)
+                    Merged.Buckets[b] += Histogram.Buckets[b].load(std::memory_order_relaxed);
+                Merged.NumItems += Histogram.NumItems.load(std::memory_order_relaxed);
+                Merged.SumTicks += Histogram.SumTicks.load(std::memory_order_relaxed);
+                const uint64_t MaxTicks = Histogram.MaxTicks.load(std::memory_order_relaxed);
+                Merged.MaxTicks = MaxTicks > Merged.MaxTicks ? MaxTicks : Merged.MaxTicks;
+                TotalTicks += Histogram.SumTicks.load(std::memory_order_relaxed);
+            }
+        }
+        if (!Stages.empty())
+            Rows.emplace_back(PID, std::move(Stages));
+    }
+
+#if defined(X_ARCH_X86)
+    fprintf(Output, "Profile: %zu threads, TSC %.3f GHz, ticks per item\n", Threads.size(), TicksPerSecond / 1e9);
+#else
+    fprintf(Output, "Profile: %zu threads, ticks are ns, ticks per item\n", Threads.size());
+#endif
+    fprintf(Output, "  %-5s %-17s %12s %10s %6s %9s %9s %9s %9s %9s\n", "PID", "stage", "items", "Mticks", "share", "mean", "p50", "p90", "p99", "max");
+    for (const std::pair<uint32_t, std::vector<xMerged>>& Row : Rows) {
+        char PID[8];
+        if (Row.first == AllPIDs)
+            snprintf(PID, sizeof(PID), "all");
+        else
+            snprintf(PID, sizeof(PID), "%u", Row.first);
+        for (uint32_t s = 0; s < (uint32_t)eStage::NumStages; s++) {
+            const xMerged& Merged = Row.second[s];
+            if (Merged.NumItems == 0)
+                continue;
+            const double Quantiles[] = { 0.5, 0.9, 0.99 };
+            uint64_t Values[3] = { 0, 0, 0 };
+            for (uint32_t q = 0; q < 3; q++) {
+                const uint64_t Rank = (uint64_t)(Quantiles[q] * Merged.NumItems);
+                uint64_t Count = 0;
+                for (uint32_t b = 0; b < NumBuckets; b++) {
+                    Count += Merged.Buckets[b];
+                    if (Count > Rank) {
+                        Values[q] = getBucketValue(b);
+                        break;
+                    }
+                }
+            }
+            fprintf(Output, "  %-5s %-17s %12" PRIu64 " %10.2f %5.1f%% %9.1f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 "\n",
+                    PID, getStageName((eStage)s), Merged.NumItems, Merged.SumTicks / 1e6, TotalTicks ? 100.0 * Merged.SumTicks / TotalTicks : 0.0,
+                    (double)Merged.SumTicks / Merged.NumItems, Values[0], Values[1], Values[2], Merged.MaxTicks);
+        }
+    }
+    fflush(Output);
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include "tsCommon.h"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Hot-path stage profiler
+//=============================================================================================================================================================================
+
+/*
+Build with -DTS_PROFILE to time parsing stages with the time stamp counter
+(rdtsc, steady_clock elsewhere). Without the define the X_PROFILE_* macros
+expand to nothing and isEnabled() is false.
+
+  X_PROFILE_BEGIN(Start);
+  ...stage...
+  X_PROFILE_END(Start, AF_Parse, PID, 1);
+
+Samples go to per-thread, per-PID histograms with log buckets (4 sub-buckets
+per power of two, so percentiles are within 25%) - recording is a few
+non-atomic adds on memory owned by the calling thread. Samples covering
+several items (a batch of headers) are counted as NumItems items of the
+average cost. Stages not tied to one PID are recorded under AllPIDs. Values
+include reading the counter itself (a few tens of ticks).
+
+Start() installs a SIGUSR1 handler that dumps the histograms merged over
+threads while running; Stop() dumps them once more.
+*/
+
+#if defined(TS_PROFILE)
+#define X_PROFILE_BEGIN(Start)                      const uint64_t Start = xProfiler::getTicks()
+#define X_PROFILE_END(Start, Stage, PID, NumItems)  xProfiler::Record(xProfiler::eStage::Stage, (PID), xProfiler::getTicks() - (Start), (NumItems))
+#else
+#define X_PROFILE_BEGIN(Start)                      do {} while (0)
+#define X_PROFILE_END(Start, Stage, PID, NumItems)  do {} while (0)
+#endif
+
+class xProfiler
+{
+public:
+  enum class eStage : uint8_t
+  {
+    Read = 0,      // sync scanning of mapped input, read() of pipeline
+    HeaderParse,   // TS header decode (batch: AllPIDs, per packet: PID)
+    AF_Parse,
+    PES_HeaderParse,
+    BufferAppend,
+    Write,         // copy to output buffers (PID), write calls of background writer (AllPIDs)
+    NumStages,
+  };
+
+  static constexpr uint32_t NumPIDs        = 8192;
+  static constexpr uint16_t AllPIDs        = NumPIDs; // stages not attributed to single PID
+  static constexpr uint32_t NumSubBuckets  = 4;
+  static constexpr uint32_t NumBuckets     = NumSubBuckets + 48 * NumSubBuckets; // up to 2^50 ticks
+
+  struct xHistogram
+  {
+    std::atomic<uint64_t> Buckets[NumBuckets];
+    std::atomic<uint64_t> NumItems;
+    std::atomic<uint64_t> SumTicks;
+    std::atomic<uint64_t> MaxTicks; // per item
+  };
+
+protected:
+  struct xPID_Profile
+  {
+    xHistogram Stages[(uint32_t)eStage::NumStages];
+  };
+
+  struct xThreadProfile
+  {
+    std::atomic<xPID_Profile*> PIDs[NumPIDs + 1];
+  };
+
+  static thread_local xThreadProfile* t_Profile;
+  static std::mutex                   s_Mutex;
+  static std::vector<xThreadProfile*> s_Threads;
+
+public:
+  static bool        isEnabled   ();
+  static void        Start       (FILE* Output);
+  static void        Stop        ();
+  static void        Dump        (FILE* Output);
+  static const char* getStageName(eStage Stage);
+
+  static uint64_t getTicks()
+  {
+#if defined(X_ARCH_X86)
+    return __rdtsc();
+#else
+    return xSteadyNanoseconds();
+#endif
+  }
+
+  static void Record(eStage Stage, uint32_t PID, uint64_t Ticks, uint32_t NumItems)
+  {
+    xThreadProfile* Profile = t_Profile != nullptr ? t_Profile : xRegisterThread();
+    xPID_Profile* PID_Profile = Profile->PIDs[PID].load(std::memory_order_relaxed);
+    if (PID_Profile == nullptr)
+      PID_Profile = xAddPID(Profile, PID);
+    xAdd(PID_Profile->Stages[(uint32_t)Stage], Ticks, NumItems);
+  }
+
+  /// @brief Log bucket of value - exact below NumSubBuckets, then NumSubBuckets per power of two
+  static uint32_t getBucket(uint64_t Value)
+  {
+    if (Value < NumSubBuckets)
+      return (uint32_t)Value;
+    const uint32_t Exponent = 63 - xCountLeadingZeros64(Value); // >= 2
+    const uint32_t Bucket = NumSubBuckets + (Exponent - 2) * NumSubBuckets + (uint32_t)((Value >> (Exponent - 2)) & (NumSubBuckets - 1));
+    return Bucket < NumBuckets ? Bucket : NumBuckets - 1;
+  }
+  static uint64_t getBucketValue(uint32_t Bucket); // lowest value in bucket
+
+protected:
+  static uint64_t        xSteadyNanoseconds();
+  static xThreadProfile* xRegisterThread   ();
+  static xPID_Profile*   xAddPID           (xThreadProfile* Profile, uint32_t PID);
+
+  // Single writer (owning thread) - relaxed load + store is enough and compiles to plain add
+  static void xIncrement(std::atomic<uint64_t>& Counter, uint64_t Value) { Counter.store(Counter.load(std::memory_order_relaxed) + Value, std::memory_order_relaxed); }
+  static void xAdd(xHistogram& Histogram, uint64_t Ticks, uint32_t NumItems)
+  {
+    const uint64_t TicksPerItem = NumItems > 1 ? Ticks / NumItems : Ticks;
+    xIncrement(Histogram.Buckets[getBucket(TicksPerItem)], NumItems);
+    xIncrement(Histogram.NumItems, NumItems);
+    xIncrement(Histogram.SumTicks, Ticks);
+    if (TicksPerItem > Histogram.MaxTicks.load(std::memory_order_relaxed))
+      Histogram.MaxTicks.store(TicksPerItem, std::memory_order_relaxed);
+  }
+};
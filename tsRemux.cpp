@@ -0,0 +1,337 @@
+#include "tsRemux.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+//=============================================================================================================================================================================
+// xTS_Remuxer
+//=============================================================================================================================================================================
+
+static constexpr uint16_t c_NoTable = 0xFFFF;
+
+xTS_Remuxer::xTS_Remuxer(const xConfig& Config)
+    : m_Config(Config), m_FileDescriptor(-1), m_NumSpans(0), m_NumGenerated(0), m_NumPackets(0), m_NumPacketsWritten(0), m_NumNullDropped(0),
+      m_NumSectionsRewritten(0), m_NumBytesWritten(0), m_NumWriteCalls(0), m_Error(false)
+{
+    m_Flags.fill(0);
+    m_CC.fill(0);
+    m_TableIndex.fill(c_NoTable);
+    xAddTable((uint16_t)xTS_PacketHeader::ePID::PAT, Flag_PAT);
+    if (!m_Config.DropNull)
+        m_Flags[(uint16_t)xTS_PacketHeader::ePID::NuLL] |= Flag_Keep;
+}
+
+/// @brief Create (truncate) output file
+bool xTS_Remuxer::Open(const std::string& FileName)
+{
+    Close();
+#if defined(_WIN32)
+    m_FileDescriptor = _open(FileName.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    m_FileDescriptor = open(FileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    m_Error = false;
+    return m_FileDescriptor >= 0;
+}
+
+/// @brief Keep PID as is (and list it in rewritten PMT of its program)
+void xTS_Remuxer::AddPID(uint16_t PID)
+{
+    m_Flags[PID & (NumPIDs - 1)] |= Flag_Keep | Flag_Explicit;
+}
+
+/**
+  @brief Gather kept packets of batch, write them unless input is stable
+  @param Packets are pointers to 188 byte packets (any stride)
+ */
+void xTS_Remuxer::AddPackets(const uint8_t* const* Packets, uint32_t NumPackets)
+{
+    for (uint32_t i = 0; i < NumPackets; i++) {
+        const uint8_t* Packet = Packets[i];
+        const uint16_t PID    = xTS_HeaderLayout::PID::Get(Packet);
+        const uint8_t  Flags  = m_Flags[PID];
+        if (Flags & (Flag_PAT | Flag_PMT))
+            xProcessPSI(Packet, PID);
+        else if (Flags & Flag_Keep)
+            xGather(Packet);
+        else if (PID == (uint16_t)xTS_PacketHeader::ePID::NuLL)
+            m_NumNullDropped++;
+    }
+    m_NumPackets += NumPackets;
+    if (!m_Config.StableInput)
+        Flush();
+}
+
+/// @brief Write gathered packets (one writev per I/O vector, repeated on partial write)
+void xTS_Remuxer::Flush()
+{
+    if (m_NumSpans == 0)
+        return;
+    if (m_FileDescriptor >= 0) {
+#if defined(_WIN32)
+        for (uint32_t i = 0; i < m_NumSpans; i++) {
+            m_NumWriteCalls++;
+            if (_write(m_FileDescriptor, m_Spans[i].Data, m_Spans[i].Size) != (int)m_Spans[i].Size)
+                m_Error = true;
+            else
+                m_NumBytesWritten += m_Spans[i].Size;
+        }
+#else
+        struct iovec IOVecs[MaxIOVecs];
+        for (uint32_t i = 0; i < m_NumSpans; i++) {
+            IOVecs[i].iov_base = const_cast<uint8_t*>(m_Spans[i].Data);
+            IOVecs[i].iov_len  = m_Spans[i].Size;
+        }
+        struct iovec* Pending = IOVecs;
+        uint32_t NumPending = m_NumSpans;
+        while (NumPending > 0) {
+            m_NumWriteCalls++;
+            ssize_t Written = writev(m_FileDescriptor, Pending, (int)NumPending);
+            if (Written < 0) {
+                if (errno == EINTR)
+                    continue;
+                m_Error = true;
+                break;
+            }
+            m_NumBytesWritten += (uint64_t)Written;
+            // Partial write - skip completed vectors and continue with the rest
+            while (NumPending > 0 && (size_t)Written >= Pending->iov_len) {
+                Written -= Pending->iov_len;
+                Pending++;
+                NumPending--;
+            }
+            if (NumPending > 0) {
+                Pending->iov_base = static_cast<uint8_t*>(Pending->iov_base) + Written;
+                Pending->iov_len -= Written;
+            }
+        }
+#endif
+    }
+    m_NumSpans = 0;
+    m_NumGenerated = 0;
+}
+
+/// @brief Flush and close output file
+/// @return false if any write failed
+bool xTS_Remuxer::Close()
+{
+    Flush();
+    if (m_FileDescriptor >= 0) {
+#if defined(_WIN32)
+        _close(m_FileDescriptor);
+#else
+        close(m_FileDescriptor);
+#endif
+    }
+    m_FileDescriptor = -1;
+    return !m_Error;
+}
+
+/// @brief Add packet to I/O vector - extends last entry when packet follows it in memory
+void xTS_Remuxer::xGather(const uint8_t* Packet)
+{
+    m_NumPacketsWritten++;
+    if (m_NumSpans != 0) {
+        xSpan& Last = m_Spans[m_NumSpans - 1];
+        if (Last.Data + Last.Size == Packet) {
+            Last.Size += xTS::TS_PacketLength;
+            return;
+        }
+    }
+    if (m_NumSpans == MaxIOVecs)
+        Flush();
+    m_Spans[m_NumSpans++] = xSpan{Packet, xTS::TS_PacketLength};
+}
+
+/// @brief Assemble PAT/PMT sections - original packets are dropped, rewritten sections are emitted once complete
+void xTS_Remuxer::xProcessPSI(const uint8_t* Packet, uint16_t PID)
+{
+    m_PacketHeader.Reset();
+    m_PacketHeader.Parse(Packet, xTS::TS_PacketLength);
+    if (!(m_PacketHeader.getAdaptationFieldControl() & 0x01) || m_PacketHeader.hasTransportError())
+        return;
+    const uint32_t PayloadOffset = xTS::TS_HeaderLength + (m_PacketHeader.hasAdaptationField() ? Packet[4] + 1u : 0u);
+    if (PayloadOffset >= xTS::TS_PacketLength)
+        return;
+
+    xPSI_SectionAssembler* Assembler = m_Tables[m_TableIndex[PID]].Assembler.get();
+    if (Assembler->AbsorbPacket(Packet, &m_PacketHeader, PayloadOffset) != xPSI_SectionAssembler::eResult::SectionsReady)
+        return;
+    for (uint32_t s = 0; s < Assembler->getNumCompleted(); s++) {
+        const uint8_t* Section = Assembler->getSection(s);
+        const uint32_t Length  = Assembler->getSectionLength(s);
+        if ((m_Flags[PID] & Flag_PAT) && Section[0] == xPSI::eTableId_PAT)
+            xProcessPAT(Section, Length);
+        else if ((m_Flags[PID] & Flag_PMT) && Section[0] == xPSI::eTableId_PMT)
+            xProcessPMT(PID, Section, Length);
+    }
+}
+
+void xTS_Remuxer::xProcessPAT(const uint8_t* Section, uint32_t Length)
+{
+    xPSI_PAT PAT;
+    if (PAT.Parse(Section, Length) == NOT_VALID)
+        return;
+    m_PAT_Section.assign(Section, Section + Length);
+
+    // Programs keep their streams across PAT repetitions
+    std::vector<xProgram> Programs;
+    for (uint32_t p = 0; p < PAT.getNumPrograms(); p++) {
+        const xPSI_PAT::xProgram& Entry = PAT.getProgram(p);
+        if (Entry.ProgramNumber == 0 || (m_Config.ProgramNumber != 0 && Entry.ProgramNumber != m_Config.ProgramNumber))
+            continue;
+        xProgram Program = { Entry.ProgramNumber, Entry.PID, {} };
+        for (xProgram& Known : m_Programs) {
+            if (Known.ProgramNumber == Program.ProgramNumber && Known.PMT_PID == Program.PMT_PID)
+                Program.PIDs.swap(Known.PIDs);
+        }
+        Programs.push_back(std::move(Program));
+        xAddTable(Entry.PID, Flag_PMT);
+    }
+    m_Programs.swap(Programs);
+    xEmitPAT();
+}
+
+void xTS_Remuxer::xProcessPMT(uint16_t PID, const uint8_t* Section, uint32_t Length)
+{
+    if (Length < xPSI_PMT_HeaderLayout::Length + xPSI::CRC_Length)
+        return;
+    const uint16_t ProgramNumber = xPSI_LongHeaderLayout::TableIdExtension::Get(Section);
+    xProgram* Program = nullptr;
+    for (xProgram& Candidate : m_Programs) {
+        if (Candidate.ProgramNumber == ProgramNumber && Candidate.PMT_PID == PID)
+            Program = &Candidate;
+    }
+    if (Program == nullptr)
+        return;
+
+    // Rewritten section: header, PCR_PID, program info as received, ES loop entries of kept streams
+    typedef xPSI_PMT_EntryLayout L;
+    const uint32_t PMT_Header = xPSI_PMT_HeaderLayout::tWord::Load(Section);
+    const uint32_t ProgramInfoLength = xPSI_PMT_HeaderLayout::ProgramInfoLength::Extract(PMT_Header);
+    const uint32_t LoopEnd = Length - xPSI::CRC_Length;
+    if (xPSI_PMT_HeaderLayout::Length + ProgramInfoLength > LoopEnd)
+        return;
+    m_Section.assign(Section, Section + xPSI_PMT_HeaderLayout::Length + ProgramInfoLength);
+    std::vector<uint16_t> PIDs;
+    for (uint32_t i = xPSI_PMT_HeaderLayout::Length + ProgramInfoLength; i + L::Length <= LoopEnd; ) {
+        const uint64_t Entry = L::tWord::Load(Section + i);
+        const uint32_t ES_InfoLength = L::ES_InfoLength::Extract(Entry);
+        if (i + L::Length + ES_InfoLength > LoopEnd)
+            return;
+        const uint16_t StreamPID = L::PID::Extract(Entry);
+        if (xIsKeptStream(StreamPID, L::StreamType::Extract(Entry), Section + i + L::Length, ES_InfoLength)) {
+            m_Section.insert(m_Section.end(), Section + i, Section + i + L::Length + ES_InfoLength);
+            PIDs.push_back(StreamPID);
+        }
+        i += L::Length + ES_InfoLength;
+    }
+    const uint16_t PCR_PID = xPSI_PMT_HeaderLayout::PCR_PID::Extract(PMT_Header);
+    if (!PIDs.empty() && PCR_PID != (uint16_t)xTS_PacketHeader::ePID::NuLL)
+        PIDs.push_back(PCR_PID);
+
+    // Streams no longer listed are dropped (unless given by PID)
+    for (uint16_t Old : Program->PIDs) {
+        if (!(m_Flags[Old] & Flag_Explicit))
+            m_Flags[Old] &= ~Flag_Keep;
+    }
+    for (uint16_t New : PIDs)
+        m_Flags[New] |= Flag_Keep;
+    const bool KeptBefore = !Program->PIDs.empty();
+    Program->PIDs.swap(PIDs);
+
+    if (KeptBefore != !Program->PIDs.empty())
+        xEmitPAT();
+    if (!Program->PIDs.empty())
+        xEmitSection(PID, m_Section);
+}
+
+/// @brief Emit PAT listing programs that keep streams (NIT entry is dropped)
+void xTS_Remuxer::xEmitPAT()
+{
+    if (m_PAT_Section.size() < xPSI::LongHeaderLength + xPSI::CRC_Length)
+        return;
+    std::vector<uint8_t>& Section = m_PAT_Rewritten;
+    Section.assign(m_PAT_Section.begin(), m_PAT_Section.begin() + xPSI::LongHeaderLength);
+    for (const xProgram& Program : m_Programs) {
+        if (Program.PIDs.empty())
+            continue;
+        const uint8_t Entry[4] = { (uint8_t)(Program.ProgramNumber >> 8), (uint8_t)Program.ProgramNumber, (uint8_t)(0xE0 | (Program.PMT_PID >> 8)), (uint8_t)Program.PMT_PID };
+        Section.insert(Section.end(), Entry, Entry + 4);
+    }
+    xEmitSection((uint16_t)xTS_PacketHeader::ePID::PAT, Section);
+}
+
+/**
+  @brief Finish rewritten section (length, version, CRC_32) and packetize it into generated packets
+  @param PID is PID of table (own continuity counter)
+  @param Section is rewritten section without CRC_32
+ */
+void xTS_Remuxer::xEmitSection(uint16_t PID, std::vector<uint8_t>& Section)
+{
+    xTable& Table = m_Tables[m_TableIndex[PID]];
+    const uint32_t SectionLength = (uint32_t)Section.size() - xPSI::SectionHeaderLength + xPSI::CRC_Length;
+    Section[1] = (Section[1] & 0xF0) | (uint8_t)((SectionLength >> 8) & 0x0F);
+    Section[2] = (uint8_t)SectionLength;
+
+    // Version follows changes of rewritten content - received version would not tell when only the selection changed
+    const uint8_t ReceivedVersion = xPSI_LongHeaderLayout::Version::Get(Section.data());
+    Section[5] &= 0xC1;
+    const uint32_t Content = xCRC32::Calc(Section.data(), Section.size());
+    if (!Table.Emitted)
+        Table.Version = ReceivedVersion;
+    else if (Content != Table.Content)
+        Table.Version = (Table.Version + 1) & 0x1F;
+    Table.Content = Content;
+    Table.Emitted = true;
+    Section[5] |= Table.Version << 1;
+    const uint32_t CRC = xCRC32::Calc(Section.data(), Section.size());
+    const uint8_t CRC_Bytes[4] = { (uint8_t)(CRC >> 24), (uint8_t)(CRC >> 16), (uint8_t)(CRC >> 8), (uint8_t)CRC };
+    Section.insert(Section.end(), CRC_Bytes, CRC_Bytes + 4);
+    m_NumSectionsRewritten++;
+
+    // pointer_field 0 in first packet, rest of last packet is stuffing
+    for (uint32_t Offset = 0, First = 1; Offset < Section.size(); First = 0) {
+        // Flush before claiming a slot - xGather must not flush (and free the slots) while this packet is pending
+        if (m_NumGenerated == MaxGenerated || m_NumSpans == MaxIOVecs)
+            Flush();
+        uint8_t* Packet = m_Generated[m_NumGenerated++];
+        Packet[0] = 0x47;
+        Packet[1] = (uint8_t)((First ? 0x40 : 0x00) | (PID >> 8));
+        Packet[2] = (uint8_t)PID;
+        Packet[3] = (uint8_t)(0x10 | m_CC[PID]);
+        m_CC[PID] = (m_CC[PID] + 1) & 0x0F;
+        uint32_t Position = xTS::TS_HeaderLength;
+        if (First)
+            Packet[Position++] = 0;
+        const uint32_t Size = (uint32_t)Section.size() - Offset < xTS::TS_PacketLength - Position ? (uint32_t)Section.size() - Offset : xTS::TS_PacketLength - Position;
+        memcpy(Packet + Position, Section.data() + Offset, Size);
+        memset(Packet + Position + Size, 0xFF, xTS::TS_PacketLength - Position - Size);
+        Offset += Size;
+        xGather(Packet);
+    }
+}
+
+/// @brief Start assembling sections of PID (PAT or PMT)
+void xTS_Remuxer::xAddTable(uint16_t PID, uint8_t Flag)
+{
+    PID &= NumPIDs - 1;
+    m_Flags[PID] |= Flag;
+    if (m_TableIndex[PID] != c_NoTable)
+        return;
+    m_TableIndex[PID] = (uint16_t)m_Tables.size();
+    m_Tables.push_back(xTable{std::unique_ptr<xPSI_SectionAssembler>(new xPSI_SectionAssembler()), 0, 0, false});
+}
+
+bool xTS_Remuxer::xIsKeptStream(uint16_t PID, uint8_t StreamType, const uint8_t* Descriptors, uint32_t DescriptorsLength) const
+{
+    return (m_Flags[PID] & Flag_Explicit) || (m_Config.StreamSelection & xPSI_PMT::ClassifyStream(StreamType, Descriptors, DescriptorsLength)) != 0;
+}
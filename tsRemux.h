@@ -0,0 +1,139 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include "tsPSI.h"
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+//=============================================================================================================================================================================
+// PID-filtering TS remuxer
+//=============================================================================================================================================================================
+
+/*
+Writes a transport stream holding a subset of the input:
+ - elementary streams picked by PID (AddPID) or by category of their PMT
+   entry, optionally of one program only,
+ - PCR PID of every program that keeps a stream,
+ - PAT and PMTs rewritten to list only what is kept (version_number is
+   advanced whenever rewritten content changes, CRC_32 recomputed),
+ - NULL packets unless DropNull.
+Everything else is dropped. Output is plain 188 byte TS also for M2TS or
+Reed-Solomon input.
+
+Kept packets are not copied: their addresses are gathered into an I/O vector
+(runs of adjacent packets merge into one entry) and written with writev()
+straight from the input buffers. Rewritten PSI packets, the only bytes
+produced here, are gathered from a small packet array. With StableInput
+(memory-mapped file) packets are gathered until the vector is full; otherwise
+(pipeline slabs, network buffers that are reused) the batch is written before
+AddPackets returns.
+
+Packets of PIDs that turn out to be kept only when their PMT is seen are
+dropped until then.
+*/
+
+class xTS_Remuxer
+{
+public:
+  static constexpr uint32_t NumPIDs      = 8192;
+  static constexpr uint32_t MaxIOVecs    = 1024; // IOV_MAX on Linux
+  static constexpr uint32_t MaxGenerated = 64;   // rewritten PSI packets gathered before write
+
+  struct xConfig
+  {
+    uint16_t ProgramNumber   = 0;     // keep streams of this program only (0 = any program)
+    uint8_t  StreamSelection = 0;     // xPSI_PMT::eStreamCategory mask of streams kept besides AddPID ones
+    bool     DropNull        = false;
+    bool     StableInput     = true;  // packets passed to AddPackets stay valid until Close (memory-mapped input)
+  };
+
+protected:
+  enum ePID_Flags : uint8_t
+  {
+    Flag_Keep     = 0x01, // passed as is
+    Flag_Explicit = 0x02, // AddPID
+    Flag_PAT      = 0x04, // rewritten
+    Flag_PMT      = 0x08, // rewritten
+  };
+
+  struct xTable
+  {
+    std::unique_ptr<xPSI_SectionAssembler> Assembler;
+    uint32_t Content;  // CRC of last rewritten section with version_number cleared
+    uint8_t  Version;  // version_number of rewritten section
+    bool     Emitted;
+  };
+
+  struct xProgram
+  {
+    uint16_t              ProgramNumber;
+    uint16_t              PMT_PID;
+    std::vector<uint16_t> PIDs;   // kept streams and PCR PID (empty = program dropped)
+  };
+
+  struct xSpan
+  {
+    const uint8_t* Data;
+    uint32_t       Size;
+  };
+
+  xConfig                        m_Config;
+  int                            m_FileDescriptor;
+  std::array<uint8_t, NumPIDs>   m_Flags;
+  std::array<uint8_t, NumPIDs>   m_CC;          // continuity counter of rewritten PSI packets
+  std::array<uint16_t, NumPIDs>  m_TableIndex;  // index into m_Tables, 0xFFFF if none
+  std::vector<xTable>            m_Tables;
+  std::vector<xProgram>          m_Programs;    // programs of last PAT
+  std::vector<uint8_t>           m_PAT_Section; // last PAT section as received
+  std::vector<uint8_t>           m_Section;     // rewritten PMT section
+  std::vector<uint8_t>           m_PAT_Rewritten;
+  xTS_PacketHeader               m_PacketHeader;
+
+  xSpan                          m_Spans[MaxIOVecs];
+  uint32_t                       m_NumSpans;
+  uint8_t                        m_Generated[MaxGenerated][xTS::TS_PacketLength];
+  uint32_t                       m_NumGenerated;
+
+  //statistics
+  uint64_t                       m_NumPackets;         // input
+  uint64_t                       m_NumPacketsWritten;
+  uint64_t                       m_NumNullDropped;
+  uint64_t                       m_NumSectionsRewritten;
+  uint64_t                       m_NumBytesWritten;
+  uint64_t                       m_NumWriteCalls;
+  bool                           m_Error;
+
+public:
+  xTS_Remuxer(const xConfig& Config);
+  ~xTS_Remuxer() { Close(); }
+  xTS_Remuxer(const xTS_Remuxer&) = delete;
+  xTS_Remuxer& operator=(const xTS_Remuxer&) = delete;
+
+  bool Open      (const std::string& FileName);
+  void AddPID    (uint16_t PID);
+  void AddPackets(const uint8_t* const* Packets, uint32_t NumPackets);
+  void Flush     ();
+  bool Close     ();
+
+public:
+  bool     isOpen                 () const { return m_FileDescriptor >= 0; }
+  uint64_t getNumPackets          () const { return m_NumPackets; }
+  uint64_t getNumPacketsWritten   () const { return m_NumPacketsWritten; }
+  uint64_t getNumNullDropped      () const { return m_NumNullDropped; }
+  uint64_t getNumSectionsRewritten() const { return m_NumSectionsRewritten; }
+  uint64_t getNumBytesWritten     () const { return m_NumBytesWritten; }
+  uint64_t getNumWriteCalls       () const { return m_NumWriteCalls; }
+  bool     hasError               () const { return m_Error; }
+
+protected:
+  void xGather        (const uint8_t* Packet);
+  void xProcessPSI    (const uint8_t* Packet, uint16_t PID);
+  void xProcessPAT    (const uint8_t* Section, uint32_t Length);
+  void xProcessPMT    (uint16_t PID, const uint8_t* Section, uint32_t Length);
+  void xEmitPAT       ();
+  void xEmitSection   (uint16_t PID, std::vector<uint8_t>& Section);
+  void xAddTable      (uint16_t PID, uint8_t Flag);
+  bool xIsKeptStream  (uint16_t PID, uint8_t StreamType, const uint8_t* Descriptors, uint32_t DescriptorsLength) const;
+};
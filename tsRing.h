@@ -0,0 +1,128 @@
+#pragma once
+#include "tsCommon.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Lock-free single-producer / single-consumer ring
+//=============================================================================================================================================================================
+
+/*
+Bounded FIFO for exactly one producer thread and one consumer thread. Head is
+written only by the producer, tail only by the consumer; each side keeps a
+cached copy of the other index so the shared cache line is touched only when
+the ring looks full (producer) or empty (consumer). Capacity is rounded up to
+a power of two. Slots are used to pass pointers to pre-allocated objects
+(packet slabs, output buffers) - nothing is allocated after construction.
+*/
+
+template <class tType> class xSPSC_Ring
+{
+public:
+  static constexpr uint32_t CacheLineSize = 64;
+
+protected:
+  std::vector<tType> m_Slots;
+  uint64_t           m_Mask;
+
+  alignas(CacheLineSize) std::atomic<uint64_t> m_Head; // next slot to write (producer)
+  uint64_t                                     m_CachedTail;
+  alignas(CacheLineSize) std::atomic<uint64_t> m_Tail; // next slot to read (consumer)
+  uint64_t                                     m_CachedHead;
+
+public:
+  explicit xSPSC_Ring(uint32_t Capacity) : m_Head(0), m_CachedTail(0), m_Tail(0), m_CachedHead(0)
+  {
+    uint32_t RoundedCapacity = 1;
+    while (RoundedCapacity < Capacity)
+      RoundedCapacity <<= 1;
+    m_Slots.resize(RoundedCapacity);
+    m_Mask = RoundedCapacity - 1;
+  }
+  xSPSC_Ring(const xSPSC_Ring&) = delete;
+  xSPSC_Ring& operator=(const xSPSC_Ring&) = delete;
+
+  /// @brief Producer side - false if ring is full
+  bool tryPush(const tType& Value)
+  {
+    const uint64_t Head = m_Head.load(std::memory_order_relaxed);
+    if (Head - m_CachedTail > m_Mask) {
+      m_CachedTail = m_Tail.load(std::memory_order_acquire);
+      if (Head - m_CachedTail > m_Mask)
+        return false;
+    }
+    m_Slots[Head & m_Mask] = Value;
+    m_Head.store(Head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Consumer side - pointer to oldest element or nullptr if ring is empty (element stays in ring)
+  const tType* peek()
+  {
+    const uint64_t Tail = m_Tail.load(std::memory_order_relaxed);
+    if (Tail == m_CachedHead) {
+      m_CachedHead = m_Head.load(std::memory_order_acquire);
+      if (Tail == m_CachedHead)
+        return nullptr;
+    }
+    return &m_Slots[Tail & m_Mask];
+  }
+
+  /// @brief Consumer side - false if ring is empty
+  bool tryPop(tType& Value)
+  {
+    const tType* Front = peek();
+    if (Front == nullptr)
+      return false;
+    Value = *Front;
+    m_Tail.store(m_Tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    return true;
+  }
+
+  uint32_t getCapacity() const { return (uint32_t)m_Mask + 1; }
+  uint32_t getSize    () const { return (uint32_t)(m_Head.load(std::memory_order_acquire) - m_Tail.load(std::memory_order_acquire)); } // approximate when called by third thread
+};
+
+//=============================================================================================================================================================================
+
+/*
+Wait strategy for ring stages: spin with pause for a short while (the other
+stage is usually just about to deliver), then yield, then sleep in short
+intervals so an idle stage does not burn a core.
+*/
+
+class xBackoff
+{
+public:
+  static constexpr uint32_t NumSpins          = 64;
+  static constexpr uint32_t NumYields         = 64;
+  static constexpr uint32_t SleepMicroseconds = 50;
+
+protected:
+  uint32_t m_Count;
+
+public:
+  xBackoff() : m_Count(0) {}
+
+  void Reset() { m_Count = 0; }
+  /// @brief Spin and yield phases are over - next Wait sleeps (caller may block on an event instead)
+  bool isSpent() const { return m_Count >= NumSpins + NumYields; }
+  void Wait ()
+  {
+    if (m_Count < NumSpins) {
+#if defined(X_ARCH_X86)
+      _mm_pause();
+#endif
+    }
+    else if (m_Count < NumSpins + NumYields) {
+      std::this_thread::yield();
+    }
+    else {
+      std::this_thread::sleep_for(std::chrono::microseconds(SleepMicroseconds));
+      return;
+    }
+    m_Count++;
+  }
+};
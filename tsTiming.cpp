@@ -0,0 +1,324 @@
+#include "tsTiming.h"
+#include <chrono>
+#include <cmath>
+
+//=============================================================================================================================================================================
+// xTS_TimingAnalyzer - statistics
+//=============================================================================================================================================================================
+
+void xTS_TimingAnalyzer::xMoments::Add(double Value)
+{
+    Count++;
+    const double Delta = Value - Mean;
+    Mean += Delta / Count;
+    M2   += Delta * (Value - Mean);
+    Min   = Count == 1 || Value < Min ? Value : Min;
+    Max   = Count == 1 || Value > Max ? Value : Max;
+}
+
+double xTS_TimingAnalyzer::xMoments::getStdDev() const
+{
+    return Count > 1 ? sqrt(M2 / (Count - 1)) : 0.0;
+}
+
+void xTS_TimingAnalyzer::xHistogram::Add(double Value)
+{
+    const double Bucket = (Value - First) / Width + 1;
+    Buckets[Bucket < 1 ? 0 : Bucket >= NumBuckets - 1 ? NumBuckets - 1 : (uint32_t)Bucket]++;
+}
+
+/// @brief Upper bound of bucket holding Quantile of values (HUGE_VAL when it is the overflow bucket)
+double xTS_TimingAnalyzer::xHistogram::getQuantile(double Quantile) const
+{
+    uint64_t NumValues = 0;
+    for (uint64_t Count : Buckets)
+        NumValues += Count;
+    const uint64_t Rank = (uint64_t)(Quantile * NumValues);
+    uint64_t Count = 0;
+    for (uint32_t b = 0; b < NumBuckets - 1; b++) {
+        Count += Buckets[b];
+        if (Count > Rank)
+            return First + b * Width;
+    }
+    return HUGE_VAL;
+}
+
+void xTS_TimingAnalyzer::xRegression::Add(double X, double Y)
+{
+    Count++;
+    const double DeltaX = X - MeanX;
+    MeanX += DeltaX / Count;
+    MeanY += (Y - MeanY) / Count;
+    M2_X  += DeltaX * (X - MeanX);
+    C_XY  += DeltaX * (Y - MeanY);
+}
+
+//=============================================================================================================================================================================
+// xTS_TimingAnalyzer
+//=============================================================================================================================================================================
+
+/**
+  @param Config sets snapshot period and limits
+  @param Output receives snapshots (not closed)
+ */
+xTS_TimingAnalyzer::xTS_TimingAnalyzer(const xConfig& Config, FILE* Output)
+    : m_Config(Config), m_Output(Output), m_NumPackets(0), m_NumStreams(0), m_ClockPID(InvalidPID), m_LastPCR_PID(InvalidPID),
+      m_ClockOrigin(0), m_IntervalStart(0), m_NumSnapshots(0), m_ArrivalTime(0)
+{
+    m_Index.fill(InvalidPID);
+}
+
+/**
+  @brief Analyze batch just passed to the demuxer
+  @param Packets are pointers to TS packets of all PIDs, in input order
+  @param Demuxer provides program clock PID of discovered streams (PMT PCR_PID)
+ */
+void xTS_TimingAnalyzer::AddPackets(const uint8_t* const* Packets, uint32_t NumPackets, const xTS_Demuxer& Demuxer)
+{
+    if (m_Config.ArrivalClock)
+        m_ArrivalTime = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    const std::vector<xTS_Demuxer::xStreamInfo>& Streams = Demuxer.getStreams();
+    for (; m_NumStreams < Streams.size(); m_NumStreams++)
+        xGetPID(Streams[m_NumStreams].PID).PCR_PID = Streams[m_NumStreams].PCR_PID;
+
+    for (uint32_t i = 0; i < NumPackets; i++, m_NumPackets++) {
+        const uint8_t* Packet = Packets[i];
+        if (Packet[0] != 'G')
+            continue;
+        const uint16_t PID = xTS_HeaderLayout::PID::Get(Packet);
+        xPID_Timing& Timing = xGetPID(PID);
+        Timing.NumPackets++;
+        Timing.NumIntervalPackets++;
+
+        // Byte tests first - only PES starts and packets carrying PCR are decoded
+        const uint32_t PayloadOffset = xTS::TS_HeaderLength + ((Packet[3] & 0x20) ? Packet[4] + 1 : 0);
+        const bool PES_Start = (Packet[1] & 0x40) && (Packet[3] & 0x10) && PayloadOffset + 3 <= xTS::TS_PacketLength &&
+                               Packet[PayloadOffset] == 0 && Packet[PayloadOffset + 1] == 0 && Packet[PayloadOffset + 2] == 1;
+        const bool PCR       = (Packet[3] & 0x20) && Packet[4] >= 7 && (Packet[5] & 0x10);
+        if (PES_Start || PCR)
+            xAddPacket(Packet, Timing, PES_Start);
+    }
+}
+
+/// @brief Print statistics of last (partial) interval
+void xTS_TimingAnalyzer::Finish()
+{
+    int64_t IntervalEnd = 0;
+    xSnapshot(xGetClock(m_ClockPID, IntervalEnd) ? IntervalEnd : m_IntervalStart);
+}
+
+xTS_TimingAnalyzer::xPID_Timing& xTS_TimingAnalyzer::xGetPID(uint16_t PID)
+{
+    if (m_Index[PID] != InvalidPID)
+        return m_PIDs[m_Index[PID]];
+
+    m_Index[PID] = (uint16_t)m_PIDs.size();
+    m_PIDs.emplace_back();
+    xPID_Timing& Timing = m_PIDs.back();
+    Timing.PID                 = PID;
+    Timing.PCR_PID             = InvalidPID;
+    Timing.NumPackets          = 0;
+    Timing.NumIntervalPackets  = 0;
+    Timing.IntervalBitrate     = 0;
+    Timing.NumPCR              = 0;
+    Timing.NumPCR_Discontinuities = 0;
+    Timing.NumPCR_Jumps        = 0;
+    Timing.LastPCR             = 0;
+    Timing.LastPCR_Packet      = 0;
+    Timing.RatePCR             = 0;
+    Timing.RatePCR_Packet      = 0;
+    Timing.FirstArrival        = 0;
+    Timing.FirstArrivalPCR     = 0;
+    Timing.NumPES              = 0;
+    Timing.NumPTS              = 0;
+    Timing.NumPTS_Discontinuities = 0;
+    Timing.LastDecodeTime      = 0;
+    Timing.PCR_IntervalHistogram.First   = 0;    // 5 ms buckets up to 110 ms
+    Timing.PCR_IntervalHistogram.Width   = 5;
+    Timing.PCR_JitterHistogram.First     = -1100; // 100 ns buckets, +-1.1 us
+    Timing.PCR_JitterHistogram.Width     = 100;
+    Timing.PTS_PCR_OffsetHistogram.First = -100; // 100 ms buckets up to 2.1 s
+    Timing.PTS_PCR_OffsetHistogram.Width = 100;
+    return Timing;
+}
+
+void xTS_TimingAnalyzer::xAddPacket(const uint8_t* Packet, xPID_Timing& Timing, bool PES_Start)
+{
+    m_PacketHeader.Reset();
+    m_PacketHeader.Parse(Packet, xTS::TS_PacketLength);
+    m_AdaptationField.Reset();
+    if (m_PacketHeader.hasAdaptationField())
+        m_AdaptationField.Parse(Packet, xTS::TS_PacketLength, m_PacketHeader.getAdaptationFieldControl());
+
+    if (m_AdaptationField.hasPCR())
+        xAddPCR(Timing, m_AdaptationField.getPCR(), m_AdaptationField.hasDiscontinuity());
+
+    if (!PES_Start)
+        return;
+    const uint32_t PayloadOffset = xTS::TS_HeaderLength + (m_PacketHeader.hasAdaptationField() ? m_AdaptationField.getNumBytes() : 0);
+    m_PES_Header.Reset();
+    if (m_PES_Header.Parse(Packet + PayloadOffset, (int32_t)(xTS::TS_PacketLength - PayloadOffset)) == NOT_VALID || m_PES_Header.getPacketStartCodePrefix() != 1)
+        return;
+    xAddPES(Timing);
+}
+
+/**
+  @brief Account PCR of PID
+  @param PCR is 27 MHz value as coded (base * 300 + extension)
+  @param Discontinuity is discontinuity_indicator of packet
+ */
+void xTS_TimingAnalyzer::xAddPCR(xPID_Timing& Timing, uint64_t PCR, bool Discontinuity)
+{
+    const uint64_t Base    = PCR / xTS::BaseToExtendedClockMultiplier;
+    const int64_t  Current = (Timing.NumPCR != 0 ? xTS::UnwrapTimestamp(Base, Timing.LastPCR / xTS::BaseToExtendedClockMultiplier) : (int64_t)Base) *
+                             xTS::BaseToExtendedClockMultiplier + (int64_t)(PCR % xTS::BaseToExtendedClockMultiplier);
+    const uint64_t Packet  = m_NumPackets;
+
+    if (Timing.NumPCR == 0) {
+        Timing.RatePCR         = Current;
+        Timing.RatePCR_Packet  = Packet;
+        Timing.FirstArrival    = m_ArrivalTime;
+        Timing.FirstArrivalPCR = Current;
+    }
+    else {
+        const int64_t Delta = Current - Timing.LastPCR;
+        if (Discontinuity || Delta < 0 || Delta > m_Config.PCR_JumpLimit) {
+            (Discontinuity ? Timing.NumPCR_Discontinuities : Timing.NumPCR_Jumps)++;
+            // New time base - rate estimate restarts, drift fit and snapshot clock continue as if no time passed
+            Timing.RatePCR         = Current;
+            Timing.RatePCR_Packet  = Packet;
+            Timing.FirstArrivalPCR += Delta;
+            if (Timing.PID == m_ClockPID) {
+                m_ClockOrigin   += Delta;
+                m_IntervalStart += Delta;
+            }
+        }
+        else {
+            Timing.PCR_Interval.Add(Delta / (double)xTS::ExtendedClockFrequency_kHz);
+            Timing.PCR_IntervalHistogram.Add(Delta / (double)xTS::ExtendedClockFrequency_kHz);
+            if (Timing.LastPCR_Packet > Timing.RatePCR_Packet) {
+                const double TicksPerPacket = (double)(Timing.LastPCR - Timing.RatePCR) / (Timing.LastPCR_Packet - Timing.RatePCR_Packet);
+                const double Predicted      = Timing.LastPCR + (Packet - Timing.LastPCR_Packet) * TicksPerPacket;
+                const double Jitter         = (Current - Predicted) * 1e9 / xTS::ExtendedClockFrequency_Hz;
+                Timing.PCR_Jitter.Add(Jitter);
+                Timing.PCR_JitterHistogram.Add(Jitter);
+            }
+        }
+    }
+    if (m_Config.ArrivalClock)
+        Timing.PCR_Drift.Add(m_ArrivalTime - Timing.FirstArrival, (double)(Current - Timing.FirstArrivalPCR) / xTS::ExtendedClockFrequency_Hz);
+
+    Timing.LastPCR        = Current;
+    Timing.LastPCR_Packet = Packet;
+    Timing.NumPCR++;
+    m_LastPCR_PID = Timing.PID;
+
+    if (m_ClockPID == InvalidPID) {
+        m_ClockPID      = Timing.PID;
+        m_ClockOrigin   = Current;
+        m_IntervalStart = Current;
+    }
+    else if (Timing.PID == m_ClockPID && m_Config.SnapshotPeriod > 0 && Current - m_IntervalStart >= (int64_t)(m_Config.SnapshotPeriod * xTS::ExtendedClockFrequency_Hz)) {
+        xSnapshot(Current);
+    }
+}
+
+/// @brief Account PES header just parsed into m_PES_Header
+void xTS_TimingAnalyzer::xAddPES(xPID_Timing& Timing)
+{
+    Timing.NumPES++;
+    if (!m_PES_Header.hasPTS())
+        return;
+
+    // PTS and program clock share one unwrapped time line (both start unwrapping from their first coded value)
+    int64_t Clock = 0;
+    const bool    HasClock  = xGetClock(Timing.PCR_PID, Clock);
+    const int64_t Reference = HasClock ? Clock / xTS::BaseToExtendedClockMultiplier : Timing.NumPTS != 0 ? Timing.LastDecodeTime : (int64_t)m_PES_Header.getPTS();
+    const int64_t PTS        = xTS::UnwrapTimestamp(m_PES_Header.getPTS(), Reference);
+    const int64_t DecodeTime = m_PES_Header.hasDTS() ? xTS::UnwrapTimestamp(m_PES_Header.getDTS(), Reference) : PTS;
+    Timing.NumPTS++;
+
+    if (HasClock) {
+        const double Offset = (PTS - Clock / (double)xTS::BaseToExtendedClockMultiplier) / xTS::BaseClockFrequency_kHz;
+        Timing.PTS_PCR_Offset.Add(Offset);
+        Timing.PTS_PCR_OffsetHistogram.Add(Offset);
+    }
+    if (Timing.NumPTS > 1) {
+        const int64_t Delta = DecodeTime - Timing.LastDecodeTime;
+        if (Delta < 0 || Delta > m_Config.PTS_JumpLimit)
+            Timing.NumPTS_Discontinuities++;
+    }
+    Timing.LastDecodeTime = DecodeTime;
+}
+
+/**
+  @brief Program clock at current packet - last PCR of PCR_PID extrapolated with mean transport rate
+  @param PCR_PID is PID carrying clock, InvalidPID for PID that carried PCR last
+  @return false when no PCR was seen yet
+ */
+bool xTS_TimingAnalyzer::xGetClock(uint16_t PCR_PID, int64_t& PCR) const
+{
+    const uint16_t PID = PCR_PID != InvalidPID ? PCR_PID : m_LastPCR_PID;
+    if (PID == InvalidPID || m_Index[PID] == InvalidPID || m_PIDs[m_Index[PID]].NumPCR == 0)
+        return false;
+
+    const xPID_Timing& Timing = m_PIDs[m_Index[PID]];
+    PCR = Timing.LastPCR;
+    if (Timing.LastPCR_Packet > Timing.RatePCR_Packet)
+        PCR += (int64_t)((double)(Timing.LastPCR - Timing.RatePCR) / (Timing.LastPCR_Packet - Timing.RatePCR_Packet) * (m_NumPackets - Timing.LastPCR_Packet));
+    return true;
+}
+
+/// @brief Close snapshot interval at IntervalEnd (27 MHz time of m_ClockPID) and print statistics
+void xTS_TimingAnalyzer::xSnapshot(int64_t IntervalEnd)
+{
+    const double Seconds = (double)(IntervalEnd - m_IntervalStart) / xTS::ExtendedClockFrequency_Hz;
+    uint64_t NumIntervalPackets = 0;
+    for (xPID_Timing& Timing : m_PIDs) {
+        NumIntervalPackets += Timing.NumIntervalPackets;
+        if (Seconds > 0) {
+            Timing.IntervalBitrate = Timing.NumIntervalPackets * xTS::TS_PacketLength * 8 / Seconds;
+            Timing.Bitrate.Add(Timing.IntervalBitrate);
+        }
+        Timing.NumIntervalPackets = 0;
+    }
+    m_NumSnapshots++;
+
+    if (m_Output != nullptr) {
+        if (m_ClockPID == InvalidPID)
+            fprintf(m_Output, "Timing: snapshot %u, no PCR (bitrates unknown)\n", m_NumSnapshots);
+        else
+            fprintf(m_Output, "Timing: snapshot %u at %.3fs (PCR of PID %u), interval %.3fs, transport %.3f Mbit/s\n", m_NumSnapshots,
+                    (double)(IntervalEnd - m_ClockOrigin) / xTS::ExtendedClockFrequency_Hz, m_ClockPID, Seconds,
+                    Seconds > 0 ? NumIntervalPackets * xTS::TS_PacketLength * 8 / Seconds / 1e6 : 0.0);
+        Print(m_Output);
+        fflush(m_Output);
+    }
+    m_IntervalStart = IntervalEnd;
+}
+
+/// @brief Per-PID statistics - bitrate of last interval and over intervals, PCR and PES timing of PIDs carrying them
+void xTS_TimingAnalyzer::Print(FILE* Output) const
+{
+    for (const xPID_Timing& Timing : m_PIDs) {
+        fprintf(Output, "  PID %4u: packets=%" PRIu64 " bitrate=%.3f Mbit/s (min %.3f, mean %.3f, max %.3f)\n", Timing.PID, Timing.NumPackets,
+                Timing.IntervalBitrate / 1e6, Timing.Bitrate.Min / 1e6, Timing.Bitrate.Mean / 1e6, Timing.Bitrate.Max / 1e6);
+        if (Timing.NumPCR != 0) {
+            fprintf(Output, "            PCR: n=%" PRIu64 " interval=%.2f ms (std %.2f, max %.2f, p99 <%.0f) jitter=%+.0f ns (std %.0f, min %+.0f, max %+.0f, p1 <%.0f, p99 <%.0f)",
+                    Timing.NumPCR, Timing.PCR_Interval.Mean, Timing.PCR_Interval.getStdDev(), Timing.PCR_Interval.Max, Timing.PCR_IntervalHistogram.getQuantile(0.99),
+                    Timing.PCR_Jitter.Mean, Timing.PCR_Jitter.getStdDev(), Timing.PCR_Jitter.Min, Timing.PCR_Jitter.Max,
+                    Timing.PCR_JitterHistogram.getQuantile(0.01), Timing.PCR_JitterHistogram.getQuantile(0.99));
+            if (Timing.PCR_Drift.M2_X > 0)
+                fprintf(Output, " drift=%+.2f ppm", (Timing.PCR_Drift.getSlope() - 1) * 1e6);
+            fprintf(Output, " discontinuities=%" PRIu64 " jumps=%" PRIu64 "\n", Timing.NumPCR_Discontinuities, Timing.NumPCR_Jumps);
+        }
+        if (Timing.NumPES != 0) {
+            fprintf(Output, "            PES: n=%" PRIu64 " PTS=%" PRIu64, Timing.NumPES, Timing.NumPTS);
+            if (Timing.PTS_PCR_Offset.Count != 0)
+                fprintf(Output, " PTS-PCR=%.1f ms (std %.1f, min %.1f, max %.1f, p99 <%.0f)", Timing.PTS_PCR_Offset.Mean, Timing.PTS_PCR_Offset.getStdDev(),
+                        Timing.PTS_PCR_Offset.Min, Timing.PTS_PCR_Offset.Max, Timing.PTS_PCR_OffsetHistogram.getQuantile(0.99));
+            fprintf(Output, " discontinuities=%" PRIu64 "\n", Timing.NumPTS_Discontinuities);
+        }
+    }
+}
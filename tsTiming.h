@@ -0,0 +1,157 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include "tsDemuxer.h"
+#include <array>
+#include <cstdio>
+#include <vector>
+
+//=============================================================================================================================================================================
+// Streaming PCR/PTS timing analytics
+//=============================================================================================================================================================================
+
+/*
+Per-PID timing statistics computed incrementally while demuxing:
+ - bitrate of every PID over each snapshot interval (and its min/mean/max),
+ - PCR interval, PCR jitter (PCR against the time predicted from the mean
+   transport rate since the last PCR discontinuity, as for PCR accuracy in
+   TR 101 290 - assumes constant transport rate), PCR jumps and signalled
+   discontinuities,
+ - PCR drift against the arrival clock (live input only) - slope of a linear
+   fit of PCR time over arrival time, in ppm,
+ - PTS-PCR offset of PES (PTS against the program clock extrapolated to the
+   packet carrying the PES header) and PTS discontinuities (decode time going
+   back or jumping ahead by more than PTS_JumpLimit).
+Timestamps are unwrapped across the 33-bit wrap. State per PID is fixed size
+- running moments (Welford) and fixed-bucket histograms, no sample lists - so
+memory does not grow on endless live input; it is allocated once when a PID
+is first seen.
+
+Stream time of the first PID carrying PCR drives snapshots: every
+SnapshotPeriod seconds of it the statistics are printed and interval
+counters restart. Finish() prints the last (partial) interval.
+*/
+
+class xTS_TimingAnalyzer
+{
+public:
+  static constexpr uint32_t NumPIDs    = xTS_Demuxer::NumPIDs;
+  static constexpr uint16_t InvalidPID = 0xFFFF;
+
+  struct xConfig
+  {
+    double  SnapshotPeriod = 10.0;  // seconds of stream time, 0 = only final snapshot
+    bool    ArrivalClock   = false; // packets are processed as they arrive (live input) - enables drift
+    int64_t PTS_JumpLimit  = xTS::BaseClockFrequency_Hz; // 90 kHz
+    int64_t PCR_JumpLimit  = xTS::ExtendedClockFrequency_Hz / 10; // 27 MHz, 100 ms (TR 101 290 PCR discontinuity)
+  };
+
+  /// @brief Running count, mean, variance (Welford), min and max
+  struct xMoments
+  {
+    uint64_t Count = 0;
+    double   Mean  = 0;
+    double   M2    = 0;
+    double   Min   = 0;
+    double   Max   = 0;
+
+    void   Add      (double Value);
+    double getStdDev() const;
+  };
+
+  /// @brief Fixed buckets - [0] below First, [NumBuckets - 1] at or above First + (NumBuckets - 2) * Width
+  struct xHistogram
+  {
+    static constexpr uint32_t NumBuckets = 24;
+
+    double   First = 0;
+    double   Width = 1;
+    uint64_t Buckets[NumBuckets] = {};
+
+    void   Add        (double Value);
+    double getQuantile(double Quantile) const; // upper bound of bucket
+  };
+
+  /// @brief Online linear fit of Y over X (co-moments, numerically stable for long runs)
+  struct xRegression
+  {
+    uint64_t Count = 0;
+    double   MeanX = 0;
+    double   MeanY = 0;
+    double   M2_X  = 0;
+    double   C_XY  = 0;
+
+    void   Add     (double X, double Y);
+    double getSlope() const { return M2_X > 0 ? C_XY / M2_X : 0; }
+  };
+
+  struct xPID_Timing
+  {
+    uint16_t    PID;
+    uint16_t    PCR_PID;           // program clock used for PTS-PCR offset (InvalidPID = last PCR seen)
+    uint64_t    NumPackets;
+    uint64_t    NumIntervalPackets;
+    double      IntervalBitrate;   // bit/s, last snapshot interval
+    xMoments    Bitrate;           // bit/s per snapshot interval
+    //PCR
+    uint64_t    NumPCR;
+    uint64_t    NumPCR_Discontinuities; // discontinuity_indicator
+    uint64_t    NumPCR_Jumps;           // back or ahead by more than PCR_JumpLimit without discontinuity_indicator
+    int64_t     LastPCR;           // 27 MHz, unwrapped
+    uint64_t    LastPCR_Packet;    // packet index of LastPCR
+    int64_t     RatePCR;           // start of rate estimate (first PCR after discontinuity)
+    uint64_t    RatePCR_Packet;
+    double      FirstArrival;
+    int64_t     FirstArrivalPCR;
+    xMoments    PCR_Interval;      // ms
+    xHistogram  PCR_IntervalHistogram;
+    xMoments    PCR_Jitter;        // ns
+    xHistogram  PCR_JitterHistogram;
+    xRegression PCR_Drift;         // PCR seconds over arrival seconds
+    //PES
+    uint64_t    NumPES;
+    uint64_t    NumPTS;
+    uint64_t    NumPTS_Discontinuities;
+    int64_t     LastDecodeTime;    // 90 kHz, unwrapped
+    xMoments    PTS_PCR_Offset;    // ms
+    xHistogram  PTS_PCR_OffsetHistogram;
+  };
+
+protected:
+  xConfig                        m_Config;
+  FILE*                          m_Output;
+  std::array<uint16_t, NumPIDs>  m_Index;  // PID -> m_PIDs index, InvalidPID when not seen
+  std::vector<xPID_Timing>       m_PIDs;   // in order of appearance
+  uint64_t                       m_NumPackets;
+  size_t                         m_NumStreams; // streams of demuxer already mapped to PCR PID
+  uint16_t                       m_ClockPID;   // PID whose PCR drives snapshots
+  uint16_t                       m_LastPCR_PID;
+  int64_t                        m_ClockOrigin;   // 27 MHz, first PCR of m_ClockPID
+  int64_t                        m_IntervalStart; // 27 MHz, PCR of m_ClockPID
+  uint32_t                       m_NumSnapshots;
+  double                         m_ArrivalTime;   // seconds, time of current batch
+
+  xTS_PacketHeader    m_PacketHeader;
+  xTS_AdaptationField m_AdaptationField;
+  xPES_PacketHeader   m_PES_Header;
+
+public:
+  xTS_TimingAnalyzer(const xConfig& Config, FILE* Output = stdout);
+
+  void AddPackets(const uint8_t* const* Packets, uint32_t NumPackets, const xTS_Demuxer& Demuxer);
+  void Finish    ();
+  void Print     (FILE* Output) const;
+
+public:
+  const xConfig&                  getConfig      () const { return m_Config; }
+  const std::vector<xPID_Timing>& getPIDs        () const { return m_PIDs; }
+  uint32_t                        getNumSnapshots() const { return m_NumSnapshots; }
+
+protected:
+  xPID_Timing& xGetPID       (uint16_t PID);
+  void         xAddPacket    (const uint8_t* Packet, xPID_Timing& Timing, bool PES_Start);
+  void         xAddPCR       (xPID_Timing& Timing, uint64_t PCR, bool Discontinuity);
+  void         xAddPES       (xPID_Timing& Timing);
+  bool         xGetClock     (uint16_t PCR_PID, int64_t& PCR) const;
+  void         xSnapshot     (int64_t IntervalEnd);
+};
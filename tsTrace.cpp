@@ -0,0 +1,208 @@
+#include "tsTrace.h"
+#include <cstdarg>
+#include <cstring>
+
+//=============================================================================================================================================================================
+// xTrace
+//=============================================================================================================================================================================
+
+xTrace::eLevel  xTrace::s_Level  = xTrace::eLevel::Off;
+xTrace::eFormat xTrace::s_Format = xTrace::eFormat::Text;
+FILE*           xTrace::s_Output = stdout;
+
+static const char* const c_LevelNames[] = { "off", "error", "warning", "info", "pes", "packet" };
+
+static const char* xResultName(xPES_Assembler::eResult Result)
+{
+    switch (Result) {
+        case xPES_Assembler::eResult::StreamPackedLost:   return "lost";
+        case xPES_Assembler::eResult::AssemblingStarted:  return "started";
+        case xPES_Assembler::eResult::AssemblingContinue: return "continue";
+        case xPES_Assembler::eResult::AssemblingFinished: return "finished";
+        default:                                          return "unexpected";
+    }
+}
+
+/**
+  @brief Set verbosity and sink
+  @param Output is stream receiving events (not closed, stdout if nullptr)
+ */
+void xTrace::Configure(eLevel Level, eFormat Format, FILE* Output)
+{
+    s_Level  = Level;
+    s_Format = Format;
+    s_Output = Output != nullptr ? Output : stdout;
+}
+
+/// @brief Level from name ("off", "error", "warning", "info", "pes", "packet") or number 0-5
+bool xTrace::ParseLevel(const char* Name, eLevel& Level)
+{
+    for (uint32_t i = 0; i < sizeof(c_LevelNames) / sizeof(c_LevelNames[0]); i++) {
+        if (strcmp(Name, c_LevelNames[i]) == 0 || (Name[0] == (char)('0' + i) && Name[1] == '\0')) {
+            Level = (eLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool xTrace::ParseFormat(const char* Name, eFormat& Format)
+{
+    if (strcmp(Name, "text") == 0) { Format = eFormat::Text; return true; }
+    if (strcmp(Name, "json") == 0) { Format = eFormat::JSON; return true; }
+    return false;
+}
+
+const char* xTrace::getLevelName(eLevel Level)
+{
+    return (uint32_t)Level < sizeof(c_LevelNames) / sizeof(c_LevelNames[0]) ? c_LevelNames[(uint32_t)Level] : "unknown";
+}
+
+void xTrace::xWrite(const char* Event, int Length)
+{
+    if (Length > (int)MaxEventLength - 1)
+        Length = (int)MaxEventLength - 1;
+    fwrite(Event, 1, (size_t)Length, s_Output);
+}
+
+/// @brief Append String as JSON string literal (quoted, escaped)
+int xTrace::xAppendString(char* Buffer, int Length, const char* String)
+{
+    const int Limit = (int)MaxEventLength - 8;
+    Buffer[Length++] = '"';
+    for (; *String != '\0' && Length < Limit; String++) {
+        const char c = *String;
+        if (c == '"' || c == '\\') {
+            Buffer[Length++] = '\\';
+            Buffer[Length++] = c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            Length += snprintf(Buffer + Length, MaxEventLength - Length, "\\u%04x", (unsigned char)c);
+        }
+        else {
+            Buffer[Length++] = c;
+        }
+    }
+    Buffer[Length++] = '"';
+    return Length;
+}
+
+/// @brief Free-form event, printf-style
+void xTrace::Message(eLevel Level, const char* Format, ...)
+{
+    char Text[MaxEventLength - 32]; // room for level and JSON framing
+    va_list Args;
+    va_start(Args, Format);
+    vsnprintf(Text, sizeof(Text), Format, Args);
+    va_end(Args);
+
+    char Event[MaxEventLength];
+    int Length;
+    if (s_Format == eFormat::JSON) {
+        Length = snprintf(Event, sizeof(Event), "{\"level\":\"%s\",\"msg\":", getLevelName(Level));
+        Length = xAppendString(Event, Length, Text);
+        Event[Length++] = '}';
+        Event[Length++] = '\n';
+    }
+    else {
+        Length = snprintf(Event, sizeof(Event), "[%s] %s\n", getLevelName(Level), Text);
+    }
+    xWrite(Event, Length);
+}
+
+/**
+  @brief Event for every packet of demuxed PID - text format is the classic per-packet dump
+  @param Assembler is assembler of packet PID (PES header is reported when assembling started)
+ */
+void xTrace::Packet(uint64_t PacketId, const xTS_PacketHeader& PacketHeader, const xTS_AdaptationField& AdaptationField, xPES_Assembler::eResult Result, const xPES_Assembler* Assembler)
+{
+    if (s_Format == eFormat::Text) {
+        // Written with several calls - stream is locked so events from reader thread land between packets
+#if defined(_WIN32)
+        _lock_file(s_Output);
+#else
+        flockfile(s_Output);
+#endif
+        fprintf(s_Output, "%010" PRIu64 " ", PacketId);
+        PacketHeader.Print(s_Output);
+        if (PacketHeader.hasAdaptationField()) {
+            fprintf(s_Output, "\n");
+            AdaptationField.Print(s_Output);
+            fprintf(s_Output, "\n");
+        }
+        switch (Result) {
+            case xPES_Assembler::eResult::StreamPackedLost:
+                fprintf(s_Output, "\nPcktLost \n");
+                break;
+            case xPES_Assembler::eResult::AssemblingStarted:
+                fprintf(s_Output, "\n           Assembling Started  \n");
+                Assembler->PrintPESH(s_Output);
+                break;
+            case xPES_Assembler::eResult::AssemblingContinue:
+                fprintf(s_Output, " Assembling Continue \n");
+                break;
+            case xPES_Assembler::eResult::AssemblingFinished:
+                fprintf(s_Output, "           Assembling Finished \n");
+                fprintf(s_Output, "           PES: PcktLen=%d HeadLen=%d DataLen=%d\n", Assembler->getNumPacketBytes(), Assembler->getHeaderLength(), Assembler->getNumPacketBytes() - Assembler->getHeaderLength());
+                break;
+            default:
+                break;
+        }
+#if defined(_WIN32)
+        _unlock_file(s_Output);
+#else
+        funlockfile(s_Output);
+#endif
+        return;
+    }
+
+    char Event[MaxEventLength];
+    int Length = snprintf(Event, sizeof(Event), "{\"pkt\":%" PRIu64 ",\"pid\":%u,\"tei\":%d,\"pusi\":%d,\"tsc\":%u,\"afc\":%u,\"cc\":%u",
+                          PacketId, PacketHeader.getPID(), PacketHeader.hasTransportError(), PacketHeader.isPayloadStart(), PacketHeader.getTSC(), PacketHeader.getAFC(), PacketHeader.getCC());
+    if (PacketHeader.hasAdaptationField()) {
+        Length += snprintf(Event + Length, sizeof(Event) - Length, ",\"af\":{\"len\":%u,\"dc\":%d,\"ra\":%d", AdaptationField.getAdaptationFieldLength(), AdaptationField.hasDiscontinuity(), AdaptationField.hasRandomAccess());
+        if (AdaptationField.hasPCR())
+            Length += snprintf(Event + Length, sizeof(Event) - Length, ",\"pcr\":%" PRIu64, AdaptationField.getPCR());
+        Length += snprintf(Event + Length, sizeof(Event) - Length, "}");
+    }
+    Length += snprintf(Event + Length, sizeof(Event) - Length, ",\"result\":\"%s\"", xResultName(Result));
+    Length = xAppendPES(Event, Length, Result, Assembler);
+    xWrite(Event, Length);
+}
+
+/// @brief Event for PES started, finished or lost
+void xTrace::PES(uint64_t PacketId, uint16_t PID, xPES_Assembler::eResult Result, const xPES_Assembler* Assembler)
+{
+    char Event[MaxEventLength];
+    int Length;
+    if (s_Format == eFormat::JSON)
+        Length = snprintf(Event, sizeof(Event), "{\"pkt\":%" PRIu64 ",\"pid\":%u,\"result\":\"%s\"", PacketId, PID, xResultName(Result));
+    else
+        Length = snprintf(Event, sizeof(Event), "%010" PRIu64 " PID=%u PES %s", PacketId, PID, xResultName(Result));
+    Length = xAppendPES(Event, Length, Result, Assembler);
+    xWrite(Event, Length);
+}
+
+/// @brief Append PES header (started) or PES size (finished) and terminate event
+int xTrace::xAppendPES(char* Event, int Length, xPES_Assembler::eResult Result, const xPES_Assembler* Assembler)
+{
+    const bool JSON = s_Format == eFormat::JSON;
+    if (Result == xPES_Assembler::eResult::AssemblingStarted) {
+        const xPES_PacketHeader& Header = Assembler->getHeader();
+        Length += snprintf(Event + Length, MaxEventLength - Length, JSON ? ",\"pes\":{\"sid\":%u,\"len\":%u" : " SID=%u L=%u", Header.getStreamId(), Header.getPacketLength());
+        if (Header.hasPTS())
+            Length += snprintf(Event + Length, MaxEventLength - Length, JSON ? ",\"pts\":%" PRIu64 : " PTS=%" PRIu64, Header.getPTS());
+        if (Header.hasDTS())
+            Length += snprintf(Event + Length, MaxEventLength - Length, JSON ? ",\"dts\":%" PRIu64 : " DTS=%" PRIu64, Header.getDTS());
+        if (JSON)
+            Event[Length++] = '}';
+    }
+    else if (Result == xPES_Assembler::eResult::AssemblingFinished) {
+        const int DataLength = Assembler->getNumPacketBytes() - Assembler->getHeaderLength();
+        Length += snprintf(Event + Length, MaxEventLength - Length, JSON ? ",\"pes\":{\"data_len\":%d}" : " DataLen=%d", DataLength);
+    }
+    if (JSON)
+        Event[Length++] = '}';
+    Event[Length++] = '\n';
+    return Length;
+}
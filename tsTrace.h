@@ -0,0 +1,81 @@
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include <cstdio>
+
+//=============================================================================================================================================================================
+// Event tracing
+//=============================================================================================================================================================================
+
+/*
+Diagnostics are emitted as events through X_TRACE(Level, Call). Call is
+evaluated only when Level is enabled at runtime (xTrace::setLevel) - a
+disabled trace point costs one load and compare. Trace points above
+TS_TRACE_MAX_LEVEL are removed at compile time: build production binaries
+with -DTS_TRACE_MAX_LEVEL=0 to strip tracing completely.
+
+Events go to one sink (stdout by default) as text (the classic per-packet
+dump) or JSON lines (one object per event, for tools). Every event is written
+with a single fwrite (the text packet dump under the stream lock), so events
+from the reader thread and demux workers do not mix.
+
+Levels: Error, Warning (lost packets, CRC errors, sync loss), Info (streams
+discovered), PES (PES started/finished), Packet (every packet of demuxed PIDs).
+*/
+
+#ifndef TS_TRACE_MAX_LEVEL
+#define TS_TRACE_MAX_LEVEL 5 // xTrace::eLevel::Packet
+#endif
+
+#define X_TRACE(Level, Call) do { if ((int)(Level) <= TS_TRACE_MAX_LEVEL && xTrace::isEnabled(Level)) { Call; } } while (0)
+
+class xTrace
+{
+public:
+  enum class eLevel : uint8_t
+  {
+    Off = 0,
+    Error,
+    Warning,
+    Info,
+    PES,
+    Packet,
+  };
+
+  enum class eFormat : uint8_t
+  {
+    Text = 0,
+    JSON,
+  };
+
+  static constexpr uint32_t MaxEventLength = 1024;
+
+protected:
+  static eLevel  s_Level;
+  static eFormat s_Format;
+  static FILE*   s_Output;
+
+public:
+  static void        Configure  (eLevel Level, eFormat Format, FILE* Output);
+  static void        setLevel   (eLevel Level) { s_Level = Level; }
+  static bool        isEnabled  (eLevel Level) { return Level <= s_Level; }
+  static eLevel      getLevel   () { return s_Level; }
+  static eFormat     getFormat  () { return s_Format; }
+  static bool        ParseLevel (const char* Name, eLevel& Level);
+  static bool        ParseFormat(const char* Name, eFormat& Format);
+  static const char* getLevelName(eLevel Level);
+
+  //events
+  static void Message(eLevel Level, const char* Format, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+  static void Packet (uint64_t PacketId, const xTS_PacketHeader& PacketHeader, const xTS_AdaptationField& AdaptationField, xPES_Assembler::eResult Result, const xPES_Assembler* Assembler);
+  static void PES    (uint64_t PacketId, uint16_t PID, xPES_Assembler::eResult Result, const xPES_Assembler* Assembler);
+
+protected:
+  static void xWrite       (const char* Event, int Length);
+  static int  xAppendString(char* Buffer, int Length, const char* String);
+  static int  xAppendPES   (char* Event, int Length, xPES_Assembler::eResult Result, const xPES_Assembler* Assembler);
+};
@@ -1,8 +1,52 @@
 #include "tsTransportStream.h"
+#include "tsElementary.h"
+#include "tsProfiler.h"
 #include <cstdio>
-#include <fstream>
+#include <cstring>
+#include <new>
 #include <vector>
 
+//=============================================================================================================================================================================
+// Layouts (ISO/IEC 13818-1), see tsBitfield.h
+//=============================================================================================================================================================================
+
+/// Optional fields of adaptation field (table 2-6), located at run time - layouts start at the field, bytes before it (length, flags) are readable
+struct xTS_AdaptationFieldLayout
+{
+  typedef xClockField<0, 6, 2> Clock;                    // PCR, OPCR
+  typedef xBitWord<0, 2, 2> tLTW_Word;                   // ltw_valid_flag, ltw_offset
+  typedef tLTW_Word::Field<0,  1> LTW_Valid;
+  typedef tLTW_Word::Field<1, 15> LTW_Offset;
+  typedef xBitWord<-1, 4, 3, 2> tPiecewiseRateWord;      // 2 reserved bits, piecewise_rate
+  typedef tPiecewiseRateWord::Field<2, 22> PiecewiseRate;
+  typedef xTimestampField<0, 5, 3> SeamlessSplice;       // splice_type in place of timestamp prefix
+  typedef xBitWord<0, 1, 5> tSpliceTypeWord;
+  typedef tSpliceTypeWord::Field<0, 4> SpliceType;
+};
+
+/// PES packet header (table 2-21) - fixed part is one 64-bit word and PES_header_data_length
+struct xPES_HeaderLayout
+{
+  static constexpr uint32_t FixedLength = 9;
+  static constexpr uint32_t PTS_Length  = FixedLength + 5;  // header holding PTS (or DTS alone)
+  static constexpr uint32_t DTS_Length  = FixedLength + 10; // header holding PTS and DTS
+
+  typedef xBitWord<0, 8, FixedLength> tWord;
+  typedef tWord::Field< 0, 24> PacketStartCodePrefix;
+  typedef tWord::Field<24,  8> StreamId;
+  typedef tWord::Field<32, 16> PacketLength;
+  typedef tWord::Field<56,  2> PTS_DTS_Flags;
+  typedef tWord::Field<58,  1> ESCR_Flag;
+  typedef tWord::Field<59,  1> ES_RateFlag;
+  typedef tWord::Field<60,  1> DSM_TrickModeFlag;
+  typedef tWord::Field<61,  1> AdditionalCopyInfoFlag;
+  typedef tWord::Field<62,  1> PES_CRC_Flag;
+  typedef tWord::Field<63,  1> PES_ExtensionFlag;
+  typedef xBitWord<8, 1, FixedLength>::Field<64, 8> HeaderDataLength;
+  typedef xTimestampField<FixedLength,     PTS_Length> PTS;
+  typedef xTimestampField<FixedLength + 5, DTS_Length> DTS;
+};
+
 //=============================================================================================================================================================================
 // xTS_PacketHeader
 //=============================================================================================================================================================================
@@ -24,28 +68,31 @@ void xTS_PacketHeader::Reset()
 /**
   @brief Parse all TS packet header fields
   @param Input is pointer to buffer containing TS packet
+  @param Size is number of bytes available in Input
   @return Number of parsed bytes (4 on success, -1 on failure) 
  */
-int32_t xTS_PacketHeader::Parse(const std::vector<uint8_t>& Input)
+int32_t xTS_PacketHeader::Parse(const uint8_t* Input, uint32_t Size)
 {
-    if (Input.empty())
+    if (Input == nullptr || Size < xTS::TS_HeaderLength)
         return NOT_VALID;
 
-    m_SB = Input[0];
-    m_E = (Input[1] & 0x80) != 0;
-    m_S = (Input[1] & 0x40) != 0;
-    m_T = (Input[1] & 0x20) != 0;
-    m_PID = ((Input[1] & 0x1F) << 8) | Input[2];
-    m_TSC = (Input[3] >> 6) & 0x03;
-    m_AFC = (Input[3] >> 4) & 0x03;
-    m_CC = Input[3] & 0x0F;
+    typedef xTS_HeaderLayout L;
+    const L::tWord::tWord Word = L::tWord::Load(Input);
+    m_SB  = L::SyncByte::Extract(Word);
+    m_E   = L::TransportErrorIndicator::Extract(Word) != 0;
+    m_S   = L::PayloadUnitStartIndicator::Extract(Word) != 0;
+    m_T   = L::TransportPriority::Extract(Word) != 0;
+    m_PID = L::PID::Extract(Word);
+    m_TSC = L::TransportScramblingControl::Extract(Word);
+    m_AFC = L::AdaptationFieldControl::Extract(Word);
+    m_CC  = L::ContinuityCounter::Extract(Word);
 
     return 4;
 }
 
-void xTS_PacketHeader::Print() const
+void xTS_PacketHeader::Print(FILE* Output) const
 {
-    printf("TS: SB=%02d E=%d S=%d P=%d PID=%5d TSC=%d AF=%d CC=%2d",
+    fprintf(Output, "TS: SB=%02d E=%d S=%d P=%d PID=%5d TSC=%d AF=%d CC=%2d",
            m_SB,
            m_E,
            m_S,
@@ -58,88 +105,280 @@ void xTS_PacketHeader::Print() const
     return;
 }
 
+//=============================================================================================================================================================================
+// xTS_PacketHeaderBatch
+//=============================================================================================================================================================================
+
+/// @brief Decode header of one packet into columns
+inline void xTS_PacketHeaderBatch::xDecode(uint32_t Idx, const uint8_t* Packet)
+{
+    typedef xTS_HeaderLayout L;
+    const L::tWord::tWord Word = L::tWord::Load(Packet);
+    m_SB  [Idx] = L::SyncByte::Extract(Word);
+    m_TEI [Idx] = L::TransportErrorIndicator::Extract(Word);
+    m_PUSI[Idx] = L::PayloadUnitStartIndicator::Extract(Word);
+    m_PID [Idx] = L::PID::Extract(Word);
+    m_TSC [Idx] = L::TransportScramblingControl::Extract(Word);
+    m_AFC [Idx] = L::AdaptationFieldControl::Extract(Word);
+    m_CC  [Idx] = L::ContinuityCounter::Extract(Word);
+}
+
+uint32_t xTS_PacketHeaderBatch::ParseScalar(const uint8_t* const* Packets, uint32_t NumPackets)
+{
+    if (NumPackets > MaxPackets)
+        NumPackets = MaxPackets;
+    for (uint32_t i = 0; i < NumPackets; i++) {
+        xDecode(i, Packets[i]);
+    }
+    m_NumPackets = NumPackets;
+    return NumPackets;
+}
+
+/**
+  @brief Decode headers of NumPackets packets
+  @param Packets is array of pointers to TS packets
+  @param NumPackets is number of packets (at most MaxPackets)
+  @return Number of decoded headers
+ */
+#if defined(X_ARCH_X86)
+uint32_t xTS_PacketHeaderBatch::Parse(const uint8_t* const* Packets, uint32_t NumPackets)
+{
+    if (NumPackets > MaxPackets)
+        NumPackets = MaxPackets;
+
+    const __m128i Mask01   = _mm_set1_epi32(0x01);
+    const __m128i Mask03   = _mm_set1_epi32(0x03);
+    const __m128i Mask0F   = _mm_set1_epi32(0x0F);
+    const __m128i MaskFF   = _mm_set1_epi32(0xFF);
+    const __m128i Mask1F00 = _mm_set1_epi32(0x1F00);
+    const __m128i Zero     = _mm_setzero_si128();
+
+    uint32_t i = 0;
+    for (; i + 8 <= NumPackets; i += 8) {
+        // Gather 4 header bytes of 8 packets
+        uint32_t Words[8];
+        for (uint32_t j = 0; j < 8; j++)
+            memcpy(&Words[j], Packets[i + j], sizeof(uint32_t));
+        const __m128i W0 = _mm_loadu_si128((const __m128i*)(Words + 0));
+        const __m128i W1 = _mm_loadu_si128((const __m128i*)(Words + 4));
+
+        // Fields as 32-bit lanes, narrowed to 16 bit (packs) and 8 bit (packus) - lanes are little-endian loads, so shifts are those of xTS_HeaderLayout with bytes reversed
+        #define X_FIELD8(Shift, Mask) _mm_packus_epi16(_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(W0, Shift), Mask), _mm_and_si128(_mm_srli_epi32(W1, Shift), Mask)), Zero)
+        _mm_storel_epi64((__m128i*)(m_SB   + i), X_FIELD8( 0, MaskFF));
+        _mm_storel_epi64((__m128i*)(m_TEI  + i), X_FIELD8(15, Mask01));
+        _mm_storel_epi64((__m128i*)(m_PUSI + i), X_FIELD8(14, Mask01));
+        _mm_storel_epi64((__m128i*)(m_TSC  + i), X_FIELD8(30, Mask03));
+        _mm_storel_epi64((__m128i*)(m_AFC  + i), X_FIELD8(28, Mask03));
+        _mm_storel_epi64((__m128i*)(m_CC   + i), X_FIELD8(24, Mask0F));
+        #undef X_FIELD8
+
+        const __m128i PID0 = _mm_or_si128(_mm_and_si128(W0, Mask1F00), _mm_and_si128(_mm_srli_epi32(W0, 16), MaskFF));
+        const __m128i PID1 = _mm_or_si128(_mm_and_si128(W1, Mask1F00), _mm_and_si128(_mm_srli_epi32(W1, 16), MaskFF));
+        _mm_storeu_si128((__m128i*)(m_PID + i), _mm_packs_epi32(PID0, PID1));
+    }
+    for (; i < NumPackets; i++) {
+        xDecode(i, Packets[i]);
+    }
+    m_NumPackets = NumPackets;
+    return NumPackets;
+}
+#else
+uint32_t xTS_PacketHeaderBatch::Parse(const uint8_t* const* Packets, uint32_t NumPackets)
+{
+    return ParseScalar(Packets, NumPackets);
+}
+#endif
+
 //=============================================================================================================================================================================
 // xTS_AdaptationField
 //=============================================================================================================================================================================
 
 void xTS_AdaptationField::Reset()
 {
+    m_Field = nullptr;
     m_AdaptationFieldControl = 0;
     m_AdaptationFieldLength = 0;
-    m_RA = false;
-    m_DC = false;
-    m_SP = false;
-    m_PR = false;
-    m_OR = false;
-    m_SF = false;
-    m_TP = false;
-    m_EX = false;
-    m_PCR = 0;
     return;
 }
 
 /**
-@brief Parse adaptation field
-@param PacketBuffer is pointer to buffer containing TS packet
+@brief Parse adaptation field - only the length is read, fields are decoded by getters
+@param PacketBuffer is pointer to buffer containing TS packet (must outlive use of getters)
+@param Size is number of bytes available in PacketBuffer
 @param AdaptationFieldControl is value of Adaptation Field Control field of
 corresponding TS packet header
 @return Number of parsed bytes (length of AF or -1 on failure)
+Length that does not fit into the packet (above 183, above 182 with payload) is kept for the payload offset check of
+the caller, but the view reads no field of such adaptation field.
 */
 
-int32_t xTS_AdaptationField::Parse(const std::vector<uint8_t>& PacketBuffer, uint8_t AdaptationFieldControl)
+int32_t xTS_AdaptationField::Parse(const uint8_t* PacketBuffer, uint32_t Size, uint8_t AdaptationFieldControl)
 {
     m_AdaptationFieldControl = AdaptationFieldControl;
-    xTS m_xTS;
 
-    if (PacketBuffer.empty())
+    if (PacketBuffer == nullptr || Size < xTS::TS_PacketLength)
         return NOT_VALID;
 
-    m_AdaptationFieldLength = PacketBuffer[4];
-    m_RA = (PacketBuffer[5] & 0x80) != 0;
-    m_DC = (PacketBuffer[5] & 0x40) != 0;     
-    m_SP = (PacketBuffer[5] & 0x20) != 0;
-    m_PR = (PacketBuffer[5] & 0x10) != 0;
-    m_OR = (PacketBuffer[5] & 0x08) != 0;
-    m_SF = (PacketBuffer[5] & 0x04) != 0;
-    m_TP = (PacketBuffer[5] & 0x02) != 0;
-    m_EX = (PacketBuffer[5] & 0x01) != 0;
-
-    if (m_PR == true)
-    {
-        // Pierwsze 33 bity po polu kontrolnym to pola PCR
-        m_PCR |= static_cast<uint64_t>(PacketBuffer[6]) << 25;
-        m_PCR |= static_cast<uint64_t>(PacketBuffer[7]) << 17;
-        m_PCR |= static_cast<uint64_t>(PacketBuffer[8]) << 9;
-        m_PCR |= static_cast<uint64_t>(PacketBuffer[9]) << 1;
-        m_PCR |= static_cast<uint64_t>(PacketBuffer[10]) >> 7;
-        m_PCR *= m_xTS.BaseToExtendedClockMultiplier;
-
-        m_time = static_cast<float>(m_PCR) / m_xTS.ExtendedClockFrequency_Hz;
+    m_Field = PacketBuffer + xTS::TS_HeaderLength;
+    m_AdaptationFieldLength = m_Field[0];
+    const uint32_t MaxLength = xTS::TS_PacketLength - xTS::TS_HeaderLength - 1 - (AdaptationFieldControl == 3 ? 1 : 0);
+    if (m_AdaptationFieldLength > MaxLength) {
+        m_Field = nullptr;
+        return NOT_VALID;
     }
     return m_AdaptationFieldLength;
 }
 
+/**
+@brief Locate optional field - walks fields present before it (PCR, OPCR, splice_countdown, private data, extension)
+@param Flag is flag of field (eFlag_PCR..eFlag_Extension), 0 locates stuffing
+@return Offset of field from adaptation_field_length byte, 0 if field is absent or does not fit into adaptation field
+*/
+uint32_t xTS_AdaptationField::xFind(uint8_t Flag) const
+{
+    const uint8_t  Flags = getFlags();
+    const uint32_t End   = getNumBytes();
+    if (m_Field == nullptr || m_AdaptationFieldLength == 0 || (Flag != 0 && !(Flags & Flag)))
+        return 0;
+
+    uint32_t Offset = 2;
+    for (uint8_t Field = eFlag_PCR; Field != 0; Field >>= 1) {
+        if (!(Flags & Field))
+            continue;
+        uint32_t FieldSize;
+        if (Field == eFlag_PCR || Field == eFlag_OPCR)
+            FieldSize = 6;
+        else if (Field == eFlag_SplicingPoint)
+            FieldSize = 1;
+        else // length byte followed by data
+            FieldSize = Offset < End ? 1 + m_Field[Offset] : 1;
+        if (Offset + FieldSize > End)
+            return 0;
+        if (Field == Flag)
+            return Offset;
+        Offset += FieldSize;
+    }
+    return Offset;
+}
+
+/// @brief Offset of field of adaptation field extension (ltw, piecewise_rate, seamless_splice) from adaptation_field_length byte, 0 if absent
+uint32_t xTS_AdaptationField::xFindExtension(uint8_t Flag) const
+{
+    const uint32_t Extension = xFind(eFlag_Extension);
+    if (Extension == 0 || m_Field[Extension] == 0)
+        return 0;
+    const uint8_t  Flags = m_Field[Extension + 1];
+    const uint32_t End   = Extension + 1 + m_Field[Extension];
+    if (!(Flags & Flag))
+        return 0;
+
+    static constexpr uint8_t  Fields    [] = { eExtFlag_LTW, eExtFlag_PiecewiseRate, eExtFlag_SeamlessSplice };
+    static constexpr uint32_t FieldSizes[] = { 2, 3, 5 };
+    uint32_t Offset = Extension + 2;
+    for (uint32_t i = 0; i < 3; i++) {
+        if (!(Flags & Fields[i]))
+            continue;
+        if (Offset + FieldSizes[i] > End)
+            return 0;
+        if (Fields[i] == Flag)
+            return Offset;
+        Offset += FieldSizes[i];
+    }
+    return 0;
+}
+
+uint64_t xTS_AdaptationField::getPCR() const
+{
+    const uint32_t Offset = xFind(eFlag_PCR);
+    return Offset != 0 ? xTS_AdaptationFieldLayout::Clock::Get(m_Field + Offset) : 0;
+}
 
-void xTS_AdaptationField::Print() const
+uint64_t xTS_AdaptationField::getOPCR() const
 {
+    const uint32_t Offset = xFind(eFlag_OPCR);
+    return Offset != 0 ? xTS_AdaptationFieldLayout::Clock::Get(m_Field + Offset) : 0;
+}
 
-    printf("           AF: L=%3d DC=%d RA=%d SP=%d PR=%d OR=%d SF=%d TP=%d EX=%d",
-    m_AdaptationFieldLength,
-    m_RA,
-    m_DC,
-    m_SP,
-    m_PR,
-    m_OR,
-    m_SF,
-    m_TP,
-    m_EX);
+/// @brief Packets left until splicing point (negative after it)
+int8_t xTS_AdaptationField::getSpliceCountdown() const
+{
+    const uint32_t Offset = xFind(eFlag_SplicingPoint);
+    return Offset != 0 ? static_cast<int8_t>(m_Field[Offset]) : 0;
+}
+
+/// @brief Transport private data - returns its length, Data points into packet (nullptr if absent)
+uint8_t xTS_AdaptationField::getPrivateData(const uint8_t*& Data) const
+{
+    const uint32_t Offset = xFind(eFlag_PrivateData);
+    Data = Offset != 0 ? m_Field + Offset + 1 : nullptr;
+    return Offset != 0 ? m_Field[Offset] : 0;
+}
+
+/// @brief Stuffing bytes after optional fields (0 if fields overrun adaptation field)
+uint32_t xTS_AdaptationField::getStuffingLength() const
+{
+    const uint32_t Offset = xFind(0);
+    return Offset != 0 ? getNumBytes() - Offset : 0;
+}
+
+uint8_t xTS_AdaptationField::getExtensionFlags() const
+{
+    const uint32_t Offset = xFind(eFlag_Extension);
+    return Offset != 0 && m_Field[Offset] != 0 ? m_Field[Offset + 1] & 0xE0 : 0;
+}
+
+bool xTS_AdaptationField::getLTW(bool& Valid, uint16_t& Offset) const
+{
+    const uint32_t Field = xFindExtension(eExtFlag_LTW);
+    if (Field == 0)
+        return false;
+    typedef xTS_AdaptationFieldLayout L;
+    const L::tLTW_Word::tWord Word = L::tLTW_Word::Load(m_Field + Field);
+    Valid  = L::LTW_Valid::Extract(Word) != 0;
+    Offset = L::LTW_Offset::Extract(Word);
+    return true;
+}
+
+bool xTS_AdaptationField::getPiecewiseRate(uint32_t& Rate) const
+{
+    const uint32_t Field = xFindExtension(eExtFlag_PiecewiseRate);
+    if (Field == 0)
+        return false;
+    Rate = xTS_AdaptationFieldLayout::PiecewiseRate::Get(m_Field + Field);
+    return true;
+}
 
-    if (m_PR == true)
-        printf(" PCR=%d (Time=%fs) Stuffing=0",
-        m_PCR,
-        m_time);
-    else
-        printf(" Stuffing=%d", m_AdaptationFieldLength - 1);
+/// @brief Seamless splice - DTS_next_AU uses PES timestamp layout with splice_type in place of prefix
+bool xTS_AdaptationField::getSeamlessSplice(uint8_t& SpliceType, uint64_t& DTS_NextAU) const
+{
+    const uint32_t Field = xFindExtension(eExtFlag_SeamlessSplice);
+    if (Field == 0)
+        return false;
+    SpliceType = xTS_AdaptationFieldLayout::SpliceType::Get(m_Field + Field);
+    DTS_NextAU = xTS_AdaptationFieldLayout::SeamlessSplice::Get(m_Field + Field);
+    return true;
+}
+
+void xTS_AdaptationField::Print(FILE* Output) const
+{
+    const uint8_t Flags = getFlags();
+
+    fprintf(Output, "           AF: L=%3d DC=%d RA=%d SP=%d PR=%d OR=%d SF=%d TP=%d EX=%d",
+    m_AdaptationFieldLength,
+    (Flags & eFlag_Discontinuity) != 0,
+    (Flags & eFlag_RandomAccess) != 0,
+    (Flags & eFlag_ESPriority) != 0,
+    (Flags & eFlag_PCR) != 0,
+    (Flags & eFlag_OPCR) != 0,
+    (Flags & eFlag_SplicingPoint) != 0,
+    (Flags & eFlag_PrivateData) != 0,
+    (Flags & eFlag_Extension) != 0);
+
+    if (hasPCR())
+        fprintf(Output, " PCR=%" PRIu64 " (Time=%fs)",
+        getPCR(),
+        static_cast<float>(getPCR()) / xTS::ExtendedClockFrequency_Hz);
+    fprintf(Output, " Stuffing=%u", getStuffingLength());
 }
 
 
@@ -168,166 +407,428 @@ void xPES_PacketHeader::Reset() {
     return;
 }
 
-int32_t xPES_PacketHeader::Parse(const std::vector<uint8_t>& Data, int32_t Offset) {
-    if (Data.empty())
+/**
+@brief Parse PES packet header
+@param Input is pointer to first byte of PES packet (packet_start_code_prefix)
+@param Size is number of bytes available in Input
+@return Length of PES header (or -1 on failure)
+*/
+int32_t xPES_PacketHeader::Parse(const uint8_t* Input, int32_t Size) {
+    typedef xPES_HeaderLayout L;
+    if (Input == nullptr || Size < (int32_t)L::FixedLength)
+        return NOT_VALID;
+
+    const uint64_t Word = L::tWord::Load(Input);
+    m_PacketStartCodePrefix     = L::PacketStartCodePrefix::Extract(Word);
+    m_StreamId                  = L::StreamId::Extract(Word);
+    m_PacketLength              = L::PacketLength::Extract(Word);
+    m_PTS_DTS                   = L::PTS_DTS_Flags::Extract(Word);
+    m_ESCR_flag                 = L::ESCR_Flag::Extract(Word) != 0;
+    m_ES_rate_flag              = L::ES_RateFlag::Extract(Word) != 0;
+    m_DSM_trick_mode_flag       = L::DSM_TrickModeFlag::Extract(Word) != 0;
+    m_additional_copy_info_flag = L::AdditionalCopyInfoFlag::Extract(Word) != 0;
+    m_PES_CRC_flag              = L::PES_CRC_Flag::Extract(Word) != 0;
+    m_PES_extension_flag        = L::PES_ExtensionFlag::Extract(Word) != 0;
+
+    m_HeaderLength = L::FixedLength + L::HeaderDataLength::Get(Input);
+    if (m_HeaderLength > Size)
+        return NOT_VALID;
+    // PES_packet_length counts bytes after itself - header longer than whole PES packet is malformed
+    if (m_PacketLength != 0 && xTS::PES_HeaderLength + m_PacketLength < (uint32_t)m_HeaderLength)
         return NOT_VALID;
-    std::vector<uint8_t> Input(Data.begin() + Offset, Data.end());
-    xTS m_xTS;
-
-    m_PacketStartCodePrefix = (static_cast<uint32_t>(Input[0]) << 16) | (static_cast<uint32_t>(Input[1]) << 8) | static_cast<uint32_t>(Input[2]);
-    m_StreamId              = Input[3];
-    m_PacketLength          = (static_cast<uint16_t>(Input[4]) << 8) | (static_cast<uint16_t>(Input[5]));
-    m_PTS_DTS               = Input[7] >> 6;
-
-    m_ESCR_flag = (Input[7] & 0x20) != 0;
-    m_ES_rate_flag = (Input[7] & 0x10) != 0;
-    m_DSM_trick_mode_flag = (Input[7] & 0x08) != 0;
-    m_additional_copy_info_flag = (Input[7] & 0x04) != 0;
-    m_PES_CRC_flag = (Input[7] & 0x02) != 0;
-    m_PES_extension_flag = (Input[7] & 0x01) != 0;
-    
-    m_HeaderLength = 9 + (Input[8]);
-
-    if (m_PTS_DTS == 0x02) { // PTS = 1, DTS = 0
-        m_PresentationTimeStamp = (static_cast<uint32_t>(Input[9] & 0x0E) << 30) |  // 0x0E = 00001110
-                                  (static_cast<uint32_t>(Input[10]) << 22) |        // 0xFF = 11111111
-                                  (static_cast<uint32_t>(Input[11] & 0xFE) << 15) | // 0xFE = 11111110
-                                  (static_cast<uint32_t>(Input[12]) << 7) |         // 0xFF = 11111111
-                                  (static_cast<uint32_t>(Input[13] & 0xFE) >> 1);   // 0xFE = 11111110
-        m_PTS_time = static_cast<float>(m_PresentationTimeStamp) / m_xTS.BaseClockFrequency_Hz;
-
-    } else if (m_PTS_DTS == 0x01) { // PTS = 0, DTS = 1
-        m_DecodeTimeStamp = (static_cast<uint32_t>(Input[9] & 0x0E) << 30) |        // 0x0E = 00001110
-                                  (static_cast<uint32_t>(Input[10]) << 22) |        // 0xFF = 11111111
-                                  (static_cast<uint32_t>(Input[11] & 0xFE) << 15) | // 0xFE = 11111110
-                                  (static_cast<uint32_t>(Input[12]) << 7) |         // 0xFF = 11111111
-                                  (static_cast<uint32_t>(Input[13] & 0xFE) >> 1);   // 0xFE = 11111110
-        m_DTS_time = static_cast<float>(m_DecodeTimeStamp) / m_xTS.BaseClockFrequency_Hz;
-
-    } else if (m_PTS_DTS == 0x03) { // PTS = 1, DTS = 1
-        m_PresentationTimeStamp = (static_cast<uint32_t>(Input[9] & 0x0E) << 30) |  
-                                  (static_cast<uint32_t>(Input[10]) << 22) |
-                                  (static_cast<uint32_t>(Input[11] & 0xFE) << 15) |
-                                  (static_cast<uint32_t>(Input[12]) << 7) |
-                                  (static_cast<uint32_t>(Input[13] & 0xFE) >> 1);
-        m_PTS_time = static_cast<float>(m_PresentationTimeStamp) / m_xTS.BaseClockFrequency_Hz;
-
-        m_DecodeTimeStamp = (static_cast<uint32_t>(Input[14] & 0x0E) << 30) |
-                                  (static_cast<uint32_t>(Input[15]) << 22) |
-                                  (static_cast<uint32_t>(Input[16] & 0xFE) << 15) |
-                                  (static_cast<uint32_t>(Input[17]) << 7) |
-                                  (static_cast<uint32_t>(Input[18] & 0xFE) >> 1);
-        m_DTS_time = static_cast<float>(m_DecodeTimeStamp) / m_xTS.BaseClockFrequency_Hz;
+
+    // Timestamps are read only from a header long enough to hold them (flags of a shorter one are ignored)
+    if (m_PTS_DTS == 0x03 && m_HeaderLength < (int32_t)L::DTS_Length)
+        m_PTS_DTS = m_HeaderLength < (int32_t)L::PTS_Length ? 0 : 0x02;
+    else if (m_PTS_DTS != 0 && m_HeaderLength < (int32_t)L::PTS_Length)
+        m_PTS_DTS = 0;
+
+    if (m_PTS_DTS & 0x02) {
+        m_PresentationTimeStamp = L::PTS::Get(Input);
+        m_PTS_time = static_cast<float>(m_PresentationTimeStamp) / xTS::BaseClockFrequency_Hz;
+    }
+    if (m_PTS_DTS == 0x01 || m_PTS_DTS == 0x03) { // DTS alone (forbidden value) is read at PTS position
+        m_DecodeTimeStamp = m_PTS_DTS == 0x03 ? L::DTS::Get(Input) : L::PTS::Get(Input);
+        m_DTS_time = static_cast<float>(m_DecodeTimeStamp) / xTS::BaseClockFrequency_Hz;
     }
 
     return m_HeaderLength;
 }
 
-void xPES_PacketHeader::Print() const {
-    printf("           PES: PSCP=%d SID=%d L=%d ", m_PacketStartCodePrefix, m_StreamId, m_PacketLength);
+void xPES_PacketHeader::Print(FILE* Output) const {
+    fprintf(Output, "           PES: PSCP=%d SID=%d L=%d ", m_PacketStartCodePrefix, m_StreamId, m_PacketLength);
 
     if (m_PTS_DTS == 0x02 || m_PTS_DTS == 0x03) {
-        printf("PTS=%d (Time=%fs) ", m_PresentationTimeStamp, m_PTS_time);
+        fprintf(Output, "PTS=%" PRIu64 " (Time=%fs) ", m_PresentationTimeStamp, m_PTS_time);
     } else if (m_PTS_DTS == 0x01) {
-        printf("DTS=%d (Time=%fs) ", m_DecodeTimeStamp, m_DTS_time);
+        fprintf(Output, "DTS=%" PRIu64 " (Time=%fs) ", m_DecodeTimeStamp, m_DTS_time);
     }
-    printf("\n");
+    fprintf(Output, "\n");
     return;
 }
 
+//=============================================================================================================================================================================
+// xPES_BufferPool
+//=============================================================================================================================================================================
+
+xPES_BufferPool::~xPES_BufferPool()
+{
+    for (std::vector<uint8_t*>& Free : m_Free) {
+        for (uint8_t* Block : Free)
+            xAlignedFree(Block);
+    }
+}
+
+/// @brief Size class of smallest block holding Size bytes (largest class if none does)
+uint32_t xPES_BufferPool::xGetClass(uint32_t Size)
+{
+    if (Size <= MinBlockSize)
+        return 0;
+    const uint32_t Log2 = 64 - xCountLeadingZeros64(Size - 1);
+    return (Log2 < MaxBlockSizeLog2 ? Log2 : MaxBlockSizeLog2) - MinBlockSizeLog2;
+}
+
+/**
+  @brief Take block from free list of its size class, allocate only if the list is empty
+  @param MinSize is wanted size (blocks are at most MaxBlockSize)
+  @param BlockSize receives size of block
+ */
+uint8_t* xPES_BufferPool::Acquire(uint32_t MinSize, uint32_t& BlockSize)
+{
+    const uint32_t Class = xGetClass(MinSize);
+    BlockSize = MinBlockSize << Class;
+    m_NumAcquired++;
+    std::vector<uint8_t*>& Free = m_Free[Class];
+    if (!Free.empty()) {
+        uint8_t* Block = Free.back();
+        Free.pop_back();
+        return Block;
+    }
+    uint8_t* Block = static_cast<uint8_t*>(xAlignedAlloc(64, BlockSize));
+    if (Block == nullptr)
+        throw std::bad_alloc();
+    m_NumBlocks++;
+    m_NumBytes += BlockSize;
+    return Block;
+}
+
+void xPES_BufferPool::Release(uint8_t* Block, uint32_t BlockSize)
+{
+    m_Free[xGetClass(BlockSize)].push_back(Block);
+}
+
+//=============================================================================================================================================================================
+// xPES_Buffer
+//=============================================================================================================================================================================
+
+xPES_Buffer& xPES_Buffer::operator=(xPES_Buffer&& Other) noexcept
+{
+    if (this != &Other) {
+        Reset();
+        m_Pool   = Other.m_Pool;
+        m_Blocks = std::move(Other.m_Blocks);
+        m_Size   = Other.m_Size;
+        Other.m_Blocks.clear();
+        Other.m_Size = 0;
+    }
+    return *this;
+}
+
+/// @brief Take first block big enough for Size bytes (up to MaxBlockSize) - buffer must be empty
+void xPES_Buffer::Reserve(uint32_t Size)
+{
+    if (!m_Blocks.empty())
+        return;
+    xBlock Block = { nullptr, 0, 0 };
+    Block.Data = m_Pool->Acquire(Size, Block.Capacity);
+    m_Blocks.push_back(Block);
+}
+
+/// @brief Append bytes, chaining MaxBlockSize blocks when the last one is full
+void xPES_Buffer::Append(const uint8_t* Data, uint32_t Size)
+{
+    while (Size != 0) {
+        if (m_Blocks.empty() || m_Blocks.back().Size == m_Blocks.back().Capacity) {
+            xBlock Block = { nullptr, 0, 0 };
+            Block.Data = m_Pool->Acquire(xPES_BufferPool::MaxBlockSize, Block.Capacity);
+            m_Blocks.push_back(Block);
+        }
+        xBlock& Block = m_Blocks.back();
+        const uint32_t Chunk = Size < Block.Capacity - Block.Size ? Size : Block.Capacity - Block.Size;
+        memcpy(Block.Data + Block.Size, Data, Chunk);
+        Block.Size += Chunk;
+        m_Size     += Chunk;
+        Data       += Chunk;
+        Size       -= Chunk;
+    }
+}
+
+/// @brief Drop bytes beyond Size, blocks left empty go back to pool
+void xPES_Buffer::Truncate(uint32_t Size)
+{
+    if (Size >= m_Size)
+        return;
+    uint32_t Kept = 0;
+    size_t NumBlocks = 0;
+    for (xBlock& Block : m_Blocks) {
+        if (Kept >= Size && NumBlocks != 0)
+            break;
+        Block.Size = Size - Kept < Block.Size ? Size - Kept : Block.Size;
+        Kept += Block.Size;
+        NumBlocks++;
+    }
+    for (size_t i = NumBlocks; i < m_Blocks.size(); i++)
+        m_Pool->Release(m_Blocks[i].Data, m_Blocks[i].Capacity);
+    m_Blocks.resize(NumBlocks);
+    m_Size = Size;
+}
+
+/// @brief Return all blocks to pool (block list keeps its capacity)
+void xPES_Buffer::Reset()
+{
+    for (const xBlock& Block : m_Blocks)
+        m_Pool->Release(Block.Data, Block.Capacity);
+    m_Blocks.clear();
+    m_Size = 0;
+}
+
+/// @brief Copy payload to contiguous memory of getSize() bytes
+void xPES_Buffer::CopyTo(uint8_t* Destination) const
+{
+    for (const xBlock& Block : m_Blocks) {
+        memcpy(Destination, Block.Data, Block.Size);
+        Destination += Block.Size;
+    }
+}
+
 //=============================================================================================================================================================================
 // xPES_Assembler
 //=============================================================================================================================================================================
 
+/**
+@brief Assembler writing finished PES to Output
+@param Pool provides PES buffer blocks - shared by assemblers of one thread (nullptr = private pool)
+*/
+xPES_Assembler::xPES_Assembler(xTS_OutputSink* Output, xPES_BufferPool* Pool)
+    : m_OwnPool(Pool == nullptr ? new xPES_BufferPool() : nullptr), m_Pool(Pool != nullptr ? Pool : m_OwnPool.get()), m_Buffer(m_Pool), m_Output(Output), m_Framer(nullptr), m_OnFinished(nullptr), m_OnFinishedContext(nullptr) {
+    Init(-1);
+}
+
 void xPES_Assembler::xBufferReset() {
     m_LastContinuityCounter = -1;
     m_Started = false;
     m_DataOffset = 0;
     m_BufferSize = 0;
-    m_Buffer.clear(); // Dodajemy czyszczenie wektora
+    m_Buffer.Reset(); // blocks go back to pool - no allocation in steady state
     return;
 }
 
 void xPES_Assembler::Init (int32_t PID) {
     m_PID = PID;
-    m_Buffer.clear();
+    m_Buffer.Reset();
     m_BufferSize = 0;
     m_DataOffset = 0;
     m_LastContinuityCounter = -1;
+    m_Duplicate = false;
     m_Started = false;
+    m_ExpectedDataLength = 0;
+    m_NumFinished = 0;
     return;
 }
 
-void xPES_Assembler::xBufferAppend(const std::vector<uint8_t>& Data, int32_t Offset) {
-    if (Data.empty() || Data.size() <= 0) {
+/**
+@brief Append payload bytes to PES buffer - this is the only copy of packet data
+@param Data is pointer to first payload byte
+@param Size is number of bytes to append (stuffing of last packet beyond PES_packet_length is not copied)
+*/
+void xPES_Assembler::xBufferAppend(const uint8_t* Data, int32_t Size) {
+    if (Data == nullptr || Size <= 0) {
         return;
     }
-    // Dodajemy do wektora dane z bufora
-    m_Buffer.insert(m_Buffer.end(), Data.begin() + Offset, Data.end());
-    m_BufferSize += Data.size() - Offset;
+    if (m_ExpectedDataLength != 0 && m_BufferSize + (uint32_t)Size > m_ExpectedDataLength) {
+        Size = m_BufferSize < m_ExpectedDataLength ? (int32_t)(m_ExpectedDataLength - m_BufferSize) : 0;
+        if (Size == 0) {
+            return;
+        }
+    }
+    X_PROFILE_BEGIN(Start);
+    m_Buffer.Append(Data, (uint32_t)Size);
+    m_BufferSize += Size;
+    X_PROFILE_END(Start, BufferAppend, (uint32_t)m_PID & (xProfiler::NumPIDs - 1), 1);
     return;
 }
 
-xPES_Assembler::eResult xPES_Assembler::AbsorbPacket(const std::vector<uint8_t> TransportStreamPacket, const xTS_PacketHeader* PacketHeader, const xTS_AdaptationField* AdaptationField) {     
+/// @brief Offset of first payload byte in TS packet (header + adaptation field if present)
+uint32_t xPES_Assembler::xPayloadOffset(const xTS_PacketHeader* PacketHeader, const xTS_AdaptationField* AdaptationField) const {
+    return xTS::TS_HeaderLength + (PacketHeader->hasAdaptationField() ? AdaptationField->getNumBytes() : 0);
+}
+
+/**
+@brief Absorb TS packet into PES being assembled
+@param TransportStreamPacket is pointer to 188 byte TS packet (not copied, only payload is appended)
+@param PacketHeader is parsed header of TransportStreamPacket
+@param AdaptationField is parsed adaptation field of TransportStreamPacket
+@return Assembling state
+*/
+xPES_Assembler::eResult xPES_Assembler::AbsorbPacket(const uint8_t* TransportStreamPacket, const xTS_PacketHeader* PacketHeader, const xTS_AdaptationField* AdaptationField) {     
+
+    const uint32_t PayloadOffset = xPayloadOffset(PacketHeader, AdaptationField);
+    if (PayloadOffset > xTS::TS_PacketLength) {
+        xLost();
+        m_LastContinuityCounter = PacketHeader->getCC();
+        return eResult::StreamPackedLost;
+    }
+    const int32_t PayloadSize = xTS::TS_PacketLength - PayloadOffset;
+
+    // Continuity counter advances with payload only (adaptation field only packets repeat it) and one duplicate packet is allowed
+    if (!(PacketHeader->getAFC() & 0x01)) {
+        return m_Started ? eResult::AssemblingContinue : eResult::StreamPackedLost;
+    }
+    if (PacketHeader->getCC() == m_LastContinuityCounter && !m_Duplicate) {
+        m_Duplicate = true;
+        return m_Started ? eResult::AssemblingContinue : eResult::StreamPackedLost;
+    }
+    m_Duplicate = false;
 
     // Check if the packet is the start of a new PES packet
     if (PacketHeader->isPayloadStart()) {
-        if (PacketHeader->getPID() != m_PID) {
-            Init(PacketHeader->getPID());
-        }
+        FinishBefore(PacketHeader->getCC());
         xBufferReset();
         m_Started = true;
         m_PESH.Reset();
         m_LastContinuityCounter = PacketHeader->getCC();
 
-        int32_t PES_headerLength = m_PESH.Parse(TransportStreamPacket, xTS::TS_HeaderLength + AdaptationField->getNumBytes());
+        X_PROFILE_BEGIN(Start);
+        int32_t PES_headerLength = m_PESH.Parse(TransportStreamPacket + PayloadOffset, PayloadSize);
+        X_PROFILE_END(Start, PES_HeaderParse, (uint32_t)m_PID & (xProfiler::NumPIDs - 1), 1);
 
         if (PES_headerLength == NOT_VALID) {
-            m_Started = false;
+            xLost();
             return eResult::StreamPackedLost;
         }
 
-        xBufferAppend(TransportStreamPacket, xTS::TS_HeaderLength + AdaptationField->getNumBytes() + PES_headerLength);
+        m_ExpectedDataLength = 0;
+        if (m_PESH.getPacketLength() != 0) {
+            m_ExpectedDataLength = xTS::PES_HeaderLength + m_PESH.getPacketLength() - PES_headerLength;
+        }
+        // Bounded PES fits one block sized from PES_packet_length, unbounded one starts a chain
+        m_Buffer.Reserve(m_ExpectedDataLength != 0 ? m_ExpectedDataLength : xPES_BufferPool::MaxBlockSize);
+        xBufferAppend(TransportStreamPacket + PayloadOffset + PES_headerLength, PayloadSize - PES_headerLength);
         
         m_LastContinuityCounter = PacketHeader->getCC();
+        if (m_ExpectedDataLength != 0 && m_BufferSize >= m_ExpectedDataLength) {
+            xFinish();
+            return eResult::AssemblingFinished;
+        }
         return eResult::AssemblingStarted;
     }
 
     if (PacketHeader->getCC() != ((m_LastContinuityCounter + 1) & 0x0F)) {
         m_LastContinuityCounter = PacketHeader->getCC();
-        m_Started = false;
+        xLost();
         return eResult::StreamPackedLost;
     }
+    m_LastContinuityCounter = PacketHeader->getCC();
 
-    // Check if the packet is a continuation of a PES packet
-    if (m_Started && !PacketHeader->hasAdaptationField()) {
-        xBufferAppend(TransportStreamPacket, xTS::TS_HeaderLength);
-        m_LastContinuityCounter = PacketHeader->getCC();
-        return eResult::AssemblingContinue;
+    if (!m_Started) {
+        return eResult::StreamPackedLost;
     }
 
+    xBufferAppend(TransportStreamPacket + PayloadOffset, PayloadSize);
+
     // Check if the packet is the end of a PES packet
-    if (m_Started && PacketHeader->hasAdaptationField()) {
-        xBufferAppend(TransportStreamPacket, xTS::TS_HeaderLength + AdaptationField->getNumBytes());
-        m_LastContinuityCounter = PacketHeader->getCC();
-        m_Started = false;
-        if (m_PID == 136) { // Write only audio files
-            WriteFile();
-        }
+    if (m_ExpectedDataLength != 0 && m_BufferSize >= m_ExpectedDataLength) {
+        xFinish();
         return eResult::AssemblingFinished;
     }
 
-    m_Started = false;
-    m_LastContinuityCounter = PacketHeader->getCC();
+    return eResult::AssemblingContinue;
+}
+
+/**
+@brief Finish PES of unspecified length still being assembled (call at end of stream)
+@return true if PES was finished
+*/
+bool xPES_Assembler::Flush() {
+    if (!m_Started || m_ExpectedDataLength != 0) {
+        return false;
+    }
+    xFinish();
+    return true;
+}
 
-    return eResult::StreamPackedLost;
+/**
+@brief End PES being assembled as a following PES start does - PES of unspecified length ends where the next one starts, unless its tail was lost just before
+@param ContinuityCounter is CC of the packet starting the next PES
+@return true if PES was finished, false if none was open or it was dropped (bounded PES cut short, or continuity gap)
+*/
+bool xPES_Assembler::FinishBefore(uint8_t ContinuityCounter) {
+    if (!m_Started) {
+        return false;
+    }
+    if (m_ExpectedDataLength == 0 && ContinuityCounter == ((m_LastContinuityCounter + 1) & 0x0F)) {
+        xFinish();
+        return true;
+    }
+    xLost();
+    return false;
+}
+
+/**
+@brief Continue with assembling state of Other - PES started in a chunk demuxed by another assembler of the same PID
+@param Other is assembler whose state (buffer, CC, PES header) is taken over, its finished PES are added to this one's count
+*/
+void xPES_Assembler::AdoptState(xPES_Assembler& Other) {
+    // Bytes are copied - blocks of Other belong to the pool of another thread
+    m_Buffer.Reset();
+    for (uint32_t i = 0; i < Other.m_Buffer.getNumBlocks(); i++)
+        m_Buffer.Append(Other.m_Buffer.getBlock(i).Data, Other.m_Buffer.getBlock(i).Size);
+    Other.m_Buffer.Reset();
+    m_BufferSize = Other.m_BufferSize;
+    m_DataOffset = Other.m_DataOffset;
+    m_LastContinuityCounter = Other.m_LastContinuityCounter;
+    m_Duplicate = Other.m_Duplicate;
+    m_Started = Other.m_Started;
+    m_ExpectedDataLength = Other.m_ExpectedDataLength;
+    m_PESH = Other.m_PESH;
+    m_NumFinished += Other.m_NumFinished;
+    return;
+}
+
+void xPES_Assembler::xFinish() {
+    // Drop bytes beyond PES_packet_length (should not happen in conformant streams)
+    if (m_ExpectedDataLength != 0 && m_BufferSize > m_ExpectedDataLength) {
+        m_Buffer.Truncate(m_ExpectedDataLength);
+        m_BufferSize = m_ExpectedDataLength;
+    }
+    m_Started = false;
+    m_NumFinished++;
+    if (m_Output != nullptr) {
+        WriteFile();
+    }
+    if (m_Framer != nullptr) {
+        m_Framer->AddPES(m_Buffer, m_PESH);
+    }
+    if (m_OnFinished != nullptr) {
+        m_OnFinished(m_OnFinishedContext, *this); // may take the payload (TakePacket)
+    }
+    return;
 }
 
+/// @brief Drop PES being assembled - data was lost, framer has to find sync again
+void xPES_Assembler::xLost() {
+    m_Started = false;
+    if (m_Framer != nullptr) {
+        m_Framer->Resync();
+    }
+    return;
+}
 
+/// @brief Append payload of assembled PES to output sink (buffered, written in background)
 void xPES_Assembler::WriteFile() {
-    // Append the buffer to the file
-    std::ofstream file(m_FileName, std::ios::out | std::ios::app | std::ios::binary);
-    file.write(reinterpret_cast<const char*>(m_Buffer.data()), m_Buffer.size());
-    file.close();
+    X_PROFILE_BEGIN(Start);
+    for (uint32_t i = 0; i < m_Buffer.getNumBlocks(); i++)
+        m_Output->Write(m_Buffer.getBlock(i).Data, m_Buffer.getBlock(i).Size);
+    X_PROFILE_END(Start, Write, (uint32_t)m_PID & (xProfiler::NumPIDs - 1), 1);
     return;
-}
\ No newline at end of file
+}
@@ -1,5 +1,9 @@
 #pragma once
 #include "tsCommon.h"
+#include "tsBitfield.h"
+#include "tsOutputSink.h"
+#include <cstdio>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -49,6 +53,25 @@ public:
   static constexpr uint32_t BaseClockFrequency_kHz        =       90; //kHz
   static constexpr uint32_t ExtendedClockFrequency_kHz    =    27000; //kHz
   static constexpr uint32_t BaseToExtendedClockMultiplier =      300;
+
+  /// @brief Unwrapped 33-bit timestamp nearest to Reference - Value - Reference taken modulo 2^33 as signed, added to Reference
+  static int64_t UnwrapTimestamp(uint64_t Value, int64_t Reference) { return Reference + ((int64_t)((Value - (uint64_t)Reference) << 31) >> 31); }
+};
+
+//=============================================================================================================================================================================
+
+/// TS packet header layout (ISO/IEC 13818-1 table 2-2) - one 32-bit word, see tsBitfield.h
+struct xTS_HeaderLayout
+{
+  typedef xBitWord<0, 4, xTS::TS_HeaderLength> tWord;
+  typedef tWord::Field< 0,  8> SyncByte;
+  typedef tWord::Field< 8,  1> TransportErrorIndicator;
+  typedef tWord::Field< 9,  1> PayloadUnitStartIndicator;
+  typedef tWord::Field<10,  1> TransportPriority;
+  typedef tWord::Field<11, 13> PID;
+  typedef tWord::Field<24,  2> TransportScramblingControl;
+  typedef tWord::Field<26,  2> AdaptationFieldControl;
+  typedef tWord::Field<28,  4> ContinuityCounter;
 };
 
 //=============================================================================================================================================================================
@@ -80,8 +103,9 @@ protected:
 
 public:
   void     Reset();
-  int32_t  Parse(const std::vector<uint8_t>& Input);
-  void     Print() const;
+  int32_t  Parse(const uint8_t* Input, uint32_t Size);
+  int32_t  Parse(const std::vector<uint8_t>& Input) { return Parse(Input.data(), (uint32_t)Input.size()); }
+  void     Print(FILE* Output = stdout) const;
 
 public:
   uint8_t  getSyncByte() const { return m_SB; }  
@@ -99,37 +123,130 @@ public:
 
 //=============================================================================================================================================================================
 
+/*
+Structure-of-arrays decoding of many TS packet headers at once. Header words
+are gathered from packets and split into columns with SIMD shifts and masks
+(SSE2, 8 packets per step; scalar on other architectures). Demux loops such as
+PID filtering and continuity checks then run over plain arrays.
+*/
+
+class xTS_PacketHeaderBatch
+{
+public:
+  static constexpr uint32_t MaxPackets = 256;
+
+protected:
+  uint32_t m_NumPackets;
+  alignas(16) uint16_t m_PID [MaxPackets]; // Packet Identifier
+  alignas(16) uint8_t  m_SB  [MaxPackets]; // Sync byte
+  alignas(16) uint8_t  m_TEI [MaxPackets]; // Transport error indicator
+  alignas(16) uint8_t  m_PUSI[MaxPackets]; // Payload unit start indicator
+  alignas(16) uint8_t  m_TSC [MaxPackets]; // Transport scrambling control
+  alignas(16) uint8_t  m_AFC [MaxPackets]; // Adaptation field control
+  alignas(16) uint8_t  m_CC  [MaxPackets]; // Continuity counter
+
+public:
+  xTS_PacketHeaderBatch() : m_NumPackets(0) {}
+
+  uint32_t Parse      (const uint8_t* const* Packets, uint32_t NumPackets);
+  uint32_t ParseScalar(const uint8_t* const* Packets, uint32_t NumPackets);
+
+public:
+  uint32_t        getNumPackets() const { return m_NumPackets; }
+  uint16_t        getPID (uint32_t Idx) const { return m_PID [Idx]; }
+  uint8_t         getSB  (uint32_t Idx) const { return m_SB  [Idx]; }
+  bool            getTEI (uint32_t Idx) const { return m_TEI [Idx] != 0; }
+  bool            getPUSI(uint32_t Idx) const { return m_PUSI[Idx] != 0; }
+  uint8_t         getTSC (uint32_t Idx) const { return m_TSC [Idx]; }
+  uint8_t         getAFC (uint32_t Idx) const { return m_AFC [Idx]; }
+  uint8_t         getCC  (uint32_t Idx) const { return m_CC  [Idx]; }
+  const uint16_t* getPIDs() const { return m_PID; }
+  const uint8_t*  getSBs () const { return m_SB;  }
+  const uint8_t*  getCCs () const { return m_CC;  }
+  const uint8_t*  getAFCs() const { return m_AFC; }
+  const uint8_t*  getTEIs() const { return m_TEI; }
+  const uint8_t*  getTSCs() const { return m_TSC; }
+
+protected:
+  void xDecode(uint32_t Idx, const uint8_t* Packet);
+};
+
+//=============================================================================================================================================================================
+
+/*
+View over the adaptation field of the packet passed to Parse() - nothing but
+the length byte is decoded until a getter asks for a field, so plain demuxing
+pays for none of them. The view is valid only while the packet bytes are.
+Optional fields are located from the flags on access; a field not fully inside
+adaptation_field_length reads as absent, as does every field when the length
+does not fit into the packet.
+*/
+
 class xTS_AdaptationField
 {
+public:
+    enum eFlags : uint8_t
+    {
+      eFlag_Discontinuity   = 0x80,
+      eFlag_RandomAccess    = 0x40,
+      eFlag_ESPriority      = 0x20,
+      eFlag_PCR             = 0x10,
+      eFlag_OPCR            = 0x08,
+      eFlag_SplicingPoint   = 0x04,
+      eFlag_PrivateData     = 0x02,
+      eFlag_Extension       = 0x01,
+    };
+
+    enum eExtensionFlags : uint8_t
+    {
+      eExtFlag_LTW            = 0x80,
+      eExtFlag_PiecewiseRate  = 0x40,
+      eExtFlag_SeamlessSplice = 0x20,
+    };
+
 protected:
     //setup
+    const uint8_t* m_Field; // adaptation_field_length byte (packet byte 4), nullptr if length does not fit into packet
     uint8_t m_AdaptationFieldControl;
     //mandatory fields
     uint8_t m_AdaptationFieldLength;
-    //optional fields - PCR
-    bool m_DC;
-    bool m_RA;
-    bool m_SP;
-    bool m_PR; // Program Clock Reference flag
-    bool m_OR;
-    bool m_SF;
-    bool m_TP;
-    bool m_EX;
-    uint32_t m_PCR;
-    // the time encoded in the PCR field measured in units of the period of the 27 MHz system clock
-    // where i is the byte index of the final byte of the program_clock_reference_base field
-    float m_time;
 
 public:
     void    Reset();
-    int32_t Parse(const std::vector<uint8_t>& PacketBuffer, uint8_t AdaptationFieldControl);
-    void    Print() const;
+    int32_t Parse(const uint8_t* PacketBuffer, uint32_t Size, uint8_t AdaptationFieldControl);
+    int32_t Parse(const std::vector<uint8_t>& PacketBuffer, uint8_t AdaptationFieldControl) { return Parse(PacketBuffer.data(), (uint32_t)PacketBuffer.size(), AdaptationFieldControl); }
+    void    Print(FILE* Output = stdout) const;
 
 public:
     //mandatory fields
     uint8_t getAdaptationFieldLength () const { return m_AdaptationFieldLength ; }
     //derived values
     uint32_t getNumBytes () const { return m_AdaptationFieldLength + 1; }
+    //flags
+    uint8_t  getFlags        () const { return m_Field != nullptr && m_AdaptationFieldLength != 0 ? m_Field[1] : 0; }
+    bool     hasDiscontinuity() const { return (getFlags() & eFlag_Discontinuity) != 0; }
+    bool     hasRandomAccess () const { return (getFlags() & eFlag_RandomAccess ) != 0; }
+    bool     hasESPriority   () const { return (getFlags() & eFlag_ESPriority   ) != 0; }
+    bool     hasPCR          () const { return xFind(eFlag_PCR) != 0; }
+    bool     hasOPCR         () const { return xFind(eFlag_OPCR) != 0; }
+    bool     hasSplicingPoint() const { return xFind(eFlag_SplicingPoint) != 0; }
+    bool     hasPrivateData  () const { return xFind(eFlag_PrivateData) != 0; }
+    bool     hasExtension    () const { return xFind(eFlag_Extension) != 0; }
+    //optional fields (0 when absent)
+    uint64_t getPCR          () const; // 27 MHz, base * 300 + extension
+    uint64_t getOPCR         () const; // 27 MHz
+    int8_t   getSpliceCountdown() const;
+    uint8_t  getPrivateData  (const uint8_t*& Data) const; // length, Data points into packet
+    uint32_t getStuffingLength() const;
+    //adaptation field extension
+    uint8_t  getExtensionFlags  () const;
+    bool     getLTW             (bool& Valid, uint16_t& Offset) const; // legal time window
+    bool     getPiecewiseRate   (uint32_t& Rate) const;             // 22 bits, units of 50 bytes/s
+    bool     getSeamlessSplice  (uint8_t& SpliceType, uint64_t& DTS_NextAU) const;
+
+protected:
+    uint32_t xFind         (uint8_t Flag) const; // offset of optional field from m_Field, 0 if absent
+    uint32_t xFindExtension(uint8_t Flag) const; // offset of extension field from m_Field, 0 if absent
 };
 
 //=============================================================================================================================================================================
@@ -171,8 +288,9 @@ class xPES_PacketHeader
 
   public:
     void Reset();
-    int32_t Parse(const std::vector<uint8_t>& Input, int32_t Offset);
-    void Print() const;
+    int32_t Parse(const uint8_t* Input, int32_t Size);
+    int32_t Parse(const std::vector<uint8_t>& Input, int32_t Offset) { return Parse(Input.data() + Offset, (int32_t)Input.size() - Offset); }
+    void Print(FILE* Output = stdout) const;
 
   public:
     //PES packet header
@@ -180,14 +298,114 @@ class xPES_PacketHeader
     uint32_t getPacketStartCodePrefix() const { return m_PacketStartCodePrefix; }
     uint8_t getStreamId () const { return m_StreamId; }
     uint16_t getPacketLength () const { return m_PacketLength; }
+    bool hasPTS () const { return (m_PTS_DTS & 0x02) != 0; }
+    bool hasDTS () const { return m_PTS_DTS == 0x03 || m_PTS_DTS == 0x01; }
+    uint64_t getPTS () const { return m_PresentationTimeStamp; }
+    uint64_t getDTS () const { return m_DecodeTimeStamp; }
+};
+
+//=============================================================================================================================================================================
+// PES buffers
+//=============================================================================================================================================================================
+
+/*
+Blocks for PES payload, recycled through free lists per size class (powers of
+2 from MinBlockSize to MaxBlockSize). A block is allocated only when its free
+list is empty, so after the first PES of every stream the assemblers run
+without heap allocation. A PES of known PES_packet_length (at most 64 KiB of
+payload) gets one block of the smallest class that holds it; PES of
+unspecified length (video) grows as a chain of MaxBlockSize blocks - bytes are
+never moved to grow.
+
+Not thread safe - pool and the buffers taking blocks from it belong to one
+thread (the demux thread), and the pool must outlive the buffers.
+*/
+
+class xPES_BufferPool
+{
+public:
+  static constexpr uint32_t MinBlockSizeLog2 = 12;
+  static constexpr uint32_t MaxBlockSizeLog2 = 16;
+  static constexpr uint32_t MinBlockSize     = 1 << MinBlockSizeLog2; // 4 KiB
+  static constexpr uint32_t MaxBlockSize     = 1 << MaxBlockSizeLog2; // 64 KiB, holds payload of any bounded PES
+  static constexpr uint32_t NumClasses       = MaxBlockSizeLog2 - MinBlockSizeLog2 + 1;
+
+protected:
+  std::vector<uint8_t*> m_Free[NumClasses];
+  uint64_t              m_NumBlocks;    // allocated
+  uint64_t              m_NumBytes;     // allocated
+  uint64_t              m_NumAcquired;
+
+public:
+  xPES_BufferPool() : m_NumBlocks(0), m_NumBytes(0), m_NumAcquired(0) {}
+  ~xPES_BufferPool();
+  xPES_BufferPool(const xPES_BufferPool&) = delete;
+  xPES_BufferPool& operator=(const xPES_BufferPool&) = delete;
+
+  uint8_t* Acquire(uint32_t MinSize, uint32_t& BlockSize);
+  void     Release(uint8_t* Block, uint32_t BlockSize);
+
+public:
+  uint64_t getNumBlocks  () const { return m_NumBlocks; }
+  uint64_t getNumBytes   () const { return m_NumBytes; }
+  uint64_t getNumAcquired() const { return m_NumAcquired; }
+
+protected:
+  static uint32_t xGetClass(uint32_t Size);
+};
+
+/*
+Payload of one PES as a chain of pool blocks. Move only - a finished PES is
+handed over with xPES_Assembler::TakePacket() without copying; its blocks go
+back to the pool when the buffer is reset or destroyed.
+*/
+
+class xPES_Buffer
+{
+public:
+  struct xBlock
+  {
+    uint8_t* Data;
+    uint32_t Size;
+    uint32_t Capacity;
+  };
+
+protected:
+  xPES_BufferPool*    m_Pool;
+  std::vector<xBlock> m_Blocks;
+  uint32_t            m_Size;
+
+public:
+  xPES_Buffer(xPES_BufferPool* Pool = nullptr) : m_Pool(Pool), m_Size(0) {}
+  ~xPES_Buffer() { Reset(); }
+  xPES_Buffer(const xPES_Buffer&) = delete;
+  xPES_Buffer& operator=(const xPES_Buffer&) = delete;
+  xPES_Buffer(xPES_Buffer&& Other) noexcept : m_Pool(Other.m_Pool), m_Blocks(std::move(Other.m_Blocks)), m_Size(Other.m_Size) { Other.m_Blocks.clear(); Other.m_Size = 0; }
+  xPES_Buffer& operator=(xPES_Buffer&& Other) noexcept;
+
+  void Reserve (uint32_t Size);
+  void Append  (const uint8_t* Data, uint32_t Size);
+  void Truncate(uint32_t Size);
+  void Reset   ();
+  void CopyTo  (uint8_t* Destination) const;
+
+public:
+  uint32_t      getSize     () const { return m_Size; }
+  bool          isEmpty     () const { return m_Size == 0; }
+  bool          isContiguous() const { return m_Blocks.size() <= 1; }
+  uint32_t      getNumBlocks() const { return (uint32_t)m_Blocks.size(); }
+  const xBlock& getBlock    (uint32_t Idx) const { return m_Blocks[Idx]; }
+  const uint8_t* getData    () const { return m_Blocks.empty() ? nullptr : m_Blocks[0].Data; } // whole PES only if isContiguous()
 };
 
 //=============================================================================================================================================================================
 
+class xES_AudioFramer;
+
 class xPES_Assembler
 {
   public:
-    xPES_Assembler(std::string FileName) : m_FileName(FileName) {}
+    xPES_Assembler(xTS_OutputSink* Output = nullptr, xPES_BufferPool* Pool = nullptr);
 
     enum class eResult : int32_t
     {
@@ -198,30 +416,54 @@ class xPES_Assembler
       AssemblingFinished,
     };
 
+    typedef void (*tFinishedCallback)(void* Context, xPES_Assembler& Assembler); // called for every finished PES
+
   protected:
 
     int32_t m_PID;
     //buffer
-    std::vector<uint8_t> m_Buffer;
+    std::unique_ptr<xPES_BufferPool> m_OwnPool; // when no shared pool is given
+    xPES_BufferPool* m_Pool;
+    xPES_Buffer m_Buffer;
     uint32_t m_BufferSize;
     uint32_t m_DataOffset;
     //operation
     int8_t m_LastContinuityCounter;
+    bool m_Duplicate; // last packet repeated m_LastContinuityCounter (one duplicate is allowed)
     bool m_Started;
+    uint32_t m_ExpectedDataLength; // 0 = unbounded (PES_packet_length == 0), finished by next PUSI
+    uint32_t m_NumFinished;
     xPES_PacketHeader m_PESH;
-    std::string m_FileName;
+    xTS_OutputSink* m_Output; // payload of finished PES is written here (nullptr = not written)
+    xES_AudioFramer* m_Framer; // finished PES is split into frames (nullptr = not framed)
+    tFinishedCallback m_OnFinished; // finished PES is passed on (nullptr = not passed)
+    void* m_OnFinishedContext;
 
   public:
     void Init (int32_t PID);
-    eResult AbsorbPacket(const std::vector<uint8_t> TransportStreamPacket, const xTS_PacketHeader* PacketHeader, const xTS_AdaptationField* AdaptationField);
-    void PrintPESH () const { m_PESH.Print(); }
-    std::vector<uint8_t> getPacket () { return m_Buffer; }
+    eResult AbsorbPacket(const uint8_t* TransportStreamPacket, const xTS_PacketHeader* PacketHeader, const xTS_AdaptationField* AdaptationField);
+    bool Flush();
+    bool FinishBefore(uint8_t ContinuityCounter);
+    void AdoptState(xPES_Assembler& Other);
+    void PrintPESH (FILE* Output = stdout) const { m_PESH.Print(Output); }
+    const xPES_PacketHeader& getHeader() const { return m_PESH; }
+    int32_t getPID () const { return m_PID; }
+    uint32_t getNumFinished () const { return m_NumFinished; }
+    const xPES_Buffer& getPacket () const { return m_Buffer; } // payload of PES just finished (until next packet is absorbed)
+    xPES_Buffer TakePacket () { return std::move(m_Buffer); }  // hands over payload of PES just finished without copy
     int32_t getNumPacketBytes() const { return m_BufferSize + m_PESH.getHeaderLength(); }
     int getHeaderLength() const { return m_PESH.getHeaderLength(); }
-    void PrepareFile(std::string FileName);
+    void SetOutput(xTS_OutputSink* Output) { m_Output = Output; }
+    xTS_OutputSink* getOutput() const { return m_Output; }
+    void SetFramer(xES_AudioFramer* Framer) { m_Framer = Framer; }
+    xES_AudioFramer* getFramer() const { return m_Framer; }
+    void SetFinishedCallback(tFinishedCallback Callback, void* Context) { m_OnFinished = Callback; m_OnFinishedContext = Context; }
     void WriteFile();
 
   protected:
     void xBufferReset ();
-    void xBufferAppend(const std::vector<uint8_t>& Data, int32_t Size);
+    void xBufferAppend(const uint8_t* Data, int32_t Size);
+    void xFinish();
+    void xLost();
+    uint32_t xPayloadOffset(const xTS_PacketHeader* PacketHeader, const xTS_AdaptationField* AdaptationField) const;
 };
\ No newline at end of file